@@ -0,0 +1,50 @@
+TARGET = adinbd
+TEMPLATE = app
+QT = core network
+CONFIG += console c++11
+CONFIG -= app_bundle
+
+VERSION = 1.0.2.0
+
+DEFINES += VERSION_NUMBER=\\\"$${VERSION}\\\"
+
+# Serves an image over the network block device protocol, Linux only
+!linux: error("adinbd needs the Linux network block device driver")
+
+DEFINES += QT_DEPRECATED_WARNINGS
+
+INCLUDEPATH += ../src
+
+SOURCES += \
+    main.cpp \
+    imageblockdevice.cpp \
+    nbdserver.cpp \
+    imageoverlay.cpp \
+    ../src/imageformat.cpp \
+    ../src/imagecodec.cpp \
+    ../src/checksum.cpp \
+    ../src/bufferscan.cpp \
+    ../src/bufferarena.cpp \
+    ../src/chunkcache.cpp \
+    ../src/chunkrepository.cpp
+
+HEADERS += \
+    blockdevice.h \
+    imageblockdevice.h \
+    imageoverlay.h \
+    nbdserver.h
+
+# Optional compression libraries, same switches as the application
+isEmpty(ZSTD_DIR): ZSTD_DIR = $$(ZSTD_DIR)
+!isEmpty(ZSTD_DIR) {
+    DEFINES += HAVE_ZSTD
+    INCLUDEPATH += $$ZSTD_DIR/include
+    LIBS += -L$$ZSTD_DIR/lib -lzstd
+}
+
+isEmpty(LZ4_DIR): LZ4_DIR = $$(LZ4_DIR)
+!isEmpty(LZ4_DIR) {
+    DEFINES += HAVE_LZ4
+    INCLUDEPATH += $$LZ4_DIR/include
+    LIBS += -L$$LZ4_DIR/lib -llz4
+}
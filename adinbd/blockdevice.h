@@ -0,0 +1,19 @@
+#ifndef BLOCKDEVICE_H
+#define BLOCKDEVICE_H
+
+#include <QString>
+
+// What the network block device server exports, read-only unless writable
+class BlockDevice
+{
+public:
+    virtual ~BlockDevice() {}
+
+    virtual quint64 size() const = 0;
+    virtual bool    isWritable() const = 0;
+    virtual bool    read(const quint64 offset, char* data, const quint64 length, QString& msg) = 0;
+    virtual bool    write(const quint64 offset, const char* data, const quint64 length, QString& msg) = 0;
+    virtual bool    flush(QString& msg) = 0;
+};
+
+#endif // BLOCKDEVICE_H
@@ -0,0 +1,193 @@
+#include <cstring>
+
+#include "imageblockdevice.h"
+
+ImageBlockDevice::ImageBlockDevice(ChunkCache* cache) :
+    m_cache(cache)
+{
+}
+
+bool ImageBlockDevice::open(const QString& path, QString& msg)
+{
+    close();
+    m_path = path;
+    if (!m_reader.open(path, msg))
+    {
+        return false;
+    }
+    if (m_reader.isManifest())
+    {
+        msg = QString("File Error;A manifest holds no data to read.");
+        return false;
+    }
+
+    // Reads look chunks up by device offset
+    const QVector<ChunkEntry>& chunks = m_reader.chunks();
+    for (int i = 1; i < chunks.size(); i++)
+    {
+        if (chunks.at(i).deviceOffset < chunks.at(i - 1).deviceOffset + chunks.at(i - 1).uncompressedLength)
+        {
+            msg = QString("File Error;The chunks of the image file overlap.");
+            return false;
+        }
+    }
+    return true;
+}
+
+void ImageBlockDevice::close()
+{
+    m_reader.close();
+    m_lastChunk.clear();
+    m_lastIndex = -1;
+}
+
+QString ImageBlockDevice::path() const
+{
+    return m_path;
+}
+
+ImageReader& ImageBlockDevice::reader()
+{
+    return m_reader;
+}
+
+quint64 ImageBlockDevice::size() const
+{
+    return m_reader.totalSize();
+}
+
+bool ImageBlockDevice::isWritable() const
+{
+    return false;
+}
+
+quint64 ImageBlockDevice::chunksDecoded() const
+{
+    return m_chunksDecoded;
+}
+
+quint64 ImageBlockDevice::cacheHits() const
+{
+    return m_cacheHits;
+}
+
+int ImageBlockDevice::findChunk(const quint64 offset) const
+{
+    // Last chunk starting at or before the offset, -1 if there is none
+    const QVector<ChunkEntry>& chunks = m_reader.chunks();
+    int low = 0;
+    int high = chunks.size();
+    while (low < high)
+    {
+        int middle = low + (high - low) / 2;
+        if (chunks.at(middle).deviceOffset <= offset)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    return low - 1;
+}
+
+bool ImageBlockDevice::chunkData(const int index, QByteArray& data, QString& msg)
+{
+    // Consecutive small reads mostly land in the chunk read last
+    if (index == m_lastIndex)
+    {
+        data = m_lastChunk;
+        return true;
+    }
+
+    const ChunkEntry& entry = m_reader.chunks().at(index);
+    const quint64 imageDigest = m_reader.header().imageDigest;
+    bool cacheable = m_cache && ChunkCache::isCacheable(m_reader.header(), entry);
+    if (cacheable && m_cache->lookup(imageDigest, index, entry, data))
+    {
+        m_cacheHits++;
+    }
+    else
+    {
+        if (!m_reader.readChunk(index, data, msg))
+        {
+            return false;
+        }
+        m_chunksDecoded++;
+        if (cacheable)
+        {
+            m_cache->insert(imageDigest, index, data);
+        }
+    }
+
+    m_lastChunk = data;
+    m_lastIndex = index;
+    return true;
+}
+
+bool ImageBlockDevice::read(const quint64 offset, char* data, const quint64 length, QString& msg)
+{
+    if ((offset > size()) || (length > size() - offset))
+    {
+        msg = QString("Read Error;Read beyond the end of the image.");
+        return false;
+    }
+
+    const QVector<ChunkEntry>& chunks = m_reader.chunks();
+    quint64 position = offset;
+    quint64 remaining = length;
+    int index = findChunk(position);
+    while (remaining > 0)
+    {
+        // Sectors before the next chunk were not imaged
+        if ((index < 0) || (position >= chunks.at(index).deviceOffset + chunks.at(index).uncompressedLength))
+        {
+            quint64 gapEnd = (index + 1 < chunks.size()) ? chunks.at(index + 1).deviceOffset : size();
+            quint64 count = qMin(remaining, gapEnd - position);
+            memset(data, 0, count);
+            data += count;
+            position += count;
+            remaining -= count;
+            index++;
+            continue;
+        }
+
+        const ChunkEntry& entry = chunks.at(index);
+        quint64 start = position - entry.deviceOffset;
+        quint64 count = qMin(remaining, entry.uncompressedLength - start);
+        if (ImageFormat::isHole(entry))
+        {
+            memset(data, ImageFormat::fillByte(entry), count);
+        }
+        else
+        {
+            QByteArray chunk;
+            if (!chunkData(index, chunk, msg))
+            {
+                return false;
+            }
+            memcpy(data, chunk.constData() + start, count);
+        }
+        data += count;
+        position += count;
+        remaining -= count;
+        index++;
+    }
+    return true;
+}
+
+bool ImageBlockDevice::write(const quint64 offset, const char* data, const quint64 length, QString& msg)
+{
+    Q_UNUSED(offset)
+    Q_UNUSED(data)
+    Q_UNUSED(length)
+    msg = QString("Write Error;The image is read-only.");
+    return false;
+}
+
+bool ImageBlockDevice::flush(QString& msg)
+{
+    Q_UNUSED(msg)
+    return true;
+}
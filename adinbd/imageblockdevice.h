@@ -0,0 +1,52 @@
+#ifndef IMAGEBLOCKDEVICE_H
+#define IMAGEBLOCKDEVICE_H
+
+#include <QByteArray>
+#include <QString>
+
+#include "blockdevice.h"
+#include "imageformat.h"
+#include "chunkcache.h"
+
+// Read-only random access to the device an image was created from. A read is
+// served from the chunks it overlaps, each decoded on its own through the index
+// of the image. Decoded chunks stay in the cache, so small reads within one
+// chunk decode it once. Holes are filled without touching the image and sectors
+// between the imaged extents read as zeros.
+class ImageBlockDevice : public BlockDevice
+{
+public:
+    explicit ImageBlockDevice(ChunkCache* cache = nullptr);
+
+    bool open(const QString& path, QString& msg);
+    void close();
+
+    QString      path() const;
+    ImageReader& reader();
+
+    quint64 size() const override;
+    bool    isWritable() const override;
+    bool    read(const quint64 offset, char* data, const quint64 length, QString& msg) override;
+    bool    write(const quint64 offset, const char* data, const quint64 length, QString& msg) override;
+    bool    flush(QString& msg) override;
+
+    quint64 chunksDecoded() const;
+    quint64 cacheHits() const;
+
+private:
+    int  findChunk(const quint64 offset) const;
+    bool chunkData(const int index, QByteArray& data, QString& msg);
+
+private:
+    Q_DISABLE_COPY(ImageBlockDevice)
+
+    QString     m_path;
+    ImageReader m_reader;
+    ChunkCache* m_cache;
+    QByteArray  m_lastChunk;
+    int         m_lastIndex = {-1};
+    quint64     m_chunksDecoded = {0};
+    quint64     m_cacheHits = {0};
+};
+
+#endif // IMAGEBLOCKDEVICE_H
@@ -0,0 +1,372 @@
+#include <QDataStream>
+#include <QDir>
+#include <QFileInfo>
+
+#include <cstring>
+#include <unistd.h>
+
+#include "imageoverlay.h"
+#include "bufferscan.h"
+
+// "WDISKADO"
+const quint64 ImageOverlay::MAGIC = Q_UINT64_C(0x574449534B41444F);
+
+// Sectors start on a 1 MB boundary of the sidecar
+static const quint64 DATA_ALIGNMENT = Q_UINT64_C(1024) * 1024;
+
+ImageOverlay::ImageOverlay(ImageBlockDevice& device) :
+    m_device(device)
+{
+}
+
+ImageOverlay::~ImageOverlay()
+{
+    close();
+}
+
+bool ImageOverlay::open(const QString& sidecarPath, QString& msg)
+{
+    close();
+    const ImageHeader& header = m_device.reader().header();
+    if ((header.version < ImageFormat::VERSION_2) || (header.imageDigest == 0) || (header.sectorSize == 0))
+    {
+        msg = QString("File Error;Only images of version 2 or later with a digest can be patched.");
+        return false;
+    }
+
+    m_blockSize = header.sectorSize;
+    quint64 blocks = size() / m_blockSize;
+    m_bitmap.fill('\0', static_cast<int>((blocks + 7) / 8));
+    m_dataOffset = (HEADER_SIZE + static_cast<quint64>(m_bitmap.size()) + DATA_ALIGNMENT - 1) / DATA_ALIGNMENT * DATA_ALIGNMENT;
+
+    m_file.setFileName(sidecarPath);
+    bool exists = m_file.exists();
+    if (!m_file.open(QIODevice::ReadWrite))
+    {
+        msg = QString("File Error;Cannot open the overlay file %1.").arg(QDir::toNativeSeparators(sidecarPath));
+        return false;
+    }
+
+    QDataStream stream(&m_file);
+    if (!exists)
+    {
+        // Resizing leaves the data area sparse, only written sectors take space
+        QByteArray headerData;
+        QDataStream out(&headerData, QIODevice::WriteOnly);
+        out << MAGIC << VERSION << static_cast<quint32>(m_blockSize) << size() << header.imageDigest;
+        headerData.append(QByteArray(HEADER_SIZE - headerData.size(), '\0'));
+        if ((m_file.write(headerData) != headerData.size()) || !m_file.resize(static_cast<qint64>(m_dataOffset + size())))
+        {
+            msg = QString("Write Error;Cannot create the overlay file.");
+            return false;
+        }
+        m_bitmapChanged = true;
+        return flush(msg);
+    }
+
+    quint64 magic = 0;
+    quint16 version = 0;
+    quint32 blockSize = 0;
+    quint64 deviceSize = 0;
+    quint64 imageDigest = 0;
+    stream >> magic >> version >> blockSize >> deviceSize >> imageDigest;
+    if ((stream.status() != QDataStream::Ok) || (magic != MAGIC) || (version != VERSION))
+    {
+        msg = QString("File Error;The overlay file is damaged.");
+        return false;
+    }
+    if ((imageDigest != header.imageDigest) || (blockSize != m_blockSize) || (deviceSize != size()))
+    {
+        msg = QString("File Error;The overlay file belongs to another image.");
+        return false;
+    }
+    if (!m_file.seek(HEADER_SIZE) || (m_file.read(m_bitmap.data(), m_bitmap.size()) != m_bitmap.size()))
+    {
+        msg = QString("File Error;The overlay file is damaged.");
+        return false;
+    }
+    return true;
+}
+
+void ImageOverlay::close()
+{
+    if (m_file.isOpen())
+    {
+        QString msg;
+        flush(msg);
+        m_file.close();
+    }
+}
+
+quint64 ImageOverlay::size() const
+{
+    return m_device.size();
+}
+
+bool ImageOverlay::isWritable() const
+{
+    return true;
+}
+
+bool ImageOverlay::isDirty(const quint64 block) const
+{
+    return (static_cast<quint8>(m_bitmap.at(static_cast<int>(block / 8))) >> (block % 8)) & 1;
+}
+
+bool ImageOverlay::isRangeDirty(const quint64 offset, const quint64 length) const
+{
+    // Bit by bit up to a byte boundary, then whole bytes of the bitmap at once
+    quint64 block = offset / m_blockSize;
+    const quint64 endBlock = (offset + length + m_blockSize - 1) / m_blockSize;
+    while ((block < endBlock) && (block % 8))
+    {
+        if (isDirty(block++))
+        {
+            return true;
+        }
+    }
+    quint64 bytes = (endBlock - block) / 8;
+    if ((bytes > 0) && !BufferScan::isZero(m_bitmap.constData() + block / 8, bytes))
+    {
+        return true;
+    }
+    block += bytes * 8;
+    while (block < endBlock)
+    {
+        if (isDirty(block++))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ImageOverlay::readSidecar(const quint64 offset, char* data, const quint64 length, QString& msg)
+{
+    if (!m_file.seek(static_cast<qint64>(m_dataOffset + offset)) ||
+        (m_file.read(data, static_cast<qint64>(length)) != static_cast<qint64>(length)))
+    {
+        msg = QString("Read Error;Cannot read from the overlay file.");
+        return false;
+    }
+    return true;
+}
+
+bool ImageOverlay::read(const quint64 offset, char* data, const quint64 length, QString& msg)
+{
+    if ((offset > size()) || (length > size() - offset))
+    {
+        msg = QString("Read Error;Read beyond the end of the image.");
+        return false;
+    }
+
+    // Runs of sectors with the same state come from the same place
+    quint64 position = offset;
+    const quint64 end = offset + length;
+    while (position < end)
+    {
+        bool dirty = isDirty(position / m_blockSize);
+        quint64 runEnd = (position / m_blockSize + 1) * m_blockSize;
+        while ((runEnd < end) && (isDirty(runEnd / m_blockSize) == dirty))
+        {
+            runEnd += m_blockSize;
+        }
+        quint64 count = qMin(runEnd, end) - position;
+        if (dirty ? !readSidecar(position, data, count, msg) : !m_device.read(position, data, count, msg))
+        {
+            return false;
+        }
+        data += count;
+        position += count;
+    }
+    return true;
+}
+
+bool ImageOverlay::write(const quint64 offset, const char* data, const quint64 length, QString& msg)
+{
+    if ((offset > size()) || (length > size() - offset))
+    {
+        msg = QString("Write Error;Write beyond the end of the image.");
+        return false;
+    }
+    if (length == 0)
+    {
+        return true;
+    }
+
+    // Partly written sectors are completed from what is there now
+    quint64 start = offset / m_blockSize * m_blockSize;
+    quint64 end = (offset + length + m_blockSize - 1) / m_blockSize * m_blockSize;
+    QByteArray buffer(static_cast<int>(end - start), '\0');
+    if ((start < offset) && !read(start, buffer.data(), m_blockSize, msg))
+    {
+        return false;
+    }
+    if ((end > offset + length) && !read(end - m_blockSize, buffer.data() + buffer.size() - m_blockSize, m_blockSize, msg))
+    {
+        return false;
+    }
+    memcpy(buffer.data() + (offset - start), data, length);
+
+    if (!m_file.seek(static_cast<qint64>(m_dataOffset + start)) || (m_file.write(buffer) != buffer.size()))
+    {
+        msg = QString("Write Error;Cannot write to the overlay file.");
+        return false;
+    }
+    for (quint64 block = start / m_blockSize; block < end / m_blockSize; block++)
+    {
+        m_bitmap[static_cast<int>(block / 8)] = static_cast<char>(m_bitmap.at(static_cast<int>(block / 8)) | (1 << (block % 8)));
+    }
+    m_bitmapChanged = true;
+    return true;
+}
+
+bool ImageOverlay::flush(QString& msg)
+{
+    // Sectors reach the disk before the bitmap that marks them
+    if (!m_file.flush() || (fsync(m_file.handle()) != 0))
+    {
+        msg = QString("Write Error;Cannot flush the overlay file.");
+        return false;
+    }
+    if (!m_bitmapChanged)
+    {
+        return true;
+    }
+    if (!m_file.seek(HEADER_SIZE) || (m_file.write(m_bitmap) != m_bitmap.size()) ||
+        !m_file.flush() || (fsync(m_file.handle()) != 0))
+    {
+        msg = QString("Write Error;Cannot write the sector map of the overlay file.");
+        return false;
+    }
+    m_bitmapChanged = false;
+    return true;
+}
+
+bool ImageOverlay::sealRange(const quint64 offset, const quint64 length, ImageWriter& writer, ChunkRepository* repository, QString& msg)
+{
+    QByteArray data(static_cast<int>(length), '\0');
+    ChunkEntry entry;
+    QByteArray payload;
+    if (!read(offset, data.data(), length, msg))
+    {
+        return false;
+    }
+    bool ok = repository ? repository->encodeChunk(writer.header(), offset, data, entry, payload, msg) :
+                           ImageFormat::encodeChunk(writer.header(), offset, data, entry, payload, msg, writer.baseChunk(offset));
+    return ok && writer.appendChunk(entry, payload, msg);
+}
+
+bool ImageOverlay::seal(const QString& imagePath, int& encodedChunks, int& copiedChunks, QString& msg)
+{
+    encodedChunks = 0;
+    copiedChunks = 0;
+    ImageReader& reader = m_device.reader();
+    QString sourcePath = QFileInfo(m_device.path()).absoluteFilePath();
+    if (QFileInfo(imagePath).absoluteFilePath() == sourcePath)
+    {
+        msg = QString("File Error;The sealed image cannot replace the image it is based on.");
+        return false;
+    }
+
+    // Linked base images and repositories are found relative to the new image
+    ImageHeader header = reader.header();
+    header.imageDigest = 0;
+    QDir sourceDir = QFileInfo(sourcePath).absoluteDir();
+    QDir targetDir = QFileInfo(imagePath).absoluteDir();
+    ImageReader baseReader;
+    ChunkRepository* repository = nullptr;
+    if (header.flags & ImageFormat::IMAGE_DELTA)
+    {
+        QString basePath = sourceDir.absoluteFilePath(header.baseName);
+        if (!baseReader.open(basePath, msg))
+        {
+            return false;
+        }
+        header.baseName = targetDir.relativeFilePath(basePath);
+    }
+    if (header.flags & ImageFormat::IMAGE_REPOSITORY)
+    {
+        repository = ChunkRepository::open(sourceDir.absoluteFilePath(header.repositoryName), msg);
+        if (!repository)
+        {
+            return false;
+        }
+        header.repositoryName = targetDir.relativeFilePath(repository->path());
+    }
+
+    ImageWriter writer;
+    if (!writer.open(imagePath, header, msg))
+    {
+        return false;
+    }
+    writer.setBase(baseReader.chunks());
+    baseReader.close();
+
+    // Chunks stored for the sealed image stay claimed against garbage collection until it is registered
+    if (repository)
+    {
+        repository->beginImage();
+    }
+    int sharedChunks = 0;
+    bool sealed = sealChunks(writer, repository, encodedChunks, copiedChunks, msg) &&
+                  writer.finish(msg) && writer.writeManifest(ImageFormat::manifestPath(imagePath), msg) &&
+                  (!repository || repository->addImage(imagePath, sharedChunks, msg));
+    if (repository)
+    {
+        repository->endImage();
+    }
+    return sealed;
+}
+
+bool ImageOverlay::sealChunks(ImageWriter& writer, ChunkRepository* repository, int& encodedChunks, int& copiedChunks, QString& msg)
+{
+    // Written sectors outside the imaged extents become chunks of their own
+    ImageReader& reader = m_device.reader();
+    const quint64 chunkSize = writer.header().chunkSize;
+    quint64 position = 0;
+    const QVector<ChunkEntry>& chunks = reader.chunks();
+    for (int i = 0; i <= chunks.size(); i++)
+    {
+        quint64 gapEnd = (i < chunks.size()) ? chunks.at(i).deviceOffset : size();
+        while (position < gapEnd)
+        {
+            quint64 count = qMin(gapEnd, (position / chunkSize + 1) * chunkSize) - position;
+            if (isRangeDirty(position, count))
+            {
+                if (!sealRange(position, count, writer, repository, msg))
+                {
+                    return false;
+                }
+                encodedChunks++;
+            }
+            position += count;
+        }
+        if (i == chunks.size())
+        {
+            break;
+        }
+
+        // Untouched chunks keep their payload, whatever codec and place it has
+        const ChunkEntry& entry = chunks.at(i);
+        QByteArray payload;
+        if (isRangeDirty(entry.deviceOffset, entry.uncompressedLength))
+        {
+            if (!sealRange(entry.deviceOffset, entry.uncompressedLength, writer, repository, msg))
+            {
+                return false;
+            }
+            encodedChunks++;
+        }
+        else if (!reader.readStoredPayload(i, payload, msg) || !writer.appendChunk(entry, payload, msg))
+        {
+            return false;
+        }
+        else
+        {
+            copiedChunks++;
+        }
+        position = entry.deviceOffset + entry.uncompressedLength;
+    }
+    return true;
+}
@@ -0,0 +1,61 @@
+#ifndef IMAGEOVERLAY_H
+#define IMAGEOVERLAY_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QString>
+
+#include "blockdevice.h"
+#include "imageblockdevice.h"
+#include "chunkrepository.h"
+
+// Writable copy-on-write view of an image. Written sectors go to a sparse
+// sidecar file (.ado), every other sector is read from the image:
+//
+//   [header][dirty bitmap, one bit per sector][sectors at their device offset]
+//
+// The header holds the digest of the image, so a sidecar is never applied to
+// another image. The bitmap is written on flush, after the sectors it marks.
+// Sealing writes a new image: chunks without written sectors are copied with
+// their stored payload as is, only the chunks holding written sectors are
+// compressed again.
+class ImageOverlay : public BlockDevice
+{
+public:
+    explicit ImageOverlay(ImageBlockDevice& device);
+    ~ImageOverlay() override;
+
+    bool open(const QString& sidecarPath, QString& msg);
+    void close();
+
+    quint64 size() const override;
+    bool    isWritable() const override;
+    bool    read(const quint64 offset, char* data, const quint64 length, QString& msg) override;
+    bool    write(const quint64 offset, const char* data, const quint64 length, QString& msg) override;
+    bool    flush(QString& msg) override;
+
+    bool seal(const QString& imagePath, int& encodedChunks, int& copiedChunks, QString& msg);
+
+    static const quint64 MAGIC;
+    static const quint16 VERSION = 1;
+    static const int     HEADER_SIZE = 64;
+
+private:
+    bool isDirty(const quint64 block) const;
+    bool isRangeDirty(const quint64 offset, const quint64 length) const;
+    bool readSidecar(const quint64 offset, char* data, const quint64 length, QString& msg);
+    bool sealRange(const quint64 offset, const quint64 length, ImageWriter& writer, ChunkRepository* repository, QString& msg);
+    bool sealChunks(ImageWriter& writer, ChunkRepository* repository, int& encodedChunks, int& copiedChunks, QString& msg);
+
+private:
+    Q_DISABLE_COPY(ImageOverlay)
+
+    ImageBlockDevice& m_device;
+    QFile             m_file;
+    QByteArray        m_bitmap;
+    quint64           m_blockSize = {0};
+    quint64           m_dataOffset = {0};
+    bool              m_bitmapChanged = {false};
+};
+
+#endif // IMAGEOVERLAY_H
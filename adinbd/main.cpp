@@ -0,0 +1,145 @@
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QRandomGenerator>
+#include <QTextStream>
+
+#include "imageblockdevice.h"
+#include "imageoverlay.h"
+#include "nbdserver.h"
+
+static const quint64 MB = Q_UINT64_C(1024) * 1024;
+static const quint64 BENCH_BLOCK = 4096;
+
+static int failWith(const QString& msg)
+{
+    // Errors carry their type in front of the text
+    QTextStream(stderr) << msg.section(';', 1) << endl;
+    return 1;
+}
+
+// Reads the first bytes of the device in 4K blocks, once in order and once at
+// random block offsets, each pass starting with a cold cache
+static int benchmark(const QString& imagePath, const quint64 cacheSize, const quint64 benchSize)
+{
+    QTextStream out(stdout);
+    const char* passNames[] = { "sequential", "random" };
+    for (int pass = 0; pass < 2; pass++)
+    {
+        ChunkCache cache(cacheSize);
+        ImageBlockDevice device(&cache);
+        QString msg;
+        if (!device.open(imagePath, msg))
+        {
+            return failWith(msg);
+        }
+
+        const quint64 blocks = qMin(benchSize, device.size()) / BENCH_BLOCK;
+        if (blocks == 0)
+        {
+            return failWith(QString("Read Error;The image is smaller than one block."));
+        }
+        QByteArray block(static_cast<int>(BENCH_BLOCK), '\0');
+        QRandomGenerator random(1);
+        QElapsedTimer timer;
+        timer.start();
+        for (quint64 i = 0; i < blocks; i++)
+        {
+            quint64 blockIndex = (pass == 0) ? i : (random.generate64() % blocks);
+            if (!device.read(blockIndex * BENCH_BLOCK, block.data(), BENCH_BLOCK, msg))
+            {
+                return failWith(msg);
+            }
+        }
+
+        double seconds = qMax<qint64>(timer.nsecsElapsed(), 1) / 1e9;
+        out << QString("%1: %2 reads of 4 KB in %3 s, %4 reads/s, %5 MB/s, %6 chunks decoded, %7 cache hits")
+                   .arg(passNames[pass], -10).arg(blocks).arg(seconds, 0, 'f', 2)
+                   .arg(blocks / seconds, 0, 'f', 0).arg(static_cast<double>(blocks * BENCH_BLOCK) / MB / seconds, 0, 'f', 1)
+                   .arg(device.chunksDecoded()).arg(device.cacheHits()) << endl;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("adinbd");
+    QCoreApplication::setApplicationVersion(VERSION_NUMBER);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Serves a WinDisk image as a network block device, read-only unless an overlay is given.");
+    parser.addHelpOption();
+    parser.addVersionOption();
+    parser.addPositionalArgument("image", "Image file (.adi) to serve.");
+    QCommandLineOption socketOption("socket", "Unix domain socket to listen on.", "path", "/run/adinbd.sock");
+    QCommandLineOption cacheOption("cache-mb", "Memory for decoded chunks in MB.", "size", "1024");
+    QCommandLineOption benchOption("bench", "Time 4 KB reads over the first <size> MB in order and at random, then exit.", "size");
+    parser.addOption(socketOption);
+    parser.addOption(cacheOption);
+    QCommandLineOption overlayOption("overlay", "Serve the image writable, written sectors go to this overlay file.", "path");
+    QCommandLineOption sealOption("seal", "Write the image with the sectors of the overlay as a new image, then exit.", "image");
+    parser.addOption(benchOption);
+    parser.addOption(overlayOption);
+    parser.addOption(sealOption);
+    parser.process(app);
+
+    if (parser.positionalArguments().size() != 1)
+    {
+        parser.showHelp(1);
+    }
+    const QString imagePath = parser.positionalArguments().first();
+    const quint64 cacheSize = parser.value(cacheOption).toULongLong() * MB;
+
+    if (parser.isSet(benchOption))
+    {
+        return benchmark(imagePath, cacheSize, parser.value(benchOption).toULongLong() * MB);
+    }
+
+    ChunkCache cache(cacheSize);
+    ImageBlockDevice device(&cache);
+    ImageOverlay overlay(device);
+    QString msg;
+    if (!device.open(imagePath, msg))
+    {
+        return failWith(msg);
+    }
+    if (parser.isSet(overlayOption) && !overlay.open(parser.value(overlayOption), msg))
+    {
+        return failWith(msg);
+    }
+
+    if (parser.isSet(sealOption))
+    {
+        if (!parser.isSet(overlayOption))
+        {
+            return failWith(QString("Argument Error;Sealing needs an overlay file."));
+        }
+
+        QElapsedTimer timer;
+        timer.start();
+        int encodedChunks = 0;
+        int copiedChunks = 0;
+        if (!overlay.seal(parser.value(sealOption), encodedChunks, copiedChunks, msg))
+        {
+            return failWith(msg);
+        }
+        QTextStream(stdout) << QString("Sealed %1 in %2 s, %3 chunks compressed again, %4 chunks copied.")
+                                   .arg(parser.value(sealOption)).arg(timer.elapsed() / 1000.0, 0, 'f', 1)
+                                   .arg(encodedChunks).arg(copiedChunks) << endl;
+        return 0;
+    }
+
+    NbdServer server(parser.isSet(overlayOption) ? static_cast<BlockDevice&>(overlay) : static_cast<BlockDevice&>(device));
+    if (!server.listen(parser.value(socketOption), msg))
+    {
+        return failWith(msg);
+    }
+
+    QTextStream(stdout) << QString("Serving %1 (%2 MB) on %3").arg(imagePath).arg(device.size() / MB).arg(parser.value(socketOption)) << endl;
+    if (!server.serve(msg))
+    {
+        return failWith(msg);
+    }
+    return 0;
+}
@@ -0,0 +1,292 @@
+#include <QDataStream>
+#include <QtEndian>
+
+#include <cerrno>
+
+#include "nbdserver.h"
+
+// Protocol constants, see doc/proto.md of the nbd project
+static const quint64 NBD_MAGIC = Q_UINT64_C(0x4e42444d41474943);
+static const quint64 NBD_OPTION_MAGIC = Q_UINT64_C(0x49484156454f5054);
+static const quint64 NBD_REPLY_MAGIC = Q_UINT64_C(0x0003e889045565a9);
+static const quint32 NBD_REQUEST_MAGIC = 0x25609513;
+static const quint32 NBD_SIMPLE_REPLY_MAGIC = 0x67446698;
+
+static const quint16 NBD_FLAG_FIXED_NEWSTYLE = 0x0001;
+static const quint16 NBD_FLAG_NO_ZEROES = 0x0002;
+static const quint32 NBD_FLAG_C_NO_ZEROES = 0x00000002;
+static const quint16 NBD_FLAG_HAS_FLAGS = 0x0001;
+static const quint16 NBD_FLAG_READ_ONLY = 0x0002;
+static const quint16 NBD_FLAG_SEND_FLUSH = 0x0004;
+
+static const quint32 NBD_OPT_EXPORT_NAME = 1;
+static const quint32 NBD_OPT_ABORT = 2;
+static const quint32 NBD_OPT_INFO = 6;
+static const quint32 NBD_OPT_GO = 7;
+
+static const quint32 NBD_REP_ACK = 1;
+static const quint32 NBD_REP_INFO = 3;
+static const quint32 NBD_REP_ERR_UNSUP = 0x80000001;
+static const quint16 NBD_INFO_EXPORT = 0;
+
+static const quint16 NBD_CMD_READ = 0;
+static const quint16 NBD_CMD_WRITE = 1;
+static const quint16 NBD_CMD_DISC = 2;
+static const quint16 NBD_CMD_FLUSH = 3;
+
+// Larger requests are refused, the kernel client never sends them
+static const quint32 MAX_REQUEST_LENGTH = 32 * 1024 * 1024;
+
+NbdServer::NbdServer(BlockDevice& device) :
+    m_device(device)
+{
+}
+
+bool NbdServer::listen(const QString& socketPath, QString& msg)
+{
+    // A socket left behind by an earlier run would make listening fail
+    QLocalServer::removeServer(socketPath);
+    if (!m_server.listen(socketPath))
+    {
+        msg = QString("Socket Error;Cannot listen on %1: %2").arg(socketPath).arg(m_server.errorString());
+        return false;
+    }
+    return true;
+}
+
+bool NbdServer::serve(QString& msg)
+{
+    forever
+    {
+        if (!m_server.waitForNewConnection(-1))
+        {
+            msg = QString("Socket Error;%1").arg(m_server.errorString());
+            return false;
+        }
+
+        QLocalSocket* socket = m_server.nextPendingConnection();
+        bool transmit = false;
+        if (handshake(*socket, transmit) && transmit && !transmission(*socket, msg))
+        {
+            // A failing image ends the server, a client going away does not
+            delete socket;
+            return false;
+        }
+        socket->disconnectFromServer();
+        delete socket;
+    }
+}
+
+bool NbdServer::handshake(QLocalSocket& socket, bool& transmit)
+{
+    transmit = false;
+    QByteArray greeting;
+    QDataStream out(&greeting, QIODevice::WriteOnly);
+    out << NBD_MAGIC << NBD_OPTION_MAGIC << static_cast<quint16>(NBD_FLAG_FIXED_NEWSTYLE | NBD_FLAG_NO_ZEROES);
+    if (!writeAll(socket, greeting))
+    {
+        return false;
+    }
+
+    quint32 clientFlags = 0;
+    if (!readExact(socket, reinterpret_cast<char*>(&clientFlags), sizeof(clientFlags)))
+    {
+        return false;
+    }
+    m_noZeroes = (qFromBigEndian(clientFlags) & NBD_FLAG_C_NO_ZEROES) != 0;
+
+    const quint16 transmissionFlags = static_cast<quint16>(NBD_FLAG_HAS_FLAGS | (m_device.isWritable() ? NBD_FLAG_SEND_FLUSH : NBD_FLAG_READ_ONLY));
+    forever
+    {
+        char header[16];
+        if (!readExact(socket, header, sizeof(header)) || (qFromBigEndian<quint64>(header) != NBD_OPTION_MAGIC))
+        {
+            return false;
+        }
+        quint32 option = qFromBigEndian<quint32>(header + 8);
+        quint32 length = qFromBigEndian<quint32>(header + 12);
+        if (length > 4096)
+        {
+            return false;
+        }
+        QByteArray data(static_cast<int>(length), '\0');
+        if (!readExact(socket, data.data(), length))
+        {
+            return false;
+        }
+
+        // Every export name refers to the one image
+        if (option == NBD_OPT_EXPORT_NAME)
+        {
+            QByteArray reply;
+            QDataStream replyOut(&reply, QIODevice::WriteOnly);
+            replyOut << m_device.size() << transmissionFlags;
+            if (!m_noZeroes)
+            {
+                reply.append(QByteArray(124, '\0'));
+            }
+            transmit = true;
+            return writeAll(socket, reply);
+        }
+        else if ((option == NBD_OPT_INFO) || (option == NBD_OPT_GO))
+        {
+            QByteArray info;
+            QDataStream infoOut(&info, QIODevice::WriteOnly);
+            infoOut << NBD_INFO_EXPORT << m_device.size() << transmissionFlags;
+            if (!sendOptionReply(socket, option, NBD_REP_INFO, info) || !sendOptionReply(socket, option, NBD_REP_ACK))
+            {
+                return false;
+            }
+            if (option == NBD_OPT_GO)
+            {
+                transmit = true;
+                return true;
+            }
+        }
+        else if (option == NBD_OPT_ABORT)
+        {
+            sendOptionReply(socket, option, NBD_REP_ACK);
+            return true;
+        }
+        else if (!sendOptionReply(socket, option, NBD_REP_ERR_UNSUP))
+        {
+            return false;
+        }
+    }
+}
+
+bool NbdServer::transmission(QLocalSocket& socket, QString& msg)
+{
+    QByteArray data;
+    forever
+    {
+        char request[28];
+        if (!readExact(socket, request, sizeof(request)) || (qFromBigEndian<quint32>(request) != NBD_REQUEST_MAGIC))
+        {
+            return m_device.flush(msg);
+        }
+        quint16 type = qFromBigEndian<quint16>(request + 6);
+        quint64 handle = qFromBigEndian<quint64>(request + 8);
+        quint64 offset = qFromBigEndian<quint64>(request + 16);
+        quint32 length = qFromBigEndian<quint32>(request + 24);
+
+        if (type == NBD_CMD_READ)
+        {
+            if ((length > MAX_REQUEST_LENGTH) || (offset > m_device.size()) || (length > m_device.size() - offset))
+            {
+                if (!sendReply(socket, EINVAL, handle))
+                {
+                    return true;
+                }
+                continue;
+            }
+            data.resize(static_cast<int>(length));
+            if (!m_device.read(offset, data.data(), length, msg))
+            {
+                sendReply(socket, EIO, handle);
+                return false;
+            }
+            if (!sendReply(socket, 0, handle, data))
+            {
+                return true;
+            }
+        }
+        else if (type == NBD_CMD_WRITE)
+        {
+            // The payload follows the request and must be consumed even when refusing it
+            data.resize(static_cast<int>(qMin(length, MAX_REQUEST_LENGTH)));
+            if ((length > MAX_REQUEST_LENGTH) || !readExact(socket, data.data(), length))
+            {
+                return true;
+            }
+            quint32 error = 0;
+            if (!m_device.isWritable() || (offset > m_device.size()) || (length > m_device.size() - offset))
+            {
+                error = m_device.isWritable() ? EINVAL : EPERM;
+            }
+            else if (!m_device.write(offset, data.constData(), length, msg))
+            {
+                sendReply(socket, EIO, handle);
+                return false;
+            }
+            if (!sendReply(socket, error, handle))
+            {
+                return true;
+            }
+        }
+        else if (type == NBD_CMD_FLUSH)
+        {
+            if (!m_device.flush(msg))
+            {
+                sendReply(socket, EIO, handle);
+                return false;
+            }
+            if (!sendReply(socket, 0, handle))
+            {
+                return true;
+            }
+        }
+        else if (type == NBD_CMD_DISC)
+        {
+            // Whatever the client wrote is kept when it goes away
+            return m_device.flush(msg);
+        }
+        else if (!sendReply(socket, EINVAL, handle))
+        {
+            return true;
+        }
+    }
+}
+
+bool NbdServer::sendOptionReply(QLocalSocket& socket, const quint32 option, const quint32 type, const QByteArray& data)
+{
+    QByteArray reply;
+    QDataStream out(&reply, QIODevice::WriteOnly);
+    out << NBD_REPLY_MAGIC << option << type << static_cast<quint32>(data.size());
+    reply.append(data);
+    return writeAll(socket, reply);
+}
+
+bool NbdServer::sendReply(QLocalSocket& socket, const quint32 error, const quint64 handle, const QByteArray& data)
+{
+    // Failed reads carry no data
+    QByteArray reply;
+    QDataStream out(&reply, QIODevice::WriteOnly);
+    out << NBD_SIMPLE_REPLY_MAGIC << error << handle;
+    return writeAll(socket, reply) && ((error != 0) || writeAll(socket, data));
+}
+
+bool NbdServer::readExact(QLocalSocket& socket, char* data, const qint64 length)
+{
+    qint64 done = 0;
+    while (done < length)
+    {
+        if ((socket.bytesAvailable() == 0) && !socket.waitForReadyRead(-1))
+        {
+            return false;
+        }
+        qint64 count = socket.read(data + done, length - done);
+        if (count < 0)
+        {
+            return false;
+        }
+        done += count;
+    }
+    return true;
+}
+
+bool NbdServer::writeAll(QLocalSocket& socket, const QByteArray& data)
+{
+    if (socket.write(data) != data.size())
+    {
+        return false;
+    }
+    while (socket.bytesToWrite() > 0)
+    {
+        if (!socket.waitForBytesWritten(-1))
+        {
+            return false;
+        }
+    }
+    return true;
+}
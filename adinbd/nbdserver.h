@@ -0,0 +1,44 @@
+#ifndef NBDSERVER_H
+#define NBDSERVER_H
+
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QString>
+
+#include "blockdevice.h"
+
+// Serves one block device over the fixed newstyle network block device
+// protocol on a Unix domain socket, for the kernel client:
+//
+//   nbd-client -unix <socket> /dev/nbd0 -b 512
+//   mount -o ro /dev/nbd0p1 /mnt
+//
+// Clients are served one after the other and their requests in order, the
+// kernel splits large reads so a single connection keeps the cache busy.
+// Writes are refused unless the device is writable.
+class NbdServer
+{
+public:
+    explicit NbdServer(BlockDevice& device);
+
+    bool listen(const QString& socketPath, QString& msg);
+    bool serve(QString& msg);
+
+private:
+    bool handshake(QLocalSocket& socket, bool& transmit);
+    bool transmission(QLocalSocket& socket, QString& msg);
+    bool sendOptionReply(QLocalSocket& socket, const quint32 option, const quint32 type, const QByteArray& data = QByteArray());
+    bool sendReply(QLocalSocket& socket, const quint32 error, const quint64 handle, const QByteArray& data = QByteArray());
+
+    static bool readExact(QLocalSocket& socket, char* data, const qint64 length);
+    static bool writeAll(QLocalSocket& socket, const QByteArray& data);
+
+private:
+    Q_DISABLE_COPY(NbdServer)
+
+    BlockDevice&  m_device;
+    QLocalServer  m_server;
+    bool          m_noZeroes = {false};
+};
+
+#endif // NBDSERVER_H
@@ -0,0 +1,133 @@
+#include <QElapsedTimer>
+#include <QFile>
+#include <QThreadPool>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "benchmarks.h"
+#include "compressionpipeline.h"
+#include "decompressionpipeline.h"
+
+static const quint32 SECTOR_SIZE = 512;
+static const quint32 CHUNK_SIZE = 4096 * SECTOR_SIZE;
+static const double MB = 1024.0 * 1024.0;
+
+// Creates an image of the source and restores it to memory, all chunk buffers of
+// both directions come from the arena when one is given
+static bool roundTrip(const QString& sourcePath, const QString& imagePath, const quint16 codec, const int level, BufferArena* arena, quint64& sourceSize, QString& msg)
+{
+    QFile source(sourcePath);
+    if (!source.open(QIODevice::ReadOnly))
+    {
+        msg = QString("File Error;Cannot open %1.").arg(sourcePath);
+        return false;
+    }
+    sourceSize = static_cast<quint64>(source.size());
+
+    ImageHeader header;
+    header.codec = codec;
+    header.codecLevel = level;
+    header.sectorSize = SECTOR_SIZE;
+    header.chunkSize = CHUNK_SIZE;
+    header.totalSize = sourceSize / SECTOR_SIZE * SECTOR_SIZE;
+
+    ImageWriter writer;
+    if (!writer.open(imagePath, header, msg))
+    {
+        return false;
+    }
+    {
+        CompressionPipeline pipeline(writer, arena);
+        for (quint64 offset = 0; offset < header.totalSize; offset += CHUNK_SIZE)
+        {
+            const int length = static_cast<int>(qMin<quint64>(CHUNK_SIZE, header.totalSize - offset));
+            QByteArray data = arena ? arena->acquire(length) : QByteArray(length, Qt::Uninitialized);
+            if ((source.read(BufferArena::writable(data), length) != length) || !pipeline.submit(offset, data, msg))
+            {
+                msg = msg.isEmpty() ? QString("Read Error;Cannot read %1.").arg(sourcePath) : msg;
+                return false;
+            }
+        }
+        if (!pipeline.finish(msg) || !writer.finish(msg))
+        {
+            return false;
+        }
+    }
+
+    ImageReader reader;
+    if (!reader.open(imagePath, msg))
+    {
+        return false;
+    }
+    DecompressionPipeline pipeline(reader, arena);
+    for (int i = 0; i < reader.chunks().size(); i++)
+    {
+        int index = 0;
+        QByteArray data;
+        if (!pipeline.next(index, data, msg))
+        {
+            return false;
+        }
+        // A restore would write the chunk to the device here
+        if (arena)
+        {
+            arena->release(data);
+        }
+    }
+    return true;
+}
+
+// Peak RSS only grows within a process, so every variant runs in a child of its own
+static int measureInChild(const QString& sourcePath, const quint16 codec, const int level, const bool useArena)
+{
+    QTextStream(stdout).flush();
+    pid_t child = fork();
+    if (child < 0)
+    {
+        return failWith("Benchmark Error;Cannot start the measurement process.");
+    }
+    if (child > 0)
+    {
+        int status = 0;
+        waitpid(child, &status, 0);
+        return (WIFEXITED(status) && (WEXITSTATUS(status) == 0)) ? 0 : 1;
+    }
+
+    QString msg;
+    BufferArena arena;
+    quint64 sourceSize = 0;
+    const QString imagePath = sourcePath + ".bench.adi";
+    QElapsedTimer timer;
+    timer.start();
+    bool ok = roundTrip(sourcePath, imagePath, codec, level, useArena ? &arena : nullptr, sourceSize, msg);
+    double seconds = qMax<qint64>(timer.nsecsElapsed(), 1) / 1e9;
+    QFile::remove(imagePath);
+    if (!ok)
+    {
+        _exit(failWith(msg));
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    QTextStream out(stdout);
+    out << QString("%1: create and restore of %2 MB in %3 s, ").arg(useArena ? "With arena" : "Without arena")
+               .arg(sourceSize / MB, 0, 'f', 0).arg(seconds, 0, 'f', 2);
+    if (useArena)
+    {
+        out << QString("%1 chunk buffers allocated, %2 reused, ").arg(arena.allocations()).arg(arena.reuses());
+    }
+    else
+    {
+        out << QString("%1 chunks each allocated per stage, ").arg((sourceSize + CHUNK_SIZE - 1) / CHUNK_SIZE);
+    }
+    out << QString("peak RSS %1 MB").arg(usage.ru_maxrss / 1024.0, 0, 'f', 1) << endl;
+    out.flush();
+    _exit(0);
+}
+
+int arenaBenchmark(const QString& sourcePath, const quint16 codec, const int level)
+{
+    return measureInChild(sourcePath, codec, level, false) || measureInChild(sourcePath, codec, level, true);
+}
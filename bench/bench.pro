@@ -0,0 +1,55 @@
+TARGET = windiskbench
+TEMPLATE = app
+QT = core
+CONFIG += console c++11
+CONFIG -= app_bundle
+
+VERSION = 1.0.2.0
+
+DEFINES += VERSION_NUMBER=\\\"$${VERSION}\\\"
+
+# Throughput benchmarks of the imaging stages against file-backed sources, Linux only
+!linux: error("windiskbench runs against files and loop devices on Linux")
+
+DEFINES += QT_DEPRECATED_WARNINGS
+
+INCLUDEPATH += ../src
+
+SOURCES += \
+    main.cpp \
+    compressionbenchmark.cpp \
+    codecbenchmark.cpp \
+    iobenchmark.cpp \
+    directbenchmark.cpp \
+    arenabenchmark.cpp \
+    scanbenchmark.cpp \
+    ../src/decompressionpipeline.cpp \
+    ../src/iobackend.cpp \
+    ../src/alignedbufferpool.cpp \
+    ../src/compressionpipeline.cpp \
+    ../src/imageformat.cpp \
+    ../src/imagecodec.cpp \
+    ../src/checksum.cpp \
+    ../src/bufferarena.cpp \
+    ../src/bufferscan.cpp \
+    ../src/checkpointjournal.cpp \
+    ../src/chunkcache.cpp \
+    ../src/chunkrepository.cpp
+
+HEADERS += \
+    benchmarks.h
+
+# Optional compression libraries, same switches as the application
+isEmpty(ZSTD_DIR): ZSTD_DIR = $$(ZSTD_DIR)
+!isEmpty(ZSTD_DIR) {
+    DEFINES += HAVE_ZSTD
+    INCLUDEPATH += $$ZSTD_DIR/include
+    LIBS += -L$$ZSTD_DIR/lib -lzstd
+}
+
+isEmpty(LZ4_DIR): LZ4_DIR = $$(LZ4_DIR)
+!isEmpty(LZ4_DIR) {
+    DEFINES += HAVE_LZ4
+    INCLUDEPATH += $$LZ4_DIR/include
+    LIBS += -L$$LZ4_DIR/lib -llz4
+}
@@ -0,0 +1,33 @@
+#ifndef BENCHMARKS_H
+#define BENCHMARKS_H
+
+#include <QString>
+#include <QTextStream>
+
+// Every benchmark prints one line per measurement to stdout and returns the
+// exit code of the program. Errors carry their type in front of the text.
+
+// Image creation from a source file with 1 to maxWorkers compression workers
+int compressionBenchmark(const QString& sourcePath, const quint16 codec, const int level, const int maxWorkers);
+
+// Ratio and MB/s of every available codec and a few levels over the first limitMb of the source
+int codecBenchmark(const QString& sourcePath, const int limitMb);
+
+// Sequential reads of the source with queue depths 1, 2, 4 … up to maxQueueDepth
+int ioBenchmark(const QString& sourcePath, const bool direct, const int blockKb, const int maxQueueDepth, const int limitMb);
+
+// Copy of the source to a scratch file through the page cache and with O_DIRECT,
+// throughput and the part of both files left in the page cache
+int directBenchmark(const QString& sourcePath, const int blockKb, const int queueDepth, const int limitMb);
+
+// Image creation and restore with and without a buffer arena, chunk buffer
+// allocations and peak RSS of each
+int arenaBenchmark(const QString& sourcePath, const quint16 codec, const int level);
+
+// MB/s of every BufferScan kernel with each dispatch level the CPU supports,
+// over blockKb buffers held in memory
+int scanBenchmark(const int blockKb, const int limitMb);
+
+int failWith(const QString& msg);
+
+#endif // BENCHMARKS_H
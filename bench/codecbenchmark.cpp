@@ -0,0 +1,97 @@
+#include <QElapsedTimer>
+#include <QFile>
+
+#include "benchmarks.h"
+#include "imagecodec.h"
+
+static const int CHUNK_SIZE = 4096 * 512;
+static const double MB = 1024.0 * 1024.0;
+
+struct CodecSetting
+{
+    quint16 codec;
+    int     level;
+};
+
+// Compresses every chunk of the source with one codec on the calling thread,
+// so the numbers are per core and comparable to one compression worker
+static bool measureCodec(const QVector<QByteArray>& chunks, const CodecSetting& setting, QTextStream& out, QString& msg)
+{
+    QVector<QByteArray> payloads(chunks.size());
+    quint64 dataSize = 0;
+    quint64 payloadSize = 0;
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < chunks.size(); i++)
+    {
+        if (!ImageCodec::compress(setting.codec, setting.level, chunks.at(i), payloads[i], msg))
+        {
+            return false;
+        }
+        dataSize += static_cast<quint64>(chunks.at(i).size());
+        payloadSize += static_cast<quint64>(payloads.at(i).size());
+    }
+    double compressSeconds = qMax<qint64>(timer.nsecsElapsed(), 1) / 1e9;
+
+    QByteArray data;
+    timer.restart();
+    for (int i = 0; i < chunks.size(); i++)
+    {
+        if (!ImageCodec::uncompress(setting.codec, payloads.at(i), static_cast<quint32>(chunks.at(i).size()), data, msg))
+        {
+            return false;
+        }
+        if (data != chunks.at(i))
+        {
+            msg = QString("Verify Error;Chunk %1 differs after a round trip through %2.").arg(i).arg(ImageCodec::name(setting.codec));
+            return false;
+        }
+    }
+    double uncompressSeconds = qMax<qint64>(timer.nsecsElapsed(), 1) / 1e9;
+
+    out << QString("%1 level %2: ratio %3, compress %4 MB/s, decompress %5 MB/s")
+               .arg(ImageCodec::name(setting.codec), -5).arg(setting.level, 2)
+               .arg(static_cast<double>(dataSize) / qMax<quint64>(payloadSize, 1), 0, 'f', 2)
+               .arg(dataSize / MB / compressSeconds, 0, 'f', 1)
+               .arg(dataSize / MB / uncompressSeconds, 0, 'f', 1) << endl;
+    return true;
+}
+
+int codecBenchmark(const QString& sourcePath, const int limitMb)
+{
+    QFile source(sourcePath);
+    if (!source.open(QIODevice::ReadOnly))
+    {
+        return failWith(QString("File Error;Cannot open %1.").arg(sourcePath));
+    }
+
+    // The source is read once up front so that only the codecs are timed
+    QVector<QByteArray> chunks;
+    const qint64 limit = static_cast<qint64>(limitMb) * 1024 * 1024;
+    QByteArray chunk;
+    while ((source.pos() < limit) && !(chunk = source.read(CHUNK_SIZE)).isEmpty())
+    {
+        chunks << chunk;
+    }
+
+    QVector<CodecSetting> settings;
+    settings << CodecSetting{ImageCodec::CodecZlib, 1} << CodecSetting{ImageCodec::CodecZlib, 6} << CodecSetting{ImageCodec::CodecZlib, 9}
+             << CodecSetting{ImageCodec::CodecZstd, 1} << CodecSetting{ImageCodec::CodecZstd, 3} << CodecSetting{ImageCodec::CodecZstd, 9} << CodecSetting{ImageCodec::CodecZstd, 19}
+             << CodecSetting{ImageCodec::CodecLz4, 1} << CodecSetting{ImageCodec::CodecLz4, 9};
+
+    QTextStream out(stdout);
+    out << QString("%1: %2 MB in %3 chunks").arg(sourcePath).arg(chunks.size() * static_cast<double>(CHUNK_SIZE) / MB, 0, 'f', 0).arg(chunks.size()) << endl;
+    foreach (const CodecSetting& setting, settings)
+    {
+        if (!ImageCodec::isAvailable(setting.codec))
+        {
+            continue;
+        }
+        QString msg;
+        if (!measureCodec(chunks, setting, out, msg))
+        {
+            return failWith(msg);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,133 @@
+#include <QElapsedTimer>
+#include <QFile>
+#include <QThreadPool>
+
+#include "benchmarks.h"
+#include "compressionpipeline.h"
+#include "checksum.h"
+
+static const quint32 SECTOR_SIZE = 512;
+static const quint32 CHUNK_SIZE = 4096 * SECTOR_SIZE;
+static const double MB = 1024.0 * 1024.0;
+
+// Digest of the whole file, images written with any number of workers must match
+static bool fileDigest(const QString& path, quint64& digest, QString& msg)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        msg = QString("File Error;Cannot open %1.").arg(path);
+        return false;
+    }
+    digest = 0;
+    QByteArray block;
+    while (!(block = file.read(CHUNK_SIZE)).isEmpty())
+    {
+        digest = Checksum::xxh64(block.constData(), static_cast<quint64>(block.size()), digest);
+    }
+    return true;
+}
+
+// Reads the source in chunks as a create job reads a device and writes the image
+// through a pipeline whose pool has the given number of workers
+static bool createImage(const QString& sourcePath, const QString& imagePath, const quint16 codec, const int level, const int workers, quint64& sourceSize, QString& msg)
+{
+    QFile source(sourcePath);
+    if (!source.open(QIODevice::ReadOnly))
+    {
+        msg = QString("File Error;Cannot open %1.").arg(sourcePath);
+        return false;
+    }
+    sourceSize = static_cast<quint64>(source.size());
+
+    ImageHeader header;
+    header.codec = codec;
+    header.codecLevel = level;
+    header.sectorSize = SECTOR_SIZE;
+    header.chunkSize = CHUNK_SIZE;
+    header.totalSize = (sourceSize + SECTOR_SIZE - 1) / SECTOR_SIZE * SECTOR_SIZE;
+
+    ImageWriter writer;
+    if (!writer.open(imagePath, header, msg))
+    {
+        return false;
+    }
+
+    QThreadPool pool;
+    pool.setMaxThreadCount(workers);
+    BufferArena arena;
+    CompressionPipeline pipeline(writer, &arena, &pool);
+    for (quint64 offset = 0; offset < sourceSize; offset += CHUNK_SIZE)
+    {
+        // The tail is padded to whole sectors like the last read of a device
+        const quint64 length = qMin<quint64>(CHUNK_SIZE, header.totalSize - offset);
+        QByteArray data = arena.acquire(static_cast<int>(length));
+        qint64 count = source.read(data.data(), static_cast<qint64>(length));
+        if (count < 0)
+        {
+            msg = QString("Read Error;Cannot read %1.").arg(sourcePath);
+            return false;
+        }
+        memset(data.data() + count, 0, length - static_cast<quint64>(count));
+        if (!pipeline.submit(offset, data, msg))
+        {
+            return false;
+        }
+    }
+    return pipeline.finish(msg) && writer.finish(msg);
+}
+
+int compressionBenchmark(const QString& sourcePath, const quint16 codec, const int level, const int maxWorkers)
+{
+    if (!ImageCodec::isAvailable(codec))
+    {
+        return failWith(QString("Argument Error;Codec %1 is not available in this build.").arg(ImageCodec::name(codec)));
+    }
+
+    // Worker counts double from one up to the limit, which is always measured
+    QVector<int> workerCounts;
+    for (int workers = 1; workers < maxWorkers; workers *= 2)
+    {
+        workerCounts << workers;
+    }
+    workerCounts << maxWorkers;
+
+    QTextStream out(stdout);
+    const QString imagePath = sourcePath + ".bench.adi";
+    quint64 firstDigest = 0;
+    double firstSpeed = 0;
+    foreach (int workers, workerCounts)
+    {
+        QString msg;
+        quint64 sourceSize = 0;
+        QElapsedTimer timer;
+        timer.start();
+        bool ok = createImage(sourcePath, imagePath, codec, level, workers, sourceSize, msg);
+        double seconds = qMax<qint64>(timer.nsecsElapsed(), 1) / 1e9;
+
+        quint64 digest = 0;
+        ok = ok && fileDigest(imagePath, digest, msg);
+        qint64 imageSize = QFile(imagePath).size();
+        QFile::remove(imagePath);
+        if (!ok)
+        {
+            return failWith(msg);
+        }
+
+        double speed = sourceSize / MB / seconds;
+        if (workers == workerCounts.first())
+        {
+            firstDigest = digest;
+            firstSpeed = speed;
+        }
+        out << QString("%1 level %2, %3 workers: %4 MB in %5 s, %6 MB/s, %7x the speed of 1 worker, image %8 MB%9")
+                   .arg(ImageCodec::name(codec)).arg(level).arg(workers, 2).arg(sourceSize / MB, 0, 'f', 0)
+                   .arg(seconds, 0, 'f', 2).arg(speed, 0, 'f', 1).arg(speed / firstSpeed, 0, 'f', 2)
+                   .arg(imageSize / MB, 0, 'f', 1).arg((digest == firstDigest) ? "" : ", NOT identical to the image of 1 worker") << endl;
+        if (digest != firstDigest)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
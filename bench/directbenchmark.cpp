@@ -0,0 +1,162 @@
+#include <QElapsedTimer>
+#include <QFile>
+#include <QScopedPointer>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "benchmarks.h"
+#include "bufferarena.h"
+#include "iobackend.h"
+
+static const quint32 DIRECT_IO_ALIGNMENT = 4096;
+static const double MB = 1024.0 * 1024.0;
+
+// Bytes of the file currently held in the page cache
+static bool cachedBytes(const QString& path, quint64& cached, QString& msg)
+{
+    cached = 0;
+    int handle = open(QFile::encodeName(path).constData(), O_RDONLY | O_CLOEXEC);
+    struct stat status;
+    if ((handle < 0) || (fstat(handle, &status) != 0))
+    {
+        msg = QString("File Error;Cannot open %1.").arg(path);
+        if (handle >= 0)
+        {
+            close(handle);
+        }
+        return false;
+    }
+
+    const size_t length = static_cast<size_t>(status.st_size);
+    const size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    void* mapping = (length > 0) ? mmap(nullptr, length, PROT_READ, MAP_SHARED, handle, 0) : MAP_FAILED;
+    close(handle);
+    if (mapping == MAP_FAILED)
+    {
+        return length == 0;
+    }
+
+    QVector<unsigned char> pages(static_cast<int>((length + pageSize - 1) / pageSize));
+    bool ok = (mincore(mapping, length, pages.data()) == 0);
+    munmap(mapping, length);
+    foreach (unsigned char page, pages)
+    {
+        cached += (page & 1) ? pageSize : 0;
+    }
+    if (!ok)
+    {
+        msg = QString("File Error;Cannot query the page cache of %1.").arg(path);
+    }
+    return ok;
+}
+
+// Copies the source to the target as a clone would, reading and writing with the given
+// queue depth through chunk buffers that are aligned when the copy is direct
+static bool copyFile(const QString& sourcePath, const QString& targetPath, const bool direct, const quint32 blockSize, const int queueDepth, const quint64 limit, quint64& copied, QString& msg)
+{
+    QFile target(targetPath);
+    if (!target.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        msg = QString("File Error;Cannot create %1.").arg(targetPath);
+        return false;
+    }
+    target.close();
+
+    IoHandle sourceHandle = IoBackend::openFile(sourcePath, false, direct, msg);
+    IoHandle targetHandle = (sourceHandle >= 0) ? IoBackend::openFile(targetPath, true, direct, msg) : -1;
+    if (targetHandle < 0)
+    {
+        if (sourceHandle >= 0)
+        {
+            close(sourceHandle);
+        }
+        return false;
+    }
+    posix_fadvise(sourceHandle, 0, 0, POSIX_FADV_DONTNEED);
+
+    BufferArena arena;
+    AlignedBufferPool sourcePool(blockSize, DIRECT_IO_ALIGNMENT);
+    AlignedBufferPool targetPool(blockSize, DIRECT_IO_ALIGNMENT);
+    if (direct)
+    {
+        arena.setAlignment(DIRECT_IO_ALIGNMENT);
+    }
+    QScopedPointer<IoBackend> reader(IoBackend::create(sourceHandle, queueDepth, 512, direct ? &sourcePool : nullptr));
+    QScopedPointer<IoBackend> writer(IoBackend::create(targetHandle, queueDepth, 512, direct ? &targetPool : nullptr));
+
+    bool ok = true;
+    bool atEnd = false;
+    quint64 offset = 0;
+    copied = 0;
+    while (ok && (!atEnd || !reader->isEmpty()))
+    {
+        if (!atEnd && !reader->isFull())
+        {
+            ok = reader->submitRead(offset, arena.acquire(static_cast<int>(blockSize)), offset, msg);
+            offset += blockSize;
+            atEnd = (offset >= limit);
+            continue;
+        }
+
+        IoCompletion completion;
+        ok = reader->waitOldest(completion, msg);
+        atEnd = atEnd || (completion.transferred < completion.length);
+        if (ok && writer->isFull())
+        {
+            IoCompletion written;
+            ok = writer->waitOldest(written, msg);
+            arena.release(written.data);
+        }
+        if (ok && (completion.transferred > 0))
+        {
+            completion.data.resize(static_cast<int>(completion.transferred));
+            ok = writer->submitWrite(completion.offset, completion.data, completion.tag, msg);
+            copied += completion.transferred;
+        }
+        arena.release(completion.data);
+    }
+    ok = writer->drain(msg) && ok;
+    if (ok && !direct)
+    {
+        // Buffered writes count once they are on the disk, as at the end of a restore
+        ok = (fdatasync(targetHandle) == 0);
+    }
+    reader.reset();
+    writer.reset();
+    close(sourceHandle);
+    close(targetHandle);
+    return ok;
+}
+
+int directBenchmark(const QString& sourcePath, const int blockKb, const int queueDepth, const int limitMb)
+{
+    QTextStream out(stdout);
+    const QString targetPath = sourcePath + ".bench.out";
+    const quint32 blockSize = static_cast<quint32>(blockKb) * 1024;
+    const quint64 limit = static_cast<quint64>(limitMb) * 1024 * 1024;
+    foreach (bool direct, QVector<bool>({false, true}))
+    {
+        QString msg;
+        quint64 copied = 0;
+        QElapsedTimer timer;
+        timer.start();
+        bool ok = copyFile(sourcePath, targetPath, direct, blockSize, queueDepth, limit, copied, msg);
+        double seconds = qMax<qint64>(timer.nsecsElapsed(), 1) / 1e9;
+
+        quint64 sourceCached = 0;
+        quint64 targetCached = 0;
+        ok = ok && cachedBytes(sourcePath, sourceCached, msg) && cachedBytes(targetPath, targetCached, msg);
+        QFile::remove(targetPath);
+        if (!ok)
+        {
+            return failWith(msg);
+        }
+        out << QString("%1 copy of %2 MB, %3 KB blocks, queue depth %4: %5 MB/s, page cache %6 MB of the source and %7 MB of the target")
+                   .arg(direct ? "Direct" : "Buffered").arg(copied / MB, 0, 'f', 0).arg(blockKb).arg(queueDepth)
+                   .arg(copied / MB / seconds, 0, 'f', 1).arg(sourceCached / MB, 0, 'f', 1).arg(targetCached / MB, 0, 'f', 1) << endl;
+    }
+    return 0;
+}
@@ -0,0 +1,69 @@
+#include <QElapsedTimer>
+#include <QScopedPointer>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "benchmarks.h"
+#include "iobackend.h"
+
+static const double MB = 1024.0 * 1024.0;
+
+// Reads the first limit bytes of the source in blocks with the given queue depth
+static bool readAll(const QString& sourcePath, const bool direct, const quint32 blockSize, const int queueDepth, const quint64 limit, quint64& bytesRead, QString& msg)
+{
+    IoHandle handle = IoBackend::openFile(sourcePath, false, direct, msg);
+    if (handle < 0)
+    {
+        return false;
+    }
+    // Buffered reads would otherwise be served from the page cache of the last run
+    posix_fadvise(handle, 0, 0, POSIX_FADV_DONTNEED);
+
+    AlignedBufferPool pool(blockSize, 4096);
+    QScopedPointer<IoBackend> backend(IoBackend::create(handle, queueDepth, 512, direct ? &pool : nullptr));
+    bool ok = true;
+    bool atEnd = false;
+    quint64 offset = 0;
+    bytesRead = 0;
+    while (ok && (!atEnd || !backend->isEmpty()))
+    {
+        if (!atEnd && !backend->isFull())
+        {
+            ok = backend->submitRead(offset, QByteArray(static_cast<int>(blockSize), '\0'), offset, msg);
+            offset += blockSize;
+            atEnd = (offset >= limit);
+            continue;
+        }
+        IoCompletion completion;
+        ok = backend->waitOldest(completion, msg);
+        bytesRead += completion.transferred;
+        atEnd = atEnd || (completion.transferred < completion.length);
+    }
+    backend.reset();
+    close(handle);
+    return ok;
+}
+
+int ioBenchmark(const QString& sourcePath, const bool direct, const int blockKb, const int maxQueueDepth, const int limitMb)
+{
+    QTextStream out(stdout);
+    const quint32 blockSize = static_cast<quint32>(blockKb) * 1024;
+    const quint64 limit = static_cast<quint64>(limitMb) * 1024 * 1024;
+    for (int queueDepth = 1; queueDepth <= maxQueueDepth; queueDepth *= 2)
+    {
+        QString msg;
+        quint64 bytesRead = 0;
+        QElapsedTimer timer;
+        timer.start();
+        if (!readAll(sourcePath, direct, blockSize, queueDepth, limit, bytesRead, msg))
+        {
+            return failWith(msg);
+        }
+        double seconds = qMax<qint64>(timer.nsecsElapsed(), 1) / 1e9;
+        out << QString("%1 reads of %2 KB, queue depth %3: %4 MB in %5 s, %6 MB/s")
+                   .arg(direct ? "Direct" : "Buffered").arg(blockKb).arg(queueDepth, 2)
+                   .arg(bytesRead / MB, 0, 'f', 0).arg(seconds, 0, 'f', 2).arg(bytesRead / MB / seconds, 0, 'f', 1) << endl;
+    }
+    return 0;
+}
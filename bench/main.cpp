@@ -0,0 +1,108 @@
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QThread>
+
+#include "benchmarks.h"
+#include "imagecodec.h"
+
+int failWith(const QString& msg)
+{
+    // Errors carry their type in front of the text
+    QTextStream(stderr) << msg.section(';', 1) << endl;
+    return 1;
+}
+
+static bool parseCodec(const QString& name, quint16& codec)
+{
+    for (quint16 c = ImageCodec::CodecZlib; c <= ImageCodec::CodecLz4; c++)
+    {
+        if (ImageCodec::name(c) == name)
+        {
+            codec = c;
+            return true;
+        }
+    }
+    return false;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("windiskbench");
+    QCoreApplication::setApplicationVersion(VERSION_NUMBER);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Measures the throughput of the imaging stages against a file-backed source device.");
+    parser.addHelpOption();
+    parser.addVersionOption();
+    parser.addPositionalArgument("source", "Raw device image or block device to read.", "[source]");
+    QCommandLineOption compressionOption("compression", "Create an image of the source with 1 up to the number of cores compression workers.");
+    QCommandLineOption arenaOption("arena", "Create and restore an image of the source with and without a buffer arena.");
+    QCommandLineOption codecsOption("codecs", "Compress and decompress the source with every available codec on one core.");
+    QCommandLineOption scanOption("scan", "Time the buffer scan kernels with every supported instruction set, no source needed.");
+    QCommandLineOption limitOption("limit-mb", "Amount of the source used by --codecs, --io and --footprint, data scanned per kernel by --scan in MB.", "size", "512");
+    QCommandLineOption ioOption("io", "Read the source with queue depths from 1 up to --queue-depth.");
+    QCommandLineOption directOption("direct", "Read with O_DIRECT instead of through the page cache.");
+    QCommandLineOption footprintOption("footprint", "Copy the source buffered and with O_DIRECT, report MB/s and page cache use.");
+    QCommandLineOption blockOption("block-kb", "Size of a read in KB.", "size", "1024");
+    QCommandLineOption queueDepthOption("queue-depth", "Largest queue depth of --io, queue depth of --footprint.", "depth", "32");
+    QCommandLineOption codecOption("codec", "Codec of the created image: zlib, store, zstd or lz4.", "name", "zlib");
+    QCommandLineOption levelOption("level", "Compression level of the codec.", "level", "9");
+    QCommandLineOption workersOption("workers", "Largest number of compression workers.", "count", QString::number(QThread::idealThreadCount()));
+    parser.addOption(compressionOption);
+    parser.addOption(arenaOption);
+    parser.addOption(codecsOption);
+    parser.addOption(scanOption);
+    parser.addOption(limitOption);
+    parser.addOption(ioOption);
+    parser.addOption(directOption);
+    parser.addOption(footprintOption);
+    parser.addOption(blockOption);
+    parser.addOption(queueDepthOption);
+    parser.addOption(codecOption);
+    parser.addOption(levelOption);
+    parser.addOption(workersOption);
+    parser.process(app);
+
+    if (parser.isSet(scanOption))
+    {
+        return scanBenchmark(qMax(1, parser.value(blockOption).toInt()), qMax(1, parser.value(limitOption).toInt()));
+    }
+
+    if (parser.positionalArguments().size() != 1)
+    {
+        parser.showHelp(1);
+    }
+    const QString sourcePath = parser.positionalArguments().first();
+
+    quint16 codec = ImageCodec::CodecZlib;
+    if (!parseCodec(parser.value(codecOption), codec))
+    {
+        return failWith(QString("Argument Error;Unknown codec %1.").arg(parser.value(codecOption)));
+    }
+
+    if (parser.isSet(compressionOption))
+    {
+        return compressionBenchmark(sourcePath, codec, parser.value(levelOption).toInt(), qMax(1, parser.value(workersOption).toInt()));
+    }
+    if (parser.isSet(ioOption))
+    {
+        return ioBenchmark(sourcePath, parser.isSet(directOption), qMax(4, parser.value(blockOption).toInt()),
+                           qMax(1, parser.value(queueDepthOption).toInt()), qMax(1, parser.value(limitOption).toInt()));
+    }
+    if (parser.isSet(footprintOption))
+    {
+        return directBenchmark(sourcePath, qMax(4, parser.value(blockOption).toInt()),
+                               qMax(1, parser.value(queueDepthOption).toInt()), qMax(1, parser.value(limitOption).toInt()));
+    }
+    if (parser.isSet(arenaOption))
+    {
+        return arenaBenchmark(sourcePath, codec, parser.value(levelOption).toInt());
+    }
+    if (parser.isSet(codecsOption))
+    {
+        return codecBenchmark(sourcePath, qMax(1, parser.value(limitOption).toInt()));
+    }
+    parser.showHelp(1);
+    return 1;
+}
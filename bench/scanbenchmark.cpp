@@ -0,0 +1,72 @@
+#include <QElapsedTimer>
+
+#include <functional>
+
+#include "benchmarks.h"
+#include "bufferscan.h"
+
+static const double MB = 1024.0 * 1024.0;
+
+struct ScanKernel
+{
+    const char*              name;
+    std::function<quint64()> run;
+};
+
+// Runs one kernel over buffers that make it scan to the end, until limitMb are scanned
+static double measureKernel(const std::function<quint64()>& kernel, const quint64 blockSize, const int limitMb, quint64& result)
+{
+    const quint64 rounds = qMax<quint64>(static_cast<quint64>(limitMb) * 1024 * 1024 / blockSize, 1);
+    QElapsedTimer timer;
+    timer.start();
+    for (quint64 i = 0; i < rounds; i++)
+    {
+        result += kernel();
+    }
+    double seconds = qMax<qint64>(timer.nsecsElapsed(), 1) / 1e9;
+    return rounds * blockSize / MB / seconds;
+}
+
+int scanBenchmark(const int blockKb, const int limitMb)
+{
+    // Blocks without a difference or foreign byte, every kernel reads all of them
+    const quint64 blockSize = static_cast<quint64>(blockKb) * 1024;
+    const QByteArray zeros(static_cast<int>(blockSize), '\0');
+    const QByteArray zerosCopy(static_cast<int>(blockSize), '\0');
+    const QByteArray filled(static_cast<int>(blockSize), '\xAB');
+    const char* a = zeros.constData();
+    const char* b = zerosCopy.constData();
+    const char* f = filled.constData();
+
+    QVector<ScanKernel> kernels;
+    kernels << ScanKernel{"firstDifference", [=]() { return BufferScan::firstDifference(a, b, blockSize); }}
+            << ScanKernel{"firstNotEqual", [=]() { return BufferScan::firstNotEqual(f, blockSize, 0xAB); }}
+            << ScanKernel{"isEqual", [=]() { return BufferScan::isEqual(a, b, blockSize) ? quint64(1) : quint64(0); }}
+            << ScanKernel{"isZero", [=]() { return BufferScan::isZero(a, blockSize) ? quint64(1) : quint64(0); }}
+            << ScanKernel{"isFilled", [=]() { quint8 fill = 0; return BufferScan::isFilled(f, blockSize, fill) ? quint64(fill) : quint64(0); }};
+
+    QTextStream out(stdout);
+    const BufferScan::Level selected = BufferScan::level();
+    out << QString("%1 KB blocks, %2 MB per kernel, dispatch picks %3")
+               .arg(blockKb).arg(limitMb).arg(BufferScan::levelName(selected)) << endl;
+
+    // Each level the CPU supports is forced in turn, the results are checked so the calls stay in
+    quint64 result = 0;
+    for (int level = BufferScan::LevelScalar; level <= BufferScan::supportedLevel(); level++)
+    {
+        BufferScan::setLevel(static_cast<BufferScan::Level>(level));
+        QString line = QString("%1:").arg(BufferScan::levelName(static_cast<BufferScan::Level>(level)), -9);
+        foreach (const ScanKernel& kernel, kernels)
+        {
+            line += QString(" %1 %2 MB/s").arg(kernel.name).arg(measureKernel(kernel.run, blockSize, limitMb, result), 0, 'f', 0);
+        }
+        out << line << endl;
+    }
+    BufferScan::setLevel(selected);
+
+    if (result == 0)
+    {
+        return failWith(QString("Verify Error;The kernels found a difference in identical buffers."));
+    }
+    return 0;
+}
@@ -0,0 +1,82 @@
+#ifdef Q_OS_WIN
+#include <malloc.h>
+#else
+#include <cstdlib>
+#endif
+
+#include "alignedbufferpool.h"
+
+static char* alignedAlloc(const quint32 size, const quint32 alignment)
+{
+#ifdef Q_OS_WIN
+    return static_cast<char*>(_aligned_malloc(size, alignment));
+#else
+    void* buffer = nullptr;
+    return (posix_memalign(&buffer, qMax<size_t>(alignment, sizeof(void*)), size) == 0) ? static_cast<char*>(buffer) : nullptr;
+#endif
+}
+
+static void alignedFree(char* buffer)
+{
+#ifdef Q_OS_WIN
+    _aligned_free(buffer);
+#else
+    free(buffer);
+#endif
+}
+
+AlignedBufferPool::AlignedBufferPool(const quint32 bufferSize, const quint32 alignment) :
+    m_bufferSize(static_cast<quint32>(alignUp(bufferSize, alignment))),
+    m_alignment(alignment)
+{
+}
+
+AlignedBufferPool::~AlignedBufferPool()
+{
+    foreach (char* buffer, m_all)
+    {
+        alignedFree(buffer);
+    }
+}
+
+quint32 AlignedBufferPool::bufferSize() const
+{
+    return m_bufferSize;
+}
+
+quint32 AlignedBufferPool::alignment() const
+{
+    return m_alignment;
+}
+
+char* AlignedBufferPool::acquire()
+{
+    QMutexLocker locker(&m_mutex);
+    if (!m_free.isEmpty())
+    {
+        char* buffer = m_free.last();
+        m_free.removeLast();
+        return buffer;
+    }
+
+    char* buffer = alignedAlloc(m_bufferSize, m_alignment);
+    if (buffer)
+    {
+        m_all.append(buffer);
+    }
+    return buffer;
+}
+
+void AlignedBufferPool::release(char* buffer)
+{
+    if (buffer)
+    {
+        QMutexLocker locker(&m_mutex);
+        m_free.append(buffer);
+    }
+}
+
+quint64 AlignedBufferPool::alignUp(const quint64 value, const quint64 alignment)
+{
+    return (alignment > 1) ? ((value + alignment - 1) / alignment) * alignment : value;
+}
@@ -0,0 +1,34 @@
+#ifndef ALIGNEDBUFFERPOOL_H
+#define ALIGNEDBUFFERPOOL_H
+
+#include <QMutex>
+#include <QVector>
+
+// Fixed size buffers aligned for unbuffered device I/O. Released buffers are
+// kept and handed out again, so a transfer only allocates while the number of
+// buffers in use grows. Safe to use from several threads.
+class AlignedBufferPool
+{
+public:
+    AlignedBufferPool(const quint32 bufferSize, const quint32 alignment);
+    ~AlignedBufferPool();
+
+    quint32 bufferSize() const;
+    quint32 alignment() const;
+
+    char* acquire();
+    void  release(char* buffer);
+
+    static quint64 alignUp(const quint64 value, const quint64 alignment);
+
+private:
+    Q_DISABLE_COPY(AlignedBufferPool)
+
+    quint32        m_bufferSize;
+    quint32        m_alignment;
+    QMutex         m_mutex;
+    QVector<char*> m_free;
+    QVector<char*> m_all;
+};
+
+#endif // ALIGNEDBUFFERPOOL_H
@@ -0,0 +1,102 @@
+#include "bufferarena.h"
+
+BufferArena::BufferArena()
+{
+}
+
+void BufferArena::setAlignment(const int alignment)
+{
+    QMutexLocker locker(&m_mutex);
+    if (alignment != m_alignment)
+    {
+        m_alignment = qMax(1, alignment);
+        m_free.clear();
+    }
+}
+
+QByteArray BufferArena::acquire(const int size)
+{
+    QByteArray buffer;
+    int alignment = 1;
+    {
+        QMutexLocker locker(&m_mutex);
+
+        // Most recently released buffer that is large enough
+        for (int i = m_free.size() - 1; i >= 0; i--)
+        {
+            if (m_free.at(i).capacity() >= size)
+            {
+                buffer.swap(m_free[i]);
+                m_free.remove(i);
+                break;
+            }
+        }
+
+        if (buffer.isNull())
+        {
+            m_allocations++;
+        }
+        else
+        {
+            m_reuses++;
+        }
+        alignment = m_alignment;
+    }
+
+    if (buffer.isNull() && (alignment > 1))
+    {
+        // Qt only aligns its own allocations to the header, the data of this
+        // one starts on the boundary and the size is set by the resize below
+        QArrayData* data = QArrayData::allocate(sizeof(char), static_cast<size_t>(alignment), static_cast<size_t>(size) + 1, QArrayData::CapacityReserved);
+        QByteArrayDataPtr dataPtr = { static_cast<QByteArrayData*>(data) };
+        buffer = QByteArray(dataPtr);
+    }
+
+    // Resizing within the capacity of an unshared buffer does not allocate,
+    // the reserved flag keeps the memory when the buffer is resized to zero
+    buffer.resize(size);
+    buffer.reserve(buffer.capacity());
+    return buffer;
+}
+
+void BufferArena::release(QByteArray& buffer)
+{
+    if (buffer.capacity() == 0)
+    {
+        return;
+    }
+
+    // Buffers Qt allocated behind the arena's back would never be handed out again
+    QMutexLocker locker(&m_mutex);
+    if (!isAligned(buffer.constData(), static_cast<quint64>(m_alignment)))
+    {
+        buffer = QByteArray();
+        return;
+    }
+    m_free.append(QByteArray());
+    m_free.last().swap(buffer);
+}
+
+char* BufferArena::writable(QByteArray& buffer)
+{
+    // data() would move an aligned buffer into a plain Qt allocation, an
+    // unshared one can be written through its const pointer
+    return buffer.isDetached() ? const_cast<char*>(buffer.constData()) : buffer.data();
+}
+
+bool BufferArena::isAligned(const char* buffer, const quint64 alignment)
+{
+    return (alignment <= 1) || ((reinterpret_cast<quintptr>(buffer) % alignment) == 0);
+}
+
+quint64 BufferArena::allocations() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_allocations;
+}
+
+quint64 BufferArena::reuses() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_reuses;
+}
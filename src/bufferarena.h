@@ -0,0 +1,41 @@
+#ifndef BUFFERARENA_H
+#define BUFFERARENA_H
+
+#include <QByteArray>
+#include <QMutex>
+#include <QVector>
+
+// Recycles chunk buffers between the stages of a transfer. A released buffer
+// keeps its capacity, so once the pipeline is primed every chunk is read,
+// compressed and written in memory that is already allocated. Buffers still
+// referenced elsewhere stay valid, Qt detaches them on the next write.
+// With an alignment set, buffers start on that boundary so unbuffered I/O can
+// use them without a bounce copy. Qt copies such buffers on data(), code
+// that fills them in place goes through writable() instead.
+// Safe to use from several threads.
+class BufferArena
+{
+public:
+    BufferArena();
+
+    void       setAlignment(const int alignment);
+    QByteArray acquire(const int size);
+    void       release(QByteArray& buffer);
+
+    static char* writable(QByteArray& buffer);
+    static bool  isAligned(const char* buffer, const quint64 alignment);
+
+    quint64 allocations() const;
+    quint64 reuses() const;
+
+private:
+    Q_DISABLE_COPY(BufferArena)
+
+    mutable QMutex      m_mutex;
+    QVector<QByteArray> m_free;
+    int                 m_alignment = {1};
+    quint64             m_allocations = {0};
+    quint64             m_reuses = {0};
+};
+
+#endif // BUFFERARENA_H
@@ -0,0 +1,429 @@
+#include <QAtomicInt>
+
+#include <cstring>
+
+#include "bufferscan.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define BUFFERSCAN_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+// MSVC emits any intrinsic without special flags, GCC and Clang need the
+// instruction set enabled per function so the rest of the file stays generic
+#if defined(BUFFERSCAN_X86) && (defined(__GNUC__) || defined(__clang__))
+#define TARGET_SSE2   __attribute__((target("sse2")))
+#define TARGET_AVX2   __attribute__((target("avx2")))
+#define TARGET_AVX512 __attribute__((target("avx512f,avx512bw")))
+#else
+#define TARGET_SSE2
+#define TARGET_AVX2
+#define TARGET_AVX512
+#endif
+
+typedef quint64 (*DifferenceKernel)(const char* a, const char* b, const quint64 length);
+typedef quint64 (*NotEqualKernel)(const char* data, const quint64 length, const quint8 value);
+
+struct Kernels
+{
+    DifferenceKernel firstDifference;
+    NotEqualKernel   firstNotEqual;
+};
+
+static quint64 firstDifferenceScalar(const char* a, const char* b, const quint64 length)
+{
+    // Skip equal words, the byte loop then locates the difference inside the word
+    quint64 i = 0;
+    for (; i + sizeof(quint64) <= length; i += sizeof(quint64))
+    {
+        quint64 wordA;
+        quint64 wordB;
+        memcpy(&wordA, a + i, sizeof(wordA));
+        memcpy(&wordB, b + i, sizeof(wordB));
+        if (wordA != wordB)
+        {
+            break;
+        }
+    }
+
+    for (; i < length; i++)
+    {
+        if (a[i] != b[i])
+        {
+            return i;
+        }
+    }
+    return length;
+}
+
+static quint64 firstNotEqualScalar(const char* data, const quint64 length, const quint8 value)
+{
+    quint64 pattern = Q_UINT64_C(0x0101010101010101) * value;
+    quint64 i = 0;
+    for (; i + sizeof(quint64) <= length; i += sizeof(quint64))
+    {
+        quint64 word;
+        memcpy(&word, data + i, sizeof(word));
+        if (word != pattern)
+        {
+            break;
+        }
+    }
+
+    for (; i < length; i++)
+    {
+        if (static_cast<quint8>(data[i]) != value)
+        {
+            return i;
+        }
+    }
+    return length;
+}
+
+#ifdef BUFFERSCAN_X86
+
+static inline int lowestBit(const quint32 mask)
+{
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return static_cast<int>(index);
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+static inline int lowestBit64(const quint64 mask)
+{
+    quint32 low = static_cast<quint32>(mask);
+    return low ? lowestBit(low) : 32 + lowestBit(static_cast<quint32>(mask >> 32));
+}
+
+// The vector kernels test four registers per iteration and only look for the
+// exact byte once a block differs, the remainder falls through to the next
+// narrower kernel
+
+TARGET_SSE2 static quint64 firstDifferenceSse2(const char* a, const char* b, const quint64 length)
+{
+    quint64 i = 0;
+    for (; i + 64 <= length; i += 64)
+    {
+        __m128i eq0 = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)), _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i)));
+        __m128i eq1 = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i + 16)), _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i + 16)));
+        __m128i eq2 = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i + 32)), _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i + 32)));
+        __m128i eq3 = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i + 48)), _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i + 48)));
+        __m128i eq = _mm_and_si128(_mm_and_si128(eq0, eq1), _mm_and_si128(eq2, eq3));
+        if (_mm_movemask_epi8(eq) != 0xFFFF)
+        {
+            break;
+        }
+    }
+
+    for (; i + 16 <= length; i += 16)
+    {
+        __m128i eq = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)), _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i)));
+        quint32 diff = ~static_cast<quint32>(_mm_movemask_epi8(eq)) & 0xFFFF;
+        if (diff)
+        {
+            return i + lowestBit(diff);
+        }
+    }
+    return i + firstDifferenceScalar(a + i, b + i, length - i);
+}
+
+TARGET_SSE2 static quint64 firstNotEqualSse2(const char* data, const quint64 length, const quint8 value)
+{
+    __m128i pattern = _mm_set1_epi8(static_cast<char>(value));
+    quint64 i = 0;
+    for (; i + 64 <= length; i += 64)
+    {
+        __m128i eq0 = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i)), pattern);
+        __m128i eq1 = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + 16)), pattern);
+        __m128i eq2 = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + 32)), pattern);
+        __m128i eq3 = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + 48)), pattern);
+        __m128i eq = _mm_and_si128(_mm_and_si128(eq0, eq1), _mm_and_si128(eq2, eq3));
+        if (_mm_movemask_epi8(eq) != 0xFFFF)
+        {
+            break;
+        }
+    }
+
+    for (; i + 16 <= length; i += 16)
+    {
+        __m128i eq = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i)), pattern);
+        quint32 diff = ~static_cast<quint32>(_mm_movemask_epi8(eq)) & 0xFFFF;
+        if (diff)
+        {
+            return i + lowestBit(diff);
+        }
+    }
+    return i + firstNotEqualScalar(data + i, length - i, value);
+}
+
+TARGET_AVX2 static quint64 firstDifferenceAvx2(const char* a, const char* b, const quint64 length)
+{
+    quint64 i = 0;
+    for (; i + 128 <= length; i += 128)
+    {
+        __m256i eq0 = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i)), _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i)));
+        __m256i eq1 = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i + 32)), _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i + 32)));
+        __m256i eq2 = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i + 64)), _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i + 64)));
+        __m256i eq3 = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i + 96)), _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i + 96)));
+        __m256i eq = _mm256_and_si256(_mm256_and_si256(eq0, eq1), _mm256_and_si256(eq2, eq3));
+        if (static_cast<quint32>(_mm256_movemask_epi8(eq)) != 0xFFFFFFFF)
+        {
+            break;
+        }
+    }
+
+    for (; i + 32 <= length; i += 32)
+    {
+        __m256i eq = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i)), _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i)));
+        quint32 diff = ~static_cast<quint32>(_mm256_movemask_epi8(eq));
+        if (diff)
+        {
+            return i + lowestBit(diff);
+        }
+    }
+    return i + firstDifferenceSse2(a + i, b + i, length - i);
+}
+
+TARGET_AVX2 static quint64 firstNotEqualAvx2(const char* data, const quint64 length, const quint8 value)
+{
+    __m256i pattern = _mm256_set1_epi8(static_cast<char>(value));
+    quint64 i = 0;
+    for (; i + 128 <= length; i += 128)
+    {
+        __m256i eq0 = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i)), pattern);
+        __m256i eq1 = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + 32)), pattern);
+        __m256i eq2 = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + 64)), pattern);
+        __m256i eq3 = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + 96)), pattern);
+        __m256i eq = _mm256_and_si256(_mm256_and_si256(eq0, eq1), _mm256_and_si256(eq2, eq3));
+        if (static_cast<quint32>(_mm256_movemask_epi8(eq)) != 0xFFFFFFFF)
+        {
+            break;
+        }
+    }
+
+    for (; i + 32 <= length; i += 32)
+    {
+        __m256i eq = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i)), pattern);
+        quint32 diff = ~static_cast<quint32>(_mm256_movemask_epi8(eq));
+        if (diff)
+        {
+            return i + lowestBit(diff);
+        }
+    }
+    return i + firstNotEqualSse2(data + i, length - i, value);
+}
+
+TARGET_AVX512 static quint64 firstDifferenceAvx512(const char* a, const char* b, const quint64 length)
+{
+    quint64 i = 0;
+    for (; i + 256 <= length; i += 256)
+    {
+        __mmask64 ne0 = _mm512_cmpneq_epi8_mask(_mm512_loadu_si512(a + i), _mm512_loadu_si512(b + i));
+        __mmask64 ne1 = _mm512_cmpneq_epi8_mask(_mm512_loadu_si512(a + i + 64), _mm512_loadu_si512(b + i + 64));
+        __mmask64 ne2 = _mm512_cmpneq_epi8_mask(_mm512_loadu_si512(a + i + 128), _mm512_loadu_si512(b + i + 128));
+        __mmask64 ne3 = _mm512_cmpneq_epi8_mask(_mm512_loadu_si512(a + i + 192), _mm512_loadu_si512(b + i + 192));
+        if (ne0 | ne1 | ne2 | ne3)
+        {
+            break;
+        }
+    }
+
+    for (; i + 64 <= length; i += 64)
+    {
+        quint64 diff = _mm512_cmpneq_epi8_mask(_mm512_loadu_si512(a + i), _mm512_loadu_si512(b + i));
+        if (diff)
+        {
+            return i + lowestBit64(diff);
+        }
+    }
+    return i + firstDifferenceAvx2(a + i, b + i, length - i);
+}
+
+TARGET_AVX512 static quint64 firstNotEqualAvx512(const char* data, const quint64 length, const quint8 value)
+{
+    __m512i pattern = _mm512_set1_epi8(static_cast<char>(value));
+    quint64 i = 0;
+    for (; i + 256 <= length; i += 256)
+    {
+        __mmask64 ne0 = _mm512_cmpneq_epi8_mask(_mm512_loadu_si512(data + i), pattern);
+        __mmask64 ne1 = _mm512_cmpneq_epi8_mask(_mm512_loadu_si512(data + i + 64), pattern);
+        __mmask64 ne2 = _mm512_cmpneq_epi8_mask(_mm512_loadu_si512(data + i + 128), pattern);
+        __mmask64 ne3 = _mm512_cmpneq_epi8_mask(_mm512_loadu_si512(data + i + 192), pattern);
+        if (ne0 | ne1 | ne2 | ne3)
+        {
+            break;
+        }
+    }
+
+    for (; i + 64 <= length; i += 64)
+    {
+        quint64 diff = _mm512_cmpneq_epi8_mask(_mm512_loadu_si512(data + i), pattern);
+        if (diff)
+        {
+            return i + lowestBit64(diff);
+        }
+    }
+    return i + firstNotEqualAvx2(data + i, length - i, value);
+}
+
+static void cpuid(const int leaf, const int subleaf, quint32 regs[4])
+{
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuidex(info, leaf, subleaf);
+    for (int i = 0; i < 4; i++)
+    {
+        regs[i] = static_cast<quint32>(info[i]);
+    }
+#else
+    __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+static quint64 enabledStateMask()
+{
+#if defined(_MSC_VER)
+    return _xgetbv(0);
+#else
+    quint32 low;
+    quint32 high;
+    __asm__ volatile("xgetbv" : "=a"(low), "=d"(high) : "c"(0));
+    return (static_cast<quint64>(high) << 32) | low;
+#endif
+}
+
+#endif // BUFFERSCAN_X86
+
+static BufferScan::Level detectLevel()
+{
+    BufferScan::Level level = BufferScan::LevelScalar;
+
+#ifdef BUFFERSCAN_X86
+    quint32 regs[4];
+    cpuid(0, 0, regs);
+    quint32 maxLeaf = regs[0];
+    if (maxLeaf < 1)
+    {
+        return level;
+    }
+
+    cpuid(1, 0, regs);
+    if (regs[3] & (1u << 26))
+    {
+        level = BufferScan::LevelSse2;
+    }
+
+    // The wider registers are only usable when the OS saves them on a context switch
+    bool osSavesAvx = (regs[2] & (1u << 27)) && (regs[2] & (1u << 28));
+    if (!osSavesAvx || (maxLeaf < 7))
+    {
+        return level;
+    }
+    quint64 xcr0 = enabledStateMask();
+    cpuid(7, 0, regs);
+
+    if (((xcr0 & 0x06) == 0x06) && (regs[1] & (1u << 5)))
+    {
+        level = BufferScan::LevelAvx2;
+    }
+
+    // AVX-512F and AVX-512BW, with the opmask and upper ZMM state enabled
+    if (((xcr0 & 0xE6) == 0xE6) && (regs[1] & (1u << 16)) && (regs[1] & (1u << 30)))
+    {
+        level = BufferScan::LevelAvx512;
+    }
+#endif
+
+    return level;
+}
+
+// Kernels of each level, only the scalar ones exist on other architectures
+static const Kernels KERNELS[] =
+{
+    { firstDifferenceScalar, firstNotEqualScalar },
+#ifdef BUFFERSCAN_X86
+    { firstDifferenceSse2, firstNotEqualSse2 },
+    { firstDifferenceAvx2, firstNotEqualAvx2 },
+    { firstDifferenceAvx512, firstNotEqualAvx512 }
+#endif
+};
+
+static QAtomicInt s_level = {-1};
+
+static const Kernels& kernels()
+{
+    int level = s_level.loadAcquire();
+    if (level < 0)
+    {
+        s_level.testAndSetOrdered(-1, BufferScan::supportedLevel());
+        level = s_level.loadAcquire();
+    }
+    return KERNELS[level];
+}
+
+BufferScan::Level BufferScan::supportedLevel()
+{
+    static const Level supported = detectLevel();
+    return supported;
+}
+
+BufferScan::Level BufferScan::level()
+{
+    kernels();
+    return static_cast<Level>(s_level.loadAcquire());
+}
+
+const char* BufferScan::levelName(const Level level)
+{
+    static const char* const NAMES[] = { "scalar", "sse2", "avx2", "avx512bw" };
+    return NAMES[level];
+}
+
+bool BufferScan::setLevel(const Level level)
+{
+    if ((level < LevelScalar) || (level > supportedLevel()))
+    {
+        return false;
+    }
+    s_level.storeRelease(level);
+    return true;
+}
+
+quint64 BufferScan::firstDifference(const char* a, const char* b, const quint64 length)
+{
+    return kernels().firstDifference(a, b, length);
+}
+
+quint64 BufferScan::firstNotEqual(const char* data, const quint64 length, const quint8 value)
+{
+    return kernels().firstNotEqual(data, length, value);
+}
+
+bool BufferScan::isEqual(const char* a, const char* b, const quint64 length)
+{
+    return firstDifference(a, b, length) == length;
+}
+
+bool BufferScan::isZero(const char* data, const quint64 length)
+{
+    return firstNotEqual(data, length, 0) == length;
+}
+
+bool BufferScan::isFilled(const char* data, const quint64 length, quint8& fill)
+{
+    if (length == 0)
+    {
+        return false;
+    }
+    fill = static_cast<quint8>(data[0]);
+    return firstNotEqual(data + 1, length - 1, fill) == length - 1;
+}
@@ -0,0 +1,35 @@
+#ifndef BUFFERSCAN_H
+#define BUFFERSCAN_H
+
+#include <QtGlobal>
+
+// Byte scanning kernels for the hot loops of imaging, zero and fill detection
+// and buffer comparison. The widest instruction set the CPU and the OS support
+// (AVX-512BW, AVX2 or SSE2) is picked once at first use, other CPUs use the
+// scalar kernels. A narrower level can be forced to compare the kernels.
+class BufferScan
+{
+public:
+    enum Level { LevelScalar = 0, LevelSse2, LevelAvx2, LevelAvx512 };
+
+    static Level       supportedLevel();
+    static Level       level();
+    static const char* levelName(const Level level);
+
+    // Uses the kernels of level from now on, false when the CPU does not support it
+    static bool setLevel(const Level level);
+
+    // Offset of the first byte that differs between both buffers, length when they are identical
+    static quint64 firstDifference(const char* a, const char* b, const quint64 length);
+
+    // Offset of the first byte that is not equal to value, length when there is none
+    static quint64 firstNotEqual(const char* data, const quint64 length, const quint8 value);
+
+    static bool isEqual(const char* a, const char* b, const quint64 length);
+    static bool isZero(const char* data, const quint64 length);
+
+    // True when the buffer holds a single repeated byte, which is returned in fill
+    static bool isFilled(const char* data, const quint64 length, quint8& fill);
+};
+
+#endif // BUFFERSCAN_H
@@ -0,0 +1,24 @@
+#ifndef CANCELTOKEN_H
+#define CANCELTOKEN_H
+
+#include <QAtomicInt>
+
+// Set from the GUI thread, polled by the I/O loops of a job
+class CancelToken
+{
+public:
+    void cancel()
+    {
+        m_cancelled.storeRelease(1);
+    }
+
+    bool isCancelled() const
+    {
+        return m_cancelled.loadAcquire() != 0;
+    }
+
+private:
+    QAtomicInt m_cancelled = {0};
+};
+
+#endif // CANCELTOKEN_H
@@ -0,0 +1,146 @@
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+#include "checkpointjournal.h"
+#include "checksum.h"
+
+// "WDISKADJ"
+const quint64 CheckpointJournal::MAGIC = Q_UINT64_C(0x574449534B41444A);
+
+CheckpointJournal::CheckpointJournal(const QString& path, const Checkpoint& identity, const int intervalMs) :
+    m_path(path),
+    m_identity(identity),
+    m_intervalMs(intervalMs)
+{
+    m_timer.start();
+}
+
+QString CheckpointJournal::createPath(const QString& imagePath)
+{
+    QFileInfo fileInfo(imagePath);
+    return fileInfo.path() + "/" + fileInfo.completeBaseName() + ".adj";
+}
+
+QString CheckpointJournal::restorePath(const quint64 imageDigest, const int deviceId)
+{
+    // The image may be on a read-only share, restore journals stay with the application
+    QString dir = QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation) + "/journals";
+    QDir().mkpath(dir);
+    return QString("%1/restore-%2-%3.adj").arg(dir).arg(imageDigest, 16, 16, QChar('0')).arg(deviceId);
+}
+
+bool CheckpointJournal::load(Checkpoint& checkpoint) const
+{
+    QFile file(m_path);
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        return false;
+    }
+    QByteArray data = file.readAll();
+    file.close();
+
+    // The content is followed by its digest
+    if (data.size() < static_cast<int>(sizeof(quint64)))
+    {
+        return false;
+    }
+    int contentSize = data.size() - static_cast<int>(sizeof(quint64));
+    QDataStream in(data);
+    in.skipRawData(contentSize);
+    quint64 digest = 0;
+    in >> digest;
+    if (digest != Checksum::xxh64(data.constData(), static_cast<quint64>(contentSize)))
+    {
+        return false;
+    }
+
+    in.device()->seek(0);
+    quint64 magic = 0;
+    quint16 version = 0;
+    quint32 chunkCount = 0;
+    Checkpoint loaded;
+    in >> magic >> version;
+    if ((magic != MAGIC) || (version != VERSION))
+    {
+        return false;
+    }
+    in >> loaded.kind >> loaded.header.codec >> loaded.header.codecLevel >> loaded.header.sectorSize
+       >> loaded.header.chunkSize >> loaded.header.totalSize >> loaded.header.imageDigest >> loaded.header.baseDigest
+       >> loaded.deviceSize >> loaded.layoutDigest >> loaded.discardHoles >> loaded.committedChunks >> loaded.runningDigest
+       >> loaded.fileLength >> chunkCount;
+    if ((in.status() != QDataStream::Ok) || (chunkCount > static_cast<quint32>(contentSize) / ImageFormat::INDEX_ENTRY_SIZE))
+    {
+        return false;
+    }
+
+    loaded.chunks.resize(static_cast<int>(chunkCount));
+    for (int i = 0; i < loaded.chunks.size(); i++)
+    {
+        ChunkEntry& entry = loaded.chunks[i];
+        in >> entry.deviceOffset >> entry.fileOffset >> entry.compressedLength
+           >> entry.uncompressedLength >> entry.flags >> entry.checksum;
+    }
+    if ((in.status() != QDataStream::Ok) || (loaded.committedChunks < 0) || !matchesIdentity(loaded))
+    {
+        return false;
+    }
+
+    checkpoint = loaded;
+    return true;
+}
+
+bool CheckpointJournal::isDue() const
+{
+    return m_timer.elapsed() >= m_intervalMs;
+}
+
+bool CheckpointJournal::save(const qint32 committedChunks, const quint64 runningDigest, const QVector<ChunkEntry>& chunks, const quint64 fileLength, QString& msg)
+{
+    m_timer.restart();
+
+    QByteArray data;
+    QDataStream out(&data, QIODevice::WriteOnly);
+    out << MAGIC << VERSION << m_identity.kind << m_identity.header.codec << m_identity.header.codecLevel
+        << m_identity.header.sectorSize << m_identity.header.chunkSize << m_identity.header.totalSize
+        << m_identity.header.imageDigest << m_identity.header.baseDigest << m_identity.deviceSize << m_identity.layoutDigest
+        << m_identity.discardHoles << committedChunks << runningDigest << fileLength << static_cast<quint32>(chunks.size());
+    foreach (const ChunkEntry& entry, chunks)
+    {
+        out << entry.deviceOffset << entry.fileOffset << entry.compressedLength
+            << entry.uncompressedLength << entry.flags << entry.checksum;
+    }
+    out << Checksum::xxh64(data.constData(), static_cast<quint64>(data.size()));
+
+    // Written to a temporary file and renamed, the previous checkpoint stays valid until then
+    QSaveFile file(m_path);
+    if (!file.open(QIODevice::WriteOnly) || (file.write(data) != data.size()) || !file.commit())
+    {
+        msg = QString("Write Error;Cannot write the checkpoint journal %1.").arg(QDir::toNativeSeparators(m_path));
+        return false;
+    }
+    return true;
+}
+
+void CheckpointJournal::remove()
+{
+    QFile::remove(m_path);
+}
+
+bool CheckpointJournal::matchesIdentity(const Checkpoint& checkpoint) const
+{
+    return (checkpoint.kind == m_identity.kind) &&
+           (checkpoint.header.codec == m_identity.header.codec) &&
+           (checkpoint.header.codecLevel == m_identity.header.codecLevel) &&
+           (checkpoint.header.sectorSize == m_identity.header.sectorSize) &&
+           (checkpoint.header.chunkSize == m_identity.header.chunkSize) &&
+           (checkpoint.header.totalSize == m_identity.header.totalSize) &&
+           (checkpoint.header.imageDigest == m_identity.header.imageDigest) &&
+           (checkpoint.header.baseDigest == m_identity.header.baseDigest) &&
+           (checkpoint.deviceSize == m_identity.deviceSize) &&
+           (checkpoint.layoutDigest == m_identity.layoutDigest) &&
+           (checkpoint.discardHoles == m_identity.discardHoles);
+}
@@ -0,0 +1,61 @@
+#ifndef CHECKPOINTJOURNAL_H
+#define CHECKPOINTJOURNAL_H
+
+#include <QElapsedTimer>
+#include <QString>
+#include <QVector>
+
+#include "imageformat.h"
+
+// Progress of an interrupted job. The identity fields tell which image and
+// device it belongs to and how holes were restored, committedChunks counts
+// the leading chunks that are completely written. A create also keeps the
+// index of those chunks and the length of the image file holding them.
+struct Checkpoint
+{
+    quint32             kind = {0};
+    ImageHeader         header;
+    quint64             deviceSize = {0};
+    quint64             layoutDigest = {0};
+    bool                discardHoles = {false};
+    qint32              committedChunks = {0};
+    quint64             runningDigest = {0};
+    quint64             fileLength = {0};
+    QVector<ChunkEntry> chunks;
+};
+
+// Small file a create or restore rewrites every few seconds, so a cancelled
+// or interrupted job continues after its last committed chunk instead of
+// starting over. Every save replaces the file atomically and carries a digest
+// of its content, a torn or damaged journal is ignored.
+class CheckpointJournal
+{
+public:
+    static const quint32 KIND_CREATE = 1;
+    static const quint32 KIND_RESTORE = 2;
+
+    CheckpointJournal(const QString& path, const Checkpoint& identity, const int intervalMs = 2000);
+
+    static QString createPath(const QString& imagePath);
+    static QString restorePath(const quint64 imageDigest, const int deviceId);
+
+    // True when an intact journal of the same image and device exists
+    bool load(Checkpoint& checkpoint) const;
+    bool isDue() const;
+    bool save(const qint32 committedChunks, const quint64 runningDigest, const QVector<ChunkEntry>& chunks, const quint64 fileLength, QString& msg);
+    void remove();
+
+private:
+    bool matchesIdentity(const Checkpoint& checkpoint) const;
+
+private:
+    static const quint64 MAGIC;
+    static const quint16 VERSION = 3;
+
+    QString       m_path;
+    Checkpoint    m_identity;
+    int           m_intervalMs;
+    QElapsedTimer m_timer;
+};
+
+#endif // CHECKPOINTJOURNAL_H
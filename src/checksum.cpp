@@ -0,0 +1,140 @@
+#include <cstring>
+
+#include "checksum.h"
+
+static const quint64 PRIME64_1 = Q_UINT64_C(0x9E3779B185EBCA87);
+static const quint64 PRIME64_2 = Q_UINT64_C(0xC2B2AE3D27D4EB4F);
+static const quint64 PRIME64_3 = Q_UINT64_C(0x165667B19E3779F9);
+static const quint64 PRIME64_4 = Q_UINT64_C(0x85EBCA77C2B2AE63);
+static const quint64 PRIME64_5 = Q_UINT64_C(0x27D4EB2F165667C5);
+
+static inline quint64 rotl64(const quint64 x, const int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline quint64 read64(const char* p)
+{
+    // Image data is little endian on all supported platforms
+    quint64 v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline quint32 read32(const char* p)
+{
+    quint32 v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+quint64 Checksum::round(quint64 acc, const quint64 input)
+{
+    acc += input * PRIME64_2;
+    acc = rotl64(acc, 31);
+    acc *= PRIME64_1;
+    return acc;
+}
+
+quint64 Checksum::mergeRound(quint64 acc, const quint64 val)
+{
+    acc ^= round(0, val);
+    acc = acc * PRIME64_1 + PRIME64_4;
+    return acc;
+}
+
+quint64 Checksum::xxh64(const char* data, const quint64 length, const quint64 seed)
+{
+    const char* p = data;
+    const char* end = data + length;
+    quint64 h64;
+
+    if (length >= 32)
+    {
+        const char* limit = end - 32;
+        quint64 v1 = seed + PRIME64_1 + PRIME64_2;
+        quint64 v2 = seed + PRIME64_2;
+        quint64 v3 = seed;
+        quint64 v4 = seed - PRIME64_1;
+
+        do
+        {
+            v1 = round(v1, read64(p));
+            v2 = round(v2, read64(p + 8));
+            v3 = round(v3, read64(p + 16));
+            v4 = round(v4, read64(p + 24));
+            p += 32;
+        } while (p <= limit);
+
+        h64 = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        h64 = mergeRound(h64, v1);
+        h64 = mergeRound(h64, v2);
+        h64 = mergeRound(h64, v3);
+        h64 = mergeRound(h64, v4);
+    }
+    else
+    {
+        h64 = seed + PRIME64_5;
+    }
+
+    h64 += length;
+
+    while (p + 8 <= end)
+    {
+        h64 ^= round(0, read64(p));
+        h64 = rotl64(h64, 27) * PRIME64_1 + PRIME64_4;
+        p += 8;
+    }
+
+    if (p + 4 <= end)
+    {
+        h64 ^= static_cast<quint64>(read32(p)) * PRIME64_1;
+        h64 = rotl64(h64, 23) * PRIME64_2 + PRIME64_3;
+        p += 4;
+    }
+
+    while (p < end)
+    {
+        h64 ^= static_cast<quint64>(static_cast<uchar>(*p)) * PRIME64_5;
+        h64 = rotl64(h64, 11) * PRIME64_1;
+        p++;
+    }
+
+    h64 ^= h64 >> 33;
+    h64 *= PRIME64_2;
+    h64 ^= h64 >> 29;
+    h64 *= PRIME64_3;
+    h64 ^= h64 >> 32;
+
+    return h64;
+}
+
+struct Crc32Table
+{
+    quint32 entries[256];
+
+    Crc32Table()
+    {
+        for (quint32 i = 0; i < 256; i++)
+        {
+            quint32 c = i;
+            for (int k = 0; k < 8; k++)
+            {
+                c = (c & 1) ? (0xEDB88320u ^ (c >> 1)) : (c >> 1);
+            }
+            entries[i] = c;
+        }
+    }
+};
+
+quint32 Checksum::crc32(const char* data, const quint64 length)
+{
+    static const Crc32Table table;
+
+    quint32 crc = 0xFFFFFFFFu;
+    for (quint64 i = 0; i < length; i++)
+    {
+        crc = table.entries[(crc ^ static_cast<quint8>(data[i])) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
@@ -0,0 +1,20 @@
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <QtGlobal>
+
+class Checksum
+{
+public:
+    // 64-bit xxHash (XXH64) of the given buffer
+    static quint64 xxh64(const char* data, const quint64 length, const quint64 seed = 0);
+
+    // CRC-32 (IEEE 802.3, as used by GPT headers and partition entries)
+    static quint32 crc32(const char* data, const quint64 length);
+
+private:
+    static quint64 round(quint64 acc, const quint64 input);
+    static quint64 mergeRound(quint64 acc, const quint64 val);
+};
+
+#endif // CHECKSUM_H
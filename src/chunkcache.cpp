@@ -0,0 +1,210 @@
+#include <QDir>
+#include <QFile>
+#include <QSaveFile>
+
+#include <climits>
+
+#include "chunkcache.h"
+#include "checksum.h"
+
+// QCache counts in int, the cost of a chunk is its size in KB
+static int costOf(const quint64 bytes)
+{
+    return static_cast<int>(qMin<quint64>((bytes + 1023) / 1024, INT_MAX));
+}
+
+ChunkCache::ChunkCache(const quint64 memoryLimit)
+{
+    setMemoryLimit(memoryLimit);
+}
+
+void ChunkCache::setMemoryLimit(const quint64 memoryLimit)
+{
+    QMutexLocker locker(&m_mutex);
+    m_memory.setMaxCost(costOf(memoryLimit));
+}
+
+bool ChunkCache::setSpillDirectory(const QString& path, const quint64 sizeLimit, QString& msg)
+{
+    QMutexLocker locker(&m_mutex);
+    m_spillDir.clear();
+    m_spillLimit = 0;
+    m_spillSize = 0;
+    m_spilled.clear();
+    m_spillOrder.clear();
+    if (path.isEmpty() || (sizeLimit == 0))
+    {
+        return true;
+    }
+
+    QDir dir(path);
+    if (!dir.exists() && !dir.mkpath("."))
+    {
+        msg = QString("File Error;Could not create the cache directory %1.").arg(QDir::toNativeSeparators(path));
+        return false;
+    }
+    m_spillDir = dir.absolutePath();
+    m_spillLimit = sizeLimit;
+
+    // Pick up the chunks of earlier sessions, oldest first
+    foreach (const QFileInfo& fileInfo, dir.entryInfoList(QStringList("*.chunk"), QDir::Files, QDir::Time | QDir::Reversed))
+    {
+        QStringList parts = fileInfo.completeBaseName().split('-');
+        bool digestOk = false;
+        bool indexOk = false;
+        Key key(parts.first().toULongLong(&digestOk, 16), parts.last().toInt(&indexOk));
+        if ((parts.size() != 2) || !digestOk || !indexOk)
+        {
+            continue;
+        }
+        addSpilled(key, static_cast<quint64>(fileInfo.size()));
+    }
+    trimSpilled();
+    return true;
+}
+
+bool ChunkCache::isEnabled() const
+{
+    QMutexLocker locker(&m_mutex);
+    return (m_memory.maxCost() > 0) || !m_spillDir.isEmpty();
+}
+
+bool ChunkCache::isCacheable(const ImageHeader& header, const ChunkEntry& entry)
+{
+    // Holes are decoded without reading the image, there is nothing to save
+    return (header.version >= ImageFormat::VERSION_2) && (header.imageDigest != 0) && !ImageFormat::isHole(entry);
+}
+
+bool ChunkCache::lookup(const quint64 imageDigest, const int index, const ChunkEntry& entry, QByteArray& data)
+{
+    Key key(imageDigest, index);
+    {
+        QMutexLocker locker(&m_mutex);
+        QByteArray* cached = m_memory.object(key);
+        if (cached)
+        {
+            data = *cached;
+            return true;
+        }
+    }
+
+    if (!readSpilled(key, entry, data))
+    {
+        return false;
+    }
+
+    QMutexLocker locker(&m_mutex);
+    m_memory.insert(key, new QByteArray(data), costOf(static_cast<quint64>(data.size())));
+    return true;
+}
+
+void ChunkCache::insert(const quint64 imageDigest, const int index, const QByteArray& data)
+{
+    Key key(imageDigest, index);
+    {
+        QMutexLocker locker(&m_mutex);
+        m_memory.insert(key, new QByteArray(data), costOf(static_cast<quint64>(data.size())));
+    }
+    writeSpilled(key, data);
+}
+
+QString ChunkCache::spillFilePath(const QString& dir, const Key& key) const
+{
+    return QString("%1/%2-%3.chunk").arg(dir).arg(key.first, 16, 16, QChar('0')).arg(key.second);
+}
+
+bool ChunkCache::readSpilled(const Key& key, const ChunkEntry& entry, QByteArray& data)
+{
+    QString path;
+    {
+        QMutexLocker locker(&m_mutex);
+        if (!m_spilled.contains(key))
+        {
+            return false;
+        }
+        path = spillFilePath(m_spillDir, key);
+    }
+
+    // The file is read without the lock, a damaged or vanished one is dropped
+    QFile file(path);
+    bool ok = file.open(QIODevice::ReadOnly);
+    if (ok)
+    {
+        data = file.readAll();
+        ok = (static_cast<quint64>(data.size()) == entry.uncompressedLength) &&
+             (Checksum::xxh64(data.constData(), static_cast<quint64>(data.size())) == entry.checksum);
+        file.close();
+    }
+
+    QMutexLocker locker(&m_mutex);
+    if (!m_spilled.contains(key))
+    {
+        return ok;
+    }
+    if (!ok)
+    {
+        removeSpilled(key);
+        return false;
+    }
+
+    // Most recently used again
+    Spilled& spilled = m_spilled[key];
+    m_spillOrder.splice(m_spillOrder.end(), m_spillOrder, spilled.position);
+    return true;
+}
+
+void ChunkCache::writeSpilled(const Key& key, const QByteArray& data)
+{
+    QString dir;
+    {
+        QMutexLocker locker(&m_mutex);
+        if (m_spillDir.isEmpty() || m_spilled.contains(key) || (static_cast<quint64>(data.size()) > m_spillLimit))
+        {
+            return;
+        }
+        dir = m_spillDir;
+    }
+
+    // Written to a temporary file and renamed, a reader never sees a partial chunk
+    QSaveFile file(spillFilePath(dir, key));
+    if (!file.open(QIODevice::WriteOnly) || (file.write(data) != data.size()) || !file.commit())
+    {
+        return;
+    }
+
+    QMutexLocker locker(&m_mutex);
+    if ((m_spillDir == dir) && !m_spilled.contains(key))
+    {
+        addSpilled(key, static_cast<quint64>(data.size()));
+        trimSpilled();
+    }
+}
+
+void ChunkCache::addSpilled(const Key& key, const quint64 size)
+{
+    // Called with the mutex held
+    Spilled spilled;
+    spilled.size = size;
+    spilled.position = m_spillOrder.insert(m_spillOrder.end(), key);
+    m_spilled.insert(key, spilled);
+    m_spillSize += size;
+}
+
+void ChunkCache::removeSpilled(const Key& key)
+{
+    // Called with the mutex held
+    Spilled spilled = m_spilled.take(key);
+    m_spillOrder.erase(spilled.position);
+    m_spillSize -= spilled.size;
+    QFile::remove(spillFilePath(m_spillDir, key));
+}
+
+void ChunkCache::trimSpilled()
+{
+    // Called with the mutex held, drops the least recently used chunks
+    while ((m_spillSize > m_spillLimit) && !m_spillOrder.empty())
+    {
+        Key oldest = m_spillOrder.front();
+        removeSpilled(oldest);
+    }
+}
@@ -0,0 +1,69 @@
+#ifndef CHUNKCACHE_H
+#define CHUNKCACHE_H
+
+#include <QByteArray>
+#include <QCache>
+#include <QHash>
+#include <QMutex>
+#include <QPair>
+#include <QString>
+
+#include <list>
+
+#include "imageformat.h"
+
+// Keeps decoded chunks of recently restored images so restoring the same image
+// again skips reading and decompressing it. Chunks are keyed by the image digest
+// and their index, so a changed image never hits stale data. The most recently
+// used chunks stay in memory up to a size limit. With a spill directory every
+// chunk is also written there, bounded by its own size limit, and survives the
+// application. Chunks read back from the directory are checked against their
+// digest. Safe to use from several threads.
+class ChunkCache
+{
+public:
+    explicit ChunkCache(const quint64 memoryLimit = Q_UINT64_C(1024) * 1024 * 1024);
+
+    void setMemoryLimit(const quint64 memoryLimit);
+    bool setSpillDirectory(const QString& path, const quint64 sizeLimit, QString& msg);
+
+    // False when neither memory nor a spill directory is available, lookups would always miss
+    bool isEnabled() const;
+
+    // Only version 2 images with an image digest and chunks holding data are cached
+    static bool isCacheable(const ImageHeader& header, const ChunkEntry& entry);
+
+    bool lookup(const quint64 imageDigest, const int index, const ChunkEntry& entry, QByteArray& data);
+    void insert(const quint64 imageDigest, const int index, const QByteArray& data);
+
+private:
+    typedef QPair<quint64, int> Key;
+
+    struct Spilled
+    {
+        quint64                    size;
+        std::list<Key>::iterator   position;
+    };
+
+    QString spillFilePath(const QString& dir, const Key& key) const;
+    bool    readSpilled(const Key& key, const ChunkEntry& entry, QByteArray& data);
+    void    writeSpilled(const Key& key, const QByteArray& data);
+    void    addSpilled(const Key& key, const quint64 size);
+    void    removeSpilled(const Key& key);
+    void    trimSpilled();
+
+private:
+    Q_DISABLE_COPY(ChunkCache)
+
+    mutable QMutex          m_mutex;
+    QCache<Key, QByteArray> m_memory;
+
+    // Spilled chunks, the list runs from least to most recently used
+    QString                 m_spillDir;
+    quint64                 m_spillLimit = {0};
+    quint64                 m_spillSize = {0};
+    QHash<Key, Spilled>     m_spilled;
+    std::list<Key>          m_spillOrder;
+};
+
+#endif // CHUNKCACHE_H
@@ -0,0 +1,468 @@
+#include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDateTime>
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QLockFile>
+#include <QMap>
+#include <QSaveFile>
+#include <QSet>
+
+#include "chunkrepository.h"
+#include "checksum.h"
+#include "bufferscan.h"
+
+// "ADCK"
+const quint32 ChunkRepository::CHUNK_MAGIC = 0x4144434B;
+
+// Unreferenced chunks younger than this may still be claimed by a running create
+static const qint64 GRACE_PERIOD_SECS = 3600;
+
+static QString lockPath(const QString& path)
+{
+    return path + "/repository.lock";
+}
+
+ChunkRepository* ChunkRepository::open(const QString& path, QString& msg)
+{
+    static QMutex registryMutex;
+    static QMap<QString, ChunkRepository*> registry;
+
+    QDir dir(path);
+    if ((!dir.exists() && !dir.mkpath(".")) || !dir.mkpath("chunks") || !dir.mkpath("images") || !dir.mkpath("claims"))
+    {
+        msg = QString("File Error;Cannot create the chunk repository %1.").arg(QDir::toNativeSeparators(path));
+        return nullptr;
+    }
+
+    QMutexLocker locker(&registryMutex);
+    QString canonical = QFileInfo(dir.absolutePath()).canonicalFilePath();
+    if (!registry.contains(canonical))
+    {
+        registry.insert(canonical, new ChunkRepository(canonical));
+    }
+    return registry.value(canonical);
+}
+
+ChunkRepository::ChunkRepository(const QString& path) :
+    m_path(path)
+{
+}
+
+QString ChunkRepository::path() const
+{
+    return m_path;
+}
+
+QString ChunkRepository::chunkPath(const QByteArray& key) const
+{
+    QString hex = QString::fromLatin1(key.toHex());
+    return QString("%1/chunks/%2/%3.chunk").arg(m_path).arg(hex.left(2)).arg(hex);
+}
+
+bool ChunkRepository::encodeChunk(const ImageHeader& header, const quint64 deviceOffset, const QByteArray& data, ChunkEntry& entry, QByteArray& payload, QString& msg)
+{
+    // Holes stay in the image, they have no payload to share
+    quint8 fill = 0;
+    if (BufferScan::isFilled(data.constData(), static_cast<quint64>(data.size()), fill))
+    {
+        return ImageFormat::encodeChunk(header, deviceOffset, data, entry, payload, msg);
+    }
+
+    // A chunk already in the repository is only hashed, never compressed again
+    QByteArray key = QCryptographicHash::hash(data, QCryptographicHash::Sha256);
+    QString path = chunkPath(key);
+    bool stored = QFile::exists(path);
+    if (stored && !claimChunk(key, path, stored, msg))
+    {
+        return false;
+    }
+    if (!stored)
+    {
+        QByteArray compressed;
+        if (!ImageCodec::compress(header.codec, header.codecLevel, data, compressed, msg))
+        {
+            return false;
+        }
+
+        QByteArray chunkHeader;
+        QDataStream out(&chunkHeader, QIODevice::WriteOnly);
+        out << CHUNK_MAGIC << header.codec << static_cast<quint16>(0);
+
+        // Written to a temporary file and renamed, a concurrent writer of the same chunk writes the same bytes
+        QDir().mkpath(QFileInfo(path).path());
+        QSaveFile file(path);
+        if (!file.open(QIODevice::WriteOnly) || (file.write(chunkHeader) != chunkHeader.size()) ||
+            (file.write(compressed) != compressed.size()) || !file.commit())
+        {
+            msg = QString("Write Error;Cannot write a chunk to the chunk repository.");
+            return false;
+        }
+        if (!claimChunk(key, path, stored, msg))
+        {
+            return false;
+        }
+        if (!stored)
+        {
+            msg = QString("Write Error;Cannot claim a chunk in the chunk repository.");
+            return false;
+        }
+    }
+
+    entry = ChunkEntry();
+    entry.deviceOffset = deviceOffset;
+    entry.flags = ImageFormat::CHUNK_REPOSITORY;
+    entry.compressedLength = static_cast<quint32>(key.size());
+    entry.uncompressedLength = static_cast<quint32>(data.size());
+    entry.checksum = Checksum::xxh64(data.constData(), static_cast<quint64>(data.size()));
+    payload = key;
+    return true;
+}
+
+bool ChunkRepository::claimChunk(const QByteArray& key, const QString& path, bool& stored, QString& msg)
+{
+    // Garbage collection holds the lock while it decides, so it never removes a chunk
+    // between the check here and the claim
+    QMutexLocker locker(&m_mutex);
+    QLockFile lock(lockPath(m_path));
+    if (!lock.lock())
+    {
+        msg = QString("File Error;Cannot lock the chunk repository.");
+        return false;
+    }
+
+    // A reused chunk counts as new for the grace period, one collected meanwhile is written again
+    QFile file(path);
+    stored = file.open(QIODevice::ReadWrite) && file.setFileTime(QDateTime::currentDateTimeUtc(), QFileDevice::FileModificationTime);
+    if (!stored)
+    {
+        return true;
+    }
+    if (m_claims.isOpen() && ((m_claims.write(key) != key.size()) || !m_claims.flush()))
+    {
+        msg = QString("Write Error;Cannot claim a chunk in the chunk repository.");
+        return false;
+    }
+    return true;
+}
+
+void ChunkRepository::beginImage()
+{
+    QMutexLocker locker(&m_mutex);
+    if (m_creates++ > 0)
+    {
+        return;
+    }
+
+    // The lock tells other processes this one is alive, the claims of a crashed process are dropped
+    QString base = QString("%1/claims/%2-%3").arg(m_path).arg(QCoreApplication::applicationPid()).arg(QDateTime::currentMSecsSinceEpoch());
+    m_claimLock.reset(new QLockFile(base + ".lock"));
+    m_claimLock->setStaleLockTime(0);
+    m_claims.setFileName(base + ".keys");
+    if (!m_claimLock->tryLock(0) || !m_claims.open(QIODevice::WriteOnly))
+    {
+        // Without a claims file the grace period is all that protects the chunks of the create
+        m_claimLock.reset();
+    }
+}
+
+void ChunkRepository::endImage()
+{
+    QMutexLocker locker(&m_mutex);
+    if ((m_creates == 0) || (--m_creates > 0))
+    {
+        return;
+    }
+
+    // Registered images hold their chunks from now on
+    QLockFile lock(lockPath(m_path));
+    lock.lock();
+    if (m_claims.isOpen())
+    {
+        m_claims.remove();
+    }
+    m_claimLock.reset();
+}
+
+bool ChunkRepository::loadClaims(QSet<QByteArray>& claimed) const
+{
+    claimed.clear();
+    QDir claimsDir(m_path + "/claims");
+    foreach (const QString& name, claimsDir.entryList(QStringList("*.keys"), QDir::Files))
+    {
+        QString keysPath = claimsDir.filePath(name);
+        if (keysPath != m_claims.fileName())
+        {
+            // Nobody holds the lock of the claims, their process is gone
+            QLockFile owner(keysPath.left(keysPath.size() - 5) + ".lock");
+            owner.setStaleLockTime(0);
+            if (owner.tryLock(0))
+            {
+                QFile::remove(keysPath);
+                owner.unlock();
+                continue;
+            }
+        }
+
+        QFile file(keysPath);
+        if (!file.open(QIODevice::ReadOnly))
+        {
+            return false;
+        }
+        QByteArray keys = file.readAll();
+        for (int i = 0; i + KEY_SIZE <= keys.size(); i += KEY_SIZE)
+        {
+            claimed.insert(keys.mid(i, KEY_SIZE));
+        }
+    }
+    return true;
+}
+
+bool ChunkRepository::readChunk(const QByteArray& key, QByteArray& payload, QString& msg) const
+{
+    QFile file(chunkPath(key));
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        msg = QString("File Error;Chunk %1 is missing from the chunk repository.").arg(QString::fromLatin1(key.toHex()));
+        return false;
+    }
+
+    // Read into the caller's buffer, it is only reallocated when too small
+    qint64 size = file.size();
+    payload.resize(static_cast<int>(size));
+    if ((size < CHUNK_HEADER_SIZE) || (file.read(payload.data(), size) != size))
+    {
+        msg = QString("File Error;Chunk %1 of the chunk repository is damaged.").arg(QString::fromLatin1(key.toHex()));
+        return false;
+    }
+    return true;
+}
+
+bool ChunkRepository::decodeChunk(const ChunkEntry& entry, const QByteArray& payload, QByteArray& data, QString& msg)
+{
+    // The codec of the chunk file applies, it may differ from the codec of the image
+    QDataStream in(payload);
+    quint32 magic = 0;
+    quint16 codec = 0;
+    in >> magic >> codec;
+    if ((in.status() != QDataStream::Ok) || (magic != CHUNK_MAGIC))
+    {
+        msg = QString("File Error;A chunk of the chunk repository is damaged.");
+        return false;
+    }
+
+    QByteArray compressed = QByteArray::fromRawData(payload.constData() + CHUNK_HEADER_SIZE, payload.size() - CHUNK_HEADER_SIZE);
+    return ImageCodec::uncompress(codec, compressed, entry.uncompressedLength, data, msg);
+}
+
+bool ChunkRepository::readImageKeys(const QString& imagePath, quint64& imageDigest, QVector<QByteArray>& keys, QString& msg) const
+{
+    ImageReader reader;
+    if (!reader.open(imagePath, msg))
+    {
+        return false;
+    }
+
+    imageDigest = reader.header().imageDigest;
+    keys.clear();
+    for (int i = 0; i < reader.chunks().size(); i++)
+    {
+        if (!ImageFormat::isRepositoryReference(reader.chunks().at(i)))
+        {
+            continue;
+        }
+        QByteArray key;
+        if (!reader.readRepositoryKey(i, key, msg))
+        {
+            return false;
+        }
+        keys.append(key);
+    }
+    return true;
+}
+
+bool ChunkRepository::loadIndex(QHash<QByteArray, quint32>& refs) const
+{
+    refs.clear();
+    QFile file(m_path + "/index.dat");
+    if (!file.exists())
+    {
+        return true;
+    }
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        return false;
+    }
+    QDataStream in(&file);
+    in >> refs;
+    return in.status() == QDataStream::Ok;
+}
+
+bool ChunkRepository::saveIndex(const QHash<QByteArray, quint32>& refs) const
+{
+    QSaveFile file(m_path + "/index.dat");
+    if (!file.open(QIODevice::WriteOnly))
+    {
+        return false;
+    }
+    QDataStream out(&file);
+    out << refs;
+    return (out.status() == QDataStream::Ok) && file.commit();
+}
+
+QString ChunkRepository::refsName(const QString& imagePath)
+{
+    // The image exists while it is registered, links and relative paths resolve to the same name
+    QByteArray path = QFileInfo(imagePath).canonicalFilePath().toUtf8();
+    return QString("%1").arg(Checksum::xxh64(path.constData(), static_cast<quint64>(path.size())), 16, 16, QChar('0'));
+}
+
+bool ChunkRepository::addImage(const QString& imagePath, int& shared, QString& msg)
+{
+    shared = 0;
+    quint64 imageDigest = 0;
+    QVector<QByteArray> keys;
+    if (!readImageKeys(imagePath, imageDigest, keys, msg))
+    {
+        return false;
+    }
+
+    QMutexLocker locker(&m_mutex);
+    QLockFile lock(lockPath(m_path));
+    if (!lock.lock())
+    {
+        msg = QString("File Error;Cannot lock the chunk repository.");
+        return false;
+    }
+
+    // References are kept per image file, copies of an image with the same content each hold
+    // their chunks and an image written again to the same path replaces its earlier references
+    QString refsPath = QString("%1/images/%2.refs").arg(m_path).arg(refsName(imagePath));
+    QHash<QByteArray, quint32> refs;
+    if (!loadIndex(refs))
+    {
+        msg = QString("File Error;The index of the chunk repository is damaged.");
+        return false;
+    }
+    QFile oldFile(refsPath);
+    if (oldFile.open(QIODevice::ReadOnly))
+    {
+        QString oldPath;
+        quint64 oldDigest = 0;
+        QVector<QByteArray> oldKeys;
+        QDataStream in(&oldFile);
+        in >> oldPath >> oldDigest >> oldKeys;
+        foreach (const QByteArray& key, oldKeys)
+        {
+            if (refs.value(key) > 1)
+            {
+                refs[key]--;
+            }
+            else
+            {
+                refs.remove(key);
+            }
+        }
+        oldFile.close();
+    }
+
+    QSaveFile file(refsPath);
+    QDataStream out(&file);
+    bool ok = file.open(QIODevice::WriteOnly);
+    out << QFileInfo(imagePath).absoluteFilePath() << imageDigest << keys;
+    ok = ok && (out.status() == QDataStream::Ok) && file.commit();
+
+    foreach (const QByteArray& key, keys)
+    {
+        shared += (refs.value(key) > 0) ? 1 : 0;
+        refs[key]++;
+    }
+    if (!ok || !saveIndex(refs))
+    {
+        msg = QString("Write Error;Cannot register the image in the chunk repository.");
+        return false;
+    }
+    return true;
+}
+
+bool ChunkRepository::collectGarbage(quint64& freedBytes, QString& msg)
+{
+    freedBytes = 0;
+    QMutexLocker locker(&m_mutex);
+    QLockFile lock(lockPath(m_path));
+    if (!lock.lock())
+    {
+        msg = QString("File Error;Cannot lock the chunk repository.");
+        return false;
+    }
+
+    // Images that were deleted or written again no longer hold their chunks
+    QHash<QByteArray, quint32> refs;
+    QDir imagesDir(m_path + "/images");
+    foreach (const QString& name, imagesDir.entryList(QStringList("*.refs"), QDir::Files))
+    {
+        QFile file(imagesDir.filePath(name));
+        QString imagePath;
+        quint64 imageDigest = 0;
+        QVector<QByteArray> keys;
+        bool valid = file.open(QIODevice::ReadOnly);
+        if (valid)
+        {
+            QDataStream in(&file);
+            in >> imagePath >> imageDigest >> keys;
+            valid = (in.status() == QDataStream::Ok);
+            file.close();
+        }
+
+        ImageReader reader;
+        QString error;
+        valid = valid && reader.open(imagePath, error) && (reader.header().imageDigest == imageDigest);
+        reader.close();
+        if (!valid)
+        {
+            QFile::remove(imagesDir.filePath(name));
+            continue;
+        }
+        foreach (const QByteArray& key, keys)
+        {
+            refs[key]++;
+        }
+    }
+
+    // Chunks of images still being created are kept however long ago they were stored
+    QSet<QByteArray> claimed;
+    if (!loadClaims(claimed))
+    {
+        msg = QString("File Error;Cannot read the claims of the chunk repository.");
+        return false;
+    }
+
+    // Recounted from the registered images, drift from interrupted updates is repaired here
+    QDateTime oldest = QDateTime::currentDateTimeUtc().addSecs(-GRACE_PERIOD_SECS);
+    QDirIterator it(m_path + "/chunks", QStringList("*.chunk"), QDir::Files, QDirIterator::Subdirectories);
+    while (it.hasNext())
+    {
+        it.next();
+        QFileInfo fileInfo = it.fileInfo();
+        QByteArray key = QByteArray::fromHex(fileInfo.completeBaseName().toLatin1());
+        if (refs.contains(key) || claimed.contains(key) || (fileInfo.lastModified().toUTC() > oldest))
+        {
+            continue;
+        }
+        quint64 size = static_cast<quint64>(fileInfo.size());
+        if (QFile::remove(fileInfo.filePath()))
+        {
+            freedBytes += size;
+        }
+    }
+
+    if (!saveIndex(refs))
+    {
+        msg = QString("Write Error;Cannot write the index of the chunk repository.");
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,82 @@
+#ifndef CHUNKREPOSITORY_H
+#define CHUNKREPOSITORY_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QHash>
+#include <QLockFile>
+#include <QMutex>
+#include <QScopedPointer>
+#include <QSet>
+#include <QString>
+
+#include "imageformat.h"
+
+// Content addressed store of compressed chunks shared by many images. A chunk
+// is kept once under the SHA-256 of its uncompressed data, an image created in
+// repository mode holds only these keys in place of its payloads.
+//
+//   chunks/ab/abcd....chunk  codec header and compressed payload of one chunk
+//   images/<path hash>.refs  path, digest and chunk keys of a registered image
+//   claims/<process>.keys    chunk keys of images a running process still creates
+//   index.dat                reference count of every chunk
+//
+// Chunk files are written atomically, so concurrent writers of the same chunk
+// are harmless. The index, the image references and the claims are only
+// changed with the repository lock file held, which keeps several processes
+// consistent. Garbage collection drops the references of images that were
+// deleted or replaced, recounts all references and removes chunks nobody
+// refers to. Chunks claimed by a process that still holds the lock next to its
+// claims file are kept however long its create runs, unreferenced chunks
+// younger than an hour as well.
+class ChunkRepository
+{
+public:
+    // One instance per directory for the lifetime of the application
+    static ChunkRepository* open(const QString& path, QString& msg);
+
+    QString path() const;
+
+    // Encodes a chunk like ImageFormat::encodeChunk, the payload becomes the chunk key
+    // and the compressed data goes to the repository unless it is already there
+    bool encodeChunk(const ImageHeader& header, const quint64 deviceOffset, const QByteArray& data, ChunkEntry& entry, QByteArray& payload, QString& msg);
+    bool readChunk(const QByteArray& key, QByteArray& payload, QString& msg) const;
+    static bool decodeChunk(const ChunkEntry& entry, const QByteArray& payload, QByteArray& data, QString& msg);
+
+    // Chunks stored or reused between these calls are claimed for an image that is not registered yet
+    void beginImage();
+    void endImage();
+
+    // Registers a finished image, shared counts the chunks that were stored before
+    bool addImage(const QString& imagePath, int& shared, QString& msg);
+    bool collectGarbage(quint64& freedBytes, QString& msg);
+
+    static const int KEY_SIZE = 32;
+
+private:
+    explicit ChunkRepository(const QString& path);
+
+    QString chunkPath(const QByteArray& key) const;
+    bool    claimChunk(const QByteArray& key, const QString& path, bool& stored, QString& msg);
+    bool    loadClaims(QSet<QByteArray>& claimed) const;
+    static QString refsName(const QString& imagePath);
+    bool    readImageKeys(const QString& imagePath, quint64& imageDigest, QVector<QByteArray>& keys, QString& msg) const;
+    bool    loadIndex(QHash<QByteArray, quint32>& refs) const;
+    bool    saveIndex(const QHash<QByteArray, quint32>& refs) const;
+
+private:
+    Q_DISABLE_COPY(ChunkRepository)
+
+    static const quint32 CHUNK_MAGIC;
+    static const int     CHUNK_HEADER_SIZE = 8;
+
+    QString                   m_path;
+    mutable QMutex            m_mutex;
+
+    // Claims file of this process, open while an image is being created
+    int                       m_creates = {0};
+    QScopedPointer<QLockFile> m_claimLock;
+    QFile                     m_claims;
+};
+
+#endif // CHUNKREPOSITORY_H
@@ -0,0 +1,146 @@
+#include "clonediskjob.h"
+
+const int CHUNK_SIZE = 4096;
+
+// Handle of a target device, its I/O backend is owned by the clone pipeline
+struct CloneDiskJob::Target
+{
+    HANDLE                            handle = {INVALID_HANDLE_VALUE};
+    QScopedPointer<AlignedBufferPool> bufferPool;
+};
+
+CloneDiskJob::CloneDiskJob(const int deviceId, const QList<int>& targetIds, const bool verify, const bool discardHoles, const bool skipFreeSpace, QObject *parent) :
+    ImagingJob(deviceId, QString(), parent),
+    m_targetIds(targetIds),
+    m_verify(verify),
+    m_discardHoles(discardHoles),
+    m_skipFreeSpace(skipFreeSpace)
+{
+}
+
+CloneDiskJob::~CloneDiskJob()
+{
+    // Stop the job thread before the targets it writes are freed
+    m_cancel.cancel();
+    wait();
+    closeTargets();
+    qDeleteAll(m_targets);
+}
+
+ImagingJob::Result CloneDiskJob::execute()
+{
+    QString error;
+    setStatus(SysDef::STATUS_READING, 0);
+
+    // Get the handle of the source raw disk
+    quint64 sectorSize = 0;
+    quint64 numSectors = 0;
+    if (!openDevice(GENERIC_READ, m_queueDepth > 1, sectorSize, numSectors, error))
+    {
+        return fail(error, "Clone disk failed");
+    }
+    QScopedPointer<IoBackend> io(createIoBackend(sectorSize, CHUNK_SIZE * sectorSize));
+
+    // Only partitions and table structures are copied, free space of known file systems is left out
+    QVector<DeviceRange> ranges;
+    quint64 endSector = 0;
+    if (!readLayout(*io, sectorSize, numSectors, m_skipFreeSpace, ranges, endSector, error))
+    {
+        return fail(error, "Clone disk failed");
+    }
+
+    ClonePipeline pipeline(*io, sectorSize, CHUNK_SIZE, m_verify, m_discardHoles, m_cancel);
+    openTargets(pipeline, sectorSize, endSector, CHUNK_SIZE * sectorSize);
+    if (pipeline.liveTargets() == 0)
+    {
+        error = (pipeline.targetCount() == 0) ? QString("Write Error;Please select a target device.") : pipeline.firstError();
+        return fail(error, "Clone disk failed");
+    }
+
+    quint64 totalBytes = 0;
+    foreach (const DeviceRange& range, ranges)
+    {
+        totalBytes += range.numSectors * sectorSize;
+    }
+    setStatus(SysDef::STATUS_WRITING, totalBytes);
+
+    bool succeeded = pipeline.run(ranges, [this](const quint64 bytes) { addProgress(bytes); }, error);
+    io.reset();
+    closeTargets();
+    if (!succeeded)
+    {
+        return fail(error, "Clone disk failed");
+    }
+
+    if (pipeline.isCancelled())
+    {
+        m_message = QString("Clone disk cancelled.");
+        return ResultCancelled;
+    }
+
+    // Report the first failed target, the others were still written
+    int failed = pipeline.targetCount() - pipeline.liveTargets();
+    if (failed > 0)
+    {
+        error = pipeline.firstError();
+        fail(error, "Clone disk failed");
+        m_message = QString("Clone disk succeeded on %1 of %2 devices.").arg(pipeline.targetCount() - failed).arg(pipeline.targetCount());
+        return ResultFailed;
+    }
+
+    m_message = QString("Clone disk succeeded.");
+    return ResultSucceeded;
+}
+
+void CloneDiskJob::openTargets(ClonePipeline& pipeline, const quint64 sectorSize, const quint64 endSector, const quint64 maxLength)
+{
+    // Reading back for verification needs read access as well
+    const DWORD access = m_verify ? (GENERIC_READ | GENERIC_WRITE) : GENERIC_WRITE;
+    foreach (int targetId, m_targetIds)
+    {
+        Target* target = new Target;
+        m_targets << target;
+        const QString name = QString("PhysicalDrive%1").arg(targetId);
+
+        QString error;
+        quint64 targetSectorSize = 0;
+        quint64 targetSectors = 0;
+        quint64 physicalSectorSize = 0;
+        target->handle = openRawDevice(targetId, access, m_queueDepth > 1, targetSectorSize, targetSectors, physicalSectorSize, error);
+        if (target->handle == INVALID_HANDLE_VALUE)
+        {
+            pipeline.addFailedTarget(name, error);
+            continue;
+        }
+
+        if (targetSectorSize != sectorSize)
+        {
+            pipeline.addFailedTarget(name, QString("Write Error;The sector size of the target device does not match the source device."));
+            continue;
+        }
+
+        if (targetSectors < endSector)
+        {
+            pipeline.addFailedTarget(name, QString("Write Error;The partitions of the source device do not fit on the target device."));
+            continue;
+        }
+        HANDLE handle = target->handle;
+        ClonePipeline::Discarder discard = [handle, sectorSize](const quint64 startSector, const quint64 numSectors, QString& msg)
+        {
+            return DiskUtilities::discardSectors(handle, startSector, numSectors, sectorSize, msg);
+        };
+        pipeline.addTarget(name, createIoBackend(target->handle, sectorSize, physicalSectorSize, maxLength, target->bufferPool), discard);
+    }
+}
+
+void CloneDiskJob::closeTargets()
+{
+    foreach (Target* target, m_targets)
+    {
+        if (target->handle != INVALID_HANDLE_VALUE)
+        {
+            CloseHandle(target->handle);
+            target->handle = INVALID_HANDLE_VALUE;
+        }
+    }
+}
@@ -0,0 +1,35 @@
+#ifndef CLONEDISKJOB_H
+#define CLONEDISKJOB_H
+
+#include "imagingjob.h"
+#include "clonepipeline.h"
+
+// Copies the partitions of a source device straight to one or more target
+// devices without an image file. The job opens and locks the devices, the
+// copy itself runs through a ClonePipeline.
+class CloneDiskJob : public ImagingJob
+{
+    Q_OBJECT
+
+public:
+    explicit CloneDiskJob(const int deviceId, const QList<int>& targetIds, const bool verify, const bool discardHoles, const bool skipFreeSpace, QObject *parent = nullptr);
+    ~CloneDiskJob() override;
+
+protected:
+    Result execute() override;
+
+private:
+    struct Target;
+
+    void openTargets(ClonePipeline& pipeline, const quint64 sectorSize, const quint64 endSector, const quint64 maxLength);
+    void closeTargets();
+
+private:
+    QList<int>       m_targetIds;
+    bool             m_verify;
+    bool             m_discardHoles;
+    bool             m_skipFreeSpace;
+    QVector<Target*> m_targets;
+};
+
+#endif // CLONEDISKJOB_H
@@ -0,0 +1,240 @@
+#include <cstring>
+
+#include "clonepipeline.h"
+#include "bufferscan.h"
+#include "bufferarena.h"
+
+ClonePipeline::ClonePipeline(IoBackend& source, const quint64 sectorSize, const quint64 chunkSectors, const bool verify, const bool discardHoles, const CancelToken& cancel) :
+    m_source(source),
+    m_sectorSize(sectorSize),
+    m_chunkSectors(chunkSectors),
+    m_verify(verify),
+    m_discardHoles(discardHoles),
+    m_cancel(cancel)
+{
+}
+
+ClonePipeline::~ClonePipeline()
+{
+    qDeleteAll(m_targets);
+}
+
+void ClonePipeline::addTarget(const QString& name, IoBackend* io, const Discarder& discard)
+{
+    Target* target = new Target;
+    target->name = name;
+    target->io.reset(io);
+    target->discard = discard;
+    m_targets << target;
+}
+
+void ClonePipeline::addFailedTarget(const QString& name, const QString& error)
+{
+    Target* target = new Target;
+    target->name = name;
+    m_targets << target;
+    dropTarget(*target, error);
+}
+
+bool ClonePipeline::run(const QVector<DeviceRange>& ranges, const ProgressCallback& progress, QString& msg)
+{
+    int range = 0;
+    quint64 nextSector = ranges.isEmpty() ? 0 : ranges.first().startSector;
+    while (liveTargets() > 0)
+    {
+        if (m_cancel.isCancelled())
+        {
+            m_cancelled = true;
+            break;
+        }
+
+        // Keep the read queue of the source full, unallocated space goes to the targets unread
+        while (!m_source.isFull() && (range < ranges.size()))
+        {
+            const DeviceRange& current = ranges.at(range);
+            quint64 rangeEnd = current.startSector + current.numSectors;
+            quint64 chunkSectors = qMin(rangeEnd - nextSector, m_chunkSectors);
+            if (current.unallocated)
+            {
+                writeAll(nextSector * m_sectorSize, static_cast<quint32>(chunkSectors * m_sectorSize), QByteArray(), true);
+                progress(chunkSectors * m_sectorSize);
+            }
+            else if (!m_source.submitRead(nextSector * m_sectorSize, QByteArray(static_cast<int>(chunkSectors * m_sectorSize), Qt::Uninitialized), nextSector, msg))
+            {
+                finishTargets();
+                return false;
+            }
+            nextSector += chunkSectors;
+
+            if ((nextSector >= rangeEnd) && (++range < ranges.size()))
+            {
+                nextSector = ranges.at(range).startSector;
+            }
+        }
+
+        if (m_source.isEmpty())
+        {
+            if (range < ranges.size())
+            {
+                continue;
+            }
+            break;
+        }
+
+        IoCompletion completion;
+        if (!m_source.waitOldest(completion, msg))
+        {
+            finishTargets();
+            return false;
+        }
+
+        // Zero the part of a short read at the end of the device
+        if (completion.transferred < completion.length)
+        {
+            memset(BufferArena::writable(completion.data) + completion.transferred, 0, completion.length - completion.transferred);
+        }
+
+        // The same buffer is queued on every target
+        bool empty = BufferScan::isZero(completion.data.constData(), completion.length);
+        writeAll(completion.offset, completion.length, completion.data, empty);
+        progress(completion.length);
+    }
+    finishTargets();
+    return true;
+}
+
+bool ClonePipeline::isCancelled() const
+{
+    return m_cancelled;
+}
+
+int ClonePipeline::targetCount() const
+{
+    return m_targets.size();
+}
+
+int ClonePipeline::liveTargets() const
+{
+    int live = 0;
+    foreach (const Target* target, m_targets)
+    {
+        live += target->failed ? 0 : 1;
+    }
+    return live;
+}
+
+QString ClonePipeline::firstError() const
+{
+    foreach (const Target* target, m_targets)
+    {
+        if (target->failed)
+        {
+            return target->error;
+        }
+    }
+    return QString();
+}
+
+void ClonePipeline::writeAll(const quint64 offset, const quint32 length, const QByteArray& data, const bool empty)
+{
+    foreach (Target* target, m_targets)
+    {
+        QString error;
+        if (!target->failed && !writeChunk(*target, offset, length, data, empty, error))
+        {
+            dropTarget(*target, error);
+        }
+    }
+}
+
+bool ClonePipeline::writeChunk(Target& target, const quint64 offset, const quint32 length, const QByteArray& data, const bool empty, QString& msg)
+{
+    // Empty regions are discarded or skipped instead of written when requested
+    if (empty && m_discardHoles)
+    {
+        if (target.discardSupported && target.discard && !target.discard(offset / m_sectorSize, length / m_sectorSize, msg))
+        {
+            // Device does not support discard, leave the remaining holes untouched
+            target.discardSupported = false;
+            msg.clear();
+        }
+        return true;
+    }
+
+    // Wait for the oldest write or read back when the queue is full
+    while (target.io->isFull())
+    {
+        if (!completeOldest(target, msg))
+        {
+            return false;
+        }
+    }
+    return target.io->submitWrite(offset, data.isEmpty() ? QByteArray(static_cast<int>(length), '\0') : data, offset, msg);
+}
+
+bool ClonePipeline::completeOldest(Target& target, QString& msg)
+{
+    IoCompletion completion;
+    if (!target.io->waitOldest(completion, msg))
+    {
+        return false;
+    }
+
+    if (completion.write)
+    {
+        // Read the chunk back into the slot the write has freed
+        if (m_verify)
+        {
+            target.expected.enqueue(completion.data);
+            return target.io->submitRead(completion.offset, QByteArray(static_cast<int>(completion.length), Qt::Uninitialized), completion.tag, msg);
+        }
+        return true;
+    }
+
+    // A short read at the end of the device compares as zeros
+    if (completion.transferred < completion.length)
+    {
+        memset(BufferArena::writable(completion.data) + completion.transferred, 0, completion.length - completion.transferred);
+    }
+
+    QByteArray expected = target.expected.dequeue();
+    quint64 offset = (expected.size() == completion.data.size()) ? BufferScan::firstDifference(expected.constData(), completion.data.constData(), completion.length) : 0;
+    if (offset < completion.length)
+    {
+        msg = QString("Verify Error;Data written to the target device is NOT identical to the source device, the first difference is in sector %1.").arg((completion.offset + offset) / m_sectorSize);
+        return false;
+    }
+    return true;
+}
+
+void ClonePipeline::dropTarget(Target& target, const QString& error)
+{
+    target.failed = true;
+    target.error = error;
+
+    // Name the device in front of the message, the error type stays in front of the separator
+    int separator = target.error.indexOf(';');
+    if (separator >= 0)
+    {
+        target.error.insert(separator + 1, QString("%1: ").arg(target.name));
+    }
+    target.io.reset();
+    target.expected.clear();
+}
+
+void ClonePipeline::finishTargets()
+{
+    // Complete the outstanding writes and read backs, the backends are released for the caller to close its handles
+    foreach (Target* target, m_targets)
+    {
+        QString error;
+        while (!target->failed && !target->io->isEmpty())
+        {
+            if (!completeOldest(*target, error))
+            {
+                dropTarget(*target, error);
+            }
+        }
+        target->io.reset();
+    }
+}
@@ -0,0 +1,65 @@
+#ifndef CLONEPIPELINE_H
+#define CLONEPIPELINE_H
+
+#include <QQueue>
+#include <QScopedPointer>
+#include <QVector>
+
+#include <functional>
+
+#include "iobackend.h"
+#include "partitiontable.h"
+#include "canceltoken.h"
+
+// Copies ranges of a source to one or more targets through their I/O
+// backends, without an image file. Reads of the source stay queued while the
+// targets write, so source and targets are busy at the same time. A target
+// that fails is dropped, the others are still written. Devices are opened by
+// the caller, so the same pipeline clones between files on Linux.
+class ClonePipeline
+{
+public:
+    typedef std::function<bool(const quint64 startSector, const quint64 numSectors, QString& msg)> Discarder;
+    typedef std::function<void(const quint64 bytes)> ProgressCallback;
+
+    ClonePipeline(IoBackend& source, const quint64 sectorSize, const quint64 chunkSectors, const bool verify, const bool discardHoles, const CancelToken& cancel);
+    ~ClonePipeline();
+
+    void    addTarget(const QString& name, IoBackend* io, const Discarder& discard = Discarder());
+    void    addFailedTarget(const QString& name, const QString& error);
+    bool    run(const QVector<DeviceRange>& ranges, const ProgressCallback& progress, QString& msg);
+    bool    isCancelled() const;
+    int     targetCount() const;
+    int     liveTargets() const;
+    QString firstError() const;
+
+private:
+    struct Target
+    {
+        QString                   name;
+        QScopedPointer<IoBackend> io;
+        Discarder                 discard;
+        QQueue<QByteArray>        expected;
+        bool                      discardSupported = {true};
+        bool                      failed = {false};
+        QString                   error;
+    };
+
+    void writeAll(const quint64 offset, const quint32 length, const QByteArray& data, const bool empty);
+    bool writeChunk(Target& target, const quint64 offset, const quint32 length, const QByteArray& data, const bool empty, QString& msg);
+    bool completeOldest(Target& target, QString& msg);
+    void dropTarget(Target& target, const QString& error);
+    void finishTargets();
+
+private:
+    IoBackend&         m_source;
+    quint64            m_sectorSize;
+    quint64            m_chunkSectors;
+    bool               m_verify;
+    bool               m_discardHoles;
+    const CancelToken& m_cancel;
+    bool               m_cancelled = {false};
+    QVector<Target*>   m_targets;
+};
+
+#endif // CLONEPIPELINE_H
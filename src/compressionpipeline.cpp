@@ -0,0 +1,304 @@
+#include <QRunnable>
+
+#include "compressionpipeline.h"
+
+class CompressionPipeline::CompressTask : public QRunnable
+{
+public:
+    CompressTask(CompressionPipeline* pipeline, const quint64 sequence, const quint64 deviceOffset, const QByteArray& data) :
+        m_pipeline(pipeline),
+        m_sequence(sequence),
+        m_deviceOffset(deviceOffset),
+        m_data(data)
+    {
+    }
+
+    void run() override
+    {
+        m_pipeline->compress(m_sequence, m_deviceOffset, m_data);
+        m_pipeline->taskDone();
+    }
+
+private:
+    CompressionPipeline* m_pipeline;
+    quint64              m_sequence;
+    quint64              m_deviceOffset;
+    QByteArray           m_data;
+};
+
+class CompressionPipeline::WriterThread : public QThread
+{
+public:
+    explicit WriterThread(CompressionPipeline* pipeline) :
+        m_pipeline(pipeline)
+    {
+    }
+
+protected:
+    void run() override
+    {
+        m_pipeline->writeLoop();
+    }
+
+private:
+    CompressionPipeline* m_pipeline;
+};
+
+CompressionPipeline::CompressionPipeline(ImageWriter& writer, BufferArena* arena, QThreadPool* pool) :
+    m_writer(writer),
+    m_arena(arena),
+    m_pool(pool ? pool : sharedPool())
+{
+    int threads = qMax(1, m_pool->maxThreadCount());
+
+    // Allow every worker to have one chunk queued behind the one it is compressing
+    m_maxInFlight = 2 * threads + 2;
+
+    m_writerThread = new WriterThread(this);
+    m_writerThread->start();
+}
+
+CompressionPipeline::~CompressionPipeline()
+{
+    abort();
+    delete m_writerThread;
+    if (m_repository)
+    {
+        m_repository->endImage();
+    }
+}
+
+QThreadPool* CompressionPipeline::sharedPool()
+{
+    static QThreadPool pool;
+    return &pool;
+}
+
+bool CompressionPipeline::submit(const quint64 deviceOffset, const QByteArray& data, QString& msg)
+{
+    quint64 sequence = 0;
+    if (!reserve(sequence, msg))
+    {
+        return false;
+    }
+
+    m_mutex.lock();
+    m_tasks++;
+    m_mutex.unlock();
+    m_pool->start(new CompressTask(this, sequence, deviceOffset, data));
+    return true;
+}
+
+bool CompressionPipeline::submitEntry(const ChunkEntry& entry, QString& msg)
+{
+    // Chunks without payload skip the workers but keep their place in the image
+    quint64 sequence = 0;
+    if (!reserve(sequence, msg))
+    {
+        return false;
+    }
+
+    Result result;
+    result.entry = entry;
+
+    QMutexLocker locker(&m_mutex);
+    m_results.insert(sequence, result);
+    m_resultReady.wakeAll();
+    return true;
+}
+
+bool CompressionPipeline::reserve(quint64& sequence, QString& msg)
+{
+    QMutexLocker locker(&m_mutex);
+    while (!m_failed && (m_inFlight >= m_maxInFlight))
+    {
+        m_slotFree.wait(&m_mutex);
+    }
+
+    if (m_failed)
+    {
+        msg = m_error;
+        return false;
+    }
+
+    sequence = m_nextSequence++;
+    m_inFlight++;
+    return true;
+}
+
+bool CompressionPipeline::finish(QString& msg)
+{
+    m_mutex.lock();
+    m_finishing = true;
+    m_resultReady.wakeAll();
+    m_mutex.unlock();
+
+    m_writerThread->wait();
+    waitForTasks();
+
+    QMutexLocker locker(&m_mutex);
+    if (m_failed)
+    {
+        msg = m_error;
+        return false;
+    }
+    return true;
+}
+
+void CompressionPipeline::setJournal(CheckpointJournal* journal)
+{
+    QMutexLocker locker(&m_mutex);
+    m_journal = journal;
+}
+
+void CompressionPipeline::setRepository(ChunkRepository* repository)
+{
+    QMutexLocker locker(&m_mutex);
+    if (m_repository)
+    {
+        m_repository->endImage();
+    }
+    m_repository = repository;
+    if (m_repository)
+    {
+        m_repository->beginImage();
+    }
+}
+
+void CompressionPipeline::abort()
+{
+    m_mutex.lock();
+    if (!m_finishing || (m_nextWrite != m_nextSequence))
+    {
+        fail(QString());
+    }
+    m_mutex.unlock();
+
+    m_writerThread->wait();
+    waitForTasks();
+}
+
+void CompressionPipeline::compress(const quint64 sequence, const quint64 deviceOffset, QByteArray& data)
+{
+    m_mutex.lock();
+    bool failed = m_failed;
+    ChunkRepository* repository = m_repository;
+    m_mutex.unlock();
+    if (failed)
+    {
+        return;
+    }
+
+    Result result;
+    QString msg;
+    if (m_arena)
+    {
+        result.payload = m_arena->acquire(data.size());
+    }
+    bool ok = repository ? repository->encodeChunk(m_writer.header(), deviceOffset, data, result.entry, result.payload, msg) :
+                           ImageFormat::encodeChunk(m_writer.header(), deviceOffset, data, result.entry, result.payload, msg, m_writer.baseChunk(deviceOffset));
+    if (m_arena)
+    {
+        m_arena->release(data);
+    }
+
+    QMutexLocker locker(&m_mutex);
+    if (!ok)
+    {
+        fail(msg);
+        return;
+    }
+    m_results.insert(sequence, result);
+    m_resultReady.wakeAll();
+}
+
+void CompressionPipeline::taskDone()
+{
+    QMutexLocker locker(&m_mutex);
+    m_tasks--;
+    m_tasksDone.wakeAll();
+}
+
+void CompressionPipeline::waitForTasks()
+{
+    // The pool may be shared, only the tasks of this pipeline are waited for
+    QMutexLocker locker(&m_mutex);
+    while (m_tasks > 0)
+    {
+        m_tasksDone.wait(&m_mutex);
+    }
+}
+
+void CompressionPipeline::writeLoop()
+{
+    QMutexLocker locker(&m_mutex);
+    forever
+    {
+        while (!m_failed && !m_results.contains(m_nextWrite) && !(m_finishing && (m_nextWrite == m_nextSequence)))
+        {
+            m_resultReady.wait(&m_mutex);
+        }
+
+        // Stop on failure or when everything submitted has been written
+        if (m_failed || !m_results.contains(m_nextWrite))
+        {
+            break;
+        }
+
+        Result result = m_results.take(m_nextWrite);
+        locker.unlock();
+
+        QString msg;
+        bool ok = m_writer.appendChunk(result.entry, result.payload, msg);
+        if (m_arena)
+        {
+            m_arena->release(result.payload);
+        }
+        if (ok)
+        {
+            checkpoint();
+        }
+
+        locker.relock();
+        if (!ok)
+        {
+            fail(msg);
+            break;
+        }
+        m_nextWrite++;
+        m_inFlight--;
+        m_slotFree.wakeAll();
+    }
+}
+
+void CompressionPipeline::checkpoint()
+{
+    // Called on the writer thread without the mutex, the writer is not touched elsewhere meanwhile
+    m_mutex.lock();
+    CheckpointJournal* journal = m_journal;
+    m_mutex.unlock();
+    if (!journal || !journal->isDue())
+    {
+        return;
+    }
+
+    // A checkpoint that cannot be saved only costs the progress since the previous one
+    QString msg;
+    const QVector<ChunkEntry>& chunks = m_writer.chunks();
+    if (m_writer.sync(msg))
+    {
+        journal->save(chunks.size(), ImageFormat::imageDigest(chunks), chunks, m_writer.fileLength(), msg);
+    }
+}
+
+void CompressionPipeline::fail(const QString& msg)
+{
+    // Called with the mutex held, only the first error is kept
+    if (!m_failed)
+    {
+        m_failed = true;
+        m_error = msg;
+    }
+    m_resultReady.wakeAll();
+    m_slotFree.wakeAll();
+}
@@ -0,0 +1,81 @@
+#ifndef COMPRESSIONPIPELINE_H
+#define COMPRESSIONPIPELINE_H
+
+#include <QMap>
+#include <QMutex>
+#include <QThread>
+#include <QThreadPool>
+#include <QWaitCondition>
+
+#include "imageformat.h"
+#include "bufferarena.h"
+#include "checkpointjournal.h"
+#include "chunkrepository.h"
+
+// Compresses chunks on a pool of worker threads while a writer thread appends
+// the results to the image in submission order. The image is byte identical
+// for any number of workers. Submitting blocks once too many chunks are in
+// flight so memory use stays bounded. Unless a pool is given, all pipelines
+// share one pool sized to the cores, so concurrent jobs split the CPU evenly.
+// With a journal, the writer thread saves a checkpoint of the chunks written
+// so far whenever one is due. With a repository, workers store the chunks
+// there and the image only receives their keys, the chunks stay claimed
+// against garbage collection until the pipeline is destroyed.
+class CompressionPipeline
+{
+public:
+    CompressionPipeline(ImageWriter& writer, BufferArena* arena = nullptr, QThreadPool* pool = nullptr);
+    ~CompressionPipeline();
+
+    static QThreadPool* sharedPool();
+
+    void setJournal(CheckpointJournal* journal);
+    void setRepository(ChunkRepository* repository);
+
+    bool submit(const quint64 deviceOffset, const QByteArray& data, QString& msg);
+    bool submitEntry(const ChunkEntry& entry, QString& msg);
+    bool finish(QString& msg);
+    void abort();
+
+private:
+    struct Result
+    {
+        ChunkEntry entry;
+        QByteArray payload;
+    };
+
+    class CompressTask;
+    class WriterThread;
+
+    bool reserve(quint64& sequence, QString& msg);
+    void compress(const quint64 sequence, const quint64 deviceOffset, QByteArray& data);
+    void taskDone();
+    void waitForTasks();
+    void writeLoop();
+    void checkpoint();
+    void fail(const QString& msg);
+
+private:
+    ImageWriter&          m_writer;
+    BufferArena*          m_arena;
+    CheckpointJournal*    m_journal = {nullptr};
+    ChunkRepository*      m_repository = {nullptr};
+    QThreadPool*          m_pool;
+    WriterThread*         m_writerThread = {nullptr};
+    int                   m_maxInFlight = {0};
+
+    QMutex                m_mutex;
+    QWaitCondition        m_resultReady;
+    QWaitCondition        m_slotFree;
+    QWaitCondition        m_tasksDone;
+    QMap<quint64, Result> m_results;
+    quint64               m_nextSequence = {0};
+    quint64               m_nextWrite = {0};
+    int                   m_inFlight = {0};
+    int                   m_tasks = {0};
+    bool                  m_finishing = {false};
+    bool                  m_failed = {false};
+    QString               m_error;
+};
+
+#endif // COMPRESSIONPIPELINE_H
@@ -0,0 +1,510 @@
+#include <QDataStream>
+#include <QDir>
+#include <QFileInfo>
+
+#include <cstring>
+
+#include "createimagejob.h"
+#include "compressionpipeline.h"
+#include "checkpointjournal.h"
+#include "chunkrepository.h"
+#include "checksum.h"
+#include "bufferscan.h"
+
+const int CHUNK_SIZE = 4096;
+
+// Identifies the imaged extents, a checkpoint only applies to the same layout
+static quint64 layoutDigest(const QVector<DeviceRange>& ranges)
+{
+    QByteArray data;
+    QDataStream out(&data, QIODevice::WriteOnly);
+    foreach (const DeviceRange& range, ranges)
+    {
+        out << range.startSector << range.numSectors << range.unallocated;
+    }
+    return Checksum::xxh64(data.constData(), static_cast<quint64>(data.size()));
+}
+
+CreateImageJob::CreateImageJob(const int deviceId, const QString& imageFilePath, const quint16 codec, const int codecLevel, const bool verify, const bool skipFreeSpace, QObject *parent) :
+    ImagingJob(deviceId, imageFilePath, parent),
+    m_codec(codec),
+    m_codecLevel(codecLevel),
+    m_verify(verify),
+    m_skipFreeSpace(skipFreeSpace)
+{
+}
+
+void CreateImageJob::setBaseImage(const QString& baseImagePath)
+{
+    m_baseImagePath = baseImagePath;
+}
+
+void CreateImageJob::setChunkRepository(const QString& repositoryPath)
+{
+    m_repositoryPath = repositoryPath;
+}
+
+ImagingJob::Result CreateImageJob::execute()
+{
+    const RawImage::Format rawFormat = RawImage::formatOf(m_imageFilePath);
+    if (rawFormat != RawImage::FormatNone)
+    {
+        return createRaw(rawFormat);
+    }
+
+    QString error;
+    setStatus(SysDef::STATUS_READING, 0);
+
+    // Get the handle of the source raw disk
+    quint64 sectorSize = 0;
+    quint64 numSectors = 0;
+    if (!openDevice(GENERIC_READ, m_queueDepth > 1, sectorSize, numSectors, error))
+    {
+        return fail(error, "Create disk image failed");
+    }
+    QScopedPointer<IoBackend> io(createIoBackend(sectorSize, CHUNK_SIZE * sectorSize));
+    const quint64 deviceSize = numSectors * sectorSize;
+
+    // Only partitions and table structures are imaged, free space of known file systems is left out
+    QVector<DeviceRange> ranges;
+    quint64 readBytes = 0;
+    if (!readLayout(*io, sectorSize, numSectors, m_skipFreeSpace, ranges, numSectors, error))
+    {
+        return fail(error, "Create disk image failed");
+    }
+    foreach (const DeviceRange& range, ranges)
+    {
+        readBytes += range.unallocated ? 0 : range.numSectors * sectorSize;
+    }
+
+    ImageHeader header;
+    header.codec = m_codec;
+    header.codecLevel = m_codecLevel;
+    header.sectorSize = static_cast<quint32>(sectorSize);
+    header.chunkSize = static_cast<quint32>(CHUNK_SIZE * sectorSize);
+    header.totalSize = numSectors * sectorSize;
+
+    // A delta only stores the chunks that differ from the base image at the same offset
+    ImageReader baseReader;
+    if (!m_baseImagePath.isEmpty())
+    {
+        QFileInfo baseInfo(m_baseImagePath);
+        if (baseInfo.absoluteFilePath() == QFileInfo(m_imageFilePath).absoluteFilePath())
+        {
+            error = QString("File Error;The base image cannot be replaced by the image created from it.");
+            return fail(error, "Create disk image failed");
+        }
+        if (!baseReader.open(m_baseImagePath, error))
+        {
+            return fail(error, "Create disk image failed");
+        }
+
+        const ImageHeader& base = baseReader.header();
+        if ((base.version < ImageFormat::VERSION_2) || (base.imageDigest == 0) || baseReader.isManifest())
+        {
+            error = QString("File Error;The base image must be a complete image of version 2 or later.");
+        }
+        else if ((base.sectorSize != header.sectorSize) || (base.chunkSize != header.chunkSize))
+        {
+            error = QString("File Error;The base image was created from a device with a different sector size.");
+        }
+        if (!error.isEmpty())
+        {
+            return fail(error, "Create disk image failed");
+        }
+
+        header.flags |= ImageFormat::IMAGE_DELTA;
+        header.baseDigest = base.imageDigest;
+        header.baseName = QFileInfo(m_imageFilePath).absoluteDir().relativeFilePath(baseInfo.absoluteFilePath());
+    }
+
+    // Chunks already in the repository are only hashed, an image made of keys cannot be a delta too
+    ChunkRepository* repository = nullptr;
+    if (!m_repositoryPath.isEmpty())
+    {
+        if (header.flags & ImageFormat::IMAGE_DELTA)
+        {
+            error = QString("File Error;A delta image cannot be written to the chunk repository.");
+            return fail(error, "Create disk image failed");
+        }
+        repository = ChunkRepository::open(m_repositoryPath, error);
+        if (!repository)
+        {
+            return fail(error, "Create disk image failed");
+        }
+        header.flags |= ImageFormat::IMAGE_REPOSITORY;
+        header.repositoryName = QFileInfo(m_imageFilePath).absoluteDir().relativeFilePath(repository->path());
+    }
+
+    // An interrupted create of the same device and layout continues after its last checkpoint.
+    // Not in repository mode, the chunks of an unregistered image may be collected meanwhile.
+    Checkpoint identity;
+    identity.kind = CheckpointJournal::KIND_CREATE;
+    identity.header = header;
+    identity.deviceSize = deviceSize;
+    identity.layoutDigest = layoutDigest(ranges);
+    CheckpointJournal journal(CheckpointJournal::createPath(m_imageFilePath), identity);
+
+    Checkpoint checkpoint;
+    bool resumed = false;
+    if (!repository && journal.load(checkpoint) && !checkpoint.chunks.isEmpty() && (checkpoint.committedChunks == checkpoint.chunks.size()) &&
+        (checkpoint.runningDigest == ImageFormat::imageDigest(checkpoint.chunks)))
+    {
+        if (!boundaryMatches(*io, checkpoint.chunks, checkpoint.committedChunks, false, resumed, error))
+        {
+            return fail(error, "Create disk image failed");
+        }
+    }
+
+    ImageWriter imageWriter;
+    if (resumed && !imageWriter.resume(m_imageFilePath, header, checkpoint.chunks, checkpoint.fileLength, error))
+    {
+        // The unfinished image is gone or shorter than recorded, start over
+        imageWriter.close();
+        resumed = false;
+        error.clear();
+    }
+    if (!resumed)
+    {
+        // A stale checkpoint must never be applied to the image started now
+        journal.remove();
+    }
+    if (!resumed && !imageWriter.open(m_imageFilePath, header, error))
+    {
+        return fail(error, "Create disk image failed");
+    }
+
+    // Only the index of the base is needed, chunks matching it are hashed but never compressed
+    imageWriter.setBase(baseReader.chunks());
+    baseReader.close();
+
+    // Chunks are compressed on all cores and written in order
+    CompressionPipeline pipeline(imageWriter, &m_arena);
+    pipeline.setJournal(repository ? nullptr : &journal);
+    pipeline.setRepository(repository);
+    setStatus(SysDef::STATUS_READING, readBytes);
+    bool cancelled = false;
+
+    // Unused sectors between the extents are not part of the image
+    int range = 0;
+    quint64 nextSector = ranges.isEmpty() ? 0 : ranges.first().startSector;
+    quint64 resumedBytes = 0;
+    if (resumed)
+    {
+        // Chunks never cross an extent, reading continues right after the last committed one
+        const ChunkEntry& last = checkpoint.chunks.last();
+        quint64 resumeSector = (last.deviceOffset + last.uncompressedLength) / sectorSize;
+        while ((range < ranges.size()) && (ranges.at(range).startSector + ranges.at(range).numSectors <= resumeSector))
+        {
+            range++;
+        }
+        if (range < ranges.size())
+        {
+            nextSector = qMax(ranges.at(range).startSector, resumeSector);
+        }
+
+        foreach (const ChunkEntry& entry, checkpoint.chunks)
+        {
+            resumedBytes += ImageFormat::isUnallocated(entry) ? 0 : entry.uncompressedLength;
+        }
+        addProgress(resumedBytes);
+    }
+    forever
+    {
+        if (m_cancel.isCancelled())
+        {
+            cancelled = true;
+            break;
+        }
+
+        // Keep the read queue of the device full
+        while (!io->isFull() && (range < ranges.size()))
+        {
+            const DeviceRange& current = ranges.at(range);
+            quint64 rangeEnd = current.startSector + current.numSectors;
+            quint64 chunkSectors = (rangeEnd - nextSector >= CHUNK_SIZE) ? CHUNK_SIZE : (rangeEnd - nextSector);
+            if (current.unallocated)
+            {
+                // Holes follow the reads queued before them
+                if (!io->isEmpty())
+                {
+                    break;
+                }
+                ChunkEntry entry = ImageFormat::unallocatedChunk(nextSector * sectorSize, static_cast<quint32>(chunkSectors * sectorSize));
+                if (!pipeline.submitEntry(entry, error))
+                {
+                    return fail(error, "Create disk image failed");
+                }
+            }
+            else if (!io->submitRead(nextSector * sectorSize, m_arena.acquire(static_cast<int>(chunkSectors * sectorSize)), nextSector, error))
+            {
+                return fail(error, "Create disk image failed");
+            }
+            nextSector += chunkSectors;
+
+            if ((nextSector >= rangeEnd) && (++range < ranges.size()))
+            {
+                nextSector = ranges.at(range).startSector;
+            }
+        }
+
+        if (io->isEmpty())
+        {
+            if (range < ranges.size())
+            {
+                continue;
+            }
+            break;
+        }
+
+        // Read sectors from disk
+        IoCompletion completion;
+        if (!io->waitOldest(completion, error))
+        {
+            return fail(error, "Create disk image failed");
+        }
+
+        // Zero the part of a short read at the end of the device
+        if (completion.transferred < completion.length)
+        {
+            memset(BufferArena::writable(completion.data) + completion.transferred, 0, completion.length - completion.transferred);
+        }
+
+        // Hand sectors over to be compressed and written to file
+        if (!pipeline.submit(completion.offset, completion.data, error))
+        {
+            return fail(error, "Create disk image failed");
+        }
+        addProgress(completion.length);
+    }
+
+    if (cancelled)
+    {
+        pipeline.abort();
+
+        if (repository)
+        {
+            // Chunks stored so far stay in the repository until garbage collection removes them
+            imageWriter.close();
+            QFile::remove(m_imageFilePath);
+            m_message = QString("Create disk image cancelled.");
+            return ResultCancelled;
+        }
+
+        // The unfinished image is kept, creating it again continues after the last written chunk
+        const QVector<ChunkEntry>& chunks = imageWriter.chunks();
+        if (imageWriter.sync(error))
+        {
+            journal.save(chunks.size(), ImageFormat::imageDigest(chunks), chunks, imageWriter.fileLength(), error);
+        }
+        imageWriter.close();
+
+        m_message = QString("Create disk image cancelled. Creating the same image again continues where it stopped.");
+        return ResultCancelled;
+    }
+
+    if (!pipeline.finish(error) || !imageWriter.finish(error))
+    {
+        return fail(error, "Create disk image failed");
+    }
+
+    // Chunk digests next to the image, enough to verify a device without the image file
+    if (!imageWriter.writeManifest(ImageFormat::manifestPath(m_imageFilePath), error))
+    {
+        return fail(error, "Create disk image failed");
+    }
+    journal.remove();
+    io.reset();
+
+    // Registered before garbage collection runs, so the chunks of this image are never collected
+    int sharedChunks = 0;
+    quint64 freedBytes = 0;
+    if (repository && (!repository->addImage(m_imageFilePath, sharedChunks, error) || !repository->collectGarbage(freedBytes, error)))
+    {
+        return fail(error, "Create disk image failed");
+    }
+
+    // Verify file when needed
+    if (m_verify)
+    {
+        Result result = verifyImage(sectorSize, false);
+        if (result != ResultSucceeded)
+        {
+            return result;
+        }
+    }
+
+    m_message = QString("Create disk image succeeded.");
+    if (header.flags & ImageFormat::IMAGE_DELTA)
+    {
+        quint64 baseBytes = 0;
+        foreach (const ChunkEntry& entry, imageWriter.chunks())
+        {
+            baseBytes += ImageFormat::isBaseReference(entry) ? entry.uncompressedLength : 0;
+        }
+        m_message += QString(" %1 MB refer to the base image.").arg(static_cast<double>(baseBytes) / (1024.0 * 1024.0), 0, 'f', 1);
+    }
+    if (repository)
+    {
+        int storedChunks = 0;
+        foreach (const ChunkEntry& entry, imageWriter.chunks())
+        {
+            storedChunks += ImageFormat::isRepositoryReference(entry) ? 1 : 0;
+        }
+        m_message += QString(" %1 of %2 chunks were already in the chunk repository, %3 MB of unused chunks were removed.")
+                         .arg(sharedChunks).arg(storedChunks).arg(static_cast<double>(freedBytes) / (1024.0 * 1024.0), 0, 'f', 1);
+    }
+    if (resumed)
+    {
+        m_message += QString(" Continued after %1 MB.").arg(static_cast<double>(resumedBytes) / (1024.0 * 1024.0), 0, 'f', 1);
+    }
+    return ResultSucceeded;
+}
+
+ImagingJob::Result CreateImageJob::createRaw(const RawImage::Format format)
+{
+    QString error;
+    setStatus(SysDef::STATUS_READING, 0);
+
+    // A raw image has no index that could refer to a base image or a repository
+    if (!m_baseImagePath.isEmpty() || !m_repositoryPath.isEmpty())
+    {
+        error = QString("File Error;A raw image cannot be a delta or be written to the chunk repository.");
+        return fail(error, "Create disk image failed");
+    }
+    if (!RawImage::isAvailable(format))
+    {
+        error = QString("File Error;%1 images are not supported by this build.").arg(RawImage::name(format));
+        return fail(error, "Create disk image failed");
+    }
+
+    // Get the handle of the source raw disk
+    quint64 sectorSize = 0;
+    quint64 numSectors = 0;
+    if (!openDevice(GENERIC_READ, m_queueDepth > 1, sectorSize, numSectors, error))
+    {
+        return fail(error, "Create disk image failed");
+    }
+    QScopedPointer<IoBackend> io(createIoBackend(sectorSize, CHUNK_SIZE * sectorSize));
+
+    // The image holds the device content up to the end of the last partition. Free space
+    // and the sectors between the extents are only written as zeros without verification,
+    // their content on the device is undefined and would not compare.
+    const bool skipFreeSpace = m_skipFreeSpace && !m_verify;
+    QVector<DeviceRange> ranges;
+    quint64 endSector = 0;
+    if (!readLayout(*io, sectorSize, numSectors, skipFreeSpace, ranges, endSector, error))
+    {
+        return fail(error, "Create disk image failed");
+    }
+    if (!skipFreeSpace)
+    {
+        DeviceRange range = { 0, endSector, false };
+        ranges.clear();
+        ranges.append(range);
+    }
+    quint64 readBytes = 0;
+    foreach (const DeviceRange& range, ranges)
+    {
+        readBytes += range.unallocated ? 0 : range.numSectors * sectorSize;
+    }
+
+    RawImageWriter imageWriter;
+    if (!imageWriter.open(m_imageFilePath, format, RawImage::defaultLevel(format), error))
+    {
+        return fail(error, "Create disk image failed");
+    }
+
+    // Reads complete in order, everything is written as one stream
+    setStatus(SysDef::STATUS_READING, readBytes);
+    bool cancelled = false;
+    quint64 writtenBytes = 0;
+    int range = 0;
+    quint64 nextSector = ranges.isEmpty() ? 0 : ranges.first().startSector;
+    forever
+    {
+        if (m_cancel.isCancelled())
+        {
+            cancelled = true;
+            break;
+        }
+
+        // Keep the read queue of the device full, unallocated extents are not read
+        while (!io->isFull() && (range < ranges.size()))
+        {
+            const DeviceRange& current = ranges.at(range);
+            quint64 rangeEnd = current.startSector + current.numSectors;
+            quint64 chunkSectors = (rangeEnd - nextSector >= CHUNK_SIZE) ? CHUNK_SIZE : (rangeEnd - nextSector);
+            if (current.unallocated)
+            {
+                chunkSectors = rangeEnd - nextSector;
+            }
+            else if (!io->submitRead(nextSector * sectorSize, m_arena.acquire(static_cast<int>(chunkSectors * sectorSize)), nextSector, error))
+            {
+                return fail(error, "Create disk image failed");
+            }
+            nextSector += chunkSectors;
+
+            if ((nextSector >= rangeEnd) && (++range < ranges.size()))
+            {
+                nextSector = ranges.at(range).startSector;
+            }
+        }
+
+        if (io->isEmpty())
+        {
+            break;
+        }
+
+        IoCompletion completion;
+        if (!io->waitOldest(completion, error))
+        {
+            return fail(error, "Create disk image failed");
+        }
+
+        // Zero the part of a short read at the end of the device
+        if (completion.transferred < completion.length)
+        {
+            memset(BufferArena::writable(completion.data) + completion.transferred, 0, completion.length - completion.transferred);
+        }
+
+        // Sectors left out before this read and chunks of zeros stay holes of a sparse file
+        bool written = imageWriter.writeZeros(completion.offset - writtenBytes, error) &&
+                       (BufferScan::isZero(completion.data.constData(), completion.length) ? imageWriter.writeZeros(completion.length, error) :
+                                                                                            imageWriter.write(completion.data.constData(), completion.length, error));
+        m_arena.release(completion.data);
+        if (!written)
+        {
+            return fail(error, "Create disk image failed");
+        }
+        writtenBytes = completion.offset + completion.length;
+        addProgress(completion.length);
+    }
+    io.reset();
+
+    if (cancelled)
+    {
+        imageWriter.close();
+        QFile::remove(m_imageFilePath);
+        m_message = QString("Create disk image cancelled.");
+        return ResultCancelled;
+    }
+
+    if (!imageWriter.writeZeros(endSector * sectorSize - writtenBytes, error) || !imageWriter.finish(error))
+    {
+        return fail(error, "Create disk image failed");
+    }
+
+    // Verify file when needed
+    if (m_verify)
+    {
+        Result result = verifyImage(sectorSize, false);
+        if (result != ResultSucceeded)
+        {
+            return result;
+        }
+    }
+
+    m_message = QString("Create disk image succeeded.");
+    return ResultSucceeded;
+}
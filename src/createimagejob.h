@@ -0,0 +1,36 @@
+#ifndef CREATEIMAGEJOB_H
+#define CREATEIMAGEJOB_H
+
+#include "imagingjob.h"
+#include "rawimage.h"
+
+class CreateImageJob : public ImagingJob
+{
+    Q_OBJECT
+
+public:
+    explicit CreateImageJob(const int deviceId, const QString& imageFilePath, const quint16 codec, const int codecLevel, const bool verify, const bool skipFreeSpace, QObject *parent = nullptr);
+
+    // Creates a delta that refers to the given image for every chunk it holds unchanged
+    void setBaseImage(const QString& baseImagePath);
+
+    // Stores the chunks in the given repository, the image only holds their keys
+    void setChunkRepository(const QString& repositoryPath);
+
+protected:
+    Result execute() override;
+
+private:
+    // Copies the device content front to back into a raw .img, .gz, .xz or .zst image
+    Result createRaw(const RawImage::Format format);
+
+private:
+    QString m_baseImagePath;
+    QString m_repositoryPath;
+    quint16 m_codec;
+    int     m_codecLevel;
+    bool    m_verify;
+    bool    m_skipFreeSpace;
+};
+
+#endif // CREATEIMAGEJOB_H
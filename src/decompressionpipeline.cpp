@@ -0,0 +1,228 @@
+#include <QRunnable>
+
+#include "decompressionpipeline.h"
+
+class DecompressionPipeline::DecodeTask : public QRunnable
+{
+public:
+    DecodeTask(DecompressionPipeline* pipeline, const int index, const QByteArray& payload) :
+        m_pipeline(pipeline),
+        m_index(index),
+        m_payload(payload)
+    {
+    }
+
+    void run() override
+    {
+        m_pipeline->decode(m_index, m_payload);
+    }
+
+private:
+    DecompressionPipeline* m_pipeline;
+    int                    m_index;
+    QByteArray             m_payload;
+};
+
+class DecompressionPipeline::ReaderThread : public QThread
+{
+public:
+    explicit ReaderThread(DecompressionPipeline* pipeline) :
+        m_pipeline(pipeline)
+    {
+    }
+
+protected:
+    void run() override
+    {
+        m_pipeline->readLoop();
+    }
+
+private:
+    DecompressionPipeline* m_pipeline;
+};
+
+DecompressionPipeline::DecompressionPipeline(ImageReader& reader, BufferArena* arena, ChunkCache* cache, const int firstChunk, const int workers) :
+    m_reader(reader),
+    m_arena(arena),
+    m_cache(cache),
+    m_firstChunk(firstChunk)
+{
+    int threads = qMax(1, workers);
+    m_pool.setMaxThreadCount(threads);
+
+    // Read ahead far enough to keep every worker and the consumer busy
+    m_maxInFlight = 2 * threads + 2;
+    m_chunkCount = reader.chunks().size();
+    m_nextTake = m_firstChunk;
+
+    m_readerThread = new ReaderThread(this);
+    m_readerThread->start();
+}
+
+DecompressionPipeline::~DecompressionPipeline()
+{
+    abort();
+    delete m_readerThread;
+}
+
+bool DecompressionPipeline::next(int& index, QByteArray& data, QString& msg)
+{
+    QMutexLocker locker(&m_mutex);
+    while (!m_failed && (m_nextTake < m_chunkCount) && !m_results.contains(m_nextTake))
+    {
+        m_resultReady.wait(&m_mutex);
+    }
+
+    if (m_failed)
+    {
+        msg = m_error;
+        return false;
+    }
+
+    // All chunks consumed
+    if (m_nextTake >= m_chunkCount)
+    {
+        return false;
+    }
+
+    index = m_nextTake++;
+    data = m_results.take(index);
+    m_inFlight--;
+    m_slotFree.wakeAll();
+    return true;
+}
+
+void DecompressionPipeline::abort()
+{
+    m_mutex.lock();
+    if (m_nextTake < m_chunkCount)
+    {
+        fail(QString());
+    }
+    m_mutex.unlock();
+
+    m_readerThread->wait();
+    m_pool.waitForDone();
+}
+
+quint64 DecompressionPipeline::cacheHits() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_cacheHits;
+}
+
+quint64 DecompressionPipeline::cacheMisses() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_cacheMisses;
+}
+
+quint64 DecompressionPipeline::cacheBytesServed() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_cacheBytesServed;
+}
+
+void DecompressionPipeline::decode(const int index, QByteArray& payload)
+{
+    m_mutex.lock();
+    bool failed = m_failed;
+    m_mutex.unlock();
+    if (failed)
+    {
+        return;
+    }
+
+    QByteArray data;
+    QString msg;
+    if (m_arena)
+    {
+        data = m_arena->acquire(static_cast<int>(m_reader.chunks().at(index).uncompressedLength));
+    }
+    bool ok = m_reader.decodeChunk(index, payload, data, msg);
+    if (m_arena)
+    {
+        m_arena->release(payload);
+    }
+
+    const bool cacheable = m_cache && ChunkCache::isCacheable(m_reader.header(), m_reader.chunks().at(index));
+    if (ok && cacheable)
+    {
+        m_cache->insert(m_reader.header().imageDigest, index, data);
+    }
+
+    QMutexLocker locker(&m_mutex);
+    if (!ok)
+    {
+        fail(msg);
+        return;
+    }
+    if (cacheable)
+    {
+        m_cacheMisses++;
+    }
+    m_results.insert(index, data);
+    m_resultReady.wakeAll();
+}
+
+void DecompressionPipeline::readLoop()
+{
+    for (int index = m_firstChunk; index < m_chunkCount; index++)
+    {
+        QMutexLocker locker(&m_mutex);
+        while (!m_failed && (m_inFlight >= m_maxInFlight))
+        {
+            m_slotFree.wait(&m_mutex);
+        }
+
+        if (m_failed)
+        {
+            return;
+        }
+        m_inFlight++;
+        locker.unlock();
+
+        // A cached chunk skips the image file and the decoder
+        const ChunkEntry& entry = m_reader.chunks().at(index);
+        QByteArray data;
+        if (m_cache && ChunkCache::isCacheable(m_reader.header(), entry) &&
+            m_cache->lookup(m_reader.header().imageDigest, index, entry, data))
+        {
+            locker.relock();
+            m_cacheHits++;
+            m_cacheBytesServed += static_cast<quint64>(data.size());
+            m_results.insert(index, data);
+            m_resultReady.wakeAll();
+            continue;
+        }
+
+        // The image file is only accessed from this thread
+        QByteArray payload;
+        const quint32 compressedLength = entry.compressedLength;
+        if (m_arena && (compressedLength > 0))
+        {
+            payload = m_arena->acquire(static_cast<int>(compressedLength));
+        }
+        QString msg;
+        if (!m_reader.readCompressedChunk(index, payload, msg))
+        {
+            locker.relock();
+            fail(msg);
+            return;
+        }
+
+        m_pool.start(new DecodeTask(this, index, payload));
+    }
+}
+
+void DecompressionPipeline::fail(const QString& msg)
+{
+    // Called with the mutex held, only the first error is kept
+    if (!m_failed)
+    {
+        m_failed = true;
+        m_error = msg;
+    }
+    m_resultReady.wakeAll();
+    m_slotFree.wakeAll();
+}
@@ -0,0 +1,63 @@
+#ifndef DECOMPRESSIONPIPELINE_H
+#define DECOMPRESSIONPIPELINE_H
+
+#include <QMap>
+#include <QMutex>
+#include <QThread>
+#include <QThreadPool>
+#include <QWaitCondition>
+
+#include "imageformat.h"
+#include "bufferarena.h"
+#include "chunkcache.h"
+
+// Reads compressed chunks ahead on a reader thread and decodes them on a pool
+// of worker threads. The consumer takes the decoded chunks in image order, so
+// the device can be written continuously while the next chunks are prepared.
+// With a chunk cache, cached chunks are taken from it instead of the image
+// and every decoded chunk is added to it. Chunks before firstChunk are skipped.
+class DecompressionPipeline
+{
+public:
+    DecompressionPipeline(ImageReader& reader, BufferArena* arena = nullptr, ChunkCache* cache = nullptr, const int firstChunk = 0, const int workers = QThread::idealThreadCount());
+    ~DecompressionPipeline();
+
+    bool next(int& index, QByteArray& data, QString& msg);
+    void abort();
+
+    quint64 cacheHits() const;
+    quint64 cacheMisses() const;
+    quint64 cacheBytesServed() const;
+
+private:
+    class DecodeTask;
+    class ReaderThread;
+
+    void decode(const int index, QByteArray& payload);
+    void readLoop();
+    void fail(const QString& msg);
+
+private:
+    ImageReader&           m_reader;
+    BufferArena*           m_arena;
+    ChunkCache*            m_cache;
+    QThreadPool            m_pool;
+    ReaderThread*          m_readerThread = {nullptr};
+    int                    m_maxInFlight = {0};
+    int                    m_firstChunk = {0};
+    int                    m_chunkCount = {0};
+
+    mutable QMutex         m_mutex;
+    QWaitCondition         m_resultReady;
+    QWaitCondition         m_slotFree;
+    QMap<int, QByteArray>  m_results;
+    int                    m_nextTake = {0};
+    int                    m_inFlight = {0};
+    quint64                m_cacheHits = {0};
+    quint64                m_cacheMisses = {0};
+    quint64                m_cacheBytesServed = {0};
+    bool                   m_failed = {false};
+    QString                m_error;
+};
+
+#endif // DECOMPRESSIONPIPELINE_H
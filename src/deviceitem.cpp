@@ -1,12 +1,16 @@
 #include "deviceitem.h"
 
-DeviceItem::DeviceItem(QObject *parent) : QObject(parent)
+DeviceItem::DeviceItem(QObject *parent) : QObject(parent),
+    m_selected(false),
+    m_progress(0)
 {
 }
 
 DeviceItem::DeviceItem(const QString& label, const QString& deviceId, QObject *parent) : QObject(parent),
     m_label(label),
-    m_deviceId(deviceId)
+    m_deviceId(deviceId),
+    m_selected(false),
+    m_progress(0)
 {
 }
 
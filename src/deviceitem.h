@@ -10,6 +10,9 @@ class DeviceItem : public QObject
     Q_OBJECT
     QML_READONLY_PROPERTY(QString, label)
     QML_READONLY_PROPERTY(QString, deviceId)
+    QML_WRITABLE_PROPERTY(bool, selected)
+    QML_READONLY_PROPERTY(double, progress)
+    QML_READONLY_PROPERTY(QString, statusText)
 
 public:
     explicit DeviceItem(QObject *parent = nullptr);
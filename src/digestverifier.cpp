@@ -0,0 +1,130 @@
+#include <QRunnable>
+
+#include "digestverifier.h"
+#include "checksum.h"
+#include "bufferscan.h"
+
+class DigestVerifier::HashTask : public QRunnable
+{
+public:
+    HashTask(DigestVerifier* verifier, const ChunkEntry& entry, const QByteArray& data) :
+        m_verifier(verifier),
+        m_entry(entry),
+        m_data(data)
+    {
+    }
+
+    void run() override
+    {
+        m_verifier->check(m_entry, m_data);
+    }
+
+private:
+    DigestVerifier* m_verifier;
+    ChunkEntry      m_entry;
+    QByteArray      m_data;
+};
+
+DigestVerifier::DigestVerifier(const quint64 sectorSize, BufferArena* arena, const int workers) :
+    m_sectorSize(sectorSize),
+    m_arena(arena)
+{
+    int threads = qMax(1, workers);
+    m_pool.setMaxThreadCount(threads);
+
+    // Allow every worker to have one chunk queued behind the one it is hashing
+    m_maxInFlight = 2 * threads;
+}
+
+DigestVerifier::~DigestVerifier()
+{
+    m_mutex.lock();
+    m_failed = true;
+    m_mutex.unlock();
+    m_pool.waitForDone();
+}
+
+bool DigestVerifier::submit(const ChunkEntry& entry, const QByteArray& data, QString& msg)
+{
+    QMutexLocker locker(&m_mutex);
+    while (!m_failed && (m_inFlight >= m_maxInFlight))
+    {
+        m_slotFree.wait(&m_mutex);
+    }
+
+    if (m_failed)
+    {
+        msg = m_error;
+        return false;
+    }
+    m_inFlight++;
+    locker.unlock();
+
+    m_pool.start(new HashTask(this, entry, data));
+    return true;
+}
+
+bool DigestVerifier::finish(QString& msg)
+{
+    m_pool.waitForDone();
+
+    QMutexLocker locker(&m_mutex);
+    if (m_failed)
+    {
+        msg = m_error;
+        return false;
+    }
+    return true;
+}
+
+bool DigestVerifier::matches(const ChunkEntry& entry, const QByteArray& data)
+{
+    // A hole matches when the data holds its fill byte only, no hash needed
+    if (ImageFormat::isHole(entry))
+    {
+        quint8 fill = 0;
+        return BufferScan::isFilled(data.constData(), static_cast<quint64>(data.size()), fill) && (fill == ImageFormat::fillByte(entry));
+    }
+    return Checksum::xxh64(data.constData(), static_cast<quint64>(data.size())) == entry.checksum;
+}
+
+QString DigestVerifier::mismatchError(const ChunkEntry& entry, const QByteArray& data, const quint64 sectorSize)
+{
+    if (ImageFormat::isHole(entry))
+    {
+        quint64 offset = BufferScan::firstNotEqual(data.constData(), static_cast<quint64>(data.size()), ImageFormat::fillByte(entry));
+        return QString("Verify Error;Data from image file and disk is NOT identical, the first difference is in sector %1.").arg((entry.deviceOffset + offset) / sectorSize);
+    }
+
+    quint64 firstSector = entry.deviceOffset / sectorSize;
+    quint64 lastSector = (entry.deviceOffset + entry.uncompressedLength - 1) / sectorSize;
+    return QString("Verify Error;Data from image file and disk is NOT identical in sectors %1 to %2.").arg(firstSector).arg(lastSector);
+}
+
+void DigestVerifier::check(const ChunkEntry& entry, QByteArray& data)
+{
+    m_mutex.lock();
+    bool failed = m_failed;
+    m_mutex.unlock();
+
+    bool identical = failed || matches(entry, data);
+    QString error;
+    if (!identical)
+    {
+        error = mismatchError(entry, data, m_sectorSize);
+    }
+
+    if (m_arena)
+    {
+        m_arena->release(data);
+    }
+
+    QMutexLocker locker(&m_mutex);
+    if (!identical && !m_failed)
+    {
+        m_failed = true;
+        m_error = error;
+    }
+    m_inFlight--;
+    m_slotFree.wakeAll();
+}
@@ -0,0 +1,49 @@
+#ifndef DIGESTVERIFIER_H
+#define DIGESTVERIFIER_H
+
+#include <QMutex>
+#include <QThread>
+#include <QThreadPool>
+#include <QWaitCondition>
+
+#include "imageformat.h"
+#include "bufferarena.h"
+
+// Hashes device reads on a pool of worker threads and compares them with the
+// chunk digests of an image, nothing is decompressed. Submitting blocks once
+// too many chunks are waiting so memory use stays bounded. The first mismatch
+// stops the verification.
+class DigestVerifier
+{
+public:
+    explicit DigestVerifier(const quint64 sectorSize, BufferArena* arena = nullptr, const int workers = QThread::idealThreadCount());
+    ~DigestVerifier();
+
+    bool submit(const ChunkEntry& entry, const QByteArray& data, QString& msg);
+    bool finish(QString& msg);
+
+    static bool matches(const ChunkEntry& entry, const QByteArray& data);
+
+    // Verify error for a chunk that does not match, a hole names the first differing
+    // sector while a digest can only name the sectors of the whole chunk
+    static QString mismatchError(const ChunkEntry& entry, const QByteArray& data, const quint64 sectorSize);
+
+private:
+    class HashTask;
+
+    void check(const ChunkEntry& entry, QByteArray& data);
+
+private:
+    quint64        m_sectorSize;
+    BufferArena*   m_arena;
+    QThreadPool    m_pool;
+    int            m_maxInFlight = {0};
+
+    QMutex         m_mutex;
+    QWaitCondition m_slotFree;
+    int            m_inFlight = {0};
+    bool           m_failed = {false};
+    QString        m_error;
+};
+
+#endif // DIGESTVERIFIER_H
@@ -24,6 +24,7 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <cstddef>
 #include <windows.h>
 #include <winioctl.h>
 
@@ -48,11 +49,11 @@ HANDLE DiskUtilities::getHandleOnFile(LPCWSTR filelocation, DWORD access, QStrin
     return hFile;
 }
 
-HANDLE DiskUtilities::getHandleOnDevice(int device, DWORD access, QString &msg)
+HANDLE DiskUtilities::getHandleOnDevice(int device, DWORD access, QString &msg, DWORD flags)
 {
     HANDLE hDevice;
     QString devicename = QString("\\\\.\\PhysicalDrive%1").arg(device);
-    hDevice = CreateFile(devicename.toLatin1().data(), access, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, 0, nullptr);
+    hDevice = CreateFile(devicename.toLatin1().data(), access, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, flags, nullptr);
     if (hDevice == INVALID_HANDLE_VALUE)
     {
         wchar_t *errormessage = nullptr;
@@ -223,6 +224,46 @@ bool DiskUtilities::writeSectorDataToHandle(HANDLE handle, const QByteArray& dat
     return bResult;
 }
 
+bool DiskUtilities::discardSectors(HANDLE handle, const quint64 startSector, const quint64 numSectors, const quint64 sectorSize, QString& msg)
+{
+    // Tell the device the range no longer holds data (TRIM / UNMAP)
+    struct
+    {
+        DEVICE_MANAGE_DATA_SET_ATTRIBUTES attributes;
+        DEVICE_DATA_SET_RANGE             range;
+    } request;
+    OVERLAPPED overlapped;
+    DWORD junk;
+    BOOL bResult;
+
+    memset(&request, 0, sizeof(request));
+    request.attributes.Size = sizeof(DEVICE_MANAGE_DATA_SET_ATTRIBUTES);
+    request.attributes.Action = DeviceDsmAction_Trim;
+    request.attributes.DataSetRangesOffset = offsetof(decltype(request), range);
+    request.attributes.DataSetRangesLength = sizeof(DEVICE_DATA_SET_RANGE);
+    request.range.StartingOffset = static_cast<LONGLONG>(startSector * sectorSize);
+    request.range.LengthInBytes = numSectors * sectorSize;
+
+    // Also valid on handles opened with FILE_FLAG_OVERLAPPED
+    memset(&overlapped, 0, sizeof(overlapped));
+    overlapped.hEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+    bResult = DeviceIoControl(handle, IOCTL_STORAGE_MANAGE_DATA_SET_ATTRIBUTES, &request, sizeof(request), nullptr, 0, &junk, &overlapped);
+    if (!bResult && (GetLastError() == ERROR_IO_PENDING))
+    {
+        bResult = GetOverlappedResult(handle, &overlapped, &junk, TRUE);
+    }
+    CloseHandle(overlapped.hEvent);
+    if (!bResult)
+    {
+        wchar_t *errormessage = nullptr;
+        FormatMessageW(FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_ALLOCATE_BUFFER, nullptr, GetLastError(), 0, (LPWSTR)&errormessage, 0, nullptr);
+        QString errText = QString::fromUtf16((const ushort *)errormessage);
+        msg = QString("Discard Error;An error occurred when attempting to discard data on the device.\n Error %1: %2").arg(GetLastError()).arg(errText);
+        LocalFree(errormessage);
+    }
+    return bResult;
+}
+
 quint64 DiskUtilities::getNumberOfSectors(HANDLE handle, quint64& sectorsize, QString& msg)
 {
     DWORD junk;
@@ -244,6 +285,25 @@ quint64 DiskUtilities::getNumberOfSectors(HANDLE handle, quint64& sectorsize, QS
     return (quint64)diskgeometry.DiskSize.QuadPart / (quint64)diskgeometry.Geometry.BytesPerSector;
 }
 
+quint64 DiskUtilities::getPhysicalSectorSize(HANDLE handle, const quint64 logicalSectorSize)
+{
+    // Not every driver reports the access alignment, fall back to the logical sector size
+    STORAGE_PROPERTY_QUERY query;
+    memset(&query, 0, sizeof(query));
+    query.PropertyId = StorageAccessAlignmentProperty;
+    query.QueryType = PropertyStandardQuery;
+
+    STORAGE_ACCESS_ALIGNMENT_DESCRIPTOR alignment;
+    memset(&alignment, 0, sizeof(alignment));
+    DWORD junk;
+    if (!DeviceIoControl(handle, IOCTL_STORAGE_QUERY_PROPERTY, &query, sizeof(query), &alignment, sizeof(alignment), &junk, nullptr)
+            || (alignment.BytesPerPhysicalSector < logicalSectorSize))
+    {
+        return logicalSectorSize;
+    }
+    return alignment.BytesPerPhysicalSector;
+}
+
 quint64 DiskUtilities::getFileSizeInSectors(HANDLE handle, const quint64 sectorsize, QString& msg)
 {
     quint64 retVal = 0;
@@ -50,7 +50,7 @@ public:
     DiskUtilities();
 
     static HANDLE     getHandleOnFile(LPCWSTR filelocation, DWORD access, QString& msg);
-    static HANDLE     getHandleOnDevice(int device, DWORD access, QString& msg);
+    static HANDLE     getHandleOnDevice(int device, DWORD access, QString& msg, DWORD flags = 0);
     static HANDLE     getHandleOnVolume(int volume, DWORD access, QString& msg);
     static QString    getDriveLabel(const char *drv);
     static DWORD      getDeviceID(HANDLE hVolume, QString& msg);
@@ -60,7 +60,9 @@ public:
     static bool       isVolumeUnmounted(HANDLE handle);
     static QByteArray readSectorDataFromHandle(HANDLE handle, quint64 startsector, const quint64 numSectors, const quint64 sectorSize, QString& msg);
     static bool       writeSectorDataToHandle(HANDLE handle, const QByteArray& data, const quint64 startSector, const quint64 numSectors, const quint64 sectorSize, QString &msg);
+    static bool       discardSectors(HANDLE handle, const quint64 startSector, const quint64 numSectors, const quint64 sectorSize, QString &msg);
     static quint64    getNumberOfSectors(HANDLE handle, quint64& sectorsize, QString &msg);
+    static quint64    getPhysicalSectorSize(HANDLE handle, const quint64 logicalSectorSize);
     static quint64    getFileSizeInSectors(HANDLE handle, const quint64 sectorsize, QString& msg);
     static bool       spaceAvailable(char *location, quint64 spaceneeded, QString &msg);
     static bool       checkDriveType(char *name, ULONG *pid, QString &msg);
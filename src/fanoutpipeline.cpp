@@ -0,0 +1,168 @@
+#include "fanoutpipeline.h"
+#include "decompressionpipeline.h"
+#include "rawstreampipeline.h"
+
+class FanOutPipeline::DecoderThread : public QThread
+{
+public:
+    explicit DecoderThread(FanOutPipeline* pipeline) :
+        m_pipeline(pipeline)
+    {
+    }
+
+protected:
+    void run() override
+    {
+        m_pipeline->decodeLoop();
+    }
+
+private:
+    FanOutPipeline* m_pipeline;
+};
+
+FanOutPipeline::FanOutPipeline(const QString& imageFilePath, const int consumers, ChunkCache* cache, const int window) :
+    m_imageFilePath(imageFilePath),
+    m_cache(cache),
+    m_window(qMax(1, window)),
+    m_queues(consumers),
+    m_attached(consumers, true)
+{
+    m_decoderThread = new DecoderThread(this);
+}
+
+FanOutPipeline::~FanOutPipeline()
+{
+    abort();
+    delete m_decoderThread;
+}
+
+void FanOutPipeline::start()
+{
+    m_decoderThread->start();
+}
+
+bool FanOutPipeline::next(const int consumer, int& index, ChunkEntry& entry, QByteArray& data, QString& msg)
+{
+    QMutexLocker locker(&m_mutex);
+    while (m_queues.at(consumer).isEmpty() && !m_finished && !m_aborted)
+    {
+        m_chunkReady.wait(&m_mutex);
+    }
+
+    if (!m_queues.at(consumer).isEmpty())
+    {
+        Chunk chunk = m_queues[consumer].dequeue();
+        index = chunk.index;
+        entry = chunk.entry;
+        data = chunk.data;
+        m_slotFree.wakeAll();
+        return true;
+    }
+
+    // All chunks consumed, or decoding stopped before the end of the image
+    if (!m_error.isEmpty())
+    {
+        msg = m_error;
+    }
+    else if (!m_finished)
+    {
+        msg = QString("File Error;Decoding of the image file was stopped.");
+    }
+    return false;
+}
+
+void FanOutPipeline::detach(const int consumer)
+{
+    QMutexLocker locker(&m_mutex);
+    m_attached[consumer] = false;
+    m_queues[consumer].clear();
+    m_slotFree.wakeAll();
+}
+
+void FanOutPipeline::abort()
+{
+    m_mutex.lock();
+    m_aborted = true;
+    m_chunkReady.wakeAll();
+    m_slotFree.wakeAll();
+    m_mutex.unlock();
+
+    m_decoderThread->wait();
+}
+
+bool FanOutPipeline::hasRoom() const
+{
+    // Called with the mutex held
+    for (int i = 0; i < m_queues.size(); i++)
+    {
+        if (m_attached.at(i) && (m_queues.at(i).size() >= m_window))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool FanOutPipeline::publish(const int index, const ChunkEntry& entry, QByteArray& data)
+{
+    QMutexLocker locker(&m_mutex);
+    while (!m_aborted && !hasRoom())
+    {
+        m_slotFree.wait(&m_mutex);
+    }
+
+    if (m_aborted || !m_attached.contains(true))
+    {
+        return false;
+    }
+
+    Chunk chunk = { index, entry, data };
+    for (int i = 0; i < m_queues.size(); i++)
+    {
+        if (m_attached.at(i))
+        {
+            m_queues[i].enqueue(chunk);
+        }
+    }
+    data = QByteArray();
+    m_chunkReady.wakeAll();
+    return true;
+}
+
+void FanOutPipeline::decodeLoop()
+{
+    // Decoded buffers are shared by every queue, the last consumer frees them
+    QString error;
+    int index = 0;
+    ChunkEntry entry;
+    QByteArray data;
+    if (RawImage::formatOf(m_imageFilePath) != RawImage::FormatNone)
+    {
+        RawStreamPipeline pipeline(m_imageFilePath);
+        if (pipeline.start(error))
+        {
+            while (pipeline.next(index, entry, data, error) && publish(index, entry, data))
+            {
+            }
+        }
+        pipeline.abort();
+    }
+    else
+    {
+        ImageReader reader;
+        if (reader.open(m_imageFilePath, error))
+        {
+            DecompressionPipeline pipeline(reader, nullptr, m_cache);
+            while (pipeline.next(index, data, error) && publish(index, reader.chunks().at(index), data))
+            {
+            }
+            pipeline.abort();
+        }
+    }
+
+    QMutexLocker locker(&m_mutex);
+    m_error = error;
+    m_finished = error.isEmpty() && !m_aborted;
+    m_aborted = m_aborted || !error.isEmpty();
+    m_chunkReady.wakeAll();
+}
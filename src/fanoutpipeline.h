@@ -0,0 +1,60 @@
+#ifndef FANOUTPIPELINE_H
+#define FANOUTPIPELINE_H
+
+#include <QMutex>
+#include <QQueue>
+#include <QThread>
+#include <QVector>
+#include <QWaitCondition>
+
+#include "imageformat.h"
+#include "chunkcache.h"
+
+// Decodes every chunk of an image once and hands the same buffer to several
+// consumers, one per target device. Each consumer has its own queue of at
+// most window chunks and the decoder waits for the slowest one, so a fast
+// device runs at most that far ahead of a slow one. A consumer that fails
+// or is cancelled detaches and is no longer waited for. Raw images are
+// decoded as a stream, every chunk comes with its index entry.
+class FanOutPipeline
+{
+public:
+    FanOutPipeline(const QString& imageFilePath, const int consumers, ChunkCache* cache = nullptr, const int window = 16);
+    ~FanOutPipeline();
+
+    void start();
+    bool next(const int consumer, int& index, ChunkEntry& entry, QByteArray& data, QString& msg);
+    void detach(const int consumer);
+    void abort();
+
+private:
+    class DecoderThread;
+
+    struct Chunk
+    {
+        int        index;
+        ChunkEntry entry;
+        QByteArray data;
+    };
+
+    void decodeLoop();
+    bool publish(const int index, const ChunkEntry& entry, QByteArray& data);
+    bool hasRoom() const;
+
+private:
+    QString                m_imageFilePath;
+    ChunkCache*            m_cache;
+    int                    m_window;
+    DecoderThread*         m_decoderThread = {nullptr};
+
+    QMutex                 m_mutex;
+    QWaitCondition         m_chunkReady;
+    QWaitCondition         m_slotFree;
+    QVector<QQueue<Chunk>> m_queues;
+    QVector<bool>          m_attached;
+    bool                   m_finished = {false};
+    bool                   m_aborted = {false};
+    QString                m_error;
+};
+
+#endif // FANOUTPIPELINE_H
@@ -0,0 +1,529 @@
+#include <QtEndian>
+
+#include <cstring>
+
+#include "filesystemprobe.h"
+
+// Largest single read, well below the transfer buffer of a job
+const quint64 MAX_READ_SECTORS = 2048;
+const int MAX_DIRECTORY_CLUSTERS = 64;
+
+const quint16 EXT_MAGIC = 0xEF53;
+const quint32 EXT_COMPAT_SPARSE_SUPER2 = 0x0200;
+const quint32 EXT_INCOMPAT_META_BG = 0x0010;
+const quint32 EXT_INCOMPAT_64BIT = 0x0080;
+const quint32 EXT_RO_COMPAT_SPARSE_SUPER = 0x0001;
+const quint16 EXT_BG_BLOCK_UNINIT = 0x0002;
+
+static inline quint16 le16(const char* p)
+{
+    return qFromLittleEndian<quint16>(reinterpret_cast<const uchar*>(p));
+}
+
+static inline quint32 le32(const char* p)
+{
+    return qFromLittleEndian<quint32>(reinterpret_cast<const uchar*>(p));
+}
+
+static inline quint64 le64(const char* p)
+{
+    return qFromLittleEndian<quint64>(reinterpret_cast<const uchar*>(p));
+}
+
+static bool isPowerOf(quint64 value, const quint64 base)
+{
+    while ((value > 1) && (value % base == 0))
+    {
+        value /= base;
+    }
+    return value == 1;
+}
+
+FileSystemProbe::FileSystemProbe()
+{
+}
+
+bool FileSystemProbe::probe(const PartitionTable::SectorReader& reader, const quint64 sectorSize, const DiskExtent& partition, const quint64 minFreeSectors, QString& msg)
+{
+    m_reader = &reader;
+    m_sectorSize = sectorSize;
+    m_partition = partition;
+    m_minFreeSectors = qMax<quint64>(minFreeSectors, 1);
+    m_fatSectorCached = ~Q_UINT64_C(0);
+    reset();
+
+    QByteArray boot;
+    if (!readBytes(0, 512, boot, msg))
+    {
+        return msg.isEmpty();
+    }
+
+    bool ok = true;
+    if (memcmp(boot.constData() + 3, "EXFAT   ", 8) == 0)
+    {
+        ok = probeExFat(boot, msg);
+    }
+    else if ((static_cast<quint8>(boot.at(510)) == 0x55) && (static_cast<quint8>(boot.at(511)) == 0xAA) &&
+             ((static_cast<quint8>(boot.at(0)) == 0xEB) || (static_cast<quint8>(boot.at(0)) == 0xE9)))
+    {
+        ok = probeFat(boot, msg);
+    }
+    else
+    {
+        ok = probeExt(msg);
+    }
+
+    // Structures that do not add up are treated as fully allocated
+    if (!ok || (m_type == TypeUnknown))
+    {
+        reset();
+    }
+    m_reader = nullptr;
+    return ok || msg.isEmpty();
+}
+
+FileSystemProbe::Type FileSystemProbe::type() const
+{
+    return m_type;
+}
+
+QString FileSystemProbe::typeName() const
+{
+    switch (m_type)
+    {
+    case TypeFat16:
+        return QString("FAT16");
+    case TypeFat32:
+        return QString("FAT32");
+    case TypeExFat:
+        return QString("exFAT");
+    case TypeExt:
+        return QString("ext2/3/4");
+    default:
+        return QString("unknown");
+    }
+}
+
+const QVector<DiskExtent>& FileSystemProbe::freeExtents() const
+{
+    return m_free;
+}
+
+quint64 FileSystemProbe::freeSectors() const
+{
+    quint64 sectors = 0;
+    foreach (const DiskExtent& extent, m_free)
+    {
+        sectors += extent.numSectors;
+    }
+    return sectors;
+}
+
+bool FileSystemProbe::probeFat(const QByteArray& boot, QString& msg)
+{
+    const char* p = boot.constData();
+    quint32 bytesPerSector = le16(p + 11);
+    quint32 sectorsPerCluster = static_cast<quint8>(p[13]);
+    quint32 reservedSectors = le16(p + 14);
+    quint32 numFats = static_cast<quint8>(p[16]);
+    quint32 rootEntries = le16(p + 17);
+    quint64 totalSectors = le16(p + 19) ? le16(p + 19) : le32(p + 32);
+    quint64 fatSize = le16(p + 22) ? le16(p + 22) : le32(p + 36);
+
+    if ((bytesPerSector != m_sectorSize) || (sectorsPerCluster == 0) || (sectorsPerCluster & (sectorsPerCluster - 1)) ||
+        (reservedSectors == 0) || (numFats == 0) || (fatSize == 0) || (totalSectors == 0) || (totalSectors > m_partition.numSectors))
+    {
+        return true;
+    }
+
+    quint64 rootDirSectors = (rootEntries * 32 + bytesPerSector - 1) / bytesPerSector;
+    quint64 firstDataSector = reservedSectors + numFats * fatSize + rootDirSectors;
+    if (firstDataSector >= totalSectors)
+    {
+        return true;
+    }
+
+    // FAT12 volumes are too small to be worth it
+    quint64 clusterCount = (totalSectors - firstDataSector) / sectorsPerCluster;
+    if (clusterCount < 4085)
+    {
+        return true;
+    }
+    const bool fat32 = (clusterCount >= 65525);
+    const quint64 entrySize = fat32 ? 4 : 2;
+    const quint64 fatBytes = (clusterCount + 2) * entrySize;
+    if (fatBytes > fatSize * bytesPerSector)
+    {
+        return true;
+    }
+
+    beginRuns();
+    addUnit(m_partition.startSector, firstDataSector, false);
+
+    // Walk the first FAT, cluster n is free when its entry is zero
+    const quint64 pieceBytes = MAX_READ_SECTORS * m_sectorSize;
+    for (quint64 offset = 0; offset < fatBytes; offset += pieceBytes)
+    {
+        QByteArray fat;
+        if (!readBytes(static_cast<quint64>(reservedSectors) * bytesPerSector + offset, qMin(pieceBytes, fatBytes - offset), fat, msg))
+        {
+            return false;
+        }
+
+        for (quint64 i = 0; i + entrySize <= static_cast<quint64>(fat.size()); i += entrySize)
+        {
+            quint64 cluster = (offset + i) / entrySize;
+            if (cluster < 2)
+            {
+                continue;
+            }
+            quint32 value = fat32 ? (le32(fat.constData() + i) & 0x0FFFFFFF) : le16(fat.constData() + i);
+            addUnit(m_partition.startSector + firstDataSector + (cluster - 2) * sectorsPerCluster, sectorsPerCluster, value == 0);
+        }
+    }
+    endRuns();
+
+    m_type = fat32 ? TypeFat32 : TypeFat16;
+    return true;
+}
+
+bool FileSystemProbe::probeExFat(const QByteArray& boot, QString& msg)
+{
+    const char* p = boot.constData();
+    quint32 bytesPerSectorShift = static_cast<quint8>(p[108]);
+    quint32 sectorsPerClusterShift = static_cast<quint8>(p[109]);
+    if ((bytesPerSectorShift < 9) || (bytesPerSectorShift > 12) || (sectorsPerClusterShift > 25 - bytesPerSectorShift) ||
+        ((Q_UINT64_C(1) << bytesPerSectorShift) != m_sectorSize))
+    {
+        return true;
+    }
+
+    const quint64 sectorsPerCluster = Q_UINT64_C(1) << sectorsPerClusterShift;
+    const quint64 clusterBytes = sectorsPerCluster * m_sectorSize;
+    const quint64 clusterHeapOffset = le32(p + 88);
+    const quint64 clusterCount = le32(p + 92);
+    quint32 cluster = le32(p + 96);
+    m_fatOffset = le32(p + 80);
+    if ((clusterCount == 0) || (clusterHeapOffset + clusterCount * sectorsPerCluster > m_partition.numSectors))
+    {
+        return true;
+    }
+
+    // The allocation bitmap is described by an entry of the root directory
+    quint64 bitmapCluster = 0;
+    quint64 bitmapLength = 0;
+    bool endOfDirectory = false;
+    for (int i = 0; (i < MAX_DIRECTORY_CLUSTERS) && !endOfDirectory && (bitmapCluster == 0); i++)
+    {
+        if ((cluster < 2) || (cluster >= clusterCount + 2))
+        {
+            break;
+        }
+
+        QByteArray directory;
+        if (!readBytes((clusterHeapOffset + (cluster - 2) * sectorsPerCluster) * m_sectorSize, clusterBytes, directory, msg))
+        {
+            return false;
+        }
+
+        for (int e = 0; e + 32 <= directory.size(); e += 32)
+        {
+            quint8 entryType = static_cast<quint8>(directory.at(e));
+            if (entryType == 0x00)
+            {
+                endOfDirectory = true;
+                break;
+            }
+            if (entryType == 0x81)
+            {
+                bitmapCluster = le32(directory.constData() + e + 20);
+                bitmapLength = le64(directory.constData() + e + 24);
+                break;
+            }
+        }
+
+        if (!exFatNextCluster(cluster, cluster, msg))
+        {
+            return false;
+        }
+    }
+
+    if ((bitmapCluster < 2) || (bitmapCluster >= clusterCount + 2) || (bitmapLength * 8 < clusterCount))
+    {
+        return true;
+    }
+
+    beginRuns();
+    addUnit(m_partition.startSector, clusterHeapOffset, false);
+
+    // The bitmap is stored contiguously, bit n covers cluster n + 2
+    const quint64 bitmapBytes = (clusterCount + 7) / 8;
+    const quint64 bitmapOffset = (clusterHeapOffset + (bitmapCluster - 2) * sectorsPerCluster) * m_sectorSize;
+    const quint64 pieceBytes = MAX_READ_SECTORS * m_sectorSize;
+    quint64 index = 0;
+    for (quint64 offset = 0; offset < bitmapBytes; offset += pieceBytes)
+    {
+        QByteArray bitmap;
+        if (!readBytes(bitmapOffset + offset, qMin(pieceBytes, bitmapBytes - offset), bitmap, msg))
+        {
+            return false;
+        }
+
+        for (int i = 0; (i < bitmap.size()) && (index < clusterCount); i++)
+        {
+            quint8 bits = static_cast<quint8>(bitmap.at(i));
+            if (((bits == 0x00) || (bits == 0xFF)) && (index + 8 <= clusterCount))
+            {
+                addUnit(m_partition.startSector + clusterHeapOffset + index * sectorsPerCluster, 8 * sectorsPerCluster, bits == 0x00);
+                index += 8;
+                continue;
+            }
+            for (int bit = 0; (bit < 8) && (index < clusterCount); bit++, index++)
+            {
+                addUnit(m_partition.startSector + clusterHeapOffset + index * sectorsPerCluster, sectorsPerCluster, !(bits & (1 << bit)));
+            }
+        }
+    }
+    endRuns();
+
+    m_type = TypeExFat;
+    return true;
+}
+
+bool FileSystemProbe::probeExt(QString& msg)
+{
+    QByteArray sb;
+    if (!readBytes(1024, 1024, sb, msg))
+    {
+        return msg.isEmpty();
+    }
+
+    const char* p = sb.constData();
+    if (le16(p + 56) != EXT_MAGIC)
+    {
+        return true;
+    }
+
+    quint32 logBlockSize = le32(p + 24);
+    if (logBlockSize > 6)
+    {
+        return true;
+    }
+    const quint64 blockSize = Q_UINT64_C(1024) << logBlockSize;
+    const quint32 compat = le32(p + 92);
+    const quint32 incompat = le32(p + 96);
+    const quint32 roCompat = le32(p + 100);
+    const bool is64Bit = (incompat & EXT_INCOMPAT_64BIT) != 0;
+
+    quint64 blocksCount = le32(p + 4);
+    if (is64Bit)
+    {
+        blocksCount |= static_cast<quint64>(le32(p + 0x150)) << 32;
+    }
+    const quint64 firstDataBlock = le32(p + 20);
+    const quint64 blocksPerGroup = le32(p + 32);
+    const quint64 inodesPerGroup = le32(p + 40);
+    const quint64 inodeSize = (le32(p + 76) >= 1) ? le16(p + 88) : 128;
+    const quint64 descSize = is64Bit ? le16(p + 254) : 32;
+    const quint64 reservedGdtBlocks = le16(p + 206);
+
+    // Descriptors of META_BG file systems are spread over the disk, not handled
+    if ((blockSize % m_sectorSize) || (blocksPerGroup == 0) || (blocksPerGroup > blockSize * 8) || (incompat & EXT_INCOMPAT_META_BG) ||
+        (descSize < 32) || (descSize > blockSize) || (firstDataBlock >= blocksCount) ||
+        (blocksCount * (blockSize / m_sectorSize) > m_partition.numSectors))
+    {
+        return true;
+    }
+
+    const quint64 sectorsPerBlock = blockSize / m_sectorSize;
+    const quint64 groupCount = (blocksCount - firstDataBlock + blocksPerGroup - 1) / blocksPerGroup;
+    const quint64 gdtBlocks = (groupCount * descSize + blockSize - 1) / blockSize;
+    const quint64 inodeTableBlocks = (inodesPerGroup * inodeSize + blockSize - 1) / blockSize;
+
+    QByteArray descriptors;
+    if (!readBytes((firstDataBlock + 1) * blockSize, groupCount * descSize, descriptors, msg))
+    {
+        return false;
+    }
+
+    // Metadata blocks of all groups, needed to rebuild uninitialised bitmaps.
+    // These extents count file system blocks, not sectors
+    QVector<DiskExtent> metadata;
+    for (quint64 g = 0; g < groupCount; g++)
+    {
+        const char* d = descriptors.constData() + g * descSize;
+        quint64 blockBitmap = le32(d + 0);
+        quint64 inodeBitmap = le32(d + 4);
+        quint64 inodeTable = le32(d + 8);
+        if (descSize >= 64)
+        {
+            blockBitmap |= static_cast<quint64>(le32(d + 0x20)) << 32;
+            inodeBitmap |= static_cast<quint64>(le32(d + 0x24)) << 32;
+            inodeTable |= static_cast<quint64>(le32(d + 0x28)) << 32;
+        }
+
+        DiskExtent extent;
+        extent.startSector = blockBitmap;
+        extent.numSectors = 1;
+        metadata.append(extent);
+        extent.startSector = inodeBitmap;
+        metadata.append(extent);
+        extent.startSector = inodeTable;
+        extent.numSectors = inodeTableBlocks;
+        metadata.append(extent);
+    }
+
+    beginRuns();
+    addUnit(m_partition.startSector, firstDataBlock * sectorsPerBlock, false);
+
+    for (quint64 g = 0; g < groupCount; g++)
+    {
+        const char* d = descriptors.constData() + g * descSize;
+        const quint64 groupStart = firstDataBlock + g * blocksPerGroup;
+        const quint64 groupBlocks = qMin(blocksPerGroup, blocksCount - groupStart);
+        const quint16 flags = le16(d + 18);
+
+        QByteArray bitmap;
+        if (flags & EXT_BG_BLOCK_UNINIT)
+        {
+            // Backup groups of SPARSE_SUPER2 are listed elsewhere, keep such groups whole
+            if (compat & EXT_COMPAT_SPARSE_SUPER2)
+            {
+                addUnit(m_partition.startSector + groupStart * sectorsPerBlock, groupBlocks * sectorsPerBlock, false);
+                continue;
+            }
+
+            // Rebuild the bitmap the way the kernel does: superblock backup,
+            // descriptor blocks and any group metadata placed in this group
+            bitmap.fill('\0', static_cast<int>(blockSize));
+            bool hasSuper = !(roCompat & EXT_RO_COMPAT_SPARSE_SUPER) || (g <= 1) || isPowerOf(g, 3) || isPowerOf(g, 5) || isPowerOf(g, 7);
+            quint64 baseBlocks = hasSuper ? 1 + gdtBlocks + reservedGdtBlocks : 0;
+            for (quint64 b = 0; b < qMin(baseBlocks, groupBlocks); b++)
+            {
+                bitmap[static_cast<int>(b / 8)] = static_cast<char>(bitmap.at(static_cast<int>(b / 8)) | (1 << (b % 8)));
+            }
+            foreach (const DiskExtent& extent, metadata)
+            {
+                quint64 first = qMax(extent.startSector, groupStart);
+                quint64 last = qMin(extent.startSector + extent.numSectors, groupStart + groupBlocks);
+                for (quint64 b = first; b < last; b++)
+                {
+                    quint64 bit = b - groupStart;
+                    bitmap[static_cast<int>(bit / 8)] = static_cast<char>(bitmap.at(static_cast<int>(bit / 8)) | (1 << (bit % 8)));
+                }
+            }
+        }
+        else
+        {
+            quint64 blockBitmap = le32(d + 0);
+            if (descSize >= 64)
+            {
+                blockBitmap |= static_cast<quint64>(le32(d + 0x20)) << 32;
+            }
+            if ((blockBitmap >= blocksCount) || !readBytes(blockBitmap * blockSize, blockSize, bitmap, msg))
+            {
+                return false;
+            }
+        }
+
+        for (quint64 b = 0; b < groupBlocks; )
+        {
+            quint8 bits = static_cast<quint8>(bitmap.at(static_cast<int>(b / 8)));
+            if ((b % 8 == 0) && ((bits == 0x00) || (bits == 0xFF)) && (b + 8 <= groupBlocks))
+            {
+                addUnit(m_partition.startSector + (groupStart + b) * sectorsPerBlock, 8 * sectorsPerBlock, bits == 0x00);
+                b += 8;
+                continue;
+            }
+            addUnit(m_partition.startSector + (groupStart + b) * sectorsPerBlock, sectorsPerBlock, !(bits & (1 << (b % 8))));
+            b++;
+        }
+    }
+    endRuns();
+
+    m_type = TypeExt;
+    return true;
+}
+
+bool FileSystemProbe::readBytes(const quint64 partitionOffset, const quint64 length, QByteArray& data, QString& msg)
+{
+    // Reads past the partition mean the structures are damaged, msg stays empty
+    quint64 firstSector = partitionOffset / m_sectorSize;
+    quint64 lastSector = (partitionOffset + length + m_sectorSize - 1) / m_sectorSize;
+    if ((length == 0) || (lastSector > m_partition.numSectors))
+    {
+        return false;
+    }
+
+    QByteArray sectors;
+    for (quint64 sector = firstSector; sector < lastSector; sector += MAX_READ_SECTORS)
+    {
+        QByteArray piece;
+        if (!(*m_reader)(m_partition.startSector + sector, qMin(MAX_READ_SECTORS, lastSector - sector), piece, msg))
+        {
+            return false;
+        }
+        sectors.append(piece);
+    }
+
+    data = sectors.mid(static_cast<int>(partitionOffset % m_sectorSize), static_cast<int>(length));
+    return static_cast<quint64>(data.size()) == length;
+}
+
+bool FileSystemProbe::exFatNextCluster(const quint32 cluster, quint32& next, QString& msg)
+{
+    quint64 offset = m_fatOffset * m_sectorSize + static_cast<quint64>(cluster) * 4;
+    quint64 sector = offset / m_sectorSize;
+    if (sector != m_fatSectorCached)
+    {
+        if (!readBytes(sector * m_sectorSize, m_sectorSize, m_fatSector, msg))
+        {
+            return false;
+        }
+        m_fatSectorCached = sector;
+    }
+
+    // Values from 0xFFFFFFF7 up mark bad clusters and the end of a chain
+    quint32 value = le32(m_fatSector.constData() + offset % m_sectorSize);
+    next = (value >= 0xFFFFFFF7) ? 0 : value;
+    return true;
+}
+
+void FileSystemProbe::beginRuns()
+{
+    m_free.clear();
+    m_run = DiskExtent();
+}
+
+void FileSystemProbe::addUnit(const quint64 startSector, const quint64 numSectors, const bool free)
+{
+    if (free && (m_run.numSectors > 0) && (m_run.startSector + m_run.numSectors == startSector))
+    {
+        m_run.numSectors += numSectors;
+        return;
+    }
+
+    endRuns();
+    if (free)
+    {
+        m_run.startSector = startSector;
+        m_run.numSectors = numSectors;
+    }
+}
+
+void FileSystemProbe::endRuns()
+{
+    // Short runs would only add index entries
+    if (m_run.numSectors >= m_minFreeSectors)
+    {
+        m_free.append(m_run);
+    }
+    m_run = DiskExtent();
+}
+
+void FileSystemProbe::reset()
+{
+    m_type = TypeUnknown;
+    m_free.clear();
+    m_run = DiskExtent();
+}
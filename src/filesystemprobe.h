@@ -0,0 +1,56 @@
+#ifndef FILESYSTEMPROBE_H
+#define FILESYSTEMPROBE_H
+
+#include <QByteArray>
+#include <QString>
+#include <QVector>
+
+#include "partitiontable.h"
+
+// Recognises the filesystem of a partition and reads its allocation
+// structures: the FAT of FAT16/FAT32, the allocation bitmap of exFAT and the
+// block bitmaps of ext2/3/4. Runs of unallocated clusters are reported in
+// device sectors so they can be left out of an image. Anything not
+// understood is reported as fully allocated.
+class FileSystemProbe
+{
+public:
+    enum Type { TypeUnknown = 0, TypeFat16, TypeFat32, TypeExFat, TypeExt };
+
+    FileSystemProbe();
+
+    bool probe(const PartitionTable::SectorReader& reader, const quint64 sectorSize, const DiskExtent& partition, const quint64 minFreeSectors, QString& msg);
+
+    Type                       type() const;
+    QString                    typeName() const;
+    const QVector<DiskExtent>& freeExtents() const;
+    quint64                    freeSectors() const;
+
+private:
+    bool probeFat(const QByteArray& boot, QString& msg);
+    bool probeExFat(const QByteArray& boot, QString& msg);
+    bool probeExt(QString& msg);
+    bool readBytes(const quint64 partitionOffset, const quint64 length, QByteArray& data, QString& msg);
+    bool exFatNextCluster(const quint32 cluster, quint32& next, QString& msg);
+
+    void beginRuns();
+    void addUnit(const quint64 startSector, const quint64 numSectors, const bool free);
+    void endRuns();
+    void reset();
+
+private:
+    const PartitionTable::SectorReader* m_reader = {nullptr};
+    quint64             m_sectorSize = {512};
+    DiskExtent          m_partition;
+    quint64             m_minFreeSectors = {0};
+    Type                m_type = {TypeUnknown};
+    QVector<DiskExtent> m_free;
+    DiskExtent          m_run;
+
+    // exFAT FAT lookups
+    quint64             m_fatOffset = {0};
+    quint64             m_fatSectorCached = {~Q_UINT64_C(0)};
+    QByteArray          m_fatSector;
+};
+
+#endif // FILESYSTEMPROBE_H
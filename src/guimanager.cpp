@@ -1,36 +1,101 @@
-#include <QDebug>
 #include <QFileInfo>
 #include <QElapsedTimer>
-#include <QCoreApplication>
 #include <QDir>
 #include <QSettings>
 
 #include "guimanager.h"
 #include "deviceevent.h"
+#include "createimagejob.h"
+#include "restoreimagejob.h"
+#include "clonediskjob.h"
+#include "verifyimagejob.h"
 
 const int ONE_SEC_IN_MS = 1000;
 const int MEGA_BYTES = 1024 * 1024;
-const int CHUNK_SIZE = 4096;
+const int PROGRESS_REFRESH_MS = 100;
+
+struct CompressionMode
+{
+    const char* name;
+    quint16     codec;
+    int         level;
+};
+
+// Speed/size trade-offs offered for new images, modes whose codec is not built in are hidden
+const CompressionMode COMPRESSION_MODES[] =
+{
+    { "Fastest (LZ4)",           ImageCodec::CodecLz4,   1  },
+    { "Fast (Zstandard 1)",      ImageCodec::CodecZstd,  1  },
+    { "Balanced (Zstandard 3)",  ImageCodec::CodecZstd,  3  },
+    { "Small (Zstandard 19)",    ImageCodec::CodecZstd,  19 },
+    { "Compatible (zlib 9)",     ImageCodec::CodecZlib,  9  },
+    { "None",                    ImageCodec::CodecStore, 0  }
+};
 
 GuiManager::GuiManager(QObject *parent) : QObject(parent),
     m_deviceIndex(-1),
     m_canCancel(false),
     m_canRead(false),
     m_canWrite(false),
+    m_canClone(false),
     m_busy(false),
     m_verify(false),
+    m_discardHoles(false),
+    m_skipFreeSpace(true),
+    m_differentialRestore(false),
+    m_chunkRepositoryAvailable(false),
+    m_useChunkRepository(false),
     m_progress(0),
-    m_version(VERSION_NUMBER)
+    m_version(VERSION_NUMBER),
+    m_compressionMode(-1)
 {
+    for (uint i = 0; i < sizeof(COMPRESSION_MODES) / sizeof(COMPRESSION_MODES[0]); i++)
+    {
+        if (ImageCodec::isAvailable(COMPRESSION_MODES[i].codec))
+        {
+            m_compressionModeTable << static_cast<int>(i);
+            m_compressionModes << QString(COMPRESSION_MODES[i].name);
+        }
+    }
+
     m_devices = new QQmlObjectListModel<DeviceItem>(this, "label", "deviceId");
     connect(this, &GuiManager::deviceIndexChanged, this, &GuiManager::onDeviceIndexChanged);
     connect(this, &GuiManager::imageFileUrlChanged, this, &GuiManager::onImageFileUrlChanged);
     connect(this, &GuiManager::imageFilePathChanged, this, &GuiManager::onImageFilePathChanged);
+    connect(this, &GuiManager::baseImageUrlChanged, this, &GuiManager::onBaseImageUrlChanged);
+    connect(this, &GuiManager::compressionModeChanged, this, &GuiManager::saveSettings);
+
+    // Progress of a running job is sampled at a fixed rate
+    m_progressTimer.setInterval(PROGRESS_REFRESH_MS);
+    connect(&m_progressTimer, &QTimer::timeout, this, &GuiManager::onProgressTimeout);
 
     removableDevices();
+    update_message("Please choose create or restore image");
+
+    // A problem with the settings replaces the prompt
     loadSettings();
+}
 
-    update_message("Please choose create or restore image");
+GuiManager::~GuiManager()
+{
+    // Jobs are children of this object and would only be stopped after the fan-out
+    // pipeline and the chunk cache they still use are gone
+    foreach (const RunningJob& running, m_jobs)
+    {
+        running.job->cancel();
+    }
+    if (m_fanOut)
+    {
+        m_fanOut->abort();
+    }
+    for (int i = 0; i < m_jobs.size(); i++)
+    {
+        m_jobs.at(i).job->wait();
+        if (!m_jobs.at(i).finished)
+        {
+            unlockVolumes(m_jobs[i].lockedVolumes);
+        }
+    }
 }
 
 bool GuiManager::event(QEvent* ev)
@@ -60,156 +125,139 @@ void GuiManager::createImage()
         return;
     }
 
-    DeviceItem* deviceItem = m_devices->at(m_deviceIndex);
-    if (!deviceItem)
+    QList<DeviceItem*> sources = targetDevices();
+    if (sources.isEmpty())
     {
-        error = QString("Write Error;Please select a device.");
+        error = QString("Write Error;Please check at least one source device.");
         setError(error);
         return;
     }
 
-    // Check if image file is located on a volume on the selected device
-    if (!checkFileLocation(deviceItem))
+    // An optional base image turns the new images into deltas against it
+    if (!m_baseImagePath.isEmpty() && !QFileInfo(m_baseImagePath).isFile())
     {
+        error = QString("File Error;The selected base image does not exist.");
+        setError(error);
         return;
     }
 
+    // Check if image file is located on a volume on the selected devices
+    foreach (DeviceItem* deviceItem, sources)
+    {
+        if (!checkFileLocation(deviceItem))
+        {
+            return;
+        }
+    }
+
     setBusy(true);
+    m_jobName = QString("Create disk image");
 
-    // Lock  all volumes
-    if (!lockVolumes(deviceItem))
+    // Lock the volumes of all sources before any job starts, they stay locked until the job of their device is done
+    QVector<QList<HANDLE>> lockedVolumes;
+    QString failedDevice;
+    if (!lockAllVolumes(sources, lockedVolumes, failedDevice))
     {
         setBusy(false);
-        update_message("Create disk image failed");
+        update_message(QString("Create disk image failed, the volumes of device %1 cannot be locked. No device was imaged.").arg(failedDevice));
         return;
     }
 
-    // Get the handle of the target raw disk
-    m_rawDiskHandle = DiskUtilities::getHandleOnDevice(deviceItem->get_deviceId().toUInt(), GENERIC_READ, error);
-    if (m_rawDiskHandle == INVALID_HANDLE_VALUE)
+    // Every source is imaged by its own job into its own file, the jobs
+    // share the compression workers
+    const CompressionMode& mode = COMPRESSION_MODES[m_compressionModeTable.value(m_compressionMode, 0)];
+    QFileInfo fileInfo(m_imageFilePath);
+    for (int i = 0; i < sources.size(); i++)
     {
-        setError(error);
-        setBusy(false);
-        update_message("Create disk image failed");
-        return;
+        DeviceItem* deviceItem = sources.at(i);
+        QString imageFilePath = m_imageFilePath;
+        if (sources.size() > 1)
+        {
+            imageFilePath = QString("%1/%2-%3.%4").arg(fileInfo.path()).arg(fileInfo.completeBaseName()).arg(deviceItem->get_deviceId()).arg(fileInfo.suffix());
+        }
+
+        CreateImageJob* job = new CreateImageJob(deviceItem->get_deviceId().toInt(), imageFilePath, mode.codec, mode.level, m_verify, m_skipFreeSpace, this);
+        job->setBaseImage(m_baseImagePath);
+        job->setChunkRepository((m_useChunkRepository && m_baseImagePath.isEmpty()) ? m_chunkRepositoryPath : QString());
+        startJob(job, deviceItem->get_deviceId(), lockedVolumes.at(i));
     }
+}
 
-    quint64 sectorSize = 0;
-    quint64 numSectors = DiskUtilities::getNumberOfSectors(m_rawDiskHandle, sectorSize, error);
-    if (!error.isEmpty())
+void GuiManager::restoreImage()
+{
+    // Clear message
+    update_message("");
+    QString error;
+
+    if (m_imageFilePath.isEmpty())
     {
+        error = QString("Write Error;Please specify a image file to save data to.");
         setError(error);
-        setBusy(false);
-        update_message("Create disk image failed");
         return;
     }
 
-    // Read MBR partition table
-    QByteArray sectorData = DiskUtilities::readSectorDataFromHandle(m_rawDiskHandle, 0, 1, 512, error);
-    if (!error.isEmpty())
+    QList<DeviceItem*> targets = targetDevices();
+    if (targets.isEmpty())
     {
+        error = QString("Write Error;Please check at least one target device.");
         setError(error);
-        setBusy(false);
-        update_message("Create disk image failed");
         return;
     }
-    numSectors = 1;
 
-    // Read partition information
-    for (quint64 i = 0; i < 4; i++)
-    {
-        quint32 partitionStartSector = *((quint32*)(sectorData.data() + 0x1BE + 8 + 16 * i));
-        quint32 partitionNumSectors = *((quint32*)(sectorData.data() + 0x1BE + 12 + 16 * i));
-        // Set numsectors to end of last partition
-        if (partitionStartSector + partitionNumSectors > numSectors)
-        {
-            numSectors = partitionStartSector + partitionNumSectors;
-        }
-    }
-
-    QFile imageFile(m_imageFilePath);
-    if (!imageFile.open(QIODevice::WriteOnly))
+    // Check the image file
+    if (!checkImageFile())
     {
-        error = QString("Write Error;Cannot open image file.");
-        setError(error);
-        setBusy(false);
-        update_message("Create disk image failed");
         return;
     }
 
-    QElapsedTimer elapsedTimer;
-    elapsedTimer.start();
-    quint64 lastI = 0;
-    bool cancelled = false;
-    QDataStream out;
-    out.setDevice(&imageFile);
-
-    // Store the total size of the disk (partitions) at the begining of the file
-    quint64 totalSize = numSectors * sectorSize;
-    out << totalSize;
-
-    for (quint64 i = 0; i < numSectors; i += CHUNK_SIZE)
+    // Check if image file is located on a volume on the selected devices
+    foreach (DeviceItem* deviceItem, targets)
     {
-        if (!m_busy)
+        if (!checkFileLocation(deviceItem))
         {
-            // Cancelled
-            cancelled = true;
-            break;
+            return;
         }
+    }
+
+    setBusy(true);
+    m_jobName = QString("Restore disk image");
 
-        // Read sectors from disk
-        sectorData = DiskUtilities::readSectorDataFromHandle(m_rawDiskHandle, i, (numSectors - i >= CHUNK_SIZE) ? CHUNK_SIZE : (numSectors - i), sectorSize, error);
-        if (!error.isEmpty())
+    // Lock and unmount volumes on these devices
+    foreach (DeviceItem* deviceItem, targets)
+    {
+        if (!lockAndUnmountVolumes(deviceItem))
         {
-            setError(error);
             setBusy(false);
-            update_message("Create disk image failed");
+            update_message("Restore disk image failed");
             return;
         }
+    }
 
-        // Write sectors to file
-        out << qCompress(sectorData, 9);
-
-        if (elapsedTimer.elapsed() >= ONE_SEC_IN_MS)
-        {
-            // Calculate speed
-            double mbPerSec = ((static_cast<double>(sectorSize) * (i - lastI)) * (static_cast<double>(ONE_SEC_IN_MS) / elapsedTimer.elapsed())) / static_cast<double>(MEGA_BYTES);
-            update_message(QString("Reading speed %1 MB/s").arg(formatDouble(mbPerSec, 2)));
-
-            // Calculate percentage
-            update_progress(static_cast<double>(i) / static_cast<double>(numSectors));
-
-            lastI = i;
-            elapsedTimer.restart();
-        }
-        QCoreApplication::processEvents();
+    // Several targets share one decoder, every chunk is decompressed once
+    ChunkCache* chunkCache = m_chunkCache.isEnabled() ? &m_chunkCache : nullptr;
+    if (targets.size() > 1)
+    {
+        m_fanOut.reset(new FanOutPipeline(m_imageFilePath, targets.size(), chunkCache));
     }
-    imageFile.close();
 
-    // Verify file when needed
-    if (m_verify)
+    for (int i = 0; i < targets.size(); i++)
     {
-        // Data verification
-        if (!verifyImage(deviceItem, sectorSize))
+        RestoreImageJob* job = new RestoreImageJob(targets.at(i)->get_deviceId().toInt(), m_imageFilePath, m_verify, m_discardHoles, m_differentialRestore, this);
+        job->setChunkCache(chunkCache);
+        if (m_fanOut)
         {
-            return;
+            job->setFanOut(m_fanOut.data(), i);
         }
+        startJob(job, targets.at(i)->get_deviceId(), QList<HANDLE>());
     }
 
-    setBusy(false);
-    if (cancelled)
-    {
-        update_message("Create disk image cancelled.");
-
-        // TODO remove unfinished file
-    }
-    else
+    if (m_fanOut)
     {
-        update_message("Create disk image succeeded.");
+        m_fanOut->start();
     }
 }
 
-void GuiManager::restoreImage()
+void GuiManager::verifyDevice()
 {
     // Clear message
     update_message("");
@@ -217,285 +265,277 @@ void GuiManager::restoreImage()
 
     if (m_imageFilePath.isEmpty())
     {
-        error = QString("Write Error;Please specify a image file to save data to.");
+        error = QString("File Error;Please specify an image or manifest file to compare with.");
         setError(error);
         return;
     }
 
-    DeviceItem* deviceItem = m_devices->at(m_deviceIndex);
-    if (!deviceItem)
+    QList<DeviceItem*> targets = targetDevices();
+    if (targets.isEmpty())
     {
-        error = QString("Write Error;Please select a device.");
+        error = QString("Read Error;Please check at least one device.");
         setError(error);
         return;
     }
 
-    // Check the image file
-    QFileInfo fileInfo(m_imageFilePath);
-    if (!fileInfo.exists() || !fileInfo.isFile())
+    if (!checkImageFile())
     {
-        error = QString("File Error;The selected file does not exist.");
-        setError(error);
         return;
     }
-    else if (!fileInfo.isReadable())
+
+    setBusy(true);
+    m_jobName = QString("Verify disk image");
+
+    // Every device is read by its own job, the volumes of all of them are locked first and stay locked until their job is done
+    QVector<QList<HANDLE>> lockedVolumes;
+    QString failedDevice;
+    if (!lockAllVolumes(targets, lockedVolumes, failedDevice))
     {
-        error = QString("File Error;You do not have permision to read the selected file.");
-        setError(error);
+        setBusy(false);
+        update_message(QString("Verify disk image failed, the volumes of device %1 cannot be locked. No device was verified.").arg(failedDevice));
         return;
     }
-    else if (fileInfo.size() == 0)
+    for (int i = 0; i < targets.size(); i++)
     {
-        error = QString("File Error;The specified file contains no data.");
+        startJob(new VerifyImageJob(targets.at(i)->get_deviceId().toInt(), m_imageFilePath, m_discardHoles, this), targets.at(i)->get_deviceId(), lockedVolumes.at(i));
+    }
+}
+
+void GuiManager::cloneDevice()
+{
+    // Clear message
+    update_message("");
+    QString error;
+
+    DeviceItem* source = m_devices->at(m_deviceIndex);
+    if (!source)
+    {
+        error = QString("Read Error;Please select a source device.");
         setError(error);
         return;
     }
 
-    QFile imageFile(m_imageFilePath);
-    if (!imageFile.open(QIODevice::ReadOnly))
+    QList<DeviceItem*> targets = targetDevices();
+    if (targets.isEmpty())
     {
-        error = QString("File Error;Cannot open specified image file.");
+        error = QString("Write Error;Please check at least one target device.");
         setError(error);
         return;
     }
-
-    // Check if image file is located on a volume on the selected device
-    if (!checkFileLocation(deviceItem))
+    else if (targets.contains(source))
     {
+        error = QString("Write Error;The source device cannot be a target device as well.");
+        setError(error);
         return;
     }
 
     setBusy(true);
+    m_jobName = QString("Clone disk");
 
-    // Lock and unmount volumes on this device
-    if (!lockAndUnmountVolumes(deviceItem))
+    // The source stays locked while it is read, the targets are unmounted
+    QList<HANDLE> lockedVolumes;
+    bool locked = lockVolumes(source, lockedVolumes);
+    QList<int> targetIds;
+    foreach (DeviceItem* deviceItem, targets)
     {
-        setBusy(false);
-        update_message("Restore disk image failed");
-        return;
+        locked = locked && lockAndUnmountVolumes(deviceItem);
+        targetIds << deviceItem->get_deviceId().toInt();
     }
 
-    // Get the handle of the target raw disk
-    m_rawDiskHandle = DiskUtilities::getHandleOnDevice(deviceItem->get_deviceId().toUInt(), GENERIC_WRITE, error);
-    if (m_rawDiskHandle == INVALID_HANDLE_VALUE)
+    if (!locked)
     {
-        setError(error);
+        unlockVolumes(lockedVolumes);
         setBusy(false);
-        update_message("Restore disk image failed");
+        update_message("Clone disk failed");
         return;
     }
 
-    quint64 sectorSize = 0;
-    DiskUtilities::getNumberOfSectors(m_rawDiskHandle, sectorSize, error);
-    if (!error.isEmpty())
-    {
-        setError(error);
-        setBusy(false);
-        update_message("Restore disk image failed");
-        return;
-    }
+    startJob(new CloneDiskJob(source->get_deviceId().toInt(), targetIds, m_verify, m_discardHoles, m_skipFreeSpace, this), source->get_deviceId(), lockedVolumes);
+}
 
-    quint64 targetDiskSize = rawDiskSize(m_rawDiskHandle);
-    if (0 == targetDiskSize)
-    {
-        //For external card readers you may not get device change notification when you remove the card/flash.
-        //(So no WM_DEVICECHANGE signal). Device stays but size goes to 0. [Is there special event for this on Windows??]
-        setBusy(false);
-        update_message("Restore disk image failed");
-        return;
-    }
+void GuiManager::startJob(ImagingJob* job, const QString& deviceId, const QList<HANDLE>& lockedVolumes)
+{
+    job->setQueueDepth(m_queueDepth);
+    job->setDirectIo(m_directIo);
+    connect(job, &QThread::finished, this, &GuiManager::onJobFinished);
 
-    QElapsedTimer elapsedTimer;
-    elapsedTimer.start();
-    quint64 lastI = 0;
-    bool cancelled = false;
-    QDataStream out;
-    out.setDevice(&imageFile);
-    quint64 imageDiskSize = 0;
-    out >> imageDiskSize;
+    RunningJob running = { job, deviceId, lockedVolumes, false };
+    m_jobs << running;
 
-    // Check if image disk size is larger than target disk size
-    if (imageDiskSize > targetDiskSize)
+    if (!m_progressTimer.isActive())
     {
-        error = QString("Write Error;Content in selected image file is larger than the size of the selected device.");
-        setError(error);
-        setBusy(false);
-        update_message("Restore disk image failed");
-        return;
+        m_lastStatus = SysDef::STATUS_IDLE;
+        m_lastBytes = 0;
+        m_speedTimer.start();
+        m_progressTimer.start();
     }
+    job->start();
+}
 
-    quint64 i = 0;
-    while (!out.atEnd())
+void GuiManager::onJobFinished()
+{
+    ImagingJob* job = qobject_cast<ImagingJob*>(sender());
+    bool allFinished = true;
+    for (int i = 0; i < m_jobs.size(); i++)
     {
-        if (!m_busy)
+        if (m_jobs.at(i).job == job)
         {
-            // Cancelled
-            cancelled = true;
-            break;
+            m_jobs[i].finished = true;
+
+            // The device is released as soon as its own job is done
+            unlockVolumes(m_jobs[i].lockedVolumes);
+
+            // Outcome of each target is shown next to the device
+            DeviceItem* deviceItem = m_devices->getByUid(m_jobs.at(i).deviceId);
+            if (deviceItem && (m_jobs.size() > 1))
+            {
+                deviceItem->update_statusText(job->message());
+            }
         }
+        allFinished = allFinished && m_jobs.at(i).finished;
+    }
+
+    if (allFinished)
+    {
+        finishJobs();
+    }
+}
+
+void GuiManager::finishJobs()
+{
+    m_progressTimer.stop();
 
-        // Read from file
-        QByteArray data;
-        out >> data;
-        QByteArray uncompressed = qUncompress(data);
-        quint64 wirteSectors = uncompressed.size() / sectorSize;
-        if (!DiskUtilities::writeSectorDataToHandle(m_rawDiskHandle, uncompressed, i, wirteSectors, sectorSize, error))
+    QString error;
+    QString message;
+    int succeeded = 0;
+    foreach (const RunningJob& running, m_jobs)
+    {
+        if (running.job->result() == ImagingJob::ResultSucceeded)
         {
-            setError(error);
-            setBusy(false);
-            update_message("Restore disk image failed");
-            return;
+            succeeded++;
         }
-
-        if (elapsedTimer.elapsed() >= ONE_SEC_IN_MS)
+        else if (error.isEmpty() && !running.job->error().isEmpty())
         {
-            // Calculate speed
-            double mbPerSec = ((static_cast<double>(sectorSize) * (i - lastI)) * (static_cast<double>(ONE_SEC_IN_MS) / elapsedTimer.elapsed())) / static_cast<double>(MEGA_BYTES);
-            update_message(QString("Writing speed %1 MB/s").arg(formatDouble(mbPerSec, 2)));
+            error = running.job->error();
 
-            // Calculate percentage
-            update_progress(static_cast<double>(imageFile.pos()) / static_cast<double>(imageFile.size()));
-
-            lastI = i;
-            elapsedTimer.restart();
+            // Name the device the first error belongs to when several were written
+            DeviceItem* deviceItem = m_devices->getByUid(running.deviceId);
+            if ((m_jobs.size() > 1) && deviceItem && error.contains(';'))
+            {
+                error.replace(error.indexOf(';'), 1, QString(";%1: ").arg(deviceItem->get_label()));
+            }
         }
-        i += wirteSectors;
-        QCoreApplication::processEvents();
+        message = running.job->message();
+        running.job->deleteLater();
     }
-    imageFile.close();
 
-    // Verify file when needed
-    if (m_verify)
+    if (m_jobs.size() > 1)
     {
-        // Data verification
-        if (!verifyImage(deviceItem, sectorSize))
-        {
-            return;
-        }
+        message = QString("%1 succeeded on %2 of %3 devices.").arg(m_jobName).arg(succeeded).arg(m_jobs.size());
     }
+    m_jobs.clear();
+    m_fanOut.reset();
 
+    setError(error);
     setBusy(false);
-    if (cancelled)
-    {
-        update_message("Restore disk image cancelled.");
-    }
-    else
-    {
-        update_message("Restore disk image succeeded.");
-    }
+    update_message(message);
 }
 
-bool GuiManager::verifyImage(const DeviceItem* deviceItem, const quint64 sectorSize)
+void GuiManager::onProgressTimeout()
 {
-    QString error;
-    update_progress(0);
-    update_message("");
-
-    if (m_rawDiskHandle != INVALID_HANDLE_VALUE)
+    if (m_jobs.isEmpty())
     {
-        CloseHandle(m_rawDiskHandle);
-        m_rawDiskHandle = INVALID_HANDLE_VALUE;
+        return;
     }
 
-    // Get raw disk handle in read mode
-    m_rawDiskHandle = DiskUtilities::getHandleOnDevice(deviceItem->get_deviceId().toUInt(), GENERIC_READ, error);
-    if (m_rawDiskHandle == INVALID_HANDLE_VALUE)
+    // Overall progress is the sum of all targets, the stage is the one of the first busy job
+    SysDef::Status status = SysDef::STATUS_IDLE;
+    quint64 bytesDone = 0;
+    quint64 bytesTotal = 0;
+    bool totalKnown = true;
+    foreach (const RunningJob& running, m_jobs)
     {
-        setError(error);
-        setBusy(false);
-        update_message("Verify disk image failed");
-        return false;
+        quint64 jobDone = running.job->bytesDone();
+        quint64 jobTotal = running.job->bytesTotal();
+        bytesDone += jobDone;
+        bytesTotal += jobTotal;
+
+        // The size of some raw images is only known once they are decoded
+        if (jobTotal < jobDone)
+        {
+            totalKnown = false;
+        }
+        if (!running.finished && (status == SysDef::STATUS_IDLE))
+        {
+            status = running.job->status();
+        }
+
+        DeviceItem* deviceItem = m_devices->getByUid(running.deviceId);
+        if (deviceItem && (jobTotal > 0) && (jobTotal >= jobDone))
+        {
+            deviceItem->update_progress(static_cast<double>(jobDone) / static_cast<double>(jobTotal));
+        }
     }
 
-    QFile imageFile(m_imageFilePath);
-    if (!imageFile.open(QIODevice::ReadOnly))
+    // Progress restarts when the job moves on to the next stage
+    if ((status != m_lastStatus) || (bytesDone < m_lastBytes))
     {
-        error = QString("Read Error;Cannot open image file.");
-        setError(error);
-        setBusy(false);
-        update_message("Verify disk image failed");
-        return false;
+        m_lastStatus = status;
+        m_lastBytes = bytesDone;
+        m_speedTimer.restart();
     }
 
-    QElapsedTimer elapsedTimer;
-    elapsedTimer.start();
-    quint64 lastI = 0;
-    bool cancelled = false;
-    QDataStream out;
-    out.setDevice(&imageFile);
-
-    quint64 totalSize = 0;
-    out >> totalSize;
+    if (totalKnown && (bytesTotal > 0))
+    {
+        // Calculate percentage
+        update_progress(static_cast<double>(bytesDone) / static_cast<double>(bytesTotal));
+    }
 
-    quint64 i = 0;
-    while (!out.atEnd())
+    if (m_speedTimer.elapsed() >= ONE_SEC_IN_MS)
     {
-        if (!m_busy)
+        QString action;
+        switch (status)
         {
-            // Cancelled
-            cancelled = true;
+        case SysDef::STATUS_READING:
+            action = QString("Reading");
+            break;
+        case SysDef::STATUS_WRITING:
+            action = QString("Writing");
             break;
+        case SysDef::STATUS_VERIFYING:
+            action = QString("Verifying");
+            break;
+        default:
+            return;
         }
 
-        // Read from file
-        QByteArray data;
-        out >> data;
-        QByteArray uncompressed = qUncompress(data);
-        quint64 readSectors = uncompressed.size() / sectorSize;
-
-        // Read sectors from disk
-        QByteArray sectorData = DiskUtilities::readSectorDataFromHandle(m_rawDiskHandle, i, readSectors, sectorSize, error);
-        if (!error.isEmpty())
+        // Calculate speed
+        double mbPerSec = (static_cast<double>(bytesDone - m_lastBytes) * (static_cast<double>(ONE_SEC_IN_MS) / m_speedTimer.elapsed())) / static_cast<double>(MEGA_BYTES);
+        if (totalKnown)
         {
-            setError(error);
-            setBusy(false);
-            update_message("Verify disk image failed");
-            return false;
+            update_message(QString("%1 speed %2 MB/s, %3 remaining").arg(action).arg(formatDouble(mbPerSec, 2)).arg(formatRemaining(bytesTotal - bytesDone, mbPerSec)));
         }
-
-        if (uncompressed != sectorData)
+        else
         {
-            error = QString("Verify Error;Data from image file and disk is NOT identical.");
-            setError(error);
-            setBusy(false);
-            update_message("Verify disk image failed");
-            return false;
+            update_message(QString("%1 speed %2 MB/s, %3 MB done").arg(action).arg(formatDouble(mbPerSec, 2)).arg(formatDouble(static_cast<double>(bytesDone) / static_cast<double>(MEGA_BYTES), 1)));
         }
 
-        if (elapsedTimer.elapsed() >= ONE_SEC_IN_MS)
-        {
-            // Calculate speed
-            double mbPerSec = ((static_cast<double>(sectorSize) * (i - lastI)) * (static_cast<double>(ONE_SEC_IN_MS) / elapsedTimer.elapsed())) / static_cast<double>(MEGA_BYTES);
-            update_message(QString("Verifying speed %1 MB/s").arg(formatDouble(mbPerSec, 2)));
-
-            // Calculate percentage
-            update_progress(static_cast<double>(imageFile.pos()) / static_cast<double>(imageFile.size()));
-
-            lastI = i;
-            elapsedTimer.restart();
-        }
-        i += readSectors;
-        QCoreApplication::processEvents();
-    }
-    imageFile.close();
-
-    if (cancelled)
-    {
-        update_message("Verify disk image cancelled.");
-        return false;
-    }
-    else
-    {
-        update_message("Verify disk image succeeded.");
-        return true;
+        m_lastBytes = bytesDone;
+        m_speedTimer.restart();
     }
 }
 
-
 void GuiManager::cancel()
 {
-    // Do not use setBusy here
-    // The loop in create/restore function will determine the busy status
+    // Running jobs stop at their next chunk and report back through onJobFinished
+    if (!m_jobs.isEmpty())
+    {
+        foreach (const RunningJob& running, m_jobs)
+        {
+            running.job->cancel();
+        }
+        return;
+    }
     setBusy(false);
 }
 
@@ -510,6 +550,11 @@ void GuiManager::onImageFileUrlChanged(const QUrl& path)
     set_imageFilePath(path.toLocalFile());
 }
 
+void GuiManager::onBaseImageUrlChanged(const QUrl& url)
+{
+    set_baseImagePath(url.toLocalFile());
+}
+
 void GuiManager::onImageFilePathChanged(const QString &path)
 {
     // Save the file dir as home dir
@@ -598,19 +643,19 @@ void GuiManager::removableDevices()
 
 void GuiManager::setBusy(const bool busy)
 {
-    // Close all handle and set to invalid when it is not busy
     if (!busy)
     {
-        unlockVolumes();
-        if (m_rawDiskHandle != INVALID_HANDLE_VALUE)
-        {
-            CloseHandle(m_rawDiskHandle);
-            m_rawDiskHandle = INVALID_HANDLE_VALUE;
-        }
-
         // Reset progress to 0
         update_progress(0);
     }
+    else
+    {
+        for (int i = 0; i < m_devices->count(); i++)
+        {
+            m_devices->at(i)->update_progress(0);
+            m_devices->at(i)->update_statusText(QString());
+        }
+    }
 
     update_busy(busy);
     if (m_busy)
@@ -618,6 +663,7 @@ void GuiManager::setBusy(const bool busy)
         update_canCancel(true);
         update_canRead(false);
         update_canWrite(false);
+        update_canClone(false);
     }
     else
     {
@@ -635,6 +681,7 @@ void GuiManager::enableReadWrite()
     // set read and write buttons according to status of file/device
     update_canRead(deviceSelected && fileSelected && (fileInfo.exists() ? fileInfo.isWritable() : true));
     update_canWrite(deviceSelected && fileSelected && fileInfo.isReadable());
+    update_canClone(deviceSelected && (m_devices->count() > 1));
 }
 
 void GuiManager::setError(QString &error)
@@ -661,12 +708,70 @@ void GuiManager::saveSettings()
 {
     QSettings settings;
     settings.setValue("Settings/HomeDir", m_homeDir);
+    if ((m_compressionMode >= 0) && (m_compressionMode < m_compressionModes.size()))
+    {
+        settings.setValue("Settings/Compression", m_compressionModes.at(m_compressionMode));
+    }
 }
 
 void GuiManager::loadSettings()
 {
     QSettings settings;
     update_homeDir(settings.value("Settings/HomeDir").toString());
+    // Outstanding device requests per job, 1 falls back to synchronous I/O
+    m_queueDepth = qBound(1, settings.value("Settings/QueueDepth", 4).toInt(), 64);
+    // Opt-in unbuffered device access, keeps large transfers out of the system cache
+    m_directIo = settings.value("Settings/DirectIo", false).toBool();
+
+    // Opt-in cache of decoded chunks for the next restore of the same image, in memory
+    // and optionally in a directory on a local disk
+    const quint64 mb = Q_UINT64_C(1024) * 1024;
+    m_chunkCache.setMemoryLimit(settings.value("Settings/CacheSizeMB", 0).toULongLong() * mb);
+    QString cacheError;
+    if (!m_chunkCache.setSpillDirectory(settings.value("Settings/CacheDir").toString(), settings.value("Settings/CacheDirSizeMB", 8192).toULongLong() * mb, cacheError))
+    {
+        update_message(QString("Chunk cache directory not used: %1").arg(cacheError.section(';', 1)));
+    }
+
+    // Shared directory where images created in repository mode keep their chunks
+    m_chunkRepositoryPath = settings.value("Settings/ChunkRepository").toString();
+    update_chunkRepositoryAvailable(!m_chunkRepositoryPath.isEmpty());
+
+    int mode = m_compressionModes.indexOf(settings.value("Settings/Compression").toString());
+    if (mode < 0)
+    {
+        mode = m_compressionModes.indexOf("Balanced (Zstandard 3)");
+    }
+    if (mode < 0)
+    {
+        mode = m_compressionModes.indexOf("Compatible (zlib 9)");
+    }
+    set_compressionMode(mode);
+}
+
+bool GuiManager::checkImageFile()
+{
+    QString error;
+    QFileInfo fileInfo(m_imageFilePath);
+    if (!fileInfo.exists() || !fileInfo.isFile())
+    {
+        error = QString("File Error;The selected file does not exist.");
+    }
+    else if (!fileInfo.isReadable())
+    {
+        error = QString("File Error;You do not have permision to read the selected file.");
+    }
+    else if (fileInfo.size() == 0)
+    {
+        error = QString("File Error;The specified file contains no data.");
+    }
+
+    if (!error.isEmpty())
+    {
+        setError(error);
+        return false;
+    }
+    return true;
 }
 
 bool GuiManager::checkFileLocation(const DeviceItem* deviceItem)
@@ -686,7 +791,7 @@ bool GuiManager::checkFileLocation(const DeviceItem* deviceItem)
     return false;
 }
 
-bool GuiManager::lockVolumes(const DeviceItem *deviceItem)
+bool GuiManager::lockVolumes(const DeviceItem *deviceItem, QList<HANDLE>& lockedVolumes)
 {
     if (deviceItem)
     {
@@ -703,17 +808,39 @@ bool GuiManager::lockVolumes(const DeviceItem *deviceItem)
             // Get lock on the volume
             if (!DiskUtilities::getLockOnVolume(hVolume, error))
             {
+                CloseHandle(hVolume);
                 setError(error);
                 return false;
             }
 
-            m_lockedVolumes << hVolume;
+            lockedVolumes << hVolume;
         }
         return true;
     }
     return false;
 }
 
+bool GuiManager::lockAllVolumes(const QList<DeviceItem*>& devices, QVector<QList<HANDLE>>& lockedVolumes, QString& failedDevice)
+{
+    // All or nothing, a device that cannot be locked releases the volumes of the others
+    lockedVolumes.clear();
+    foreach (const DeviceItem* deviceItem, devices)
+    {
+        lockedVolumes.append(QList<HANDLE>());
+        if (!lockVolumes(deviceItem, lockedVolumes.last()))
+        {
+            for (int i = 0; i < lockedVolumes.size(); i++)
+            {
+                unlockVolumes(lockedVolumes[i]);
+            }
+            lockedVolumes.clear();
+            failedDevice = deviceItem ? deviceItem->get_deviceId() : QString();
+            return false;
+        }
+    }
+    return true;
+}
+
 bool GuiManager::lockAndUnmountVolumes(const DeviceItem* deviceItem)
 {
     if (deviceItem)
@@ -751,21 +878,35 @@ bool GuiManager::lockAndUnmountVolumes(const DeviceItem* deviceItem)
     return false;
 }
 
-bool GuiManager::unlockVolumes()
+bool GuiManager::unlockVolumes(QList<HANDLE>& lockedVolumes)
 {
     QString error;
-    foreach(HANDLE hVolume, m_lockedVolumes)
+    bool unlocked = true;
+    foreach(HANDLE hVolume, lockedVolumes)
     {
-        // Unlock all locked volumes
+        // Unlock all locked volumes, the handles are closed in any case
         if (!DiskUtilities::removeLockOnVolume(hVolume, error))
         {
             setError(error);
-            return false;
+            unlocked = false;
         }
         CloseHandle(hVolume);
     }
-    m_lockedVolumes.clear();
-    return true;
+    lockedVolumes.clear();
+    return unlocked;
+}
+
+QList<DeviceItem*> GuiManager::targetDevices()
+{
+    QList<DeviceItem*> targets;
+    for (int i = 0; i < m_devices->count(); i++)
+    {
+        if (m_devices->at(i)->get_selected())
+        {
+            targets << m_devices->at(i);
+        }
+    }
+    return targets;
 }
 
 quint64 GuiManager::rawDiskSize(const HANDLE handle)
@@ -792,6 +933,19 @@ QString GuiManager::formatDiskSize(const quint64 size)
     }
 }
 
+QString GuiManager::formatRemaining(const quint64 remainingBytes, const double mbPerSec)
+{
+    if (mbPerSec <= 0.0)
+    {
+        return QString("--:--:--");
+    }
+
+    quint64 seconds = static_cast<quint64>((static_cast<double>(remainingBytes) / static_cast<double>(MEGA_BYTES)) / mbPerSec);
+    return QString("%1:%2:%3").arg(seconds / 3600, 2, 10, QChar('0'))
+                              .arg((seconds / 60) % 60, 2, 10, QChar('0'))
+                              .arg(seconds % 60, 2, 10, QChar('0'));
+}
+
 QString GuiManager::formatDouble(const double value, const int precision)
 {
     QString s;
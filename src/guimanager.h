@@ -3,17 +3,26 @@
 
 #include <QObject>
 #include <QEvent>
+#include <QElapsedTimer>
+#include <QScopedPointer>
+#include <QTimer>
+#include <QVector>
 
 #include "qqmlhelpers.h"
 #include "qqmlobjectlistmodel.h"
 #include "deviceitem.h"
 #include "diskutilities.h"
+#include "imagingjob.h"
+#include "fanoutpipeline.h"
+#include "chunkcache.h"
 
 class GuiManager : public QObject
 {
     Q_OBJECT
     QML_WRITABLE_PROPERTY(QUrl, imageFileUrl)
     QML_WRITABLE_PROPERTY(QString, imageFilePath)
+    QML_WRITABLE_PROPERTY(QUrl, baseImageUrl)
+    QML_WRITABLE_PROPERTY(QString, baseImagePath)
     QML_WRITABLE_PROPERTY(int, deviceIndex)
     QML_WRITABLE_PROPERTY(QString, error)
     QML_WRITABLE_PROPERTY(QString, errorType)
@@ -22,20 +31,31 @@ class GuiManager : public QObject
     QML_READONLY_PROPERTY(bool, canCancel)
     QML_READONLY_PROPERTY(bool, canRead)
     QML_READONLY_PROPERTY(bool, canWrite)
+    QML_READONLY_PROPERTY(bool, canClone)
     QML_READONLY_PROPERTY(bool, busy)
     QML_WRITABLE_PROPERTY(bool, verify)
+    QML_WRITABLE_PROPERTY(bool, discardHoles)
+    QML_WRITABLE_PROPERTY(bool, skipFreeSpace)
+    QML_WRITABLE_PROPERTY(bool, differentialRestore)
+    QML_READONLY_PROPERTY(bool, chunkRepositoryAvailable)
+    QML_WRITABLE_PROPERTY(bool, useChunkRepository)
     QML_READONLY_PROPERTY(double, progress)
     QML_READONLY_PROPERTY(QString, version)
+    QML_READONLY_PROPERTY(QStringList, compressionModes)
+    QML_WRITABLE_PROPERTY(int, compressionMode)
     QML_OBJMODEL_PROPERTY(DeviceItem, devices)
 
 public:
 
     explicit GuiManager(QObject *parent = nullptr);
+    ~GuiManager() override;
 
     bool event(QEvent* ev) override;
 
     Q_INVOKABLE void createImage();
     Q_INVOKABLE void restoreImage();
+    Q_INVOKABLE void cloneDevice();
+    Q_INVOKABLE void verifyDevice();
     Q_INVOKABLE void cancel();
 
 signals:
@@ -45,6 +65,12 @@ public slots:
     void onDeviceIndexChanged(const int index);
     void onImageFileUrlChanged(const QUrl& url);
     void onImageFilePathChanged(const QString& path);
+    void onBaseImageUrlChanged(const QUrl& url);
+
+private slots:
+    void onJobFinished();
+    void onProgressTimeout();
+
 private:
     void removableDevices();
     void setBusy(const bool busy);
@@ -53,18 +79,42 @@ private:
     int  volumeId(const QString& driveLabel);
     void saveSettings();
     void loadSettings();
+    bool checkImageFile();
     bool checkFileLocation(const DeviceItem* deviceItem);
-    bool lockVolumes(const DeviceItem* deviceItem);
+    bool lockVolumes(const DeviceItem* deviceItem, QList<HANDLE>& lockedVolumes);
+    bool lockAllVolumes(const QList<DeviceItem*>& devices, QVector<QList<HANDLE>>& lockedVolumes, QString& failedDevice);
     bool lockAndUnmountVolumes(const DeviceItem* deviceItem);
-    bool unlockVolumes();
+    bool unlockVolumes(QList<HANDLE>& lockedVolumes);
+    QList<DeviceItem*> targetDevices();
     quint64 rawDiskSize(const HANDLE handle);
     QString formatDiskSize(const quint64 size);
     QString formatDouble(const double value, const int precision);
-    bool verifyImage(const DeviceItem *deviceItem, const quint64 sectorSize);
+    QString formatRemaining(const quint64 remainingBytes, const double mbPerSec);
+    void startJob(ImagingJob* job, const QString& deviceId, const QList<HANDLE>& lockedVolumes);
+    void finishJobs();
 
 private:
-    HANDLE        m_rawDiskHandle = {INVALID_HANDLE_VALUE};
-    QList<HANDLE> m_lockedVolumes;
+    // Job of one device with the volumes it keeps locked, several run side by side
+    struct RunningJob
+    {
+        ImagingJob*   job;
+        QString       deviceId;
+        QList<HANDLE> lockedVolumes;
+        bool          finished;
+    };
+
+    QList<int>                     m_compressionModeTable;
+    QList<RunningJob>              m_jobs;
+    QScopedPointer<FanOutPipeline> m_fanOut;
+    ChunkCache                     m_chunkCache;
+    QString                        m_chunkRepositoryPath;
+    QString                        m_jobName;
+    int                            m_queueDepth = {4};
+    bool                           m_directIo = {false};
+    QTimer                         m_progressTimer;
+    QElapsedTimer                  m_speedTimer;
+    SysDef::Status                 m_lastStatus = {SysDef::STATUS_IDLE};
+    quint64                        m_lastBytes = {0};
 };
 
 #endif // GUIMANAGER_H
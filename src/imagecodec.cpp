@@ -0,0 +1,228 @@
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#include <lz4hc.h>
+#endif
+
+#include <climits>
+#include <cstring>
+
+#include "imagecodec.h"
+#include "bufferarena.h"
+
+// Codec state of the calling thread. ZSTD_compress, ZSTD_decompress and
+// LZ4_compress_HC set up and free a context on every call, which for 2 MB chunks
+// costs a noticeable share of the time; each worker keeps its own instead.
+struct CodecContext
+{
+#ifdef HAVE_ZSTD
+    ZSTD_CCtx* zstdCompress = {nullptr};
+    ZSTD_DCtx* zstdDecompress = {nullptr};
+#endif
+#ifdef HAVE_LZ4
+    QByteArray lz4HcState;
+#endif
+
+    ~CodecContext()
+    {
+#ifdef HAVE_ZSTD
+        ZSTD_freeCCtx(zstdCompress);
+        ZSTD_freeDCtx(zstdDecompress);
+#endif
+    }
+};
+
+static CodecContext& codecContext()
+{
+    static thread_local CodecContext context;
+    return context;
+}
+
+bool ImageCodec::isAvailable(const quint16 codec)
+{
+    switch (codec)
+    {
+    case CodecZlib:
+    case CodecStore:
+        return true;
+#ifdef HAVE_ZSTD
+    case CodecZstd:
+        return true;
+#endif
+#ifdef HAVE_LZ4
+    case CodecLz4:
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
+void ImageCodec::copyInto(const QByteArray& source, QByteArray& target)
+{
+    // Reuse the target buffer when it is large enough, share the source otherwise
+    if (target.capacity() >= source.size())
+    {
+        target.resize(source.size());
+        memcpy(BufferArena::writable(target), source.constData(), static_cast<size_t>(source.size()));
+    }
+    else
+    {
+        target = source;
+    }
+}
+
+QString ImageCodec::name(const quint16 codec)
+{
+    switch (codec)
+    {
+    case CodecZlib:
+        return QString("zlib");
+    case CodecStore:
+        return QString("store");
+    case CodecZstd:
+        return QString("zstd");
+    case CodecLz4:
+        return QString("lz4");
+    default:
+        return QString("unknown (%1)").arg(codec);
+    }
+}
+
+bool ImageCodec::compress(const quint16 codec, const int level, const QByteArray& data, QByteArray& payload, QString& msg)
+{
+    if (!isAvailable(codec))
+    {
+        msg = QString("Write Error;Compression codec %1 is not available in this build.").arg(name(codec));
+        return false;
+    }
+
+    switch (codec)
+    {
+    case CodecZlib:
+        payload = qCompress(data, level);
+        return true;
+    case CodecStore:
+        copyInto(data, payload);
+        return true;
+#ifdef HAVE_ZSTD
+    case CodecZstd:
+    {
+        CodecContext& context = codecContext();
+        if (!context.zstdCompress && !(context.zstdCompress = ZSTD_createCCtx()))
+        {
+            msg = QString("Write Error;Failed to allocate the compression context.");
+            return false;
+        }
+        payload.resize(static_cast<int>(ZSTD_compressBound(static_cast<size_t>(data.size()))));
+        size_t size = ZSTD_compressCCtx(context.zstdCompress, BufferArena::writable(payload), static_cast<size_t>(payload.size()), data.constData(), static_cast<size_t>(data.size()), level);
+        if (ZSTD_isError(size))
+        {
+            msg = QString("Write Error;Failed to compress data: %1").arg(ZSTD_getErrorName(size));
+            return false;
+        }
+        payload.resize(static_cast<int>(size));
+        return true;
+    }
+#endif
+#ifdef HAVE_LZ4
+    case CodecLz4:
+    {
+        payload.resize(LZ4_compressBound(data.size()));
+        int size = 0;
+        if (level > 1)
+        {
+            QByteArray& state = codecContext().lz4HcState;
+            if (state.isEmpty())
+            {
+                state.resize(LZ4_sizeofStateHC());
+            }
+            size = LZ4_compress_HC_extStateHC(state.data(), data.constData(), BufferArena::writable(payload), data.size(), payload.size(), level);
+        }
+        else
+        {
+            size = LZ4_compress_default(data.constData(), BufferArena::writable(payload), data.size(), payload.size());
+        }
+        if ((size <= 0) && !data.isEmpty())
+        {
+            msg = QString("Write Error;Failed to compress data.");
+            return false;
+        }
+        payload.resize(size);
+        return true;
+    }
+#endif
+    default:
+        return false;
+    }
+}
+
+bool ImageCodec::uncompress(const quint16 codec, const QByteArray& payload, const quint32 uncompressedLength, QByteArray& data, QString& msg)
+{
+    if (!isAvailable(codec))
+    {
+        msg = QString("File Error;The image file uses compression codec %1 which is not available in this build.").arg(name(codec));
+        return false;
+    }
+
+    // A QByteArray holds at most INT_MAX bytes, a damaged length must not outgrow the buffer
+    if (uncompressedLength > static_cast<quint32>(INT_MAX))
+    {
+        msg = QString("File Error;Failed to decompress data from the image file.");
+        return false;
+    }
+
+    bool ok = false;
+    switch (codec)
+    {
+    case CodecZlib:
+        data = qUncompress(payload);
+        ok = (static_cast<quint32>(data.size()) == uncompressedLength);
+        break;
+    case CodecStore:
+        copyInto(payload, data);
+        ok = (static_cast<quint32>(data.size()) == uncompressedLength);
+        break;
+#ifdef HAVE_ZSTD
+    case CodecZstd:
+    {
+        CodecContext& context = codecContext();
+        if (!context.zstdDecompress && !(context.zstdDecompress = ZSTD_createDCtx()))
+        {
+            break;
+        }
+        data.resize(static_cast<int>(uncompressedLength));
+        if (static_cast<quint32>(data.size()) != uncompressedLength)
+        {
+            break;
+        }
+        size_t size = ZSTD_decompressDCtx(context.zstdDecompress, BufferArena::writable(data), static_cast<size_t>(data.size()), payload.constData(), static_cast<size_t>(payload.size()));
+        ok = !ZSTD_isError(size) && (size == uncompressedLength);
+        break;
+    }
+#endif
+#ifdef HAVE_LZ4
+    case CodecLz4:
+    {
+        data.resize(static_cast<int>(uncompressedLength));
+        if (static_cast<quint32>(data.size()) != uncompressedLength)
+        {
+            break;
+        }
+        int size = LZ4_decompress_safe(payload.constData(), BufferArena::writable(data), payload.size(), data.size());
+        ok = (size >= 0) && (static_cast<quint32>(size) == uncompressedLength);
+        break;
+    }
+#endif
+    default:
+        break;
+    }
+
+    if (!ok)
+    {
+        msg = QString("File Error;Failed to decompress data from the image file.");
+    }
+    return ok;
+}
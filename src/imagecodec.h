@@ -0,0 +1,26 @@
+#ifndef IMAGECODEC_H
+#define IMAGECODEC_H
+
+#include <QByteArray>
+#include <QString>
+
+// Compression codecs for image chunks. The codec is stored in the image
+// header, zstd and lz4 support depends on HAVE_ZSTD and HAVE_LZ4 at build time.
+// Output goes into the capacity of the given payload/data buffer where the
+// codec allows it; zlib always returns a fresh buffer from qCompress/qUncompress.
+// zstd and lz4 HC keep their context per calling thread between chunks.
+class ImageCodec
+{
+public:
+    enum Codec { CodecZlib = 0, CodecStore = 1, CodecZstd = 2, CodecLz4 = 3 };
+
+    static bool    isAvailable(const quint16 codec);
+    static QString name(const quint16 codec);
+    static bool    compress(const quint16 codec, const int level, const QByteArray& data, QByteArray& payload, QString& msg);
+    static bool    uncompress(const quint16 codec, const QByteArray& payload, const quint32 uncompressedLength, QByteArray& data, QString& msg);
+
+private:
+    static void    copyInto(const QByteArray& source, QByteArray& target);
+};
+
+#endif // IMAGECODEC_H
@@ -0,0 +1,703 @@
+#include <QDataStream>
+#include <QDir>
+#include <QFileInfo>
+
+#ifdef Q_OS_WIN
+#include <windows.h>
+#include <io.h>
+#endif
+
+#include <climits>
+
+#include "imageformat.h"
+#include "checksum.h"
+#include "bufferscan.h"
+#include "bufferarena.h"
+#include "chunkrepository.h"
+
+// "WDISKADI", a version 1 image can never start with this value as it would be its size in bytes
+const quint64 ImageFormat::MAGIC = Q_UINT64_C(0x574449534B414449);
+
+bool ImageFormat::isHole(const ChunkEntry& entry)
+{
+    return (entry.flags & CHUNK_FILL) != 0;
+}
+
+bool ImageFormat::isZeroHole(const ChunkEntry& entry)
+{
+    return isHole(entry) && (fillByte(entry) == 0);
+}
+
+bool ImageFormat::isBaseReference(const ChunkEntry& entry)
+{
+    return (entry.flags & CHUNK_BASE) != 0;
+}
+
+bool ImageFormat::isRepositoryReference(const ChunkEntry& entry)
+{
+    return (entry.flags & CHUNK_REPOSITORY) != 0;
+}
+
+bool ImageFormat::isUnallocated(const ChunkEntry& entry)
+{
+    return isHole(entry) && ((entry.flags & CHUNK_UNALLOCATED) != 0);
+}
+
+quint8 ImageFormat::fillByte(const ChunkEntry& entry)
+{
+    return static_cast<quint8>((entry.flags >> 8) & 0xFF);
+}
+
+quint64 ImageFormat::imageDigest(const QVector<ChunkEntry>& chunks)
+{
+    // Covers what a device is compared against, not where the payloads are in the file
+    QByteArray index;
+    QDataStream out(&index, QIODevice::WriteOnly);
+    foreach (const ChunkEntry& entry, chunks)
+    {
+        out << entry.deviceOffset << entry.uncompressedLength << entry.flags << entry.checksum;
+    }
+    return Checksum::xxh64(index.constData(), static_cast<quint64>(index.size()));
+}
+
+QString ImageFormat::manifestPath(const QString& imagePath)
+{
+    QFileInfo fileInfo(imagePath);
+    return QString("%1/%2.adm").arg(fileInfo.path()).arg(fileInfo.completeBaseName());
+}
+
+ChunkEntry ImageFormat::unallocatedChunk(const quint64 deviceOffset, const quint32 length)
+{
+    ChunkEntry entry;
+    entry.deviceOffset = deviceOffset;
+    entry.uncompressedLength = length;
+    entry.flags = CHUNK_FILL | CHUNK_UNALLOCATED;
+    return entry;
+}
+
+QString ImageFormat::linkedName(const ImageHeader& header)
+{
+    // A delta image never writes to a repository, so one name slot serves both
+    return (header.flags & IMAGE_REPOSITORY) ? header.repositoryName : header.baseName;
+}
+
+bool ImageFormat::encodeChunk(const ImageHeader& header, const quint64 deviceOffset, const QByteArray& data, ChunkEntry& entry, QByteArray& payload, QString& msg, const ChunkEntry* base)
+{
+    entry = ChunkEntry();
+    entry.checksum = Checksum::xxh64(data.constData(), static_cast<quint64>(data.size()));
+
+    // Chunks of a single byte value need no payload, neither do chunks the base image holds
+    quint8 fill = 0;
+    if (BufferScan::isFilled(data.constData(), static_cast<quint64>(data.size()), fill))
+    {
+        payload.resize(0);
+        entry.flags = CHUNK_FILL | (static_cast<quint32>(fill) << 8);
+    }
+    else if (base && !isHole(*base) && (base->uncompressedLength == static_cast<quint32>(data.size())) && (base->checksum == entry.checksum))
+    {
+        payload.resize(0);
+        entry.flags = CHUNK_BASE;
+    }
+    else if (!ImageCodec::compress(header.codec, header.codecLevel, data, payload, msg))
+    {
+        return false;
+    }
+
+    // File offset is assigned when the payload is appended to the image
+    entry.deviceOffset = deviceOffset;
+    entry.compressedLength = static_cast<quint32>(payload.size());
+    entry.uncompressedLength = static_cast<quint32>(data.size());
+    return true;
+}
+
+bool ImageFormat::decodeChunk(const quint16 codec, const ChunkEntry& entry, const QByteArray& payload, QByteArray& data, QString& msg)
+{
+    if (isHole(entry))
+    {
+        // A damaged length would turn negative as a size
+        if (entry.uncompressedLength > static_cast<quint32>(INT_MAX))
+        {
+            msg = QString("File Error;The chunk index of the image file is damaged.");
+            return false;
+        }
+        data.fill(static_cast<char>(fillByte(entry)), static_cast<int>(entry.uncompressedLength));
+        return true;
+    }
+    return ImageCodec::uncompress(codec, payload, entry.uncompressedLength, data, msg);
+}
+
+ImageWriter::ImageWriter()
+{
+}
+
+ImageWriter::~ImageWriter()
+{
+    close();
+}
+
+bool ImageWriter::open(const QString& path, const ImageHeader& header, QString& msg)
+{
+    m_header = header;
+    m_header.version = ImageFormat::VERSION_2;
+    m_chunks.clear();
+
+    m_file.setFileName(path);
+    if (!m_file.open(QIODevice::WriteOnly))
+    {
+        msg = QString("Write Error;Cannot open image file.");
+        return false;
+    }
+
+    QByteArray linkedName = ImageFormat::linkedName(m_header).toUtf8();
+    if (!writeHeader(m_file, m_header) || (m_file.write(linkedName) != linkedName.size()))
+    {
+        msg = QString("Write Error;Cannot write header to image file.");
+        return false;
+    }
+    return true;
+}
+
+bool ImageWriter::resume(const QString& path, const ImageHeader& header, const QVector<ChunkEntry>& chunks, const quint64 fileLength, QString& msg)
+{
+    m_header = header;
+    m_header.version = ImageFormat::VERSION_2;
+    m_chunks = chunks;
+
+    // Whatever follows the last committed chunk is dropped and written again
+    m_file.setFileName(path);
+    if (!m_file.open(QIODevice::ReadWrite) || (static_cast<quint64>(m_file.size()) < fileLength) ||
+        !m_file.resize(static_cast<qint64>(fileLength)) || !m_file.seek(static_cast<qint64>(fileLength)))
+    {
+        msg = QString("Write Error;Cannot continue the unfinished image file.");
+        return false;
+    }
+    return true;
+}
+
+void ImageWriter::setBase(const QVector<ChunkEntry>& baseChunks)
+{
+    m_baseChunks.clear();
+    foreach (const ChunkEntry& entry, baseChunks)
+    {
+        m_baseChunks.insert(entry.deviceOffset, entry);
+    }
+}
+
+const ChunkEntry* ImageWriter::baseChunk(const quint64 deviceOffset) const
+{
+    QHash<quint64, ChunkEntry>::const_iterator it = m_baseChunks.constFind(deviceOffset);
+    return (it == m_baseChunks.constEnd()) ? nullptr : &it.value();
+}
+
+bool ImageWriter::writeHeader(QIODevice& device, const ImageHeader& header)
+{
+    QByteArray headerData;
+    QDataStream out(&headerData, QIODevice::WriteOnly);
+    out << ImageFormat::MAGIC << header.version << header.codec << header.sectorSize
+        << header.chunkSize << header.flags << header.totalSize << header.codecLevel << header.imageDigest
+        << header.baseDigest << static_cast<quint16>(ImageFormat::linkedName(header).toUtf8().size());
+    headerData.append(QByteArray(ImageFormat::HEADER_SIZE - headerData.size(), '\0'));
+    return device.write(headerData) == headerData.size();
+}
+
+bool ImageWriter::writeIndex(QIODevice& device, const QVector<ChunkEntry>& chunks, const quint64 indexOffset)
+{
+    QDataStream out(&device);
+    foreach (const ChunkEntry& entry, chunks)
+    {
+        out << entry.deviceOffset << entry.fileOffset << entry.compressedLength
+            << entry.uncompressedLength << entry.flags << entry.checksum;
+    }
+
+    // Trailer, the index offset is found relative to the end of the file
+    out << indexOffset << static_cast<quint64>(chunks.size()) << ImageFormat::MAGIC;
+    return out.status() == QDataStream::Ok;
+}
+
+bool ImageWriter::writeChunk(const quint64 deviceOffset, const QByteArray& data, QString& msg)
+{
+    ChunkEntry entry;
+    QByteArray payload;
+    if (!ImageFormat::encodeChunk(m_header, deviceOffset, data, entry, payload, msg, baseChunk(deviceOffset)))
+    {
+        return false;
+    }
+    return appendChunk(entry, payload, msg);
+}
+
+bool ImageWriter::appendChunk(ChunkEntry entry, const QByteArray& payload, QString& msg)
+{
+    entry.fileOffset = static_cast<quint64>(m_file.pos());
+    if (m_file.write(payload) != payload.size())
+    {
+        msg = QString("Write Error;Cannot write data to image file.");
+        return false;
+    }
+    m_chunks.append(entry);
+    return true;
+}
+
+bool ImageWriter::sync(QString& msg)
+{
+    // The chunks written so far reach the disk before a checkpoint refers to them
+    bool synced = m_file.flush();
+#ifdef Q_OS_WIN
+    synced = synced && FlushFileBuffers(reinterpret_cast<HANDLE>(_get_osfhandle(m_file.handle())));
+#endif
+    if (!synced)
+    {
+        msg = QString("Write Error;Cannot flush the image file.");
+        return false;
+    }
+    return true;
+}
+
+bool ImageWriter::finish(QString& msg)
+{
+    quint64 indexOffset = static_cast<quint64>(m_file.pos());
+    if (!writeIndex(m_file, m_chunks, indexOffset) || !m_file.flush())
+    {
+        msg = QString("Write Error;Cannot write chunk index to image file.");
+        return false;
+    }
+
+    // The digest of the index is only known now, the header is written again
+    m_header.imageDigest = ImageFormat::imageDigest(m_chunks);
+    if (!m_file.seek(0) || !writeHeader(m_file, m_header) || !m_file.flush())
+    {
+        msg = QString("Write Error;Cannot write header to image file.");
+        return false;
+    }
+    m_file.close();
+    return true;
+}
+
+bool ImageWriter::writeManifest(const QString& path, QString& msg) const
+{
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly))
+    {
+        msg = QString("Write Error;Cannot open manifest file.");
+        return false;
+    }
+
+    // Same layout as the image with every payload left out
+    ImageHeader header = m_header;
+    header.flags |= ImageFormat::IMAGE_MANIFEST;
+    header.imageDigest = ImageFormat::imageDigest(m_chunks);
+    QVector<ChunkEntry> chunks = m_chunks;
+    for (int i = 0; i < chunks.size(); i++)
+    {
+        chunks[i].fileOffset = ImageFormat::HEADER_SIZE;
+        chunks[i].compressedLength = 0;
+    }
+
+    if (!writeHeader(file, header) || !writeIndex(file, chunks, ImageFormat::HEADER_SIZE) || !file.flush())
+    {
+        msg = QString("Write Error;Cannot write manifest file.");
+        return false;
+    }
+    return true;
+}
+
+void ImageWriter::close()
+{
+    if (m_file.isOpen())
+    {
+        m_file.close();
+    }
+}
+
+const ImageHeader& ImageWriter::header() const
+{
+    return m_header;
+}
+
+const QVector<ChunkEntry>& ImageWriter::chunks() const
+{
+    return m_chunks;
+}
+
+quint64 ImageWriter::fileLength() const
+{
+    return static_cast<quint64>(m_file.pos());
+}
+
+ImageReader::ImageReader()
+{
+}
+
+ImageReader::~ImageReader()
+{
+    close();
+}
+
+bool ImageReader::open(const QString& path, QString& msg)
+{
+    m_header = ImageHeader();
+    m_chunks.clear();
+    m_base.reset();
+    m_baseIndex.clear();
+    m_repository = nullptr;
+
+    m_file.setFileName(path);
+    if (!m_file.open(QIODevice::ReadOnly))
+    {
+        msg = QString("File Error;Cannot open specified image file.");
+        return false;
+    }
+
+    QDataStream in(&m_file);
+    quint64 magic = 0;
+    in >> magic;
+    if (in.status() != QDataStream::Ok)
+    {
+        msg = QString("File Error;The specified file is not a valid image file.");
+        return false;
+    }
+
+    if (magic == ImageFormat::MAGIC)
+    {
+        return readHeaderV2(msg) && readIndexV2(msg) && openBase(msg) && openRepository(msg);
+    }
+
+    // Version 1 images start with the total size of the disk
+    m_header.version = ImageFormat::VERSION_1;
+    m_header.codec = ImageCodec::CodecZlib;
+    m_header.totalSize = magic;
+    return scanV1(msg);
+}
+
+void ImageReader::close()
+{
+    if (m_file.isOpen())
+    {
+        m_file.close();
+    }
+    m_base.reset();
+}
+
+const ImageHeader& ImageReader::header() const
+{
+    return m_header;
+}
+
+const QVector<ChunkEntry>& ImageReader::chunks() const
+{
+    return m_chunks;
+}
+
+quint64 ImageReader::totalSize() const
+{
+    return m_header.totalSize;
+}
+
+bool ImageReader::isManifest() const
+{
+    return (m_header.flags & ImageFormat::IMAGE_MANIFEST) != 0;
+}
+
+quint64 ImageReader::dataSize() const
+{
+    quint64 size = 0;
+    foreach (const ChunkEntry& entry, m_chunks)
+    {
+        size += entry.uncompressedLength;
+    }
+    return size;
+}
+
+bool ImageReader::readCompressedChunk(const int index, QByteArray& payload, QString& msg)
+{
+    const ChunkEntry& entry = m_chunks.at(index);
+    if (ImageFormat::isBaseReference(entry))
+    {
+        return m_base->readCompressedChunk(m_baseIndex.at(index), payload, msg);
+    }
+    if (ImageFormat::isRepositoryReference(entry))
+    {
+        QByteArray key;
+        return readRepositoryKey(index, key, msg) && m_repository->readChunk(key, payload, msg);
+    }
+    return readStoredPayload(index, payload, msg);
+}
+
+bool ImageReader::readStoredPayload(const int index, QByteArray& payload, QString& msg)
+{
+    const ChunkEntry& entry = m_chunks.at(index);
+    if (entry.compressedLength == 0)
+    {
+        payload.resize(0);
+        return true;
+    }
+
+    if (!m_file.seek(static_cast<qint64>(entry.fileOffset)))
+    {
+        msg = QString("Read Error;Cannot seek in image file.");
+        return false;
+    }
+
+    // Read into the caller's buffer, it is only reallocated when too small
+    payload.resize(static_cast<int>(entry.compressedLength));
+    if (m_file.read(BufferArena::writable(payload), entry.compressedLength) != static_cast<qint64>(entry.compressedLength))
+    {
+        msg = QString("Read Error;Unexpected end of image file.");
+        return false;
+    }
+    return true;
+}
+
+bool ImageReader::readRepositoryKey(const int index, QByteArray& key, QString& msg)
+{
+    if ((m_chunks.at(index).compressedLength != static_cast<quint32>(ChunkRepository::KEY_SIZE)) || !readStoredPayload(index, key, msg))
+    {
+        msg = QString("Read Error;Cannot read the repository key of chunk %1 from the image file.").arg(index);
+        return false;
+    }
+    return true;
+}
+
+bool ImageReader::readChunk(const int index, QByteArray& data, QString& msg)
+{
+    QByteArray payload;
+    if (!readCompressedChunk(index, payload, msg))
+    {
+        return false;
+    }
+
+    return decodeChunk(index, payload, data, msg);
+}
+
+bool ImageReader::decodeChunk(const int index, const QByteArray& payload, QByteArray& data, QString& msg) const
+{
+    // Does not touch the file so it may run on any thread
+    const ChunkEntry& entry = m_chunks.at(index);
+    if (ImageFormat::isBaseReference(entry))
+    {
+        return m_base->decodeChunk(m_baseIndex.at(index), payload, data, msg);
+    }
+    if (ImageFormat::isRepositoryReference(entry))
+    {
+        if (!ChunkRepository::decodeChunk(entry, payload, data, msg))
+        {
+            return false;
+        }
+    }
+    else if (!ImageFormat::decodeChunk(m_header.codec, entry, payload, data, msg))
+    {
+        return false;
+    }
+
+    if ((m_header.version >= ImageFormat::VERSION_2) && !ImageFormat::isUnallocated(entry) &&
+        (Checksum::xxh64(data.constData(), static_cast<quint64>(data.size())) != entry.checksum))
+    {
+        msg = QString("File Error;Checksum mismatch in chunk %1 of the image file.").arg(index);
+        return false;
+    }
+    return true;
+}
+
+bool ImageReader::readHeaderV2(QString& msg)
+{
+    QDataStream in(&m_file);
+    quint16 baseNameLength = 0;
+    in >> m_header.version >> m_header.codec >> m_header.sectorSize
+       >> m_header.chunkSize >> m_header.flags >> m_header.totalSize >> m_header.codecLevel >> m_header.imageDigest
+       >> m_header.baseDigest >> baseNameLength;
+    if (in.status() != QDataStream::Ok)
+    {
+        msg = QString("File Error;The header of the image file is damaged.");
+        return false;
+    }
+
+    // A manifest has no room for the linked name, its index follows the header directly
+    if ((m_header.flags & (ImageFormat::IMAGE_DELTA | ImageFormat::IMAGE_REPOSITORY)) && !isManifest())
+    {
+        m_file.seek(ImageFormat::HEADER_SIZE);
+        QByteArray linkedName = m_file.read(baseNameLength);
+        if (linkedName.size() != baseNameLength)
+        {
+            msg = QString("File Error;The header of the image file is damaged.");
+            return false;
+        }
+        if (m_header.flags & ImageFormat::IMAGE_REPOSITORY)
+        {
+            m_header.repositoryName = QString::fromUtf8(linkedName);
+        }
+        else
+        {
+            m_header.baseName = QString::fromUtf8(linkedName);
+        }
+    }
+
+    if (m_header.version != ImageFormat::VERSION_2)
+    {
+        msg = QString("File Error;Image file version %1 is not supported.").arg(m_header.version);
+        return false;
+    }
+    return true;
+}
+
+bool ImageReader::readIndexV2(QString& msg)
+{
+    qint64 fileSize = m_file.size();
+    if (fileSize < ImageFormat::HEADER_SIZE + ImageFormat::TRAILER_SIZE)
+    {
+        msg = QString("File Error;The image file is incomplete.");
+        return false;
+    }
+
+    QDataStream in(&m_file);
+    m_file.seek(fileSize - ImageFormat::TRAILER_SIZE);
+    quint64 indexOffset = 0;
+    quint64 chunkCount = 0;
+    quint64 magic = 0;
+    in >> indexOffset >> chunkCount >> magic;
+
+    // Bounded by the file before multiplying, a damaged count cannot wrap the index size
+    quint64 indexEnd = static_cast<quint64>(fileSize - ImageFormat::TRAILER_SIZE);
+    quint64 maxChunks = (indexEnd - ImageFormat::HEADER_SIZE) / ImageFormat::INDEX_ENTRY_SIZE;
+    if ((magic != ImageFormat::MAGIC) || (chunkCount > maxChunks) ||
+        (chunkCount > static_cast<quint64>(INT_MAX)) ||
+        (indexOffset < static_cast<quint64>(ImageFormat::HEADER_SIZE)) ||
+        (indexOffset + chunkCount * ImageFormat::INDEX_ENTRY_SIZE != indexEnd))
+    {
+        msg = QString("File Error;The image file is incomplete or its chunk index is damaged.");
+        return false;
+    }
+
+    m_file.seek(static_cast<qint64>(indexOffset));
+    m_chunks.resize(static_cast<int>(chunkCount));
+    for (int i = 0; i < m_chunks.size(); i++)
+    {
+        ChunkEntry& entry = m_chunks[i];
+        in >> entry.deviceOffset >> entry.fileOffset >> entry.compressedLength
+           >> entry.uncompressedLength >> entry.flags >> entry.checksum;
+
+        // Every chunk decodes to at most one chunk of the device and its payload lies before the index
+        if ((entry.uncompressedLength == 0) || (entry.uncompressedLength > m_header.chunkSize) ||
+            (entry.fileOffset > indexOffset) || (entry.compressedLength > indexOffset - entry.fileOffset))
+        {
+            msg = QString("File Error;The chunk index of the image file is damaged.");
+            return false;
+        }
+    }
+
+    if (in.status() != QDataStream::Ok)
+    {
+        msg = QString("File Error;Cannot read the chunk index of the image file.");
+        return false;
+    }
+
+    if ((m_header.imageDigest != 0) && (ImageFormat::imageDigest(m_chunks) != m_header.imageDigest))
+    {
+        msg = QString("File Error;The chunk index of the image file does not match its digest.");
+        return false;
+    }
+    return true;
+}
+
+bool ImageReader::openBase(QString& msg)
+{
+    if (!(m_header.flags & ImageFormat::IMAGE_DELTA) || isManifest())
+    {
+        return true;
+    }
+
+    // The base is found relative to the delta, so both can be moved together
+    QString basePath = QFileInfo(m_file.fileName()).dir().absoluteFilePath(m_header.baseName);
+    m_base.reset(new ImageReader());
+    if (!m_base->open(basePath, msg))
+    {
+        msg = QString("File Error;Cannot open the base image %1 of this delta image.").arg(QDir::toNativeSeparators(basePath));
+        return false;
+    }
+    if (m_base->header().imageDigest != m_header.baseDigest)
+    {
+        msg = QString("File Error;The base image %1 has changed since this delta image was created.").arg(QDir::toNativeSeparators(basePath));
+        return false;
+    }
+
+    // Every reference must name a base chunk at the same device offset
+    QHash<quint64, int> baseOffsets;
+    for (int i = 0; i < m_base->chunks().size(); i++)
+    {
+        baseOffsets.insert(m_base->chunks().at(i).deviceOffset, i);
+    }
+    m_baseIndex.fill(-1, m_chunks.size());
+    for (int i = 0; i < m_chunks.size(); i++)
+    {
+        if (!ImageFormat::isBaseReference(m_chunks.at(i)))
+        {
+            continue;
+        }
+        int baseIndex = baseOffsets.value(m_chunks.at(i).deviceOffset, -1);
+        if ((baseIndex < 0) || (m_base->chunks().at(baseIndex).checksum != m_chunks.at(i).checksum))
+        {
+            msg = QString("File Error;Chunk %1 of the delta image is missing from its base image.").arg(i);
+            return false;
+        }
+        m_baseIndex[i] = baseIndex;
+    }
+    return true;
+}
+
+bool ImageReader::openRepository(QString& msg)
+{
+    if (!(m_header.flags & ImageFormat::IMAGE_REPOSITORY) || isManifest())
+    {
+        return true;
+    }
+
+    QString repositoryPath = QFileInfo(m_file.fileName()).dir().absoluteFilePath(m_header.repositoryName);
+    if (!QFileInfo(repositoryPath).isDir())
+    {
+        msg = QString("File Error;Cannot find the chunk repository %1 of this image.").arg(QDir::toNativeSeparators(repositoryPath));
+        return false;
+    }
+    m_repository = ChunkRepository::open(repositoryPath, msg);
+    return m_repository != nullptr;
+}
+
+bool ImageReader::scanV1(QString& msg)
+{
+    // Walk the length prefixes of the QDataStream framed blobs to build an index,
+    // the uncompressed length is the big endian size qCompress puts in front of its data
+    QDataStream in(&m_file);
+    quint64 deviceOffset = 0;
+    qint64 fileSize = m_file.size();
+
+    while (!in.atEnd())
+    {
+        quint32 length = 0;
+        in >> length;
+        if (in.status() != QDataStream::Ok)
+        {
+            msg = QString("File Error;The image file is damaged.");
+            return false;
+        }
+
+        // Null byte array
+        if (length == 0xFFFFFFFF)
+        {
+            continue;
+        }
+
+        ChunkEntry entry;
+        entry.deviceOffset = deviceOffset;
+        entry.fileOffset = static_cast<quint64>(m_file.pos());
+        entry.compressedLength = length;
+        if ((length < 4) || (static_cast<qint64>(entry.fileOffset + length) > fileSize))
+        {
+            msg = QString("File Error;The image file is incomplete.");
+            return false;
+        }
+
+        in >> entry.uncompressedLength;
+        m_file.seek(static_cast<qint64>(entry.fileOffset + length));
+
+        deviceOffset += entry.uncompressedLength;
+        m_chunks.append(entry);
+    }
+    return true;
+}
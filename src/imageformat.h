@@ -0,0 +1,167 @@
+#ifndef IMAGEFORMAT_H
+#define IMAGEFORMAT_H
+
+#include <QFile>
+#include <QHash>
+#include <QScopedPointer>
+#include <QString>
+#include <QVector>
+
+#include "imagecodec.h"
+
+class ChunkRepository;
+
+// Layout of an Applikon Disk Image (.adi)
+//
+// Version 1: quint64 total size, followed by QDataStream framed qCompress blobs.
+//
+// Version 2: fixed size header, chunk payloads back to back, chunk index and trailer.
+//   [header][payload 0][payload 1]...[payload N-1][index entry 0..N-1][trailer]
+//   The trailer holds the offset of the index so any chunk can be reached directly.
+//   Chunks filled with a single byte value (mostly zero) are stored as holes without payload.
+//   Every chunk carries the XXH64 of its uncompressed data. The header holds a digest over
+//   the whole index so a damaged index is detected, zero in images written before it.
+//   A manifest (.adm) is an image without payloads: header, index and trailer only.
+//   It is enough to verify a device when the image file itself is not at hand.
+//   A delta image refers to a base image: chunks equal to the base chunk at the same
+//   device offset carry no payload and are read from the base. The path of the base,
+//   relative to the delta, follows the header and the header holds the base digest.
+//   A repository image keeps its payloads in a chunk repository: the payload of every
+//   chunk that is not a hole is the 32 byte key of the chunk there. The path of the
+//   repository, relative to the image, follows the header in place of a base name.
+
+struct ImageHeader
+{
+    quint16 version = {0};
+    quint16 codec = {0};
+    quint32 sectorSize = {0};
+    quint32 chunkSize = {0};
+    quint32 flags = {0};
+    quint64 totalSize = {0};
+    qint32  codecLevel = {0};
+    quint64 imageDigest = {0};
+    quint64 baseDigest = {0};
+    QString baseName;
+    QString repositoryName;
+};
+
+struct ChunkEntry
+{
+    quint64 deviceOffset = {0};
+    quint64 fileOffset = {0};
+    quint32 compressedLength = {0};
+    quint32 uncompressedLength = {0};
+    quint32 flags = {0};
+    quint64 checksum = {0};
+};
+
+class ImageFormat
+{
+public:
+    static const quint64 MAGIC;
+    static const quint16 VERSION_1 = 1;
+    static const quint16 VERSION_2 = 2;
+    static const int     HEADER_SIZE = 64;
+    static const int     INDEX_ENTRY_SIZE = 36;
+    static const int     TRAILER_SIZE = 24;
+
+    // Chunk flags, the fill byte of a hole is kept in bits 8-15. Unallocated
+    // chunks are zero holes for space the file system does not use, they
+    // were never read from the device and carry no checksum.
+    static const quint32 CHUNK_FILL = 0x00000001;
+    static const quint32 CHUNK_UNALLOCATED = 0x00000002;
+    static const quint32 CHUNK_BASE = 0x00000004;
+    static const quint32 CHUNK_REPOSITORY = 0x00000008;
+
+    // Header flags
+    static const quint32 IMAGE_MANIFEST = 0x00000001;
+    static const quint32 IMAGE_DELTA = 0x00000002;
+    static const quint32 IMAGE_REPOSITORY = 0x00000004;
+
+    static bool  isHole(const ChunkEntry& entry);
+    static bool  isZeroHole(const ChunkEntry& entry);
+    static bool  isUnallocated(const ChunkEntry& entry);
+    static bool  isBaseReference(const ChunkEntry& entry);
+    static bool  isRepositoryReference(const ChunkEntry& entry);
+    static quint8 fillByte(const ChunkEntry& entry);
+
+    static quint64 imageDigest(const QVector<ChunkEntry>& chunks);
+    static QString manifestPath(const QString& imagePath);
+    static ChunkEntry unallocatedChunk(const quint64 deviceOffset, const quint32 length);
+    static QString linkedName(const ImageHeader& header);
+    static bool encodeChunk(const ImageHeader& header, const quint64 deviceOffset, const QByteArray& data, ChunkEntry& entry, QByteArray& payload, QString& msg, const ChunkEntry* base = nullptr);
+    static bool decodeChunk(const quint16 codec, const ChunkEntry& entry, const QByteArray& payload, QByteArray& data, QString& msg);
+};
+
+class ImageWriter
+{
+public:
+    ImageWriter();
+    ~ImageWriter();
+
+    bool open(const QString& path, const ImageHeader& header, QString& msg);
+    bool resume(const QString& path, const ImageHeader& header, const QVector<ChunkEntry>& chunks, const quint64 fileLength, QString& msg);
+    void setBase(const QVector<ChunkEntry>& baseChunks);
+    const ChunkEntry* baseChunk(const quint64 deviceOffset) const;
+    bool writeChunk(const quint64 deviceOffset, const QByteArray& data, QString& msg);
+    bool appendChunk(ChunkEntry entry, const QByteArray& payload, QString& msg);
+    bool sync(QString& msg);
+    bool finish(QString& msg);
+    bool writeManifest(const QString& path, QString& msg) const;
+    void close();
+
+    const ImageHeader& header() const;
+    const QVector<ChunkEntry>& chunks() const;
+    quint64 fileLength() const;
+
+private:
+    static bool writeHeader(QIODevice& device, const ImageHeader& header);
+    static bool writeIndex(QIODevice& device, const QVector<ChunkEntry>& chunks, const quint64 indexOffset);
+
+private:
+    QFile                      m_file;
+    ImageHeader                m_header;
+    QVector<ChunkEntry>        m_chunks;
+    QHash<quint64, ChunkEntry> m_baseChunks;
+};
+
+class ImageReader
+{
+public:
+    ImageReader();
+    ~ImageReader();
+
+    bool open(const QString& path, QString& msg);
+    void close();
+
+    const ImageHeader& header() const;
+    const QVector<ChunkEntry>& chunks() const;
+    quint64 totalSize() const;
+    quint64 dataSize() const;
+    bool    isManifest() const;
+
+    bool readCompressedChunk(const int index, QByteArray& payload, QString& msg);
+    bool readChunk(const int index, QByteArray& data, QString& msg);
+    bool decodeChunk(const int index, const QByteArray& payload, QByteArray& data, QString& msg) const;
+    bool readRepositoryKey(const int index, QByteArray& key, QString& msg);
+
+    // The payload as stored in this file, a key or nothing for chunks held elsewhere
+    bool readStoredPayload(const int index, QByteArray& payload, QString& msg);
+
+private:
+    bool readHeaderV2(QString& msg);
+    bool readIndexV2(QString& msg);
+    bool openBase(QString& msg);
+    bool openRepository(QString& msg);
+    bool scanV1(QString& msg);
+
+private:
+    QFile                       m_file;
+    ImageHeader                 m_header;
+    QVector<ChunkEntry>         m_chunks;
+    QScopedPointer<ImageReader> m_base;
+    QVector<int>                m_baseIndex;
+    ChunkRepository*            m_repository = {nullptr};
+};
+
+#endif // IMAGEFORMAT_H
@@ -0,0 +1,595 @@
+#include <QQueue>
+
+#include <algorithm>
+#include <cstring>
+
+#include "imagingjob.h"
+#include "decompressionpipeline.h"
+#include "rawstreampipeline.h"
+#include "digestverifier.h"
+#include "bufferscan.h"
+#include "partitiontable.h"
+#include "filesystemprobe.h"
+
+// Unbuffered transfer buffers are aligned to at least a memory page
+const quint64 DIRECT_IO_ALIGNMENT = 4096;
+
+// Free space runs shorter than this are read like data
+const quint64 MIN_FREE_BYTES = 1024 * 1024;
+
+static void appendRange(QVector<DeviceRange>& ranges, const quint64 startSector, const quint64 endSector, const bool unallocated)
+{
+    if (endSector > startSector)
+    {
+        DeviceRange range = { startSector, endSector - startSector, unallocated };
+        ranges.append(range);
+    }
+}
+
+// Cuts the free extents out of the used extents, both sorted by start sector
+static QVector<DeviceRange> planRanges(const QVector<DiskExtent>& used, const QVector<DiskExtent>& free)
+{
+    QVector<DeviceRange> ranges;
+    int f = 0;
+    foreach (const DiskExtent& extent, used)
+    {
+        quint64 cursor = extent.startSector;
+        const quint64 end = extent.startSector + extent.numSectors;
+        while ((f < free.size()) && (free.at(f).startSector < end))
+        {
+            quint64 freeStart = qMax(free.at(f).startSector, cursor);
+            quint64 freeEnd = free.at(f).startSector + free.at(f).numSectors;
+            if (freeEnd > freeStart)
+            {
+                appendRange(ranges, cursor, freeStart, false);
+                appendRange(ranges, freeStart, qMin(freeEnd, end), true);
+                cursor = qMin(freeEnd, end);
+            }
+
+            // A free extent reaching past this extent may also cover the next one
+            if (freeEnd > end)
+            {
+                break;
+            }
+            f++;
+        }
+        appendRange(ranges, cursor, end, false);
+    }
+    return ranges;
+}
+
+ImagingJob::ImagingJob(const int deviceId, const QString& imageFilePath, QObject *parent) : QThread(parent),
+    m_deviceId(deviceId),
+    m_imageFilePath(imageFilePath)
+{
+}
+
+ImagingJob::~ImagingJob()
+{
+    m_cancel.cancel();
+    wait();
+}
+
+void ImagingJob::setQueueDepth(const int queueDepth)
+{
+    m_queueDepth = qMax(1, queueDepth);
+}
+
+void ImagingJob::setDirectIo(const bool directIo)
+{
+    m_directIo = directIo;
+}
+
+void ImagingJob::cancel()
+{
+    m_cancel.cancel();
+}
+
+SysDef::Status ImagingJob::status() const
+{
+    return static_cast<SysDef::Status>(m_status.loadAcquire());
+}
+
+quint64 ImagingJob::bytesDone() const
+{
+    return m_bytesDone.loadAcquire();
+}
+
+quint64 ImagingJob::bytesTotal() const
+{
+    return m_bytesTotal.loadAcquire();
+}
+
+ImagingJob::Result ImagingJob::result() const
+{
+    return static_cast<Result>(m_result.loadAcquire());
+}
+
+QString ImagingJob::error() const
+{
+    return m_error;
+}
+
+QString ImagingJob::message() const
+{
+    return m_message;
+}
+
+void ImagingJob::run()
+{
+    Result result = execute();
+    closeDevice();
+    m_status.storeRelease(SysDef::STATUS_IDLE);
+    m_result.storeRelease(result);
+}
+
+void ImagingJob::setStatus(const SysDef::Status status, const quint64 bytesTotal)
+{
+    m_bytesDone.storeRelease(0);
+    m_bytesTotal.storeRelease(bytesTotal);
+    m_status.storeRelease(status);
+}
+
+void ImagingJob::addProgress(const quint64 bytes)
+{
+    m_bytesDone.fetchAndAddRelease(bytes);
+}
+
+ImagingJob::Result ImagingJob::fail(QString& error, const QString& message)
+{
+    m_error = error;
+    m_message = message;
+    error = QString("");
+    return ResultFailed;
+}
+
+ImagingJob::Result ImagingJob::verifyImage(const quint64 sectorSize, const bool skipHoles)
+{
+    QString error;
+    setStatus(SysDef::STATUS_VERIFYING, 0);
+
+    // Get raw disk handle in read mode
+    quint64 deviceSectorSize = 0;
+    quint64 numSectors = 0;
+    if (!openDevice(GENERIC_READ, m_queueDepth > 1, deviceSectorSize, numSectors, error))
+    {
+        return fail(error, "Verify disk image failed");
+    }
+
+    if (RawImage::formatOf(m_imageFilePath) != RawImage::FormatNone)
+    {
+        return verifyRawImage(sectorSize, skipHoles);
+    }
+
+    ImageReader imageReader;
+    if (!imageReader.open(m_imageFilePath, error))
+    {
+        return fail(error, "Verify disk image failed");
+    }
+
+    if (!checkChunkAlignment(imageReader.chunks(), sectorSize, error))
+    {
+        return fail(error, "Verify disk image failed");
+    }
+
+    // Images with chunk digests are verified by hashing the device reads, nothing is decompressed
+    if (imageReader.header().version >= ImageFormat::VERSION_2)
+    {
+        return verifyDigests(imageReader.chunks(), imageReader.dataSize(), sectorSize, skipHoles);
+    }
+
+    setStatus(SysDef::STATUS_VERIFYING, imageReader.dataSize());
+    bool cancelled = false;
+
+    // Image chunks are read ahead and decompressed on all cores while the
+    // device reads of the same chunks are queued, the oldest is compared first
+    DecompressionPipeline pipeline(imageReader, &m_arena);
+    const QVector<ChunkEntry>& chunks = imageReader.chunks();
+    quint64 maxLength = sectorSize;
+    foreach (const ChunkEntry& entry, chunks)
+    {
+        maxLength = qMax<quint64>(maxLength, entry.uncompressedLength);
+    }
+    QScopedPointer<IoBackend> io(createIoBackend(sectorSize, maxLength));
+    QQueue<QByteArray> expected;
+    int c = 0;
+    QByteArray uncompressed;
+    while (pipeline.next(c, uncompressed, error))
+    {
+        if (m_cancel.isCancelled())
+        {
+            cancelled = true;
+            break;
+        }
+
+        const ChunkEntry& entry = chunks.at(c);
+
+        // Content of discarded regions and of space unused by the file system is undefined
+        if ((skipHoles && ImageFormat::isZeroHole(entry)) || ImageFormat::isUnallocated(entry))
+        {
+            m_arena.release(uncompressed);
+            addProgress(entry.uncompressedLength);
+            continue;
+        }
+
+        if (io->isFull() && !compareOldest(*io, expected, sectorSize, error))
+        {
+            return fail(error, "Verify disk image failed");
+        }
+
+        // Read sectors from disk
+        if (!io->submitRead(entry.deviceOffset, m_arena.acquire(uncompressed.size()), static_cast<quint64>(c), error))
+        {
+            return fail(error, "Verify disk image failed");
+        }
+        expected.enqueue(uncompressed);
+    }
+
+    while (!cancelled && error.isEmpty() && !io->isEmpty())
+    {
+        if (!compareOldest(*io, expected, sectorSize, error))
+        {
+            return fail(error, "Verify disk image failed");
+        }
+    }
+
+    if (!error.isEmpty())
+    {
+        return fail(error, "Verify disk image failed");
+    }
+    io.reset();
+    pipeline.abort();
+    imageReader.close();
+
+    if (cancelled)
+    {
+        m_message = QString("Verify disk image cancelled.");
+        return ResultCancelled;
+    }
+
+    m_message = QString("Verify disk image succeeded.");
+    return ResultSucceeded;
+}
+
+ImagingJob::Result ImagingJob::verifyRawImage(const quint64 sectorSize, const bool skipHoles)
+{
+    QString error;
+
+    // A raw image has no index, it is decoded once on its reader thread and the
+    // device reads of the decoded chunks are queued, the oldest is compared first
+    RawStreamPipeline pipeline(m_imageFilePath, &m_arena);
+    if (!pipeline.start(error))
+    {
+        return fail(error, "Verify disk image failed");
+    }
+
+    setStatus(SysDef::STATUS_VERIFYING, pipeline.totalSize());
+    bool cancelled = false;
+    QScopedPointer<IoBackend> io(createIoBackend(sectorSize, RawStreamPipeline::CHUNK_SIZE));
+    QQueue<QByteArray> expected;
+    int c = 0;
+    ChunkEntry entry;
+    QByteArray uncompressed;
+    while (pipeline.next(c, entry, uncompressed, error))
+    {
+        if (m_cancel.isCancelled())
+        {
+            m_arena.release(uncompressed);
+            cancelled = true;
+            break;
+        }
+
+        // Content of discarded regions is undefined
+        if (skipHoles && ImageFormat::isZeroHole(entry))
+        {
+            m_arena.release(uncompressed);
+            addProgress(entry.uncompressedLength);
+            continue;
+        }
+
+        if (io->isFull() && !compareOldest(*io, expected, sectorSize, error))
+        {
+            return fail(error, "Verify disk image failed");
+        }
+
+        if (!io->submitRead(entry.deviceOffset, m_arena.acquire(uncompressed.size()), static_cast<quint64>(c), error))
+        {
+            return fail(error, "Verify disk image failed");
+        }
+        expected.enqueue(uncompressed);
+    }
+
+    while (!cancelled && error.isEmpty() && !io->isEmpty())
+    {
+        if (!compareOldest(*io, expected, sectorSize, error))
+        {
+            return fail(error, "Verify disk image failed");
+        }
+    }
+
+    if (!error.isEmpty())
+    {
+        return fail(error, "Verify disk image failed");
+    }
+    io.reset();
+    pipeline.abort();
+
+    if (cancelled)
+    {
+        m_message = QString("Verify disk image cancelled.");
+        return ResultCancelled;
+    }
+
+    m_message = QString("Verify disk image succeeded.");
+    return ResultSucceeded;
+}
+
+ImagingJob::Result ImagingJob::verifyDigests(const QVector<ChunkEntry>& chunks, const quint64 dataSize, const quint64 sectorSize, const bool skipHoles)
+{
+    QString error;
+    setStatus(SysDef::STATUS_VERIFYING, dataSize);
+    bool cancelled = false;
+
+    // Device reads stay queued while the completed ones are hashed on all cores
+    DigestVerifier verifier(sectorSize, &m_arena);
+    quint64 maxLength = sectorSize;
+    foreach (const ChunkEntry& entry, chunks)
+    {
+        maxLength = qMax<quint64>(maxLength, entry.uncompressedLength);
+    }
+    QScopedPointer<IoBackend> io(createIoBackend(sectorSize, maxLength));
+    int c = 0;
+    forever
+    {
+        if (m_cancel.isCancelled())
+        {
+            cancelled = true;
+            break;
+        }
+
+        while (!io->isFull() && (c < chunks.size()))
+        {
+            const ChunkEntry& entry = chunks.at(c);
+
+            // Content of discarded regions and of space unused by the file system is undefined
+            if ((skipHoles && ImageFormat::isZeroHole(entry)) || ImageFormat::isUnallocated(entry))
+            {
+                addProgress(entry.uncompressedLength);
+            }
+            else if (!io->submitRead(entry.deviceOffset, m_arena.acquire(static_cast<int>(entry.uncompressedLength)), static_cast<quint64>(c), error))
+            {
+                return fail(error, "Verify disk image failed");
+            }
+            c++;
+        }
+
+        if (io->isEmpty())
+        {
+            break;
+        }
+
+        IoCompletion completion;
+        if (!io->waitOldest(completion, error))
+        {
+            return fail(error, "Verify disk image failed");
+        }
+
+        // A short read at the end of the device compares as zeros
+        if (completion.transferred < completion.length)
+        {
+            memset(BufferArena::writable(completion.data) + completion.transferred, 0, completion.length - completion.transferred);
+        }
+
+        if (!verifier.submit(chunks.at(static_cast<int>(completion.tag)), completion.data, error))
+        {
+            return fail(error, "Verify disk image failed");
+        }
+        addProgress(completion.length);
+    }
+    io.reset();
+
+    if (!verifier.finish(error))
+    {
+        return fail(error, "Verify disk image failed");
+    }
+
+    if (cancelled)
+    {
+        m_message = QString("Verify disk image cancelled.");
+        return ResultCancelled;
+    }
+
+    m_message = QString("Verify disk image succeeded.");
+    return ResultSucceeded;
+}
+
+bool ImagingJob::compareOldest(IoBackend& io, QQueue<QByteArray>& expected, const quint64 sectorSize, QString& msg)
+{
+    IoCompletion completion;
+    if (!io.waitOldest(completion, msg))
+    {
+        return false;
+    }
+
+    // A short read at the end of the device compares as zeros
+    if (completion.transferred < completion.length)
+    {
+        memset(BufferArena::writable(completion.data) + completion.transferred, 0, completion.length - completion.transferred);
+    }
+
+    QByteArray data = expected.dequeue();
+    quint64 offset = (data.size() == completion.data.size()) ? BufferScan::firstDifference(data.constData(), completion.data.constData(), completion.length) : 0;
+    if (offset < completion.length)
+    {
+        msg = QString("Verify Error;Data from image file and disk is NOT identical, the first difference is in sector %1.").arg((completion.offset + offset) / sectorSize);
+        return false;
+    }
+    m_arena.release(data);
+    m_arena.release(completion.data);
+    addProgress(completion.length);
+    return true;
+}
+
+bool ImagingJob::boundaryMatches(IoBackend& io, const QVector<ChunkEntry>& chunks, const int committedChunks, const bool skipZeroHoles, bool& matches, QString& msg)
+{
+    // The last chunks before a checkpoint are read from the device and compared with
+    // their digests, a device that was changed or swapped meanwhile is not resumed
+    const int boundaryChunks = 2;
+    int checked = 0;
+    matches = true;
+    for (int c = committedChunks - 1; (c >= 0) && (checked < boundaryChunks) && matches; c--)
+    {
+        const ChunkEntry& entry = chunks.at(c);
+        if (ImageFormat::isUnallocated(entry) || (skipZeroHoles && ImageFormat::isZeroHole(entry)))
+        {
+            continue;
+        }
+
+        IoCompletion completion;
+        if (!io.submitRead(entry.deviceOffset, m_arena.acquire(static_cast<int>(entry.uncompressedLength)), 0, msg) ||
+            !io.waitOldest(completion, msg))
+        {
+            return false;
+        }
+        matches = (completion.transferred == completion.length) && DigestVerifier::matches(entry, completion.data);
+        m_arena.release(completion.data);
+        checked++;
+    }
+    return true;
+}
+
+bool ImagingJob::checkChunkAlignment(const QVector<ChunkEntry>& chunks, const quint64 sectorSize, QString& msg)
+{
+    // Every chunk must start and end on a sector boundary of the device
+    foreach (const ChunkEntry& entry, chunks)
+    {
+        if ((entry.deviceOffset % sectorSize) || (entry.uncompressedLength % sectorSize))
+        {
+            msg = QString("File Error;The sector size of the image file does not match the selected device.");
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ImagingJob::readLayout(IoBackend& io, const quint64 sectorSize, const quint64 numSectors, const bool skipFreeSpace, QVector<DeviceRange>& ranges, quint64& endSector, QString& msg)
+{
+    PartitionTable::SectorReader readSectors = [&](const quint64 startSector, const quint64 count, QByteArray& data, QString& error)
+    {
+        IoCompletion completion;
+        if (!io.submitRead(startSector * sectorSize, QByteArray(static_cast<int>(count * sectorSize), '\0'), 0, error) || !io.waitOldest(completion, error))
+        {
+            return false;
+        }
+        data = completion.data;
+        return true;
+    };
+
+    // Find the partitions and table structures, only those are transferred
+    PartitionTable partitionTable;
+    if (!partitionTable.read(readSectors, sectorSize, numSectors, msg))
+    {
+        return false;
+    }
+    endSector = partitionTable.endSector();
+
+    // Clusters the file systems do not use are left out without being read
+    QVector<DiskExtent> freeExtents;
+    if (skipFreeSpace)
+    {
+        foreach (const DiskExtent& partition, partitionTable.partitions())
+        {
+            FileSystemProbe probe;
+            if (!probe.probe(readSectors, sectorSize, partition, MIN_FREE_BYTES / sectorSize, msg))
+            {
+                return false;
+            }
+            freeExtents << probe.freeExtents();
+        }
+        std::sort(freeExtents.begin(), freeExtents.end(), [](const DiskExtent& a, const DiskExtent& b)
+        {
+            return a.startSector < b.startSector;
+        });
+    }
+
+    ranges = planRanges(partitionTable.usedExtents(), freeExtents);
+    return true;
+}
+
+bool ImagingJob::openDevice(const DWORD access, const bool overlapped, quint64& sectorSize, quint64& numSectors, QString& msg)
+{
+    closeDevice();
+    m_rawDiskHandle = openRawDevice(m_deviceId, access, overlapped, sectorSize, numSectors, m_physicalSectorSize, msg);
+    return m_rawDiskHandle != INVALID_HANDLE_VALUE;
+}
+
+HANDLE ImagingJob::openRawDevice(const int deviceId, const DWORD access, const bool overlapped, quint64& sectorSize, quint64& numSectors, quint64& physicalSectorSize, QString& msg) const
+{
+    HANDLE handle = DiskUtilities::getHandleOnDevice(deviceId, access, msg);
+    if (handle == INVALID_HANDLE_VALUE)
+    {
+        return INVALID_HANDLE_VALUE;
+    }
+
+    numSectors = DiskUtilities::getNumberOfSectors(handle, sectorSize, msg);
+    if (!msg.isEmpty())
+    {
+        CloseHandle(handle);
+        return INVALID_HANDLE_VALUE;
+    }
+    physicalSectorSize = DiskUtilities::getPhysicalSectorSize(handle, sectorSize);
+
+    // The geometry is queried on a synchronous handle, an overlapped handle
+    // does not accept DeviceIoControl calls without an OVERLAPPED structure
+    DWORD flags = 0;
+    if (overlapped)
+    {
+        flags |= FILE_FLAG_OVERLAPPED;
+    }
+    if (m_directIo)
+    {
+        // Bypass the system cache, transfers then need aligned buffers
+        flags |= FILE_FLAG_NO_BUFFERING | FILE_FLAG_WRITE_THROUGH;
+    }
+    if (flags)
+    {
+        CloseHandle(handle);
+        handle = DiskUtilities::getHandleOnDevice(deviceId, access, msg, flags);
+    }
+    return handle;
+}
+
+IoBackend* ImagingJob::createIoBackend(const quint64 sectorSize, const quint64 maxLength)
+{
+    if (m_directIo)
+    {
+        // Chunk buffers start on the boundary of the pool buffers and go to the device in place
+        m_arena.setAlignment(static_cast<int>(qMax(m_physicalSectorSize, DIRECT_IO_ALIGNMENT)));
+    }
+    return createIoBackend(m_rawDiskHandle, sectorSize, m_physicalSectorSize, maxLength, m_bufferPool);
+}
+
+IoBackend* ImagingJob::createIoBackend(HANDLE handle, const quint64 sectorSize, const quint64 physicalSectorSize, const quint64 maxLength, QScopedPointer<AlignedBufferPool>& pool) const
+{
+    if (m_directIo)
+    {
+        // Bounce buffers for transfers the device cannot take in place, aligned to the
+        // physical sector and the memory page and sized for the largest transfer
+        const quint64 alignment = qMax(physicalSectorSize, DIRECT_IO_ALIGNMENT);
+        pool.reset(new AlignedBufferPool(static_cast<quint32>(maxLength), static_cast<quint32>(alignment)));
+    }
+    else
+    {
+        pool.reset();
+    }
+    return IoBackend::create(handle, m_queueDepth, static_cast<quint32>(sectorSize), pool.data());
+}
+
+void ImagingJob::closeDevice()
+{
+    if (m_rawDiskHandle != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(m_rawDiskHandle);
+        m_rawDiskHandle = INVALID_HANDLE_VALUE;
+    }
+}
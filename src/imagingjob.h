@@ -0,0 +1,81 @@
+#ifndef IMAGINGJOB_H
+#define IMAGINGJOB_H
+
+#include <QAtomicInteger>
+#include <QQueue>
+#include <QScopedPointer>
+#include <QThread>
+#include <QVector>
+
+#include "sysdef.h"
+#include "diskutilities.h"
+#include "imageformat.h"
+#include "iobackend.h"
+#include "bufferarena.h"
+#include "partitiontable.h"
+#include "canceltoken.h"
+
+// Base of the create/restore jobs. A job runs on its own thread and
+// publishes its status and progress through atomics, the GUI samples them
+// on a timer. Error and message are valid once the thread has finished.
+class ImagingJob : public QThread
+{
+    Q_OBJECT
+
+public:
+    enum Result { ResultNone = 0, ResultSucceeded, ResultFailed, ResultCancelled };
+
+    explicit ImagingJob(const int deviceId, const QString& imageFilePath, QObject *parent = nullptr);
+    ~ImagingJob() override;
+
+    void           setQueueDepth(const int queueDepth);
+    void           setDirectIo(const bool directIo);
+    void           cancel();
+    SysDef::Status status() const;
+    quint64        bytesDone() const;
+    quint64        bytesTotal() const;
+    Result         result() const;
+    QString        error() const;
+    QString        message() const;
+
+protected:
+    void run() override;
+    virtual Result execute() = 0;
+
+    void       setStatus(const SysDef::Status status, const quint64 bytesTotal);
+    void       addProgress(const quint64 bytes);
+    Result     fail(QString& error, const QString& message);
+    Result     verifyImage(const quint64 sectorSize, const bool skipHoles);
+    Result     verifyRawImage(const quint64 sectorSize, const bool skipHoles);
+    Result     verifyDigests(const QVector<ChunkEntry>& chunks, const quint64 dataSize, const quint64 sectorSize, const bool skipHoles);
+    bool       compareOldest(IoBackend& io, QQueue<QByteArray>& expected, const quint64 sectorSize, QString& msg);
+    bool       checkChunkAlignment(const QVector<ChunkEntry>& chunks, const quint64 sectorSize, QString& msg);
+    bool       boundaryMatches(IoBackend& io, const QVector<ChunkEntry>& chunks, const int committedChunks, const bool skipZeroHoles, bool& matches, QString& msg);
+    bool       readLayout(IoBackend& io, const quint64 sectorSize, const quint64 numSectors, const bool skipFreeSpace, QVector<DeviceRange>& ranges, quint64& endSector, QString& msg);
+    bool       openDevice(const DWORD access, const bool overlapped, quint64& sectorSize, quint64& numSectors, QString& msg);
+    HANDLE     openRawDevice(const int deviceId, const DWORD access, const bool overlapped, quint64& sectorSize, quint64& numSectors, quint64& physicalSectorSize, QString& msg) const;
+    IoBackend* createIoBackend(const quint64 sectorSize, const quint64 maxLength);
+    IoBackend* createIoBackend(HANDLE handle, const quint64 sectorSize, const quint64 physicalSectorSize, const quint64 maxLength, QScopedPointer<AlignedBufferPool>& pool) const;
+    void       closeDevice();
+
+protected:
+    int         m_deviceId;
+    QString     m_imageFilePath;
+    HANDLE      m_rawDiskHandle = {INVALID_HANDLE_VALUE};
+    int         m_queueDepth = {4};
+    bool        m_directIo = {false};
+    quint64     m_physicalSectorSize = {512};
+    CancelToken m_cancel;
+    BufferArena m_arena;
+    QString     m_error;
+    QString     m_message;
+
+private:
+    QScopedPointer<AlignedBufferPool> m_bufferPool;
+    QAtomicInt              m_status = {SysDef::STATUS_IDLE};
+    QAtomicInt              m_result = {ResultNone};
+    QAtomicInteger<quint64> m_bytesDone = {0};
+    QAtomicInteger<quint64> m_bytesTotal = {0};
+};
+
+#endif // IMAGINGJOB_H
@@ -0,0 +1,527 @@
+#include <QFile>
+
+#include <cstring>
+
+#ifndef Q_OS_WIN
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "iobackend.h"
+#include "bufferarena.h"
+
+#ifdef Q_OS_WIN
+static QString formatError(const QString& text, const DWORD errorCode)
+{
+    wchar_t *errormessage = nullptr;
+    FormatMessageW(FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_ALLOCATE_BUFFER, nullptr, errorCode, 0, (LPWSTR)&errormessage, 0, nullptr);
+    QString errText = QString::fromUtf16((const ushort *)errormessage);
+    LocalFree(errormessage);
+    return QString("%1\n Error %2: %3").arg(text).arg(errorCode).arg(errText);
+}
+#else
+static QString formatError(const QString& text, const int errorCode)
+{
+    return QString("%1\n Error %2: %3").arg(text).arg(errorCode).arg(QString::fromLocal8Bit(strerror(errorCode)));
+}
+#endif
+
+static const char* READ_ERROR = "Read Error;An error occurred when attempting to read data from handle.";
+static const char* WRITE_ERROR = "Write Error;An error occurred when attempting to write data to handle.";
+
+IoBackend::IoBackend(IoHandle handle, const int queueDepth, const quint32 sectorSize, AlignedBufferPool* pool) :
+    m_handle(handle),
+    m_queueDepth(qMax(1, queueDepth)),
+    m_sectorSize(qMax(1u, sectorSize)),
+    m_pool(pool)
+{
+}
+
+IoBackend::~IoBackend()
+{
+}
+
+IoBackend* IoBackend::create(IoHandle handle, const int queueDepth, const quint32 sectorSize, AlignedBufferPool* pool)
+{
+#ifdef Q_OS_WIN
+    // The handle must have been opened with FILE_FLAG_OVERLAPPED when queueDepth > 1
+    if (queueDepth > 1)
+    {
+        return new OverlappedIoBackend(handle, queueDepth, sectorSize, pool);
+    }
+#else
+    if (queueDepth > 1)
+    {
+        return new ThreadedIoBackend(handle, queueDepth, sectorSize, pool);
+    }
+#endif
+    return new SyncIoBackend(handle, sectorSize, pool);
+}
+
+#ifndef Q_OS_WIN
+IoHandle IoBackend::openFile(const QString& path, const bool write, const bool direct, QString& msg)
+{
+    int flags = (write ? O_RDWR : O_RDONLY) | O_CLOEXEC | (direct ? O_DIRECT : 0);
+    IoHandle handle = ::open(QFile::encodeName(path).constData(), flags);
+    if (handle < 0)
+    {
+        msg = formatError(QString("File Error;Cannot open %1.").arg(path), errno);
+    }
+    return handle;
+}
+#endif
+
+int IoBackend::queueDepth() const
+{
+    return m_queueDepth;
+}
+
+int IoBackend::inFlight() const
+{
+    return m_inFlight;
+}
+
+bool IoBackend::isFull() const
+{
+    return m_inFlight >= m_queueDepth;
+}
+
+bool IoBackend::isEmpty() const
+{
+    return m_inFlight == 0;
+}
+
+bool IoBackend::drain(QString& msg)
+{
+    bool ok = true;
+    while (!isEmpty())
+    {
+        IoCompletion completion;
+        if (!waitOldest(completion, msg))
+        {
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+bool IoBackend::checkRequest(const char* buffer, const quint32 length, QString& msg) const
+{
+    if (m_pool && (!buffer || (ioLength(length) > m_pool->bufferSize())))
+    {
+        msg = QString("Device Error;I/O request is larger than the transfer buffer.");
+        return false;
+    }
+    return true;
+}
+
+quint32 IoBackend::ioLength(const quint32 length) const
+{
+    // Unbuffered transfers must cover whole sectors, the tail of the last
+    // chunk is padded up to the next sector boundary
+    return m_pool ? static_cast<quint32>(AlignedBufferPool::alignUp(length, m_sectorSize)) : length;
+}
+
+char* IoBackend::transferBuffer(IoCompletion& request, char* bounceBuffer, bool& bounce, QString& msg) const
+{
+    // Aligned buffers covering whole sectors go to the device as they are,
+    // only others (in practice the short tail of a device) are copied
+    char* buffer = request.write ? const_cast<char*>(request.data.constData()) : BufferArena::writable(request.data);
+    bounce = m_pool && (!BufferArena::isAligned(buffer, m_pool->alignment()) || ((request.length % m_sectorSize) != 0));
+    if (!bounce)
+    {
+        return buffer;
+    }
+    if (!checkRequest(bounceBuffer, request.length, msg))
+    {
+        return nullptr;
+    }
+    if (request.write)
+    {
+        memcpy(bounceBuffer, buffer, request.length);
+        memset(bounceBuffer + request.length, 0, ioLength(request.length) - request.length);
+    }
+    return bounceBuffer;
+}
+
+void IoBackend::completeBounce(IoCompletion& request, const char* bounceBuffer) const
+{
+    if (!request.write)
+    {
+        memcpy(BufferArena::writable(request.data), bounceBuffer, request.transferred);
+    }
+}
+
+bool IoBackend::transfer(IoCompletion& request, char* buffer, QString& msg) const
+{
+    // Blocking read or write of ioLength() bytes at the request offset, a read
+    // ends early at the end of the file
+    const quint32 length = ioLength(request.length);
+#ifdef Q_OS_WIN
+    LARGE_INTEGER li;
+    li.QuadPart = static_cast<LONGLONG>(request.offset);
+    SetFilePointer(m_handle, li.LowPart, &li.HighPart, FILE_BEGIN);
+
+    DWORD transferred = 0;
+    BOOL bResult = request.write ? WriteFile(m_handle, buffer, length, &transferred, nullptr)
+                                 : ReadFile(m_handle, buffer, length, &transferred, nullptr);
+    if (!bResult)
+    {
+        msg = formatError(request.write ? WRITE_ERROR : READ_ERROR, GetLastError());
+        return false;
+    }
+#else
+    quint32 transferred = 0;
+    while (transferred < length)
+    {
+        const off_t offset = static_cast<off_t>(request.offset + transferred);
+        ssize_t count = request.write ? pwrite(m_handle, buffer + transferred, length - transferred, offset)
+                                      : pread(m_handle, buffer + transferred, length - transferred, offset);
+        if ((count < 0) && (errno == EINTR))
+        {
+            continue;
+        }
+        if (count < 0)
+        {
+            msg = formatError(request.write ? WRITE_ERROR : READ_ERROR, errno);
+            return false;
+        }
+        if (count == 0)
+        {
+            break;
+        }
+        transferred += static_cast<quint32>(count);
+    }
+#endif
+    request.transferred = qMin(static_cast<quint32>(transferred), request.length);
+    return true;
+}
+
+SyncIoBackend::SyncIoBackend(IoHandle handle, const quint32 sectorSize, AlignedBufferPool* pool) :
+    IoBackend(handle, 1, sectorSize, pool)
+{
+    if (m_pool)
+    {
+        m_buffer = m_pool->acquire();
+    }
+}
+
+SyncIoBackend::~SyncIoBackend()
+{
+    if (m_pool)
+    {
+        m_pool->release(m_buffer);
+    }
+}
+
+bool SyncIoBackend::submitRead(const quint64 offset, QByteArray buffer, const quint64 tag, QString& msg)
+{
+    m_completion = IoCompletion();
+    m_completion.offset = offset;
+    m_completion.tag = tag;
+    m_completion.length = static_cast<quint32>(buffer.size());
+    m_completion.data.swap(buffer);
+    return submit(msg);
+}
+
+bool SyncIoBackend::submitWrite(const quint64 offset, const QByteArray& data, const quint64 tag, QString& msg)
+{
+    m_completion = IoCompletion();
+    m_completion.offset = offset;
+    m_completion.tag = tag;
+    m_completion.length = static_cast<quint32>(data.size());
+    m_completion.write = true;
+    m_completion.data = data;
+    return submit(msg);
+}
+
+bool SyncIoBackend::submit(QString& msg)
+{
+    bool bounce = false;
+    char* buffer = transferBuffer(m_completion, m_buffer, bounce, msg);
+    if (!buffer || !transfer(m_completion, buffer, msg))
+    {
+        return false;
+    }
+    if (bounce)
+    {
+        completeBounce(m_completion, m_buffer);
+    }
+    m_inFlight = 1;
+    return true;
+}
+
+bool SyncIoBackend::waitOldest(IoCompletion& completion, QString& msg)
+{
+    Q_UNUSED(msg)
+    completion = m_completion;
+    m_completion = IoCompletion();
+    m_inFlight = 0;
+    return true;
+}
+
+#ifdef Q_OS_WIN
+OverlappedIoBackend::OverlappedIoBackend(IoHandle handle, const int queueDepth, const quint32 sectorSize, AlignedBufferPool* pool) :
+    IoBackend(handle, queueDepth, sectorSize, pool)
+{
+    for (int i = 0; i < m_queueDepth; i++)
+    {
+        Slot* slot = new Slot;
+        memset(&slot->overlapped, 0, sizeof(OVERLAPPED));
+        slot->overlapped.hEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+        slot->buffer = m_pool ? m_pool->acquire() : nullptr;
+        slot->bounce = false;
+        m_slots.append(slot);
+    }
+}
+
+OverlappedIoBackend::~OverlappedIoBackend()
+{
+    // Outstanding requests still reference the buffers, wait for them first
+    if (m_inFlight > 0)
+    {
+        CancelIo(m_handle);
+        QString msg;
+        drain(msg);
+    }
+
+    foreach (Slot* slot, m_slots)
+    {
+        CloseHandle(slot->overlapped.hEvent);
+        if (m_pool)
+        {
+            m_pool->release(slot->buffer);
+        }
+        delete slot;
+    }
+}
+
+bool OverlappedIoBackend::submitRead(const quint64 offset, QByteArray buffer, const quint64 tag, QString& msg)
+{
+    Slot& slot = *m_slots.at((m_head + m_inFlight) % m_queueDepth);
+    slot.request = IoCompletion();
+    slot.request.offset = offset;
+    slot.request.tag = tag;
+    slot.request.length = static_cast<quint32>(buffer.size());
+    slot.request.data.swap(buffer);
+    return submit(slot, msg);
+}
+
+bool OverlappedIoBackend::submitWrite(const quint64 offset, const QByteArray& data, const quint64 tag, QString& msg)
+{
+    Slot& slot = *m_slots.at((m_head + m_inFlight) % m_queueDepth);
+    slot.request = IoCompletion();
+    slot.request.offset = offset;
+    slot.request.tag = tag;
+    slot.request.length = static_cast<quint32>(data.size());
+    slot.request.write = true;
+    slot.request.data = data;
+    return submit(slot, msg);
+}
+
+bool OverlappedIoBackend::submit(Slot& slot, QString& msg)
+{
+    if (isFull())
+    {
+        msg = QString("Device Error;Too many outstanding I/O requests.");
+        return false;
+    }
+    char* buffer = transferBuffer(slot.request, slot.buffer, slot.bounce, msg);
+    if (!buffer)
+    {
+        return false;
+    }
+
+    HANDLE event = slot.overlapped.hEvent;
+    memset(&slot.overlapped, 0, sizeof(OVERLAPPED));
+    slot.overlapped.hEvent = event;
+    slot.overlapped.Offset = static_cast<DWORD>(slot.request.offset & 0xFFFFFFFF);
+    slot.overlapped.OffsetHigh = static_cast<DWORD>(slot.request.offset >> 32);
+    ResetEvent(event);
+
+    const quint32 length = ioLength(slot.request.length);
+    BOOL bResult;
+    if (slot.request.write)
+    {
+        bResult = WriteFile(m_handle, buffer, length, nullptr, &slot.overlapped);
+    }
+    else
+    {
+        bResult = ReadFile(m_handle, buffer, length, nullptr, &slot.overlapped);
+    }
+
+    if (!bResult && (GetLastError() != ERROR_IO_PENDING))
+    {
+        msg = formatError(slot.request.write ? WRITE_ERROR : READ_ERROR, GetLastError());
+        return false;
+    }
+    m_inFlight++;
+    return true;
+}
+
+bool OverlappedIoBackend::waitOldest(IoCompletion& completion, QString& msg)
+{
+    if (m_inFlight == 0)
+    {
+        return false;
+    }
+
+    Slot& slot = *m_slots.at(m_head);
+    DWORD transferred = 0;
+    BOOL bResult = GetOverlappedResult(m_handle, &slot.overlapped, &transferred, TRUE);
+    DWORD errorCode = GetLastError();
+
+    m_head = (m_head + 1) % m_queueDepth;
+    m_inFlight--;
+
+    completion = slot.request;
+    completion.transferred = qMin(static_cast<quint32>(transferred), completion.length);
+    slot.request = IoCompletion();
+    if (slot.bounce && bResult)
+    {
+        completeBounce(completion, slot.buffer);
+    }
+
+    if (!bResult && (errorCode != ERROR_HANDLE_EOF))
+    {
+        msg = formatError(completion.write ? WRITE_ERROR : READ_ERROR, errorCode);
+        return false;
+    }
+    return true;
+}
+#else
+// One queued request, run on a pool thread and waited for in submission order
+class ThreadedIoBackend::Slot : public QRunnable
+{
+public:
+    Slot(ThreadedIoBackend& backend) : m_backend(backend)
+    {
+        setAutoDelete(false);
+    }
+
+    void run() override
+    {
+        QString msg;
+        bool ok = m_backend.transfer(request, target, msg);
+        QMutexLocker locker(&m_backend.m_mutex);
+        error = ok ? QString() : msg;
+        done = true;
+        m_backend.m_completed.wakeAll();
+    }
+
+    IoCompletion request;
+    char*        buffer = {nullptr};
+    char*        target = {nullptr};
+    bool         bounce = {false};
+    bool         done = {false};
+    QString      error;
+
+private:
+    ThreadedIoBackend& m_backend;
+};
+
+ThreadedIoBackend::ThreadedIoBackend(IoHandle handle, const int queueDepth, const quint32 sectorSize, AlignedBufferPool* pool) :
+    IoBackend(handle, queueDepth, sectorSize, pool)
+{
+    m_threads.setMaxThreadCount(m_queueDepth);
+    for (int i = 0; i < m_queueDepth; i++)
+    {
+        Slot* slot = new Slot(*this);
+        slot->buffer = m_pool ? m_pool->acquire() : nullptr;
+        m_slots.append(slot);
+    }
+}
+
+ThreadedIoBackend::~ThreadedIoBackend()
+{
+    // Outstanding requests still reference the buffers, wait for them first
+    m_threads.waitForDone();
+    foreach (Slot* slot, m_slots)
+    {
+        if (m_pool)
+        {
+            m_pool->release(slot->buffer);
+        }
+        delete slot;
+    }
+}
+
+bool ThreadedIoBackend::submitRead(const quint64 offset, QByteArray buffer, const quint64 tag, QString& msg)
+{
+    Slot& slot = *m_slots.at((m_head + m_inFlight) % m_queueDepth);
+    slot.request = IoCompletion();
+    slot.request.offset = offset;
+    slot.request.tag = tag;
+    slot.request.length = static_cast<quint32>(buffer.size());
+    slot.request.data.swap(buffer);
+    return submit(slot, msg);
+}
+
+bool ThreadedIoBackend::submitWrite(const quint64 offset, const QByteArray& data, const quint64 tag, QString& msg)
+{
+    Slot& slot = *m_slots.at((m_head + m_inFlight) % m_queueDepth);
+    slot.request = IoCompletion();
+    slot.request.offset = offset;
+    slot.request.tag = tag;
+    slot.request.length = static_cast<quint32>(data.size());
+    slot.request.write = true;
+    slot.request.data = data;
+    return submit(slot, msg);
+}
+
+bool ThreadedIoBackend::submit(Slot& slot, QString& msg)
+{
+    if (isFull())
+    {
+        msg = QString("Device Error;Too many outstanding I/O requests.");
+        return false;
+    }
+    slot.target = transferBuffer(slot.request, slot.buffer, slot.bounce, msg);
+    if (!slot.target)
+    {
+        return false;
+    }
+
+    slot.done = false;
+    slot.error.clear();
+    m_inFlight++;
+    m_threads.start(&slot);
+    return true;
+}
+
+bool ThreadedIoBackend::waitOldest(IoCompletion& completion, QString& msg)
+{
+    if (m_inFlight == 0)
+    {
+        return false;
+    }
+
+    Slot& slot = *m_slots.at(m_head);
+    {
+        QMutexLocker locker(&m_mutex);
+        while (!slot.done)
+        {
+            m_completed.wait(&m_mutex);
+        }
+    }
+
+    m_head = (m_head + 1) % m_queueDepth;
+    m_inFlight--;
+
+    completion = slot.request;
+    slot.request = IoCompletion();
+    slot.target = nullptr;
+    if (slot.bounce && slot.error.isEmpty())
+    {
+        completeBounce(completion, slot.buffer);
+    }
+
+    if (!slot.error.isEmpty())
+    {
+        msg = slot.error;
+        return false;
+    }
+    return true;
+}
+#endif
@@ -0,0 +1,157 @@
+#ifndef IOBACKEND_H
+#define IOBACKEND_H
+
+#include <QByteArray>
+#include <QString>
+#include <QVector>
+
+#ifdef Q_OS_WIN
+#include <windows.h>
+#else
+#include <QMutex>
+#include <QThreadPool>
+#include <QWaitCondition>
+#endif
+
+#include "alignedbufferpool.h"
+
+// Device or file handle, a file descriptor outside of Windows
+#ifdef Q_OS_WIN
+typedef HANDLE IoHandle;
+#else
+typedef int IoHandle;
+#endif
+
+// Completed read or write, handed back in submission order. A read fills
+// the buffer given to submitRead(), which is returned as data.
+struct IoCompletion
+{
+    quint64    offset = {0};
+    quint64    tag = {0};
+    quint32    length = {0};
+    quint32    transferred = {0};
+    bool       write = {false};
+    QByteArray data;
+};
+
+// Keeps up to queueDepth reads or writes in flight on a device or file handle.
+// Requests complete in submission order; a full queue must be drained with
+// waitOldest() before the next submit.
+// With a buffer pool the handle is expected to be opened with
+// FILE_FLAG_NO_BUFFERING (O_DIRECT on Linux). Buffers aligned to the pool
+// alignment and covering whole sectors are transferred in place, see
+// BufferArena::setAlignment(); anything else is copied through a pool buffer
+// and padded to a whole sector.
+class IoBackend
+{
+public:
+    virtual ~IoBackend();
+
+    static IoBackend* create(IoHandle handle, const int queueDepth, const quint32 sectorSize = 512, AlignedBufferPool* pool = nullptr);
+#ifndef Q_OS_WIN
+    // Opens a file or block device for the backend, -1 on failure
+    static IoHandle   openFile(const QString& path, const bool write, const bool direct, QString& msg);
+#endif
+
+    int  queueDepth() const;
+    int  inFlight() const;
+    bool isFull() const;
+    bool isEmpty() const;
+
+    virtual bool submitRead(const quint64 offset, QByteArray buffer, const quint64 tag, QString& msg) = 0;
+    virtual bool submitWrite(const quint64 offset, const QByteArray& data, const quint64 tag, QString& msg) = 0;
+    virtual bool waitOldest(IoCompletion& completion, QString& msg) = 0;
+    bool         drain(QString& msg);
+
+protected:
+    IoBackend(IoHandle handle, const int queueDepth, const quint32 sectorSize, AlignedBufferPool* pool);
+
+    bool    checkRequest(const char* buffer, const quint32 length, QString& msg) const;
+    quint32 ioLength(const quint32 length) const;
+    bool    transfer(IoCompletion& request, char* buffer, QString& msg) const;
+    char*   transferBuffer(IoCompletion& request, char* bounceBuffer, bool& bounce, QString& msg) const;
+    void    completeBounce(IoCompletion& request, const char* bounceBuffer) const;
+
+protected:
+    IoHandle           m_handle;
+    int                m_queueDepth;
+    int                m_inFlight = {0};
+    quint32            m_sectorSize;
+    AlignedBufferPool* m_pool;
+};
+
+// Queue depth of one, plain ReadFile/WriteFile on a handle opened without
+// FILE_FLAG_OVERLAPPED, pread/pwrite on Linux
+class SyncIoBackend : public IoBackend
+{
+public:
+    SyncIoBackend(IoHandle handle, const quint32 sectorSize, AlignedBufferPool* pool);
+    ~SyncIoBackend() override;
+
+    bool submitRead(const quint64 offset, QByteArray buffer, const quint64 tag, QString& msg) override;
+    bool submitWrite(const quint64 offset, const QByteArray& data, const quint64 tag, QString& msg) override;
+    bool waitOldest(IoCompletion& completion, QString& msg) override;
+
+private:
+    bool submit(QString& msg);
+
+private:
+    IoCompletion m_completion;
+    char*        m_buffer = {nullptr};
+};
+
+#ifdef Q_OS_WIN
+// Overlapped I/O on a handle opened with FILE_FLAG_OVERLAPPED
+class OverlappedIoBackend : public IoBackend
+{
+public:
+    OverlappedIoBackend(HANDLE handle, const int queueDepth, const quint32 sectorSize, AlignedBufferPool* pool);
+    ~OverlappedIoBackend() override;
+
+    bool submitRead(const quint64 offset, QByteArray buffer, const quint64 tag, QString& msg) override;
+    bool submitWrite(const quint64 offset, const QByteArray& data, const quint64 tag, QString& msg) override;
+    bool waitOldest(IoCompletion& completion, QString& msg) override;
+
+private:
+    struct Slot
+    {
+        OVERLAPPED   overlapped;
+        IoCompletion request;
+        char*        buffer;
+        bool         bounce;
+    };
+
+    bool submit(Slot& slot, QString& msg);
+
+private:
+    QVector<Slot*> m_slots;
+    int            m_head = {0};
+};
+#else
+// pread/pwrite on one worker thread per queue slot, the kernel sees up to
+// queueDepth requests at once just as with overlapped I/O
+class ThreadedIoBackend : public IoBackend
+{
+public:
+    ThreadedIoBackend(IoHandle handle, const int queueDepth, const quint32 sectorSize, AlignedBufferPool* pool);
+    ~ThreadedIoBackend() override;
+
+    bool submitRead(const quint64 offset, QByteArray buffer, const quint64 tag, QString& msg) override;
+    bool submitWrite(const quint64 offset, const QByteArray& data, const quint64 tag, QString& msg) override;
+    bool waitOldest(IoCompletion& completion, QString& msg) override;
+
+private:
+    class Slot;
+
+    bool submit(Slot& slot, QString& msg);
+
+private:
+    QVector<Slot*> m_slots;
+    int            m_head = {0};
+    QThreadPool    m_threads;
+    QMutex         m_mutex;
+    QWaitCondition m_completed;
+};
+#endif
+
+#endif // IOBACKEND_H
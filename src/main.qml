@@ -9,7 +9,7 @@ Window
 {
     visible: true
     width: 480
-    height: 400
+    height: 650
     title: "Win Disk (Version: " + guiManager.version + ")"
 
     Universal.theme: Universal.Dark
@@ -20,7 +20,7 @@ Window
     {
         id: fileDialog
         title: "Please choose a image file"
-        nameFilters: [ "Applikon Disk Image (*.adi)" ]
+        nameFilters: verifyButton.checked ? [ "Applikon Disk Image (*.adi *.adm)", "Raw disk image (*.img *.gz *.xz *.zst)" ] : [ "Applikon Disk Image (*.adi)", "Raw disk image (*.img *.gz *.xz *.zst)" ]
         folder: guiManager.homeDir
         sidebarVisible: true
         selectExisting: !createButton.checked
@@ -32,15 +32,31 @@ Window
         }
     }
 
+    FileDialog
+    {
+        id: baseFileDialog
+        title: "Please choose a base image file"
+        nameFilters: [ "Applikon Disk Image (*.adi)" ]
+        folder: guiManager.homeDir
+        sidebarVisible: true
+        selectExisting: true
+        selectFolder: false
+        selectMultiple: false
+        onAccepted:
+        {
+            guiManager.baseImageUrl = baseFileDialog.fileUrl;
+        }
+    }
+
     MessageDialog
     {
         id: confirmDialog
         title: "Overwrite?"
         icon: StandardIcon.Warning
-        text: "All data on the selected device " + driveEdit.currentText + " will be erased! Do you want to proceed?"
+        text: "All data on the selected devices will be erased! Do you want to proceed?"
         detailedText: "This operation is irreversible, please make sure no useful data is on the selected device!"
         standardButtons: StandardButton.Yes | StandardButton.No
-        onYes: guiManager.restoreImage()
+        onYes: cloneButton.checked ? guiManager.cloneDevice() : guiManager.restoreImage()
     }
 
     MessageDialog
@@ -118,19 +134,43 @@ Window
                             guiManager.cancel();
                         }
                     }
+                    Button
+                    {
+                        id: verifyButton
+                        enabled: !guiManager.busy
+                        checkable: true
+                        text: "Verify Device"
+                        font.pixelSize: 16
+                        Layout.fillWidth: true
+                        Layout.preferredWidth: 0
+                        Layout.fillHeight: true
+                    }
+                    Button
+                    {
+                        id: cloneButton
+                        enabled: !guiManager.busy
+                        checkable: true
+                        text: "Clone Device"
+                        font.pixelSize: 16
+                        Layout.fillWidth: true
+                        Layout.preferredWidth: 0
+                        Layout.fillHeight: true
+                    }
                 }
             }
             Label
             {
-                id: deviceLabel
+                id: sourceLabel
+                visible: cloneButton.checked
                 Layout.preferredHeight: 20
                 Layout.fillWidth: true
                 font.pixelSize: 16
-                text: createButton.checked ? "Select source device" : "Select target device"
+                text: "Select source device"
             }
             ComboBox
             {
                 id: driveEdit
+                visible: cloneButton.checked
                 Layout.preferredHeight: 40
                 Layout.fillWidth: true
                 Layout.bottomMargin: 10
@@ -154,16 +194,58 @@ Window
                 }
             }
             Label
+            {
+                id: deviceLabel
+                Layout.preferredHeight: 20
+                Layout.fillWidth: true
+                font.pixelSize: 16
+                text: (createButton.checked || verifyButton.checked) ? "Select source devices" : "Select target devices"
+            }
+            ListView
+            {
+                id: deviceList
+                Layout.preferredHeight: 120
+                Layout.fillWidth: true
+                Layout.bottomMargin: 10
+                clip: true
+                model: guiManager.devices
+                ScrollBar.vertical: ScrollBar { }
+                delegate: CheckDelegate
+                {
+                    height: 40
+                    width: deviceList.width
+                    enabled: !guiManager.busy
+                    text: model.statusText ? model.label + "  " + model.statusText : model.label
+                    font.pixelSize: 16
+                    font.bold: true
+                    checked: model.selected
+                    onClicked:
+                    {
+                        model.selected = checked;
+                    }
+                    ProgressBar
+                    {
+                        anchors { left: parent.left; right: parent.right; bottom: parent.bottom }
+                        from: 0
+                        to: 1
+                        value: model.progress
+                        height: 4
+                    }
+                }
+            }
+            Label
             {
                 id: imageLabel
+                visible: !cloneButton.checked
                 Layout.preferredHeight: 20
                 Layout.fillWidth: true
                 font.pixelSize: 16
-                text: createButton.checked ? "Select target image file" : "Select source image file"
+                text: createButton.checked ? "Select target image file" : (verifyButton.checked ? "Select image or manifest file" : "Select source image file")
             }
             Item
             {
                 id: fileSelecter
+                visible: !cloneButton.checked
                 enabled: !guiManager.busy
                 Layout.preferredHeight: 40
                 Layout.fillWidth: true
@@ -193,11 +275,84 @@ Window
                     }
                 }
             }
+            Label
+            {
+                id: baseImageLabel
+                visible: createButton.checked
+                Layout.preferredHeight: 20
+                Layout.fillWidth: true
+                font.pixelSize: 16
+                text: "Base image for a delta image (optional)"
+            }
+            Item
+            {
+                id: baseFileSelecter
+                visible: createButton.checked
+                enabled: !guiManager.busy
+                Layout.preferredHeight: 40
+                Layout.fillWidth: true
+                Layout.bottomMargin: 10
+                TextField
+                {
+                    id: baseFilePathField
+                    anchors { left: parent.left; top: parent.top; bottom: parent.bottom; right: baseOpenButton.left }
+                    text: guiManager.baseImagePath
+                    font.pixelSize: 16
+                    onAccepted:
+                    {
+                        guiManager.baseImagePath = text;
+                    }
+                }
+                ToolButton
+                {
+                    id: baseOpenButton
+                    Universal.background: Universal.Steel
+                    anchors { right: parent.right; top: parent.top; bottom: parent.bottom }
+                    width: height
+                    icon.source: "qrc:/images/folder.png"
+                    icon.color: Universal.color(Universal.Cyan)
+                    onClicked:
+                    {
+                        baseFileDialog.open();
+                    }
+                }
+            }
+            Item
+            {
+                id: compressionItem
+                visible: createButton.checked
+                Layout.preferredHeight: 40
+                Layout.fillWidth: true
+                Layout.bottomMargin: 10
+                Label
+                {
+                    id: compressionLabel
+                    anchors { left: parent.left; top: parent.top; bottom: parent.bottom }
+                    width: 120
+                    text: "Compression"
+                    font.pixelSize: 16
+                    verticalAlignment: Text.AlignVCenter
+                }
+                ComboBox
+                {
+                    id: compressionEdit
+                    anchors { left: compressionLabel.right; top: parent.top; bottom: parent.bottom; right: parent.right }
+                    enabled: !guiManager.busy
+                    model: guiManager.compressionModes
+                    font.pixelSize: 16
+                    currentIndex: guiManager.compressionMode
+                    onActivated:
+                    {
+                        guiManager.compressionMode = index;
+                    }
+                }
+            }
             CheckBox
             {
                 id: verifyCheckBox
+                visible: !verifyButton.checked
                 checked: guiManager.verify
-                text: createButton.checked ? "Verify created image file" : "Verify restored target device"
+                text: createButton.checked ? "Verify created image file" : (cloneButton.checked ? "Verify target devices while cloning" : "Verify restored target device")
                 font.pixelSize: 16
                 Layout.preferredHeight: 30
                 Layout.fillWidth: true
@@ -207,6 +362,67 @@ Window
                     guiManager.verify = !guiManager.verify
                 }
             }
+            CheckBox
+            {
+                id: skipFreeSpaceCheckBox
+                visible: createButton.checked || cloneButton.checked
+                checked: guiManager.skipFreeSpace
+                text: "Skip free space of FAT, exFAT and ext4 partitions"
+                font.pixelSize: 16
+                Layout.preferredHeight: 30
+                Layout.fillWidth: true
+                Layout.bottomMargin: 10
+                onClicked:
+                {
+                    guiManager.skipFreeSpace = !guiManager.skipFreeSpace
+                }
+            }
+            CheckBox
+            {
+                id: chunkRepositoryCheckBox
+                visible: createButton.checked && guiManager.chunkRepositoryAvailable
+                enabled: guiManager.baseImagePath === ""
+                checked: guiManager.useChunkRepository
+                text: "Store chunks in the shared chunk repository"
+                font.pixelSize: 16
+                Layout.preferredHeight: 30
+                Layout.fillWidth: true
+                Layout.bottomMargin: 10
+                onClicked:
+                {
+                    guiManager.useChunkRepository = !guiManager.useChunkRepository
+                }
+            }
+            CheckBox
+            {
+                id: differentialCheckBox
+                visible: restoreButton.checked
+                checked: guiManager.differentialRestore
+                text: "Only write regions that differ from the device"
+                font.pixelSize: 16
+                Layout.preferredHeight: 30
+                Layout.fillWidth: true
+                Layout.bottomMargin: 10
+                onClicked:
+                {
+                    guiManager.differentialRestore = !guiManager.differentialRestore
+                }
+            }
+            CheckBox
+            {
+                id: discardCheckBox
+                visible: !createButton.checked
+                checked: guiManager.discardHoles
+                text: verifyButton.checked ? "Skip empty regions that were discarded" : "Discard empty regions instead of writing zeros"
+                font.pixelSize: 16
+                Layout.preferredHeight: 30
+                Layout.fillWidth: true
+                Layout.bottomMargin: 10
+                onClicked:
+                {
+                    guiManager.discardHoles = !guiManager.discardHoles
+                }
+            }
             Item
             {
                 id: emptyItem
@@ -224,15 +440,26 @@ Window
                     Button
                     {
                         id: startButton
-                        enabled: createButton.checked ? guiManager.canRead : guiManager.canWrite
-                        text: createButton.checked ? "Start Creating" : "Start Restoring"
+                        enabled: createButton.checked ? guiManager.canRead : (cloneButton.checked ? guiManager.canClone : guiManager.canWrite)
+                        text: createButton.checked ? "Start Creating" : (cloneButton.checked ? "Start Cloning" : (verifyButton.checked ? "Start Verifying" : "Start Restoring"))
                         font.pixelSize: 16
                         Layout.fillWidth: true
                         Layout.preferredWidth: 0
                         Layout.fillHeight: true
                         onClicked:
                         {
-                            createButton.checked ? guiManager.createImage() : confirmDialog.open()
+                            if (createButton.checked)
+                            {
+                                guiManager.createImage();
+                            }
+                            else if (verifyButton.checked)
+                            {
+                                guiManager.verifyDevice();
+                            }
+                            else
+                            {
+                                confirmDialog.open();
+                            }
                         }
                     }
                     Button
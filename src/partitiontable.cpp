@@ -0,0 +1,416 @@
+#include <QtEndian>
+
+#include <algorithm>
+#include <cstring>
+
+#include "partitiontable.h"
+#include "checksum.h"
+
+const int MBR_TABLE_OFFSET = 0x1BE;
+const int MBR_ENTRY_SIZE = 16;
+const int MBR_SIGNATURE_OFFSET = 0x1FE;
+const quint8 MBR_TYPE_GPT_PROTECTIVE = 0xEE;
+const int MAX_EBR_CHAIN = 256;
+const quint64 GPT_HEADER_LBA = 1;
+const quint32 GPT_MIN_HEADER_SIZE = 92;
+const quint32 GPT_MAX_ENTRIES_BYTES = 1024 * 1024;
+
+static bool hasMbrSignature(const QByteArray& sector)
+{
+    return (sector.size() >= 512) &&
+           (static_cast<quint8>(sector.at(MBR_SIGNATURE_OFFSET)) == 0x55) &&
+           (static_cast<quint8>(sector.at(MBR_SIGNATURE_OFFSET + 1)) == 0xAA);
+}
+
+static bool isExtendedType(const quint8 type)
+{
+    return (type == 0x05) || (type == 0x0F) || (type == 0x85);
+}
+
+PartitionTable::PartitionTable()
+{
+}
+
+bool PartitionTable::read(const SectorReader& reader, const quint64 sectorSize, const quint64 deviceSectors, QString& msg)
+{
+    m_sectorSize = sectorSize;
+    m_deviceSectors = deviceSectors;
+    m_scheme = SchemeNone;
+    m_partitions.clear();
+    m_extents.clear();
+
+    if (deviceSectors == 0)
+    {
+        return true;
+    }
+
+    QByteArray mbr;
+    if (!reader(0, 1, mbr, msg))
+    {
+        return false;
+    }
+
+    if (!hasMbrSignature(mbr))
+    {
+        useWholeDevice();
+        return true;
+    }
+
+    // A protective entry marks a GPT disk
+    for (int i = 0; i < 4; i++)
+    {
+        const char* entry = mbr.constData() + MBR_TABLE_OFFSET + MBR_ENTRY_SIZE * i;
+        if (static_cast<quint8>(entry[4]) == MBR_TYPE_GPT_PROTECTIVE)
+        {
+            if (!readGpt(reader, msg))
+            {
+                return false;
+            }
+            mergeExtents();
+            return true;
+        }
+    }
+
+    if (!readMbr(reader, mbr, msg))
+    {
+        return false;
+    }
+    mergeExtents();
+    return true;
+}
+
+PartitionTable::Scheme PartitionTable::scheme() const
+{
+    return m_scheme;
+}
+
+const QVector<DiskExtent>& PartitionTable::partitions() const
+{
+    return m_partitions;
+}
+
+const QVector<DiskExtent>& PartitionTable::usedExtents() const
+{
+    return m_extents;
+}
+
+quint64 PartitionTable::usedSectors() const
+{
+    quint64 sectors = 0;
+    foreach (const DiskExtent& extent, m_extents)
+    {
+        sectors += extent.numSectors;
+    }
+    return sectors;
+}
+
+quint64 PartitionTable::endSector() const
+{
+    return m_extents.isEmpty() ? 0 : m_extents.last().startSector + m_extents.last().numSectors;
+}
+
+bool PartitionTable::readMbr(const SectorReader& reader, const QByteArray& mbr, QString& msg)
+{
+    // Boot sectors of unpartitioned media carry the same signature, their
+    // code area does not pass as a table with valid status bytes
+    for (int i = 0; i < 4; i++)
+    {
+        quint8 status = static_cast<quint8>(mbr.at(MBR_TABLE_OFFSET + MBR_ENTRY_SIZE * i));
+        if ((status != 0x00) && (status != 0x80))
+        {
+            useWholeDevice();
+            return true;
+        }
+    }
+
+    for (int i = 0; i < 4; i++)
+    {
+        const char* entry = mbr.constData() + MBR_TABLE_OFFSET + MBR_ENTRY_SIZE * i;
+        quint8 type = static_cast<quint8>(entry[4]);
+        quint32 startSector = qFromLittleEndian<quint32>(reinterpret_cast<const uchar*>(entry + 8));
+        quint32 numSectors = qFromLittleEndian<quint32>(reinterpret_cast<const uchar*>(entry + 12));
+        if ((type == 0) || (numSectors == 0))
+        {
+            continue;
+        }
+
+        if ((startSector >= m_deviceSectors) || (numSectors > m_deviceSectors - startSector))
+        {
+            // Partitions reaching past the device mean the table does not belong to it
+            useWholeDevice();
+            return true;
+        }
+
+        if (isExtendedType(type))
+        {
+            // Only the EBRs and the logical partitions of the container hold data
+            if (!readEbrChain(reader, startSector, msg))
+            {
+                return false;
+            }
+        }
+        else
+        {
+            addPartition(startSector, numSectors);
+        }
+    }
+
+    if (m_partitions.isEmpty())
+    {
+        useWholeDevice();
+        return true;
+    }
+
+    // Boot loaders often live between the MBR and the first partition
+    quint64 firstStart = m_deviceSectors;
+    foreach (const DiskExtent& partition, m_partitions)
+    {
+        firstStart = qMin(firstStart, partition.startSector);
+    }
+    addRegion(0, qMax<quint64>(firstStart, 1));
+    m_scheme = SchemeMbr;
+    return true;
+}
+
+bool PartitionTable::readEbrChain(const SectorReader& reader, const quint64 extendedStart, QString& msg)
+{
+    // Logical partitions are relative to their EBR, the link to the next EBR
+    // is relative to the start of the extended partition
+    quint64 ebrSector = extendedStart;
+    for (int i = 0; i < MAX_EBR_CHAIN; i++)
+    {
+        if (ebrSector >= m_deviceSectors)
+        {
+            break;
+        }
+
+        QByteArray ebr;
+        if (!reader(ebrSector, 1, ebr, msg))
+        {
+            return false;
+        }
+        if (!hasMbrSignature(ebr))
+        {
+            break;
+        }
+        addRegion(ebrSector, 1);
+
+        const char* logical = ebr.constData() + MBR_TABLE_OFFSET;
+        quint32 logicalStart = qFromLittleEndian<quint32>(reinterpret_cast<const uchar*>(logical + 8));
+        quint32 logicalSectors = qFromLittleEndian<quint32>(reinterpret_cast<const uchar*>(logical + 12));
+        if ((static_cast<quint8>(logical[4]) != 0) && (logicalSectors != 0))
+        {
+            addPartition(ebrSector + logicalStart, logicalSectors);
+        }
+
+        const char* link = ebr.constData() + MBR_TABLE_OFFSET + MBR_ENTRY_SIZE;
+        quint32 nextOffset = qFromLittleEndian<quint32>(reinterpret_cast<const uchar*>(link + 8));
+        if (!isExtendedType(static_cast<quint8>(link[4])) || (nextOffset == 0) || (extendedStart + nextOffset <= ebrSector))
+        {
+            break;
+        }
+        ebrSector = extendedStart + nextOffset;
+    }
+    return true;
+}
+
+bool PartitionTable::readGpt(const SectorReader& reader, QString& msg)
+{
+    // Fall back to the backup header at the end of the device
+    GptHeader header;
+    bool valid = false;
+    if (!readGptHeader(reader, GPT_HEADER_LBA, header, msg))
+    {
+        return false;
+    }
+    valid = (header.myLba == GPT_HEADER_LBA);
+    if (valid && !readGptEntries(reader, header, msg))
+    {
+        if (!msg.isEmpty())
+        {
+            return false;
+        }
+        valid = false;
+    }
+
+    if (!valid)
+    {
+        m_partitions.clear();
+        m_extents.clear();
+        if (!readGptHeader(reader, m_deviceSectors - 1, header, msg))
+        {
+            return false;
+        }
+        valid = (header.myLba == m_deviceSectors - 1) && readGptEntries(reader, header, msg);
+        if (!msg.isEmpty())
+        {
+            return false;
+        }
+    }
+
+    if (!valid)
+    {
+        useWholeDevice();
+        return true;
+    }
+
+    // Protective MBR, primary header and entries, then the backup entries and header
+    addRegion(0, header.firstUsableLba);
+    quint64 backupEnd = qMax(header.myLba, header.alternateLba);
+    if (backupEnd > header.lastUsableLba)
+    {
+        addRegion(header.lastUsableLba + 1, backupEnd - header.lastUsableLba);
+    }
+    m_scheme = SchemeGpt;
+    return true;
+}
+
+bool PartitionTable::readGptHeader(const SectorReader& reader, const quint64 lba, GptHeader& header, QString& msg)
+{
+    header = GptHeader();
+    if (lba >= m_deviceSectors)
+    {
+        return true;
+    }
+
+    QByteArray sector;
+    if (!reader(lba, 1, sector, msg))
+    {
+        return false;
+    }
+
+    const uchar* p = reinterpret_cast<const uchar*>(sector.constData());
+    quint32 headerSize = (sector.size() >= static_cast<int>(GPT_MIN_HEADER_SIZE)) ? qFromLittleEndian<quint32>(p + 12) : 0;
+    if ((sector.size() < static_cast<int>(GPT_MIN_HEADER_SIZE)) || (memcmp(p, "EFI PART", 8) != 0) ||
+        (headerSize < GPT_MIN_HEADER_SIZE) || (headerSize > static_cast<quint32>(sector.size())))
+    {
+        return true;
+    }
+
+    // The header checksum is computed with its own field set to zero
+    QByteArray copy = sector.left(static_cast<int>(headerSize));
+    memset(copy.data() + 16, 0, 4);
+    if (Checksum::crc32(copy.constData(), headerSize) != qFromLittleEndian<quint32>(p + 16))
+    {
+        return true;
+    }
+
+    GptHeader parsed;
+    parsed.myLba = qFromLittleEndian<quint64>(p + 24);
+    parsed.alternateLba = qFromLittleEndian<quint64>(p + 32);
+    parsed.firstUsableLba = qFromLittleEndian<quint64>(p + 40);
+    parsed.lastUsableLba = qFromLittleEndian<quint64>(p + 48);
+    parsed.entriesLba = qFromLittleEndian<quint64>(p + 72);
+    parsed.numEntries = qFromLittleEndian<quint32>(p + 80);
+    parsed.entrySize = qFromLittleEndian<quint32>(p + 84);
+    parsed.entriesCrc = qFromLittleEndian<quint32>(p + 88);
+
+    if ((parsed.firstUsableLba > parsed.lastUsableLba) || (parsed.lastUsableLba >= m_deviceSectors) ||
+        (parsed.entrySize < 128) || (parsed.entrySize % 8) ||
+        (static_cast<quint64>(parsed.numEntries) * parsed.entrySize > GPT_MAX_ENTRIES_BYTES))
+    {
+        return true;
+    }
+    header = parsed;
+    return true;
+}
+
+bool PartitionTable::readGptEntries(const SectorReader& reader, const GptHeader& header, QString& msg)
+{
+    quint64 bytes = static_cast<quint64>(header.numEntries) * header.entrySize;
+    quint64 sectors = (bytes + m_sectorSize - 1) / m_sectorSize;
+    if ((sectors == 0) || (header.entriesLba + sectors > m_deviceSectors))
+    {
+        return false;
+    }
+
+    QByteArray entries;
+    if (!reader(header.entriesLba, sectors, entries, msg))
+    {
+        return false;
+    }
+    if ((static_cast<quint64>(entries.size()) < bytes) || (Checksum::crc32(entries.constData(), bytes) != header.entriesCrc))
+    {
+        return false;
+    }
+
+    static const char unusedType[16] = {0};
+    for (quint32 i = 0; i < header.numEntries; i++)
+    {
+        const char* entry = entries.constData() + static_cast<quint64>(i) * header.entrySize;
+        if (memcmp(entry, unusedType, sizeof(unusedType)) == 0)
+        {
+            continue;
+        }
+
+        // The last LBA is inclusive
+        quint64 firstLba = qFromLittleEndian<quint64>(reinterpret_cast<const uchar*>(entry + 32));
+        quint64 lastLba = qFromLittleEndian<quint64>(reinterpret_cast<const uchar*>(entry + 40));
+        if ((firstLba > lastLba) || !addPartition(firstLba, lastLba - firstLba + 1))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool PartitionTable::addPartition(const quint64 startSector, const quint64 numSectors)
+{
+    if ((startSector >= m_deviceSectors) || (numSectors > m_deviceSectors - startSector))
+    {
+        return false;
+    }
+
+    DiskExtent partition;
+    partition.startSector = startSector;
+    partition.numSectors = numSectors;
+    m_partitions.append(partition);
+    addRegion(startSector, numSectors);
+    return true;
+}
+
+void PartitionTable::addRegion(const quint64 startSector, const quint64 numSectors)
+{
+    if ((startSector >= m_deviceSectors) || (numSectors == 0))
+    {
+        return;
+    }
+
+    DiskExtent extent;
+    extent.startSector = startSector;
+    extent.numSectors = qMin(numSectors, m_deviceSectors - startSector);
+    m_extents.append(extent);
+}
+
+void PartitionTable::useWholeDevice()
+{
+    m_scheme = SchemeNone;
+    m_partitions.clear();
+    m_extents.clear();
+    addRegion(0, m_deviceSectors);
+}
+
+void PartitionTable::mergeExtents()
+{
+    std::sort(m_extents.begin(), m_extents.end(), [](const DiskExtent& a, const DiskExtent& b)
+    {
+        return a.startSector < b.startSector;
+    });
+
+    // Overlapping and adjacent extents are read as one
+    QVector<DiskExtent> merged;
+    foreach (const DiskExtent& extent, m_extents)
+    {
+        if (!merged.isEmpty() && (extent.startSector <= merged.last().startSector + merged.last().numSectors))
+        {
+            DiskExtent& last = merged.last();
+            quint64 end = qMax(last.startSector + last.numSectors, extent.startSector + extent.numSectors);
+            last.numSectors = end - last.startSector;
+        }
+        else
+        {
+            merged.append(extent);
+        }
+    }
+    m_extents = merged;
+}
@@ -0,0 +1,78 @@
+#ifndef PARTITIONTABLE_H
+#define PARTITIONTABLE_H
+
+#include <QByteArray>
+#include <QString>
+#include <QVector>
+
+#include <functional>
+
+// Range of device sectors, numSectors long starting at startSector
+struct DiskExtent
+{
+    quint64 startSector = {0};
+    quint64 numSectors = {0};
+};
+
+// Part of a device that is either transferred or left out as space the file system does not use
+struct DeviceRange
+{
+    quint64 startSector;
+    quint64 numSectors;
+    bool    unallocated;
+};
+
+// Parses the MBR (including the EBR chain of an extended partition) or the
+// GPT of a device and reports which sectors hold data: the partitions, the
+// partition table structures and the boot area in front of the first
+// partition. Devices without a recognised table are used as a whole.
+// Sectors are read through a callback, so the parser works on any source.
+class PartitionTable
+{
+public:
+    enum Scheme { SchemeNone = 0, SchemeMbr, SchemeGpt };
+
+    typedef std::function<bool(const quint64 startSector, const quint64 numSectors, QByteArray& data, QString& msg)> SectorReader;
+
+    PartitionTable();
+
+    bool read(const SectorReader& reader, const quint64 sectorSize, const quint64 deviceSectors, QString& msg);
+
+    Scheme                     scheme() const;
+    const QVector<DiskExtent>& partitions() const;
+    const QVector<DiskExtent>& usedExtents() const;
+    quint64                    usedSectors() const;
+    quint64                    endSector() const;
+
+private:
+    struct GptHeader
+    {
+        quint64 myLba = {0};
+        quint64 alternateLba = {0};
+        quint64 firstUsableLba = {0};
+        quint64 lastUsableLba = {0};
+        quint64 entriesLba = {0};
+        quint32 numEntries = {0};
+        quint32 entrySize = {0};
+        quint32 entriesCrc = {0};
+    };
+
+    bool readMbr(const SectorReader& reader, const QByteArray& mbr, QString& msg);
+    bool readEbrChain(const SectorReader& reader, const quint64 extendedStart, QString& msg);
+    bool readGpt(const SectorReader& reader, QString& msg);
+    bool readGptHeader(const SectorReader& reader, const quint64 lba, GptHeader& header, QString& msg);
+    bool readGptEntries(const SectorReader& reader, const GptHeader& header, QString& msg);
+    bool addPartition(const quint64 startSector, const quint64 numSectors);
+    void addRegion(const quint64 startSector, const quint64 numSectors);
+    void useWholeDevice();
+    void mergeExtents();
+
+private:
+    quint64             m_sectorSize = {512};
+    quint64             m_deviceSectors = {0};
+    Scheme              m_scheme = {SchemeNone};
+    QVector<DiskExtent> m_partitions;
+    QVector<DiskExtent> m_extents;
+};
+
+#endif // PARTITIONTABLE_H
@@ -0,0 +1,698 @@
+#include <QFileInfo>
+#include <QThread>
+
+#ifdef Q_OS_WIN
+#include <windows.h>
+#include <winioctl.h>
+#include <io.h>
+#endif
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_LZMA
+#include <lzma.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include <cstring>
+
+#include "rawimage.h"
+
+// Compressed data is read and written in blocks of this size
+static const int STREAM_BUFFER_SIZE = 1024 * 1024;
+
+RawImage::Format RawImage::formatOf(const QString& path)
+{
+    QString suffix = QFileInfo(path).suffix().toLower();
+    if ((suffix == "img") || (suffix == "raw") || (suffix == "bin"))
+    {
+        return FormatRaw;
+    }
+    if (suffix == "gz")
+    {
+        return FormatGzip;
+    }
+    if (suffix == "xz")
+    {
+        return FormatXz;
+    }
+    if (suffix == "zst")
+    {
+        return FormatZstd;
+    }
+    return FormatNone;
+}
+
+bool RawImage::isAvailable(const Format format)
+{
+    switch (format)
+    {
+    case FormatRaw:
+        return true;
+#ifdef HAVE_ZLIB
+    case FormatGzip:
+        return true;
+#endif
+#ifdef HAVE_LZMA
+    case FormatXz:
+        return true;
+#endif
+#ifdef HAVE_ZSTD
+    case FormatZstd:
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
+QString RawImage::name(const Format format)
+{
+    switch (format)
+    {
+    case FormatRaw:
+        return QString("raw");
+    case FormatGzip:
+        return QString("gzip");
+    case FormatXz:
+        return QString("xz");
+    case FormatZstd:
+        return QString("zstd");
+    default:
+        return QString("unknown");
+    }
+}
+
+int RawImage::defaultLevel(const Format format)
+{
+    switch (format)
+    {
+    case FormatGzip:
+    case FormatXz:
+        return 6;
+    case FormatZstd:
+        return 3;
+    default:
+        return 0;
+    }
+}
+
+struct RawImageReader::Decoder
+{
+    explicit Decoder(const RawImage::Format format) :
+        format(format),
+        input(STREAM_BUFFER_SIZE, '\0')
+    {
+    }
+
+    ~Decoder()
+    {
+        if (!initialized)
+        {
+            return;
+        }
+#ifdef HAVE_ZLIB
+        if (format == RawImage::FormatGzip)
+        {
+            inflateEnd(&zlib);
+        }
+#endif
+#ifdef HAVE_LZMA
+        if (format == RawImage::FormatXz)
+        {
+            lzma_end(&lzma);
+        }
+#endif
+#ifdef HAVE_ZSTD
+        if (format == RawImage::FormatZstd)
+        {
+            ZSTD_freeDStream(zstd);
+        }
+#endif
+    }
+
+    bool init(QString& msg)
+    {
+#ifdef HAVE_ZLIB
+        if (format == RawImage::FormatGzip)
+        {
+            // Detects the gzip header, members of a concatenated file are decoded one after the other
+            memset(&zlib, 0, sizeof(zlib));
+            initialized = (inflateInit2(&zlib, 15 + 32) == Z_OK);
+        }
+#endif
+#ifdef HAVE_LZMA
+        if (format == RawImage::FormatXz)
+        {
+#if LZMA_VERSION >= 50040002
+            // Blocks of a multi-block stream are decoded on all cores
+            lzma_mt mt;
+            memset(&mt, 0, sizeof(mt));
+            mt.flags = LZMA_CONCATENATED;
+            mt.threads = static_cast<uint32_t>(QThread::idealThreadCount());
+            mt.memlimit_threading = lzma_physmem() / 4;
+            mt.memlimit_stop = UINT64_MAX;
+            initialized = (lzma_stream_decoder_mt(&lzma, &mt) == LZMA_OK);
+#else
+            initialized = (lzma_stream_decoder(&lzma, UINT64_MAX, LZMA_CONCATENATED) == LZMA_OK);
+#endif
+        }
+#endif
+#ifdef HAVE_ZSTD
+        if (format == RawImage::FormatZstd)
+        {
+            // One stream decoder for all frames, libzstd decodes a frame on the calling thread only
+            zstd = ZSTD_createDStream();
+            initialized = (zstd != nullptr) && !ZSTD_isError(ZSTD_initDStream(zstd));
+            frameDone = true;
+        }
+#endif
+        if (!initialized)
+        {
+            msg = QString("File Error;Cannot start the %1 decoder.").arg(RawImage::name(format));
+        }
+        return initialized;
+    }
+
+    // Decodes from the buffered input, produces nothing once the stream has ended
+    bool decode(char* data, const quint64 length, quint64& produced, QString& msg)
+    {
+        quint64 consumed = 0;
+        produced = 0;
+        bool ok = false;
+        switch (format)
+        {
+#ifdef HAVE_ZLIB
+        case RawImage::FormatGzip:
+        {
+            zlib.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(next));
+            zlib.avail_in = static_cast<uInt>(available);
+            zlib.next_out = reinterpret_cast<Bytef*>(data);
+            zlib.avail_out = static_cast<uInt>(length);
+            int result = inflate(&zlib, Z_NO_FLUSH);
+            consumed = available - zlib.avail_in;
+            produced = length - zlib.avail_out;
+            ok = (result == Z_OK) || (result == Z_STREAM_END) || (result == Z_BUF_ERROR);
+            if (result == Z_STREAM_END)
+            {
+                inflateReset(&zlib);
+                frameDone = true;
+            }
+            else if ((consumed > 0) || (produced > 0))
+            {
+                frameDone = false;
+            }
+            break;
+        }
+#endif
+#ifdef HAVE_LZMA
+        case RawImage::FormatXz:
+        {
+            lzma.next_in = reinterpret_cast<const uint8_t*>(next);
+            lzma.avail_in = static_cast<size_t>(available);
+            lzma.next_out = reinterpret_cast<uint8_t*>(data);
+            lzma.avail_out = static_cast<size_t>(length);
+            lzma_ret result = lzma_code(&lzma, inputEnd ? LZMA_FINISH : LZMA_RUN);
+            consumed = available - lzma.avail_in;
+            produced = length - lzma.avail_out;
+            ok = (result == LZMA_OK) || (result == LZMA_STREAM_END) || ((result == LZMA_BUF_ERROR) && !inputEnd);
+            frameDone = (result == LZMA_STREAM_END);
+            streamEnd = frameDone;
+            break;
+        }
+#endif
+#ifdef HAVE_ZSTD
+        case RawImage::FormatZstd:
+        {
+            ZSTD_inBuffer in = { next, static_cast<size_t>(available), 0 };
+            ZSTD_outBuffer out = { data, static_cast<size_t>(length), 0 };
+            size_t result = ZSTD_decompressStream(zstd, &out, &in);
+            consumed = in.pos;
+            produced = out.pos;
+            ok = !ZSTD_isError(result);
+            if (ok && ((consumed > 0) || (produced > 0)))
+            {
+                frameDone = (result == 0);
+            }
+            break;
+        }
+#endif
+        default:
+            break;
+        }
+
+        if (!ok)
+        {
+            msg = QString("File Error;The %1 stream of the image file is damaged.").arg(RawImage::name(format));
+            return false;
+        }
+        next += consumed;
+        available -= consumed;
+
+        // The stream ends with the input, in the middle of a frame it was cut off
+        if ((produced == 0) && (consumed == 0) && (available == 0) && inputEnd && !streamEnd)
+        {
+            if (!frameDone)
+            {
+                msg = QString("File Error;The image file ends in the middle of its %1 stream.").arg(RawImage::name(format));
+                return false;
+            }
+            streamEnd = true;
+        }
+        return true;
+    }
+
+    RawImage::Format format;
+    QByteArray       input;
+    const char*      next = {nullptr};
+    quint64          available = {0};
+    bool             initialized = {false};
+    bool             inputEnd = {false};
+    bool             frameDone = {false};
+    bool             streamEnd = {false};
+#ifdef HAVE_ZLIB
+    z_stream         zlib;
+#endif
+#ifdef HAVE_LZMA
+    lzma_stream      lzma = LZMA_STREAM_INIT;
+#endif
+#ifdef HAVE_ZSTD
+    ZSTD_DStream*    zstd = {nullptr};
+#endif
+};
+
+RawImageReader::RawImageReader()
+{
+}
+
+RawImageReader::~RawImageReader()
+{
+    close();
+}
+
+bool RawImageReader::open(const QString& path, QString& msg)
+{
+    close();
+    m_format = RawImage::formatOf(path);
+    if (!RawImage::isAvailable(m_format))
+    {
+        msg = QString("File Error;%1 compressed images are not supported in this build.").arg(RawImage::name(m_format));
+        return false;
+    }
+
+    m_file.setFileName(path);
+    if (!m_file.open(QIODevice::ReadOnly))
+    {
+        msg = QString("File Error;Cannot open specified image file.");
+        return false;
+    }
+
+    if (m_format == RawImage::FormatRaw)
+    {
+        m_totalSize = static_cast<quint64>(m_file.size());
+        return true;
+    }
+    if (m_format == RawImage::FormatXz)
+    {
+        readXzSize();
+    }
+#ifdef HAVE_ZSTD
+    if (m_format == RawImage::FormatZstd)
+    {
+        QByteArray frameHeader = m_file.peek(ZSTD_FRAMEHEADERSIZE_MAX);
+        unsigned long long contentSize = ZSTD_getFrameContentSize(frameHeader.constData(), static_cast<size_t>(frameHeader.size()));
+        m_totalSize = ((contentSize == ZSTD_CONTENTSIZE_UNKNOWN) || (contentSize == ZSTD_CONTENTSIZE_ERROR)) ? 0 : contentSize;
+    }
+#endif
+
+    m_decoder.reset(new Decoder(m_format));
+    return m_decoder->init(msg);
+}
+
+bool RawImageReader::readXzSize()
+{
+#ifdef HAVE_LZMA
+    // The index before the stream footer records the uncompressed size of every block
+    qint64 fileSize = m_file.size();
+    if (fileSize < 2 * LZMA_STREAM_HEADER_SIZE)
+    {
+        return false;
+    }
+    lzma_stream_flags flags;
+    QByteArray footer;
+    if (m_file.seek(fileSize - LZMA_STREAM_HEADER_SIZE))
+    {
+        footer = m_file.read(LZMA_STREAM_HEADER_SIZE);
+    }
+    bool ok = (footer.size() == LZMA_STREAM_HEADER_SIZE) &&
+              (lzma_stream_footer_decode(&flags, reinterpret_cast<const uint8_t*>(footer.constData())) == LZMA_OK) &&
+              (static_cast<qint64>(flags.backward_size) <= fileSize - 2 * LZMA_STREAM_HEADER_SIZE) &&
+              m_file.seek(fileSize - LZMA_STREAM_HEADER_SIZE - static_cast<qint64>(flags.backward_size));
+
+    QByteArray indexData = ok ? m_file.read(static_cast<qint64>(flags.backward_size)) : QByteArray();
+    lzma_index* index = nullptr;
+    uint64_t memlimit = UINT64_MAX;
+    size_t position = 0;
+    ok = ok && (indexData.size() == static_cast<int>(flags.backward_size)) &&
+         (lzma_index_buffer_decode(&index, &memlimit, nullptr, reinterpret_cast<const uint8_t*>(indexData.constData()), &position, static_cast<size_t>(indexData.size())) == LZMA_OK);
+
+    // Concatenated streams or padding would need every index, their size stays unknown
+    if (ok && (lzma_index_file_size(index) == static_cast<lzma_vli>(fileSize)))
+    {
+        m_totalSize = lzma_index_uncompressed_size(index);
+    }
+    if (index)
+    {
+        lzma_index_end(index, nullptr);
+    }
+    m_file.seek(0);
+    return m_totalSize != 0;
+#else
+    return false;
+#endif
+}
+
+void RawImageReader::close()
+{
+    m_decoder.reset();
+    if (m_file.isOpen())
+    {
+        m_file.close();
+    }
+    m_totalSize = 0;
+}
+
+quint64 RawImageReader::totalSize() const
+{
+    return m_totalSize;
+}
+
+bool RawImageReader::read(char* data, const quint64 length, quint64& count, QString& msg)
+{
+    count = 0;
+    if (m_format == RawImage::FormatRaw)
+    {
+        qint64 size = m_file.read(data, static_cast<qint64>(length));
+        if (size < 0)
+        {
+            msg = QString("Read Error;Cannot read the image file.");
+            return false;
+        }
+        count = static_cast<quint64>(size);
+        return true;
+    }
+
+    Decoder& decoder = *m_decoder;
+    while ((count < length) && !decoder.streamEnd)
+    {
+        if ((decoder.available == 0) && !decoder.inputEnd)
+        {
+            qint64 size = m_file.read(decoder.input.data(), decoder.input.size());
+            if (size < 0)
+            {
+                msg = QString("Read Error;Cannot read the image file.");
+                return false;
+            }
+            decoder.next = decoder.input.constData();
+            decoder.available = static_cast<quint64>(size);
+            decoder.inputEnd = (size == 0);
+        }
+
+        quint64 produced = 0;
+        if (!decoder.decode(data + count, length - count, produced, msg))
+        {
+            return false;
+        }
+        count += produced;
+    }
+    return true;
+}
+
+struct RawImageWriter::Encoder
+{
+    explicit Encoder(const RawImage::Format format) :
+        format(format),
+        output(STREAM_BUFFER_SIZE, '\0')
+    {
+    }
+
+    ~Encoder()
+    {
+        if (!initialized)
+        {
+            return;
+        }
+#ifdef HAVE_ZLIB
+        if (format == RawImage::FormatGzip)
+        {
+            deflateEnd(&zlib);
+        }
+#endif
+#ifdef HAVE_LZMA
+        if (format == RawImage::FormatXz)
+        {
+            lzma_end(&lzma);
+        }
+#endif
+#ifdef HAVE_ZSTD
+        if (format == RawImage::FormatZstd)
+        {
+            ZSTD_freeCCtx(zstd);
+        }
+#endif
+    }
+
+    bool init(const int level, QString& msg)
+    {
+#ifdef HAVE_ZLIB
+        if (format == RawImage::FormatGzip)
+        {
+            memset(&zlib, 0, sizeof(zlib));
+            initialized = (deflateInit2(&zlib, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK);
+        }
+#endif
+#ifdef HAVE_LZMA
+        if (format == RawImage::FormatXz)
+        {
+            // Independent blocks on all cores, they can be decoded in parallel again
+            lzma_mt mt;
+            memset(&mt, 0, sizeof(mt));
+            mt.threads = static_cast<uint32_t>(QThread::idealThreadCount());
+            mt.preset = static_cast<uint32_t>(level);
+            mt.check = LZMA_CHECK_CRC64;
+            initialized = (lzma_stream_encoder_mt(&lzma, &mt) == LZMA_OK);
+        }
+#endif
+#ifdef HAVE_ZSTD
+        if (format == RawImage::FormatZstd)
+        {
+            // Worker threads are only available when the library was built with them
+            zstd = ZSTD_createCCtx();
+            initialized = (zstd != nullptr) && !ZSTD_isError(ZSTD_CCtx_setParameter(zstd, ZSTD_c_compressionLevel, level)) &&
+                          !ZSTD_isError(ZSTD_CCtx_setParameter(zstd, ZSTD_c_checksumFlag, 1));
+            if (initialized)
+            {
+                ZSTD_CCtx_setParameter(zstd, ZSTD_c_nbWorkers, QThread::idealThreadCount());
+            }
+        }
+#endif
+        if (!initialized)
+        {
+            msg = QString("Write Error;Cannot start the %1 encoder.").arg(RawImage::name(format));
+        }
+        return initialized;
+    }
+
+    // Encodes all of the data, with last the stream is completed
+    bool encode(QFile& file, const char* data, const quint64 length, const bool last, QString& msg)
+    {
+        const char* next = data;
+        quint64 remaining = length;
+        bool ok = true;
+        bool done = false;
+        while (ok && !done)
+        {
+            quint64 produced = 0;
+            switch (format)
+            {
+#ifdef HAVE_ZLIB
+            case RawImage::FormatGzip:
+            {
+                zlib.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(next));
+                zlib.avail_in = static_cast<uInt>(remaining);
+                zlib.next_out = reinterpret_cast<Bytef*>(output.data());
+                zlib.avail_out = static_cast<uInt>(output.size());
+                int result = deflate(&zlib, last ? Z_FINISH : Z_NO_FLUSH);
+                ok = (result == Z_OK) || (result == Z_STREAM_END) || (result == Z_BUF_ERROR);
+                next += remaining - zlib.avail_in;
+                remaining = zlib.avail_in;
+                produced = static_cast<quint64>(output.size()) - zlib.avail_out;
+                done = last ? (result == Z_STREAM_END) : ((remaining == 0) && (zlib.avail_out != 0));
+                break;
+            }
+#endif
+#ifdef HAVE_LZMA
+            case RawImage::FormatXz:
+            {
+                lzma.next_in = reinterpret_cast<const uint8_t*>(next);
+                lzma.avail_in = static_cast<size_t>(remaining);
+                lzma.next_out = reinterpret_cast<uint8_t*>(output.data());
+                lzma.avail_out = static_cast<size_t>(output.size());
+                lzma_ret result = lzma_code(&lzma, last ? LZMA_FINISH : LZMA_RUN);
+                ok = (result == LZMA_OK) || (result == LZMA_STREAM_END);
+                next += remaining - lzma.avail_in;
+                remaining = lzma.avail_in;
+                produced = static_cast<quint64>(output.size()) - lzma.avail_out;
+                done = last ? (result == LZMA_STREAM_END) : ((remaining == 0) && (lzma.avail_out != 0));
+                break;
+            }
+#endif
+#ifdef HAVE_ZSTD
+            case RawImage::FormatZstd:
+            {
+                ZSTD_inBuffer in = { next, static_cast<size_t>(remaining), 0 };
+                ZSTD_outBuffer out = { output.data(), static_cast<size_t>(output.size()), 0 };
+                size_t result = ZSTD_compressStream2(zstd, &out, &in, last ? ZSTD_e_end : ZSTD_e_continue);
+                ok = !ZSTD_isError(result);
+                next += in.pos;
+                remaining -= in.pos;
+                produced = out.pos;
+                done = last ? (result == 0) : (remaining == 0);
+                break;
+            }
+#endif
+            default:
+                ok = false;
+                break;
+            }
+            ok = ok && (file.write(output.constData(), static_cast<qint64>(produced)) == static_cast<qint64>(produced));
+        }
+        if (!ok)
+        {
+            msg = QString("Write Error;Cannot write %1 compressed data to image file.").arg(RawImage::name(format));
+        }
+        return ok;
+    }
+
+    RawImage::Format format;
+    QByteArray       output;
+    bool             initialized = {false};
+#ifdef HAVE_ZLIB
+    z_stream         zlib;
+#endif
+#ifdef HAVE_LZMA
+    lzma_stream      lzma = LZMA_STREAM_INIT;
+#endif
+#ifdef HAVE_ZSTD
+    ZSTD_CCtx*       zstd = {nullptr};
+#endif
+};
+
+RawImageWriter::RawImageWriter()
+{
+}
+
+RawImageWriter::~RawImageWriter()
+{
+    close();
+}
+
+bool RawImageWriter::open(const QString& path, const RawImage::Format format, const int level, QString& msg)
+{
+    close();
+    m_format = format;
+    m_length = 0;
+    if (!RawImage::isAvailable(format))
+    {
+        msg = QString("Write Error;%1 compressed images are not supported in this build.").arg(RawImage::name(format));
+        return false;
+    }
+
+    m_file.setFileName(path);
+    if (!m_file.open(QIODevice::WriteOnly))
+    {
+        msg = QString("Write Error;Cannot open image file.");
+        return false;
+    }
+
+    if (format == RawImage::FormatRaw)
+    {
+#ifdef Q_OS_WIN
+        // Skipped zeros only become holes in a sparse file, a failure just costs disk space
+        DWORD bytesReturned = 0;
+        DeviceIoControl(reinterpret_cast<HANDLE>(_get_osfhandle(m_file.handle())), FSCTL_SET_SPARSE, nullptr, 0, nullptr, 0, &bytesReturned, nullptr);
+#endif
+        return true;
+    }
+    m_encoder.reset(new Encoder(format));
+    return m_encoder->init(level, msg);
+}
+
+bool RawImageWriter::write(const char* data, const quint64 length, QString& msg)
+{
+    m_length += length;
+    if (m_format != RawImage::FormatRaw)
+    {
+        return m_encoder->encode(m_file, data, length, false, msg);
+    }
+    if (m_file.write(data, static_cast<qint64>(length)) != static_cast<qint64>(length))
+    {
+        msg = QString("Write Error;Cannot write data to image file.");
+        return false;
+    }
+    return true;
+}
+
+bool RawImageWriter::writeZeros(const quint64 length, QString& msg)
+{
+    if (m_format == RawImage::FormatRaw)
+    {
+        // The file is extended to its full length when it is finished
+        m_length += length;
+        if (!m_file.seek(static_cast<qint64>(m_length)))
+        {
+            msg = QString("Write Error;Cannot seek in image file.");
+            return false;
+        }
+        return true;
+    }
+
+    static const QByteArray zeros(STREAM_BUFFER_SIZE, '\0');
+    quint64 remaining = length;
+    while (remaining > 0)
+    {
+        quint64 count = qMin<quint64>(remaining, static_cast<quint64>(zeros.size()));
+        if (!write(zeros.constData(), count, msg))
+        {
+            return false;
+        }
+        remaining -= count;
+    }
+    return true;
+}
+
+bool RawImageWriter::finish(QString& msg)
+{
+    bool ok = (m_format == RawImage::FormatRaw) ? m_file.resize(static_cast<qint64>(m_length)) : m_encoder->encode(m_file, nullptr, 0, true, msg);
+    if (!ok || !m_file.flush())
+    {
+        if (msg.isEmpty())
+        {
+            msg = QString("Write Error;Cannot write data to image file.");
+        }
+        return false;
+    }
+    close();
+    return true;
+}
+
+void RawImageWriter::close()
+{
+    m_encoder.reset();
+    if (m_file.isOpen())
+    {
+        m_file.close();
+    }
+}
@@ -0,0 +1,84 @@
+#ifndef RAWIMAGE_H
+#define RAWIMAGE_H
+
+#include <QFile>
+#include <QScopedPointer>
+#include <QString>
+
+// Raw device images as other tools write them: the plain device content
+// (.img), or the same as one gzip, xz or zstd stream. The format follows
+// from the last file suffix. gzip, xz and zstd support depends on HAVE_ZLIB,
+// HAVE_LZMA and HAVE_ZSTD at build time. xz is compressed on all cores in
+// independent blocks and those blocks are decompressed on all cores again,
+// zstd compresses on all cores where the library was built with threads.
+// zstd is decompressed on one thread, also when the image consists of
+// several independent frames that could be decoded in parallel.
+class RawImage
+{
+public:
+    enum Format { FormatNone = -1, FormatRaw = 0, FormatGzip, FormatXz, FormatZstd };
+
+    static Format  formatOf(const QString& path);
+    static bool    isAvailable(const Format format);
+    static QString name(const Format format);
+    static int     defaultLevel(const Format format);
+};
+
+// Reads the device content of a raw image front to back
+class RawImageReader
+{
+public:
+    RawImageReader();
+    ~RawImageReader();
+
+    bool open(const QString& path, QString& msg);
+    void close();
+
+    // Recorded by plain files, xz indexes and zstd frame headers, 0 when unknown.
+    // Only the first frame of a zstd stream is counted.
+    quint64 totalSize() const;
+
+    // Reads less than length only at the end of the image
+    bool read(char* data, const quint64 length, quint64& count, QString& msg);
+
+private:
+    struct Decoder;
+
+    bool readXzSize();
+
+private:
+    Q_DISABLE_COPY(RawImageReader)
+
+    RawImage::Format        m_format = {RawImage::FormatNone};
+    QFile                   m_file;
+    QScopedPointer<Decoder> m_decoder;
+    quint64                 m_totalSize = {0};
+};
+
+// Writes device content to a raw image front to back. Zeros are left as holes
+// of a sparse file when the image is not compressed.
+class RawImageWriter
+{
+public:
+    RawImageWriter();
+    ~RawImageWriter();
+
+    bool open(const QString& path, const RawImage::Format format, const int level, QString& msg);
+    bool write(const char* data, const quint64 length, QString& msg);
+    bool writeZeros(const quint64 length, QString& msg);
+    bool finish(QString& msg);
+    void close();
+
+private:
+    struct Encoder;
+
+private:
+    Q_DISABLE_COPY(RawImageWriter)
+
+    RawImage::Format        m_format = {RawImage::FormatNone};
+    QFile                   m_file;
+    QScopedPointer<Encoder> m_encoder;
+    quint64                 m_length = {0};
+};
+
+#endif // RAWIMAGE_H
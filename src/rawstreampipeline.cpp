@@ -0,0 +1,160 @@
+#include <cstring>
+
+#include "rawstreampipeline.h"
+#include "checksum.h"
+#include "bufferscan.h"
+
+// The smallest sector size, devices with larger sectors need images of whole sectors
+static const quint64 SECTOR_ALIGNMENT = 512;
+
+class RawStreamPipeline::ReaderThread : public QThread
+{
+public:
+    explicit ReaderThread(RawStreamPipeline* pipeline) :
+        m_pipeline(pipeline)
+    {
+    }
+
+protected:
+    void run() override
+    {
+        m_pipeline->readLoop();
+    }
+
+private:
+    RawStreamPipeline* m_pipeline;
+};
+
+RawStreamPipeline::RawStreamPipeline(const QString& imageFilePath, BufferArena* arena, const int window) :
+    m_imageFilePath(imageFilePath),
+    m_arena(arena),
+    m_window(qMax(1, window))
+{
+    m_readerThread = new ReaderThread(this);
+}
+
+RawStreamPipeline::~RawStreamPipeline()
+{
+    abort();
+    delete m_readerThread;
+}
+
+bool RawStreamPipeline::start(QString& msg)
+{
+    if (!m_reader.open(m_imageFilePath, msg))
+    {
+        return false;
+    }
+    m_totalSize = m_reader.totalSize();
+    m_readerThread->start();
+    return true;
+}
+
+quint64 RawStreamPipeline::totalSize() const
+{
+    return m_totalSize;
+}
+
+bool RawStreamPipeline::next(int& index, ChunkEntry& entry, QByteArray& data, QString& msg)
+{
+    QMutexLocker locker(&m_mutex);
+    while (m_queue.isEmpty() && !m_finished && !m_aborted)
+    {
+        m_chunkReady.wait(&m_mutex);
+    }
+
+    if (!m_queue.isEmpty())
+    {
+        Chunk chunk = m_queue.dequeue();
+        index = m_nextIndex++;
+        entry = chunk.entry;
+        data = chunk.data;
+        m_slotFree.wakeAll();
+        return true;
+    }
+
+    // The end of the image, or decoding stopped before it
+    if (!m_error.isEmpty())
+    {
+        msg = m_error;
+    }
+    else if (!m_finished)
+    {
+        msg = QString("File Error;Decoding of the image file was stopped.");
+    }
+    return false;
+}
+
+void RawStreamPipeline::abort()
+{
+    m_mutex.lock();
+    m_aborted = true;
+    m_chunkReady.wakeAll();
+    m_slotFree.wakeAll();
+    m_mutex.unlock();
+
+    m_readerThread->wait();
+}
+
+void RawStreamPipeline::readLoop()
+{
+    QString error;
+    quint64 deviceOffset = 0;
+    forever
+    {
+        QByteArray data = m_arena ? m_arena->acquire(static_cast<int>(CHUNK_SIZE)) : QByteArray(static_cast<int>(CHUNK_SIZE), '\0');
+        quint64 count = 0;
+        if (!m_reader.read(BufferArena::writable(data), CHUNK_SIZE, count, error) || (count == 0))
+        {
+            if (m_arena)
+            {
+                m_arena->release(data);
+            }
+            break;
+        }
+
+        // A device holds whole sectors, the tail of an odd sized image is completed with zeros
+        quint64 length = (count + SECTOR_ALIGNMENT - 1) / SECTOR_ALIGNMENT * SECTOR_ALIGNMENT;
+        memset(BufferArena::writable(data) + count, 0, length - count);
+        data.resize(static_cast<int>(length));
+
+        Chunk chunk;
+        chunk.entry.deviceOffset = deviceOffset;
+        chunk.entry.uncompressedLength = static_cast<quint32>(length);
+        quint8 fill = 0;
+        if (BufferScan::isFilled(data.constData(), length, fill))
+        {
+            chunk.entry.flags = ImageFormat::CHUNK_FILL | (static_cast<quint32>(fill) << 8);
+        }
+        else
+        {
+            chunk.entry.checksum = Checksum::xxh64(data.constData(), length);
+        }
+        chunk.data = data;
+        deviceOffset += length;
+
+        QMutexLocker locker(&m_mutex);
+        while (!m_aborted && (m_queue.size() >= m_window))
+        {
+            m_slotFree.wait(&m_mutex);
+        }
+        if (m_aborted)
+        {
+            break;
+        }
+        m_queue.enqueue(chunk);
+        m_chunkReady.wakeAll();
+
+        if (count < CHUNK_SIZE)
+        {
+            break;
+        }
+    }
+    m_reader.close();
+
+    QMutexLocker locker(&m_mutex);
+    m_error = error;
+    m_finished = error.isEmpty() && !m_aborted;
+    m_aborted = m_aborted || !error.isEmpty();
+    m_chunkReady.wakeAll();
+}
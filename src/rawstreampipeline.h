@@ -0,0 +1,60 @@
+#ifndef RAWSTREAMPIPELINE_H
+#define RAWSTREAMPIPELINE_H
+
+#include <QMutex>
+#include <QQueue>
+#include <QThread>
+#include <QWaitCondition>
+
+#include "imageformat.h"
+#include "rawimage.h"
+#include "bufferarena.h"
+
+// Decodes a raw image on a reader thread into chunks of the device, ahead of
+// the consumer. Every chunk gets an index entry like a chunk of an .adi image:
+// chunks of a single byte value become holes and the others carry the XXH64 of
+// their data, so raw images are restored, compared and verified the same way.
+// The last chunk is padded with zeros to whole sectors of 512 bytes.
+class RawStreamPipeline
+{
+public:
+    explicit RawStreamPipeline(const QString& imageFilePath, BufferArena* arena = nullptr, const int window = 16);
+    ~RawStreamPipeline();
+
+    bool    start(QString& msg);
+    quint64 totalSize() const;
+    bool    next(int& index, ChunkEntry& entry, QByteArray& data, QString& msg);
+    void    abort();
+
+    static const quint32 CHUNK_SIZE = 2 * 1024 * 1024;
+
+private:
+    class ReaderThread;
+
+    struct Chunk
+    {
+        ChunkEntry entry;
+        QByteArray data;
+    };
+
+    void readLoop();
+
+private:
+    QString               m_imageFilePath;
+    BufferArena*          m_arena;
+    int                   m_window;
+    RawImageReader        m_reader;
+    ReaderThread*         m_readerThread = {nullptr};
+    quint64               m_totalSize = {0};
+
+    QMutex                m_mutex;
+    QWaitCondition        m_chunkReady;
+    QWaitCondition        m_slotFree;
+    QQueue<Chunk>         m_queue;
+    int                   m_nextIndex = {0};
+    bool                  m_finished = {false};
+    bool                  m_aborted = {false};
+    QString               m_error;
+};
+
+#endif // RAWSTREAMPIPELINE_H
@@ -0,0 +1,467 @@
+#include <QFile>
+#include <QMap>
+
+#include "restoreimagejob.h"
+#include "decompressionpipeline.h"
+#include "rawstreampipeline.h"
+#include "checksum.h"
+#include "digestverifier.h"
+#include "bufferscan.h"
+
+// Tags read backs of written chunks, other reads belong to the differential compare
+const quint64 READ_BACK = Q_UINT64_C(1) << 63;
+
+RestoreImageJob::RestoreImageJob(const int deviceId, const QString& imageFilePath, const bool verify, const bool discardHoles, const bool differential, QObject *parent) :
+    ImagingJob(deviceId, imageFilePath, parent),
+    m_verify(verify),
+    m_discardHoles(discardHoles),
+    m_differential(differential)
+{
+}
+
+void RestoreImageJob::setFanOut(FanOutPipeline* fanOut, const int consumer)
+{
+    m_fanOut = fanOut;
+    m_fanOutConsumer = consumer;
+}
+
+void RestoreImageJob::setChunkCache(ChunkCache* cache)
+{
+    m_chunkCache = cache;
+}
+
+ImagingJob::Result RestoreImageJob::execute()
+{
+    Result result = restore();
+
+    // The other targets of a fan-out restore no longer wait for this device
+    if (m_fanOut)
+    {
+        m_fanOut->detach(m_fanOutConsumer);
+    }
+    return result;
+}
+
+ImagingJob::Result RestoreImageJob::restore()
+{
+    QString error;
+    setStatus(SysDef::STATUS_WRITING, 0);
+
+    // Raw images are decoded as one stream, their chunks are only known as they arrive.
+    // Most raw formats record their size, it is checked again for every chunk.
+    const bool raw = RawImage::formatOf(m_imageFilePath) != RawImage::FormatNone;
+    ImageReader imageReader;
+    quint64 imageSize = 0;
+    if (raw)
+    {
+        RawImageReader rawReader;
+        if (!rawReader.open(m_imageFilePath, error))
+        {
+            return fail(error, "Restore disk image failed");
+        }
+        imageSize = rawReader.totalSize();
+    }
+    else
+    {
+        if (!imageReader.open(m_imageFilePath, error))
+        {
+            return fail(error, "Restore disk image failed");
+        }
+
+        if (imageReader.isManifest())
+        {
+            error = QString("File Error;The selected file is a manifest without data, it can only be used to verify a device.");
+            return fail(error, "Restore disk image failed");
+        }
+        imageSize = imageReader.totalSize();
+    }
+
+    // Written chunks are read back from the device itself, not from the system cache
+    if (m_verify)
+    {
+        m_directIo = true;
+    }
+
+    // Only images with an image digest can be identified by a checkpoint
+    const bool resumable = !raw && (imageReader.header().version >= ImageFormat::VERSION_2) && (imageReader.header().imageDigest != 0);
+    const QString journalPath = CheckpointJournal::restorePath(imageReader.header().imageDigest, m_deviceId);
+
+    // Get the handle of the target raw disk, a differential restore, the verification
+    // and the check of a checkpoint read it
+    quint64 sectorSize = 0;
+    quint64 numSectors = 0;
+    const bool readAccess = m_differential || m_verify || (resumable && QFile::exists(journalPath));
+    const DWORD access = readAccess ? (GENERIC_READ | GENERIC_WRITE) : GENERIC_WRITE;
+    if (!openDevice(access, m_queueDepth > 1, sectorSize, numSectors, error))
+    {
+        return fail(error, "Restore disk image failed");
+    }
+    quint64 targetDiskSize = numSectors * sectorSize;
+
+    if (0 == targetDiskSize)
+    {
+        //For external card readers you may not get device change notification when you remove the card/flash.
+        //(So no WM_DEVICECHANGE signal). Device stays but size goes to 0. [Is there special event for this on Windows??]
+        return fail(error, "Restore disk image failed");
+    }
+
+    // Check if image disk size is larger than target disk size
+    if (imageSize > targetDiskSize)
+    {
+        error = QString("Write Error;Content in selected image file is larger than the size of the selected device.");
+        return fail(error, "Restore disk image failed");
+    }
+
+    if (!raw && !checkChunkAlignment(imageReader.chunks(), sectorSize, error))
+    {
+        return fail(error, "Restore disk image failed");
+    }
+
+    setStatus(SysDef::STATUS_WRITING, raw ? imageSize : imageReader.dataSize());
+    bool cancelled = false;
+    bool discardSupported = true;
+
+    // Image chunks are read ahead and decompressed on all cores
+    // while up to m_queueDepth device reads and writes are outstanding.
+    // In differential mode the target of every chunk is read first and
+    // the chunk is only written when the device content differs, so the
+    // read of the next chunks overlaps the write of a changed one.
+    // A fan-out restore takes the chunks decoded once for all targets.
+    QVector<ChunkEntry> streamChunks;
+    const QVector<ChunkEntry>& chunks = raw ? streamChunks : imageReader.chunks();
+    const bool hasChecksums = raw || (imageReader.header().version >= ImageFormat::VERSION_2);
+    quint64 maxLength = raw ? RawStreamPipeline::CHUNK_SIZE : sectorSize;
+    foreach (const ChunkEntry& entry, chunks)
+    {
+        maxLength = qMax<quint64>(maxLength, entry.uncompressedLength);
+    }
+    QScopedPointer<IoBackend> io(createIoBackend(sectorSize, maxLength));
+
+    // An interrupted restore of this image to the same device continues after its last checkpoint,
+    // holes left discarded by one run must not count as written zeros in the next and vice versa
+    Checkpoint identity;
+    identity.kind = CheckpointJournal::KIND_RESTORE;
+    identity.header = imageReader.header();
+    identity.deviceSize = targetDiskSize;
+    identity.discardHoles = m_discardHoles;
+    CheckpointJournal journal(journalPath, identity);
+    int firstChunk = 0;
+    if (resumable)
+    {
+        Checkpoint checkpoint;
+        if (journal.load(checkpoint) && (checkpoint.committedChunks <= chunks.size()) &&
+            (checkpoint.runningDigest == ImageFormat::imageDigest(chunks.mid(0, checkpoint.committedChunks))))
+        {
+            bool matches = false;
+            if (!boundaryMatches(*io, chunks, checkpoint.committedChunks, m_discardHoles, matches, error))
+            {
+                return fail(error, "Restore disk image failed");
+            }
+            firstChunk = matches ? checkpoint.committedChunks : 0;
+        }
+        if (firstChunk == 0)
+        {
+            journal.remove();
+        }
+    }
+
+    quint64 resumedBytes = 0;
+    for (int i = 0; i < firstChunk; i++)
+    {
+        resumedBytes += chunks.at(i).uncompressedLength;
+    }
+    addProgress(resumedBytes);
+
+    QScopedPointer<DecompressionPipeline> pipeline;
+    QScopedPointer<RawStreamPipeline> rawPipeline;
+    if (!m_fanOut && raw)
+    {
+        rawPipeline.reset(new RawStreamPipeline(m_imageFilePath, &m_arena));
+        if (!rawPipeline->start(error))
+        {
+            return fail(error, "Restore disk image failed");
+        }
+    }
+    else if (!m_fanOut)
+    {
+        pipeline.reset(new DecompressionPipeline(imageReader, &m_arena, m_chunkCache, firstChunk));
+    }
+
+    // Chunks may finish out of order, holes are done at once while earlier writes are still
+    // outstanding. Everything below the lowest unfinished chunk is committed.
+    QMap<int, bool> unfinished;
+    int nextChunk = firstChunk;
+    QQueue<QByteArray> pending;
+    QQueue<quint64> digests;
+    quint64 bytesWritten = 0;
+    quint64 bytesUnchanged = 0;
+    bool endOfImage = false;
+    int c = 0;
+    ChunkEntry streamEntry;
+    QByteArray uncompressed;
+    forever
+    {
+        if (m_cancel.isCancelled())
+        {
+            cancelled = true;
+            break;
+        }
+
+        if (resumable && journal.isDue())
+        {
+            checkpoint(journal, chunks, unfinished.isEmpty() ? nextChunk : unfinished.firstKey());
+        }
+
+        // Queue device reads or writes for the next chunks of the image
+        while (!io->isFull() && !endOfImage)
+        {
+            bool more = m_fanOut ? m_fanOut->next(m_fanOutConsumer, c, streamEntry, uncompressed, error) :
+                        (rawPipeline ? rawPipeline->next(c, streamEntry, uncompressed, error) : pipeline->next(c, uncompressed, error));
+            if (!more)
+            {
+                endOfImage = true;
+                break;
+            }
+
+            // The chunks of a raw image are collected as they are decoded
+            if (raw)
+            {
+                streamChunks.append(streamEntry);
+                if (streamEntry.deviceOffset + streamEntry.uncompressedLength > targetDiskSize)
+                {
+                    error = QString("Write Error;Content in selected image file is larger than the size of the selected device.");
+                }
+                else if (streamEntry.uncompressedLength % sectorSize)
+                {
+                    error = QString("Write Error;The size of the image file is not a multiple of the %1 byte sectors of the device.").arg(sectorSize);
+                }
+                if (!error.isEmpty())
+                {
+                    releaseImageData(uncompressed);
+                    return fail(error, "Restore disk image failed");
+                }
+            }
+
+            // Chunks before the checkpoint are on the device already
+            if (c < firstChunk)
+            {
+                releaseImageData(uncompressed);
+                continue;
+            }
+
+            const ChunkEntry& entry = chunks.at(c);
+            quint64 writeSectors = uncompressed.size() / sectorSize;
+            nextChunk = c + 1;
+
+            // Empty regions are discarded or skipped instead of written when requested
+            if (m_discardHoles && ImageFormat::isZeroHole(entry))
+            {
+                if (discardSupported && !DiskUtilities::discardSectors(m_rawDiskHandle, entry.deviceOffset / sectorSize, writeSectors, sectorSize, error))
+                {
+                    // Device does not support discard, leave the remaining holes untouched
+                    discardSupported = false;
+                    error.clear();
+                }
+                releaseImageData(uncompressed);
+                addProgress(entry.uncompressedLength);
+                continue;
+            }
+
+            unfinished.insert(c, true);
+            if (m_differential)
+            {
+                pending.enqueue(uncompressed);
+                if (!io->submitRead(entry.deviceOffset, m_arena.acquire(uncompressed.size()), static_cast<quint64>(c), error))
+                {
+                    return fail(error, "Restore disk image failed");
+                }
+            }
+            else if (!io->submitWrite(entry.deviceOffset, uncompressed, static_cast<quint64>(c), error))
+            {
+                return fail(error, "Restore disk image failed");
+            }
+        }
+
+        if (!error.isEmpty())
+        {
+            return fail(error, "Restore disk image failed");
+        }
+
+        if (io->isEmpty())
+        {
+            break;
+        }
+
+        IoCompletion completion;
+        if (!io->waitOldest(completion, error))
+        {
+            return fail(error, "Restore disk image failed");
+        }
+
+        const int index = static_cast<int>(completion.tag & ~READ_BACK);
+        const ChunkEntry& entry = chunks.at(index);
+        if (completion.write)
+        {
+            // Read the chunk back into the slot the write has freed, a queue depth
+            // behind the write head. Only a digest of the decoded chunk is kept.
+            if (m_verify && !ImageFormat::isUnallocated(entry))
+            {
+                digests.enqueue(hasChecksums ? entry.checksum : Checksum::xxh64(completion.data.constData(), completion.length));
+                if (!io->submitRead(completion.offset, m_arena.acquire(static_cast<int>(completion.length)), completion.tag | READ_BACK, error))
+                {
+                    return fail(error, "Restore disk image failed");
+                }
+            }
+            else
+            {
+                unfinished.remove(index);
+            }
+            releaseImageData(completion.data);
+            addProgress(completion.length);
+            bytesWritten += completion.length;
+            continue;
+        }
+
+        if (completion.tag & READ_BACK)
+        {
+            bool identical = (completion.transferred == completion.length) && readBackMatches(entry, digests.dequeue(), completion.data);
+            if (!identical)
+            {
+                error = DigestVerifier::mismatchError(entry, completion.data, sectorSize);
+            }
+            m_arena.release(completion.data);
+            if (!identical)
+            {
+                return fail(error, "Verify disk image failed");
+            }
+            unfinished.remove(index);
+            continue;
+        }
+
+        // Content of the device read back, write the chunk only when it differs
+        QByteArray image = pending.dequeue();
+        bool unchanged = (completion.transferred == completion.length) && targetMatches(entry, hasChecksums, image, completion.data);
+        m_arena.release(completion.data);
+        if (unchanged)
+        {
+            releaseImageData(image);
+            addProgress(completion.length);
+            bytesUnchanged += completion.length;
+            unfinished.remove(index);
+        }
+        else if (!io->submitWrite(completion.offset, image, completion.tag, error))
+        {
+            return fail(error, "Restore disk image failed");
+        }
+    }
+
+    // Complete the outstanding writes
+    while (!io->isEmpty())
+    {
+        IoCompletion completion;
+        if (!io->waitOldest(completion, error))
+        {
+            return fail(error, "Restore disk image failed");
+        }
+        if (completion.write)
+        {
+            releaseImageData(completion.data);
+            addProgress(completion.length);
+            bytesWritten += completion.length;
+        }
+        else
+        {
+            m_arena.release(completion.data);
+        }
+    }
+    io.reset();
+    if (pipeline)
+    {
+        pipeline->abort();
+    }
+    if (rawPipeline)
+    {
+        rawPipeline->abort();
+    }
+    imageReader.close();
+
+    if (cancelled)
+    {
+        m_message = QString("Restore disk image cancelled.");
+        if (resumable)
+        {
+            // Chunks that completed while draining are counted as unfinished, which is safe
+            checkpoint(journal, chunks, unfinished.isEmpty() ? nextChunk : unfinished.firstKey());
+            m_message += QString(" Restoring the same image to this device again continues where it stopped.");
+        }
+        return ResultCancelled;
+    }
+    journal.remove();
+
+    m_message = QString("Restore disk image succeeded.");
+    if (firstChunk > 0)
+    {
+        m_message += QString(" Continued after %1 MB.").arg(static_cast<double>(resumedBytes) / (1024.0 * 1024.0), 0, 'f', 1);
+    }
+    if (m_differential)
+    {
+        m_message += QString(" %1 MB written, %2 MB unchanged.")
+                     .arg(static_cast<double>(bytesWritten) / (1024.0 * 1024.0), 0, 'f', 1)
+                     .arg(static_cast<double>(bytesUnchanged) / (1024.0 * 1024.0), 0, 'f', 1);
+    }
+    quint64 lookups = pipeline ? (pipeline->cacheHits() + pipeline->cacheMisses()) : 0;
+    if (lookups > 0)
+    {
+        m_message += QString(" %1% of the chunks taken from the cache, %2 MB served.")
+                     .arg(100.0 * static_cast<double>(pipeline->cacheHits()) / static_cast<double>(lookups), 0, 'f', 0)
+                     .arg(static_cast<double>(pipeline->cacheBytesServed()) / (1024.0 * 1024.0), 0, 'f', 1);
+    }
+    return ResultSucceeded;
+}
+
+void RestoreImageJob::checkpoint(CheckpointJournal& journal, const QVector<ChunkEntry>& chunks, const int committedChunks)
+{
+    // The committed chunks have completed, they are flushed to the media before a checkpoint names them
+    QString error;
+    if (FlushFileBuffers(m_rawDiskHandle))
+    {
+        journal.save(committedChunks, ImageFormat::imageDigest(chunks.mid(0, committedChunks)), QVector<ChunkEntry>(), 0, error);
+    }
+}
+
+void RestoreImageJob::releaseImageData(QByteArray& data)
+{
+    // Chunks of a fan-out restore are shared with the other targets and cached chunks with the
+    // cache, a buffer goes back to the arena once nothing else holds it
+    if ((m_fanOut || m_chunkCache) && !data.isDetached())
+    {
+        data = QByteArray();
+        return;
+    }
+    m_arena.release(data);
+}
+
+bool RestoreImageJob::readBackMatches(const ChunkEntry& entry, const quint64 digest, const QByteArray& target) const
+{
+    if (ImageFormat::isHole(entry))
+    {
+        quint8 fill = 0;
+        return BufferScan::isFilled(target.constData(), static_cast<quint64>(target.size()), fill) && (fill == ImageFormat::fillByte(entry));
+    }
+    return Checksum::xxh64(target.constData(), static_cast<quint64>(target.size())) == digest;
+}
+
+bool RestoreImageJob::targetMatches(const ChunkEntry& entry, const bool hasChecksums, const QByteArray& image, const QByteArray& target) const
+{
+    if (target.size() != image.size())
+    {
+        return false;
+    }
+
+    // Version 1 images carry no checksums, their chunks are compared directly
+    if (!hasChecksums && !ImageFormat::isHole(entry))
+    {
+        return BufferScan::isEqual(image.constData(), target.constData(), static_cast<quint64>(image.size()));
+    }
+    return DigestVerifier::matches(entry, target);
+}
@@ -0,0 +1,38 @@
+#ifndef RESTOREIMAGEJOB_H
+#define RESTOREIMAGEJOB_H
+
+#include "imagingjob.h"
+#include "fanoutpipeline.h"
+#include "chunkcache.h"
+#include "checkpointjournal.h"
+
+class RestoreImageJob : public ImagingJob
+{
+    Q_OBJECT
+
+public:
+    explicit RestoreImageJob(const int deviceId, const QString& imageFilePath, const bool verify, const bool discardHoles, const bool differential, QObject *parent = nullptr);
+
+    void setFanOut(FanOutPipeline* fanOut, const int consumer);
+    void setChunkCache(ChunkCache* cache);
+
+protected:
+    Result execute() override;
+
+private:
+    Result restore();
+    void   checkpoint(CheckpointJournal& journal, const QVector<ChunkEntry>& chunks, const int committedChunks);
+    void   releaseImageData(QByteArray& data);
+    bool   readBackMatches(const ChunkEntry& entry, const quint64 digest, const QByteArray& target) const;
+    bool   targetMatches(const ChunkEntry& entry, const bool hasChecksums, const QByteArray& image, const QByteArray& target) const;
+
+private:
+    bool m_verify;
+    bool m_discardHoles;
+    bool m_differential;
+    FanOutPipeline* m_fanOut = {nullptr};
+    int             m_fanOutConsumer = {0};
+    ChunkCache*     m_chunkCache = {nullptr};
+};
+
+#endif // RESTOREIMAGEJOB_H
@@ -0,0 +1,24 @@
+#include "verifyimagejob.h"
+
+VerifyImageJob::VerifyImageJob(const int deviceId, const QString& imageFilePath, const bool skipHoles, QObject *parent) :
+    ImagingJob(deviceId, imageFilePath, parent),
+    m_skipHoles(skipHoles)
+{
+}
+
+ImagingJob::Result VerifyImageJob::execute()
+{
+    QString error;
+    setStatus(SysDef::STATUS_VERIFYING, 0);
+
+    // The sector size of the device decides how the image chunks must be aligned
+    quint64 sectorSize = 0;
+    quint64 numSectors = 0;
+    if (!openDevice(GENERIC_READ, false, sectorSize, numSectors, error))
+    {
+        return fail(error, "Verify disk image failed");
+    }
+    closeDevice();
+
+    return verifyImage(sectorSize, m_skipHoles);
+}
@@ -0,0 +1,21 @@
+#ifndef VERIFYIMAGEJOB_H
+#define VERIFYIMAGEJOB_H
+
+#include "imagingjob.h"
+
+// Compares a device with an image or with its manifest, nothing is written
+class VerifyImageJob : public ImagingJob
+{
+    Q_OBJECT
+
+public:
+    explicit VerifyImageJob(const int deviceId, const QString& imageFilePath, const bool skipHoles, QObject *parent = nullptr);
+
+protected:
+    Result execute() override;
+
+private:
+    bool m_skipHoles;
+};
+
+#endif // VERIFYIMAGEJOB_H
@@ -32,7 +32,31 @@ SOURCES += \
     guimanager.cpp \
     diskutilities.cpp \
     winnativeeventfilter.cpp \
-    deviceevent.cpp
+    deviceevent.cpp \
+    checksum.cpp \
+    imageformat.cpp \
+    compressionpipeline.cpp \
+    decompressionpipeline.cpp \
+    imagecodec.cpp \
+    imagingjob.cpp \
+    createimagejob.cpp \
+    restoreimagejob.cpp \
+    iobackend.cpp \
+    alignedbufferpool.cpp \
+    bufferarena.cpp \
+    partitiontable.cpp \
+    filesystemprobe.cpp \
+    fanoutpipeline.cpp \
+    clonediskjob.cpp \
+    clonepipeline.cpp \
+    digestverifier.cpp \
+    verifyimagejob.cpp \
+    bufferscan.cpp \
+    chunkcache.cpp \
+    checkpointjournal.cpp \
+    chunkrepository.cpp \
+    rawimage.cpp \
+    rawstreampipeline.cpp
 
 RESOURCES += qml.qrc \
     images.qrc
@@ -56,10 +80,67 @@ else: unix:!android: target.path = /opt/$${TARGET}/bin
 
 include(../qmlmodel/qmlmodel.pri)
 
+# Optional compression libraries, set ZSTD_DIR and/or LZ4_DIR (qmake variable or
+# environment) to a directory holding include/ and lib/ to enable the codec
+isEmpty(ZSTD_DIR): ZSTD_DIR = $$(ZSTD_DIR)
+!isEmpty(ZSTD_DIR) {
+    DEFINES += HAVE_ZSTD
+    INCLUDEPATH += $$ZSTD_DIR/include
+    LIBS += -L$$ZSTD_DIR/lib -lzstd
+}
+
+isEmpty(LZ4_DIR): LZ4_DIR = $$(LZ4_DIR)
+!isEmpty(LZ4_DIR) {
+    DEFINES += HAVE_LZ4
+    INCLUDEPATH += $$LZ4_DIR/include
+    LIBS += -L$$LZ4_DIR/lib -llz4
+}
+
+# Raw .gz and .xz images, set ZLIB_DIR and/or LZMA_DIR the same way. Raw .zst
+# images follow ZSTD_DIR, plain .img images need no library.
+isEmpty(ZLIB_DIR): ZLIB_DIR = $$(ZLIB_DIR)
+!isEmpty(ZLIB_DIR) {
+    DEFINES += HAVE_ZLIB
+    INCLUDEPATH += $$ZLIB_DIR/include
+    LIBS += -L$$ZLIB_DIR/lib -lz
+}
+
+isEmpty(LZMA_DIR): LZMA_DIR = $$(LZMA_DIR)
+!isEmpty(LZMA_DIR) {
+    DEFINES += HAVE_LZMA
+    INCLUDEPATH += $$LZMA_DIR/include
+    LIBS += -L$$LZMA_DIR/lib -llzma
+}
+
 HEADERS += \
     deviceitem.h \
     guimanager.h \
     diskutilities.h \
     winnativeeventfilter.h \
     deviceevent.h \
-    sysdef.h
+    sysdef.h \
+    checksum.h \
+    imageformat.h \
+    compressionpipeline.h \
+    decompressionpipeline.h \
+    imagecodec.h \
+    imagingjob.h \
+    createimagejob.h \
+    restoreimagejob.h \
+    iobackend.h \
+    alignedbufferpool.h \
+    bufferarena.h \
+    partitiontable.h \
+    filesystemprobe.h \
+    fanoutpipeline.h \
+    clonediskjob.h \
+    clonepipeline.h \
+    canceltoken.h \
+    digestverifier.h \
+    verifyimagejob.h \
+    bufferscan.h \
+    chunkcache.h \
+    checkpointjournal.h \
+    chunkrepository.h \
+    rawimage.h \
+    rawstreampipeline.h
@@ -0,0 +1,18 @@
+TARGET = tst_chunkrepository
+QT = core testlib
+CONFIG += console testcase c++11
+CONFIG -= app_bundle
+
+# Registers images in a repository in a temporary directory and collects its garbage
+!linux: error("The chunk repository tests run against Linux files")
+
+INCLUDEPATH += ../../src
+
+SOURCES += \
+    tst_chunkrepository.cpp \
+    ../../src/chunkrepository.cpp \
+    ../../src/imageformat.cpp \
+    ../../src/imagecodec.cpp \
+    ../../src/checksum.cpp \
+    ../../src/bufferarena.cpp \
+    ../../src/bufferscan.cpp
@@ -0,0 +1,225 @@
+#include <QtTest>
+#include <QDirIterator>
+#include <QTemporaryDir>
+
+#include <ctime>
+#include <utime.h>
+
+#include "chunkrepository.h"
+#include "imagecodec.h"
+
+static const int CHUNK_SIZE = 64 * 1024;
+static const int CHUNK_COUNT = 4;
+
+// Every chunk holds its own index, so no two chunks of an image share a key
+static QByteArray pattern(const int index)
+{
+    QByteArray data(CHUNK_SIZE, '\0');
+    for (int i = 0; i < data.size(); i++)
+    {
+        data[i] = static_cast<char>((index * 31 + i / 512) & 0xFF);
+    }
+    return data;
+}
+
+class ChunkRepositoryTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void init();
+    void copiesKeepTheirChunks();
+    void rewriteReplacesReferences();
+    void reusedChunkSurvives();
+    void claimedChunksSurvive();
+
+private:
+    bool writeImage(const QString& path, const int firstChunk, QString& msg);
+    bool encodeChunks(const int firstChunk, QString& msg);
+    int  chunkFiles() const;
+    void ageChunks() const;
+    bool collect(quint64& freedBytes);
+
+    QScopedPointer<QTemporaryDir> m_dir;
+    ChunkRepository*              m_repository = {nullptr};
+};
+
+void ChunkRepositoryTest::init()
+{
+    m_dir.reset(new QTemporaryDir);
+    QVERIFY(m_dir->isValid());
+    QString msg;
+    m_repository = ChunkRepository::open(m_dir->filePath("repository"), msg);
+    QVERIFY2(m_repository, qPrintable(msg));
+}
+
+bool ChunkRepositoryTest::writeImage(const QString& path, const int firstChunk, QString& msg)
+{
+    ImageHeader header;
+    header.codec = ImageCodec::CodecZlib;
+    header.codecLevel = 1;
+    header.sectorSize = 512;
+    header.chunkSize = CHUNK_SIZE;
+    header.totalSize = static_cast<quint64>(CHUNK_COUNT) * CHUNK_SIZE;
+    header.flags = ImageFormat::IMAGE_REPOSITORY;
+    header.repositoryName = QFileInfo(path).absoluteDir().relativeFilePath(m_repository->path());
+
+    ImageWriter writer;
+    if (!writer.open(path, header, msg))
+    {
+        return false;
+    }
+    m_repository->beginImage();
+    for (int i = 0; i < CHUNK_COUNT; i++)
+    {
+        ChunkEntry entry;
+        QByteArray payload;
+        if (!m_repository->encodeChunk(writer.header(), static_cast<quint64>(i) * CHUNK_SIZE, pattern(firstChunk + i), entry, payload, msg) ||
+            !writer.appendChunk(entry, payload, msg))
+        {
+            m_repository->endImage();
+            return false;
+        }
+    }
+    int shared = 0;
+    bool result = writer.finish(msg) && m_repository->addImage(path, shared, msg);
+    m_repository->endImage();
+    return result;
+}
+
+bool ChunkRepositoryTest::encodeChunks(const int firstChunk, QString& msg)
+{
+    // Stored in the repository like a create does, without an image registered
+    ImageHeader header;
+    header.codec = ImageCodec::CodecZlib;
+    header.codecLevel = 1;
+    header.chunkSize = CHUNK_SIZE;
+    for (int i = 0; i < CHUNK_COUNT; i++)
+    {
+        ChunkEntry entry;
+        QByteArray payload;
+        if (!m_repository->encodeChunk(header, static_cast<quint64>(i) * CHUNK_SIZE, pattern(firstChunk + i), entry, payload, msg))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+int ChunkRepositoryTest::chunkFiles() const
+{
+    int count = 0;
+    QDirIterator it(m_repository->path() + "/chunks", QStringList("*.chunk"), QDir::Files, QDirIterator::Subdirectories);
+    while (it.hasNext())
+    {
+        it.next();
+        count++;
+    }
+    return count;
+}
+
+void ChunkRepositoryTest::ageChunks() const
+{
+    // Past the grace period, unreferenced chunks are collected
+    utimbuf times;
+    times.actime = time(nullptr) - 2 * 3600;
+    times.modtime = times.actime;
+    QDirIterator it(m_repository->path() + "/chunks", QStringList("*.chunk"), QDir::Files, QDirIterator::Subdirectories);
+    while (it.hasNext())
+    {
+        utime(QFile::encodeName(it.next()).constData(), &times);
+    }
+}
+
+bool ChunkRepositoryTest::collect(quint64& freedBytes)
+{
+    QString msg;
+    return m_repository->collectGarbage(freedBytes, msg);
+}
+
+void ChunkRepositoryTest::copiesKeepTheirChunks()
+{
+    // Two images with the same content under different paths
+    const QString first = m_dir->filePath("first.adi");
+    const QString second = m_dir->filePath("second.adi");
+    QString msg;
+    QVERIFY2(writeImage(first, 0, msg), qPrintable(msg));
+    QVERIFY2(writeImage(second, 0, msg), qPrintable(msg));
+    QCOMPARE(chunkFiles(), CHUNK_COUNT);
+
+    // Deleting the copy registered last leaves the chunks of the other one
+    QVERIFY(QFile::remove(second));
+    ageChunks();
+    quint64 freedBytes = 0;
+    QVERIFY(collect(freedBytes));
+    QCOMPARE(freedBytes, quint64(0));
+    QCOMPARE(chunkFiles(), CHUNK_COUNT);
+
+    QVERIFY(QFile::remove(first));
+    QVERIFY(collect(freedBytes));
+    QVERIFY(freedBytes > 0);
+    QCOMPARE(chunkFiles(), 0);
+}
+
+void ChunkRepositoryTest::rewriteReplacesReferences()
+{
+    // An image written again with other content no longer holds its old chunks
+    const QString path = m_dir->filePath("image.adi");
+    QString msg;
+    QVERIFY2(writeImage(path, 0, msg), qPrintable(msg));
+    QVERIFY2(writeImage(path, CHUNK_COUNT, msg), qPrintable(msg));
+    QCOMPARE(chunkFiles(), 2 * CHUNK_COUNT);
+
+    ageChunks();
+    quint64 freedBytes = 0;
+    QVERIFY(collect(freedBytes));
+    QCOMPARE(chunkFiles(), CHUNK_COUNT);
+    QCOMPARE(QDir(m_repository->path() + "/images").entryList(QStringList("*.refs"), QDir::Files).size(), 1);
+}
+
+void ChunkRepositoryTest::reusedChunkSurvives()
+{
+    // A create that only reuses old unreferenced chunks refreshes them past the grace period
+    QString msg;
+    QVERIFY2(encodeChunks(0, msg), qPrintable(msg));
+    ageChunks();
+    QVERIFY2(encodeChunks(0, msg), qPrintable(msg));
+    quint64 freedBytes = 0;
+    QVERIFY(collect(freedBytes));
+    QCOMPARE(freedBytes, quint64(0));
+    QCOMPARE(chunkFiles(), CHUNK_COUNT);
+}
+
+void ChunkRepositoryTest::claimedChunksSurvive()
+{
+    // A create running longer than the grace period keeps its chunks until it ends
+    QString msg;
+    m_repository->beginImage();
+    QVERIFY2(encodeChunks(0, msg), qPrintable(msg));
+    ageChunks();
+    quint64 freedBytes = 0;
+    QVERIFY(collect(freedBytes));
+    QCOMPARE(chunkFiles(), CHUNK_COUNT);
+
+    // The same claims made by another process count while it holds their lock
+    QDir claims(m_repository->path() + "/claims");
+    QStringList keys = claims.entryList(QStringList("*.keys"), QDir::Files);
+    QCOMPARE(keys.size(), 1);
+    QVERIFY(QFile::copy(claims.filePath(keys.first()), claims.filePath("other.keys")));
+    QLockFile other(claims.filePath("other.lock"));
+    QVERIFY(other.tryLock(0));
+    m_repository->endImage();
+    QVERIFY(collect(freedBytes));
+    QCOMPARE(chunkFiles(), CHUNK_COUNT);
+
+    // Claims whose lock is free were left by a process that is gone
+    other.unlock();
+    QVERIFY(collect(freedBytes));
+    QVERIFY(freedBytes > 0);
+    QCOMPARE(chunkFiles(), 0);
+    QVERIFY(claims.entryList(QStringList("*.keys"), QDir::Files).isEmpty());
+}
+
+QTEST_APPLESS_MAIN(ChunkRepositoryTest)
+
+#include "tst_chunkrepository.moc"
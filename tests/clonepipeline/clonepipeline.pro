@@ -0,0 +1,17 @@
+TARGET = tst_clonepipeline
+QT = core testlib
+CONFIG += console testcase c++11
+CONFIG -= app_bundle
+
+# Clones between files through the pread/pwrite backend
+!linux: error("The clone pipeline tests run against Linux files")
+
+INCLUDEPATH += ../../src
+
+SOURCES += \
+    tst_clonepipeline.cpp \
+    ../../src/clonepipeline.cpp \
+    ../../src/iobackend.cpp \
+    ../../src/alignedbufferpool.cpp \
+    ../../src/bufferarena.cpp \
+    ../../src/bufferscan.cpp
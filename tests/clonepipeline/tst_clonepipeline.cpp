@@ -0,0 +1,224 @@
+#include <QtTest>
+#include <QTemporaryDir>
+
+#include <unistd.h>
+
+#include "clonepipeline.h"
+
+static const quint64 SECTOR_SIZE = 512;
+static const quint64 CHUNK_SECTORS = 128;
+static const quint64 DEVICE_SECTORS = 16 * CHUNK_SECTORS + 100;
+
+// Every sector holds its own number, sectors written to the wrong offset show up
+static QByteArray pattern(const quint64 startSector, const quint64 numSectors)
+{
+    QByteArray data(static_cast<int>(numSectors * SECTOR_SIZE), '\0');
+    for (int i = 0; i < data.size(); i++)
+    {
+        data[i] = static_cast<char>(((startSector + i / SECTOR_SIZE) * 7 + 1) & 0xFF);
+    }
+    return data;
+}
+
+static DeviceRange range(const quint64 startSector, const quint64 numSectors, const bool unallocated)
+{
+    DeviceRange result = { startSector, numSectors, unallocated };
+    return result;
+}
+
+class ClonePipelineTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void init();
+    void copyToTargets();
+    void discardHoles();
+    void failedTarget();
+    void cancelled();
+
+private:
+    QString createFile(const QString& name, const QByteArray& data);
+    QByteArray readFile(const QString& path);
+
+    QScopedPointer<QTemporaryDir> m_dir;
+    QString                       m_source;
+    QByteArray                    m_sourceData;
+};
+
+void ClonePipelineTest::init()
+{
+    // Source with a zero chunk inside the partition and free space full of stale data
+    m_dir.reset(new QTemporaryDir);
+    QVERIFY(m_dir->isValid());
+    m_sourceData = pattern(0, DEVICE_SECTORS);
+    m_sourceData.replace(static_cast<int>(2 * CHUNK_SECTORS * SECTOR_SIZE), static_cast<int>(CHUNK_SECTORS * SECTOR_SIZE), QByteArray(static_cast<int>(CHUNK_SECTORS * SECTOR_SIZE), '\0'));
+    m_source = createFile("source.img", m_sourceData);
+}
+
+QString ClonePipelineTest::createFile(const QString& name, const QByteArray& data)
+{
+    const QString path = m_dir->filePath(name);
+    QFile file(path);
+    if (file.open(QIODevice::WriteOnly))
+    {
+        file.write(data);
+    }
+    return path;
+}
+
+QByteArray ClonePipelineTest::readFile(const QString& path)
+{
+    QFile file(path);
+    return file.open(QIODevice::ReadOnly) ? file.readAll() : QByteArray();
+}
+
+void ClonePipelineTest::copyToTargets()
+{
+    // Sectors 1000 to 1600 are free space, the targets get zeros there
+    QVector<DeviceRange> ranges = { range(0, 1000, false), range(1000, 600, true), range(1600, DEVICE_SECTORS - 1600, false) };
+    QByteArray expected = m_sourceData;
+    expected.replace(static_cast<int>(1000 * SECTOR_SIZE), static_cast<int>(600 * SECTOR_SIZE), QByteArray(static_cast<int>(600 * SECTOR_SIZE), '\0'));
+
+    foreach (int queueDepth, QVector<int>({1, 8}))
+    {
+        QString msg;
+        IoHandle source = IoBackend::openFile(m_source, false, false, msg);
+        QVERIFY2(source >= 0, qPrintable(msg));
+        QScopedPointer<IoBackend> sourceIo(IoBackend::create(source, queueDepth));
+
+        CancelToken cancel;
+        ClonePipeline pipeline(*sourceIo, SECTOR_SIZE, CHUNK_SECTORS, true, false, cancel);
+        QVector<IoHandle> targets;
+        for (int i = 0; i < 2; i++)
+        {
+            const QString path = createFile(QString("target%1-%2.img").arg(queueDepth).arg(i), QByteArray(m_sourceData.size(), '\xFF'));
+            targets << IoBackend::openFile(path, true, false, msg);
+            QVERIFY2(targets.last() >= 0, qPrintable(msg));
+            pipeline.addTarget(path, IoBackend::create(targets.last(), queueDepth));
+        }
+
+        quint64 progress = 0;
+        QVERIFY2(pipeline.run(ranges, [&](const quint64 bytes) { progress += bytes; }, msg), qPrintable(msg));
+        QVERIFY(!pipeline.isCancelled());
+        QCOMPARE(pipeline.liveTargets(), 2);
+        QCOMPARE(progress, DEVICE_SECTORS * SECTOR_SIZE);
+
+        sourceIo.reset();
+        close(source);
+        foreach (IoHandle target, targets)
+        {
+            close(target);
+        }
+        for (int i = 0; i < 2; i++)
+        {
+            QVERIFY(readFile(m_dir->filePath(QString("target%1-%2.img").arg(queueDepth).arg(i))) == expected);
+        }
+    }
+}
+
+void ClonePipelineTest::discardHoles()
+{
+    QString msg;
+    IoHandle source = IoBackend::openFile(m_source, false, false, msg);
+    QVERIFY2(source >= 0, qPrintable(msg));
+    QScopedPointer<IoBackend> sourceIo(IoBackend::create(source, 4));
+
+    const QString path = createFile("discard.img", QByteArray(m_sourceData.size(), '\xFF'));
+    IoHandle target = IoBackend::openFile(path, true, false, msg);
+    QVERIFY2(target >= 0, qPrintable(msg));
+
+    // The zero chunk and the free space are handed to the discarder instead of written
+    CancelToken cancel;
+    ClonePipeline pipeline(*sourceIo, SECTOR_SIZE, CHUNK_SECTORS, false, true, cancel);
+    QVector<DiskExtent> discarded;
+    pipeline.addTarget("discard", IoBackend::create(target, 4), [&](const quint64 startSector, const quint64 numSectors, QString&)
+    {
+        DiskExtent extent;
+        extent.startSector = startSector;
+        extent.numSectors = numSectors;
+        discarded << extent;
+        return true;
+    });
+    QVector<DeviceRange> ranges = { range(0, 3 * CHUNK_SECTORS, false), range(3 * CHUNK_SECTORS, DEVICE_SECTORS - 3 * CHUNK_SECTORS, true) };
+    QVERIFY2(pipeline.run(ranges, [](const quint64) {}, msg), qPrintable(msg));
+    sourceIo.reset();
+    close(source);
+    close(target);
+
+    // Free space is discarded as it is queued, ahead of the zero chunk that has to be read first
+    quint64 discardedSectors = 0;
+    bool zeroChunk = false;
+    foreach (const DiskExtent& extent, discarded)
+    {
+        discardedSectors += extent.numSectors;
+        zeroChunk = zeroChunk || ((extent.startSector == 2 * CHUNK_SECTORS) && (extent.numSectors == CHUNK_SECTORS));
+    }
+    QCOMPARE(discarded.size(), 15);
+    QVERIFY(zeroChunk);
+    QCOMPARE(discardedSectors, DEVICE_SECTORS - 2 * CHUNK_SECTORS);
+    const QByteArray data = readFile(path);
+    QVERIFY(data.left(static_cast<int>(2 * CHUNK_SECTORS * SECTOR_SIZE)) == m_sourceData.left(static_cast<int>(2 * CHUNK_SECTORS * SECTOR_SIZE)));
+    QVERIFY(data.mid(static_cast<int>(2 * CHUNK_SECTORS * SECTOR_SIZE)) == QByteArray(data.size() - static_cast<int>(2 * CHUNK_SECTORS * SECTOR_SIZE), '\xFF'));
+}
+
+void ClonePipelineTest::failedTarget()
+{
+    QString msg;
+    IoHandle source = IoBackend::openFile(m_source, false, false, msg);
+    QVERIFY2(source >= 0, qPrintable(msg));
+    QScopedPointer<IoBackend> sourceIo(IoBackend::create(source, 4));
+
+    // A target opened read only fails its first write, the other one is still written
+    const QString readOnlyPath = createFile("readonly.img", QByteArray());
+    IoHandle readOnly = IoBackend::openFile(readOnlyPath, false, false, msg);
+    const QString goodPath = createFile("good.img", QByteArray());
+    IoHandle good = IoBackend::openFile(goodPath, true, false, msg);
+    QVERIFY(readOnly >= 0 && good >= 0);
+
+    CancelToken cancel;
+    ClonePipeline pipeline(*sourceIo, SECTOR_SIZE, CHUNK_SECTORS, false, false, cancel);
+    pipeline.addFailedTarget("missing", QString("Write Error;Cannot open the device."));
+    pipeline.addTarget("readonly", IoBackend::create(readOnly, 4));
+    pipeline.addTarget("good", IoBackend::create(good, 4));
+    QCOMPARE(pipeline.liveTargets(), 2);
+
+    QVector<DeviceRange> ranges = { range(0, DEVICE_SECTORS, false) };
+    QVERIFY2(pipeline.run(ranges, [](const quint64) {}, msg), qPrintable(msg));
+    sourceIo.reset();
+    close(source);
+    close(readOnly);
+    close(good);
+
+    QCOMPARE(pipeline.targetCount(), 3);
+    QCOMPARE(pipeline.liveTargets(), 1);
+    QCOMPARE(pipeline.firstError(), QString("Write Error;missing: Cannot open the device."));
+    QVERIFY(readFile(goodPath) == m_sourceData);
+}
+
+void ClonePipelineTest::cancelled()
+{
+    QString msg;
+    IoHandle source = IoBackend::openFile(m_source, false, false, msg);
+    QVERIFY2(source >= 0, qPrintable(msg));
+    QScopedPointer<IoBackend> sourceIo(IoBackend::create(source, 4));
+    const QString path = createFile("cancelled.img", QByteArray());
+    IoHandle target = IoBackend::openFile(path, true, false, msg);
+    QVERIFY2(target >= 0, qPrintable(msg));
+
+    CancelToken cancel;
+    cancel.cancel();
+    ClonePipeline pipeline(*sourceIo, SECTOR_SIZE, CHUNK_SECTORS, false, false, cancel);
+    pipeline.addTarget("cancelled", IoBackend::create(target, 4));
+    QVector<DeviceRange> ranges = { range(0, DEVICE_SECTORS, false) };
+    QVERIFY2(pipeline.run(ranges, [](const quint64) {}, msg), qPrintable(msg));
+    QVERIFY(pipeline.isCancelled());
+    sourceIo.reset();
+    close(source);
+    close(target);
+    QCOMPARE(QFileInfo(path).size(), qint64(0));
+}
+
+QTEST_APPLESS_MAIN(ClonePipelineTest)
+
+#include "tst_clonepipeline.moc"
@@ -0,0 +1,15 @@
+TARGET = tst_filesystemprobe
+QT = core testlib
+CONFIG += console testcase c++11
+CONFIG -= app_bundle
+
+# Probes file system images made with mkfs.ext4 and mkfs.fat, tests whose tool is missing are skipped
+!linux: error("The file system probe tests need the Linux mkfs tools")
+
+INCLUDEPATH += ../../src
+
+SOURCES += \
+    tst_filesystemprobe.cpp \
+    ../../src/filesystemprobe.cpp \
+    ../../src/partitiontable.cpp \
+    ../../src/checksum.cpp
@@ -0,0 +1,191 @@
+#include <QtTest>
+#include <QProcess>
+#include <QTemporaryDir>
+
+#include "filesystemprobe.h"
+
+static const quint64 SECTOR_SIZE = 512;
+static const qint64 IMAGE_SIZE = 64 * 1024 * 1024;
+
+// Runs a tool and returns its output, false when it is missing or fails
+static bool runTool(const QString& program, const QStringList& arguments, QByteArray* output = nullptr)
+{
+    QProcess process;
+    process.start(program, arguments);
+    if (!process.waitForStarted() || !process.waitForFinished(60000) || (process.exitCode() != 0))
+    {
+        return false;
+    }
+    if (output)
+    {
+        *output = process.readAllStandardOutput();
+    }
+    return true;
+}
+
+class FileSystemProbeTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void ext4();
+    void fat32();
+    void fat16();
+    void unknown();
+
+private:
+    bool createImage(const QString& path);
+    void probeImage(const QString& path, FileSystemProbe& probe);
+    void verifyFreeIsUnused(const QString& path, const FileSystemProbe& probe);
+    void probeFat(const QString& fatSize, const FileSystemProbe::Type type);
+
+    QTemporaryDir m_dir;
+};
+
+bool FileSystemProbeTest::createImage(const QString& path)
+{
+    QFile file(path);
+    return file.open(QIODevice::WriteOnly) && file.resize(IMAGE_SIZE);
+}
+
+void FileSystemProbeTest::probeImage(const QString& path, FileSystemProbe& probe)
+{
+    QFile file(path);
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    PartitionTable::SectorReader reader = [&](const quint64 startSector, const quint64 numSectors, QByteArray& data, QString& msg)
+    {
+        if (!file.seek(static_cast<qint64>(startSector * SECTOR_SIZE)))
+        {
+            msg = QString("Read Error;Cannot seek in %1.").arg(path);
+            return false;
+        }
+        data = file.read(static_cast<qint64>(numSectors * SECTOR_SIZE));
+        return true;
+    };
+
+    // The image is a partition of its own, starting at sector zero
+    DiskExtent partition;
+    partition.numSectors = static_cast<quint64>(IMAGE_SIZE) / SECTOR_SIZE;
+    QString msg;
+    QVERIFY2(probe.probe(reader, SECTOR_SIZE, partition, 0, msg), qPrintable(msg));
+}
+
+void FileSystemProbeTest::verifyFreeIsUnused(const QString& path, const FileSystemProbe& probe)
+{
+    // Clusters mkfs left unallocated were never written, the random file data would show up
+    QFile file(path);
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    const QByteArray zeros(1024 * 1024, '\0');
+    quint64 freeSectors = 0;
+    foreach (const DiskExtent& extent, probe.freeExtents())
+    {
+        QVERIFY(file.seek(static_cast<qint64>(extent.startSector * SECTOR_SIZE)));
+        qint64 remaining = static_cast<qint64>(extent.numSectors * SECTOR_SIZE);
+        while (remaining > 0)
+        {
+            QByteArray data = file.read(qMin<qint64>(remaining, zeros.size()));
+            QVERIFY(!data.isEmpty());
+            QVERIFY(data == zeros.left(data.size()));
+            remaining -= data.size();
+        }
+        freeSectors += extent.numSectors;
+    }
+    QCOMPARE(freeSectors, probe.freeSectors());
+}
+
+void FileSystemProbeTest::ext4()
+{
+    // A random file takes part of the space, the rest must be reported free
+    QVERIFY(m_dir.isValid());
+    QDir(m_dir.path()).mkdir("content");
+    QFile content(m_dir.filePath("content/random.bin"));
+    QVERIFY(content.open(QIODevice::WriteOnly));
+    for (int i = 0; i < 8; i++)
+    {
+        QByteArray block(1024 * 1024, '\0');
+        for (int j = 0; j < block.size(); j++)
+        {
+            block[j] = static_cast<char>((j * 7 + i * 13) % 251 + 1);
+        }
+        content.write(block);
+    }
+    content.close();
+
+    const QString path = m_dir.filePath("ext4.img");
+    QVERIFY(createImage(path));
+    if (!runTool("mkfs.ext4", QStringList() << "-q" << "-F" << "-b" << "4096" << "-d" << m_dir.filePath("content") << path))
+    {
+        QSKIP("mkfs.ext4 with -d is not available");
+    }
+
+    FileSystemProbe probe;
+    probeImage(path, probe);
+    QCOMPARE(probe.type(), FileSystemProbe::TypeExt);
+    verifyFreeIsUnused(path, probe);
+
+    // Same count as the superblock, each 4 KB block is eight sectors
+    QByteArray superblock;
+    if (runTool("dumpe2fs", QStringList() << "-h" << path, &superblock))
+    {
+        quint64 freeBlocks = 0;
+        foreach (const QString& line, QString::fromLatin1(superblock).split('\n'))
+        {
+            if (line.startsWith("Free blocks:"))
+            {
+                freeBlocks = line.section(':', 1).trimmed().toULongLong();
+            }
+        }
+        QVERIFY(freeBlocks > 0);
+        QCOMPARE(probe.freeSectors(), freeBlocks * 8);
+    }
+    QVERIFY(probe.freeSectors() < static_cast<quint64>(IMAGE_SIZE - 8 * 1024 * 1024) / SECTOR_SIZE);
+}
+
+void FileSystemProbeTest::probeFat(const QString& fatSize, const FileSystemProbe::Type type)
+{
+    const QString path = m_dir.filePath(QString("fat%1.img").arg(fatSize));
+    QVERIFY(createImage(path));
+    if (!runTool("mkfs.fat", QStringList() << "-F" << fatSize << path))
+    {
+        QSKIP("mkfs.fat is not available");
+    }
+
+    FileSystemProbe probe;
+    probeImage(path, probe);
+    QCOMPARE(probe.type(), type);
+    verifyFreeIsUnused(path, probe);
+
+    // An empty file system is free apart from its reserved sectors, FATs and root directory
+    QVERIFY(probe.freeSectors() > static_cast<quint64>(IMAGE_SIZE) / SECTOR_SIZE * 9 / 10);
+}
+
+void FileSystemProbeTest::fat32()
+{
+    probeFat("32", FileSystemProbe::TypeFat32);
+}
+
+void FileSystemProbeTest::fat16()
+{
+    probeFat("16", FileSystemProbe::TypeFat16);
+}
+
+void FileSystemProbeTest::unknown()
+{
+    // Nothing is left out of a partition that is not understood
+    const QString path = m_dir.filePath("unknown.img");
+    QFile file(path);
+    QVERIFY(file.open(QIODevice::WriteOnly));
+    QVERIFY(file.resize(IMAGE_SIZE));
+    QVERIFY(file.write(QByteArray(4096, '\x5A')) == 4096);
+    file.close();
+
+    FileSystemProbe probe;
+    probeImage(path, probe);
+    QCOMPARE(probe.type(), FileSystemProbe::TypeUnknown);
+    QVERIFY(probe.freeExtents().isEmpty());
+    QCOMPARE(probe.freeSectors(), quint64(0));
+}
+
+QTEST_APPLESS_MAIN(FileSystemProbeTest)
+
+#include "tst_filesystemprobe.moc"
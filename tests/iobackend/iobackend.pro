@@ -0,0 +1,15 @@
+TARGET = tst_iobackend
+QT = core testlib
+CONFIG += console testcase c++11
+CONFIG -= app_bundle
+
+# Exercises the pread/pwrite backend against files and loop devices
+!linux: error("The I/O backend tests run against Linux files and loop devices")
+
+INCLUDEPATH += ../../src
+
+SOURCES += \
+    tst_iobackend.cpp \
+    ../../src/iobackend.cpp \
+    ../../src/alignedbufferpool.cpp \
+    ../../src/bufferarena.cpp
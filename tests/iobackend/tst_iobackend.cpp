@@ -0,0 +1,236 @@
+#include <QtTest>
+#include <QProcess>
+#include <QTemporaryDir>
+
+#include <unistd.h>
+
+#include "iobackend.h"
+#include "bufferarena.h"
+
+static const int CHUNK_SIZE = 64 * 1024;
+static const int CHUNK_COUNT = 32;
+
+// Every chunk holds its own index, so chunks written to the wrong offset show up
+static QByteArray pattern(const int index, const int length = CHUNK_SIZE)
+{
+    QByteArray data(length, '\0');
+    for (int i = 0; i < length; i++)
+    {
+        data[i] = static_cast<char>((index * 31 + i / 512) & 0xFF);
+    }
+    return data;
+}
+
+class IoBackendTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void writeAndReadBack();
+    void shortReadAtEnd();
+    void directPadsTail();
+    void directInPlace();
+    void loopDevice();
+
+private:
+    void roundTrip(const QString& path, const bool direct, const int queueDepth);
+};
+
+void IoBackendTest::roundTrip(const QString& path, const bool direct, const int queueDepth)
+{
+    QString msg;
+    IoHandle handle = IoBackend::openFile(path, true, direct, msg);
+    QVERIFY2(handle >= 0, qPrintable(msg));
+
+    AlignedBufferPool pool(CHUNK_SIZE, 4096);
+    QScopedPointer<IoBackend> backend(IoBackend::create(handle, queueDepth, 512, direct ? &pool : nullptr));
+    QCOMPARE(backend->queueDepth(), queueDepth);
+
+    // Writes in reverse order, completions must still come back in submission order
+    quint64 expectedTag = 0;
+    for (int i = CHUNK_COUNT - 1; i >= 0; i--)
+    {
+        IoCompletion completion;
+        if (backend->isFull())
+        {
+            QVERIFY2(backend->waitOldest(completion, msg), qPrintable(msg));
+            QVERIFY(completion.write);
+            QCOMPARE(completion.tag, expectedTag++);
+            QCOMPARE(completion.transferred, static_cast<quint32>(CHUNK_SIZE));
+        }
+        QVERIFY2(backend->submitWrite(static_cast<quint64>(i) * CHUNK_SIZE, pattern(i), static_cast<quint64>(CHUNK_COUNT - 1 - i), msg), qPrintable(msg));
+    }
+    QVERIFY2(backend->drain(msg), qPrintable(msg));
+
+    for (int i = 0; i < CHUNK_COUNT; i++)
+    {
+        IoCompletion completion;
+        if (backend->isFull())
+        {
+            QVERIFY2(backend->waitOldest(completion, msg), qPrintable(msg));
+            QCOMPARE(completion.transferred, static_cast<quint32>(CHUNK_SIZE));
+            QCOMPARE(completion.data, pattern(static_cast<int>(completion.tag)));
+        }
+        QVERIFY2(backend->submitRead(static_cast<quint64>(i) * CHUNK_SIZE, QByteArray(CHUNK_SIZE, '\0'), static_cast<quint64>(i), msg), qPrintable(msg));
+    }
+    while (!backend->isEmpty())
+    {
+        IoCompletion completion;
+        QVERIFY2(backend->waitOldest(completion, msg), qPrintable(msg));
+        QCOMPARE(completion.data, pattern(static_cast<int>(completion.tag)));
+    }
+
+    backend.reset();
+    close(handle);
+}
+
+void IoBackendTest::writeAndReadBack()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    foreach (int queueDepth, QVector<int>({1, 2, 8, 32}))
+    {
+        const QString path = dir.filePath(QString("qd%1.img").arg(queueDepth));
+        QFile file(path);
+        QVERIFY(file.open(QIODevice::WriteOnly));
+        file.close();
+        roundTrip(path, false, queueDepth);
+    }
+}
+
+void IoBackendTest::shortReadAtEnd()
+{
+    QTemporaryDir dir;
+    const QString path = dir.filePath("short.img");
+    QFile file(path);
+    QVERIFY(file.open(QIODevice::WriteOnly));
+    file.write(pattern(3, 1000));
+    file.close();
+
+    QString msg;
+    IoHandle handle = IoBackend::openFile(path, false, false, msg);
+    QVERIFY2(handle >= 0, qPrintable(msg));
+    foreach (int queueDepth, QVector<int>({1, 4}))
+    {
+        QScopedPointer<IoBackend> backend(IoBackend::create(handle, queueDepth));
+        QVERIFY2(backend->submitRead(0, QByteArray(4096, '\0'), 0, msg), qPrintable(msg));
+        IoCompletion completion;
+        QVERIFY2(backend->waitOldest(completion, msg), qPrintable(msg));
+        QCOMPARE(completion.transferred, 1000u);
+        QCOMPARE(completion.data.left(1000), pattern(3, 1000));
+    }
+    close(handle);
+
+    QCOMPARE(IoBackend::openFile(dir.filePath("missing.img"), false, false, msg), -1);
+    QVERIFY(msg.startsWith("File Error;"));
+}
+
+void IoBackendTest::directPadsTail()
+{
+    QTemporaryDir dir;
+    const QString path = dir.filePath("direct.img");
+    QFile file(path);
+    QVERIFY(file.open(QIODevice::WriteOnly));
+    file.close();
+
+    QString msg;
+    IoHandle handle = IoBackend::openFile(path, true, true, msg);
+    if (handle < 0)
+    {
+        QSKIP("The temporary directory does not support O_DIRECT");
+    }
+
+    // A tail shorter than a sector is written padded with zeros and read back cut to its length
+    AlignedBufferPool pool(CHUNK_SIZE, 4096);
+    foreach (int queueDepth, QVector<int>({1, 4}))
+    {
+        QScopedPointer<IoBackend> backend(IoBackend::create(handle, queueDepth, 512, &pool));
+        QVERIFY2(backend->submitWrite(0, pattern(1, 700), 0, msg), qPrintable(msg));
+        QVERIFY2(backend->drain(msg), qPrintable(msg));
+        QVERIFY2(backend->submitRead(0, QByteArray(700, '\0'), 1, msg), qPrintable(msg));
+        IoCompletion completion;
+        QVERIFY2(backend->waitOldest(completion, msg), qPrintable(msg));
+        QCOMPARE(completion.transferred, 700u);
+        QCOMPARE(completion.data, pattern(1, 700));
+
+        // Larger than a pool buffer is refused
+        QVERIFY(!backend->submitWrite(0, pattern(2, CHUNK_SIZE + 1), 2, msg));
+    }
+    close(handle);
+    QCOMPARE(QFileInfo(path).size(), qint64(1024));
+}
+
+void IoBackendTest::directInPlace()
+{
+    QTemporaryDir dir;
+    const QString path = dir.filePath("inplace.img");
+    QFile file(path);
+    QVERIFY(file.open(QIODevice::WriteOnly));
+    file.write(pattern(5));
+    file.close();
+
+    QString msg;
+    IoHandle handle = IoBackend::openFile(path, true, true, msg);
+    if (handle < 0)
+    {
+        QSKIP("The temporary directory does not support O_DIRECT");
+    }
+
+    // Aligned arena buffers reach the device without a copy, so a read lands in the submitted buffer
+    BufferArena arena;
+    arena.setAlignment(4096);
+    AlignedBufferPool pool(CHUNK_SIZE, 4096);
+    foreach (int queueDepth, QVector<int>({1, 4}))
+    {
+        QScopedPointer<IoBackend> backend(IoBackend::create(handle, queueDepth, 512, &pool));
+        QByteArray buffer = arena.acquire(CHUNK_SIZE);
+        const char* address = buffer.constData();
+        QVERIFY(BufferArena::isAligned(address, 4096));
+        QVERIFY2(backend->submitRead(0, std::move(buffer), 0, msg), qPrintable(msg));
+        IoCompletion completion;
+        QVERIFY2(backend->waitOldest(completion, msg), qPrintable(msg));
+        QVERIFY(completion.data.constData() == address);
+        QCOMPARE(completion.data, pattern(5));
+        arena.release(completion.data);
+    }
+    QCOMPARE(arena.allocations(), quint64(1));
+    close(handle);
+}
+
+void IoBackendTest::loopDevice()
+{
+    if (geteuid() != 0)
+    {
+        QSKIP("Attaching a loop device needs root");
+    }
+
+    QTemporaryDir dir;
+    const QString path = dir.filePath("loop.img");
+    QFile file(path);
+    QVERIFY(file.open(QIODevice::WriteOnly));
+    QVERIFY(file.resize(CHUNK_SIZE * CHUNK_COUNT));
+    file.close();
+
+    QProcess losetup;
+    losetup.start("losetup", QStringList() << "--find" << "--show" << path);
+    if (!losetup.waitForFinished() || (losetup.exitCode() != 0))
+    {
+        QSKIP("No loop device available");
+    }
+    const QString device = QString::fromLocal8Bit(losetup.readAllStandardOutput()).trimmed();
+
+    foreach (int queueDepth, QVector<int>({1, 8}))
+    {
+        roundTrip(device, true, queueDepth);
+        roundTrip(device, false, queueDepth);
+    }
+    QProcess::execute("losetup", QStringList() << "--detach" << device);
+
+    // The device wrote through to the backing file
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    QCOMPARE(file.read(CHUNK_SIZE), pattern(0));
+}
+
+QTEST_APPLESS_MAIN(IoBackendTest)
+
+#include "tst_iobackend.moc"
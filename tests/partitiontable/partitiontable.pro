@@ -0,0 +1,14 @@
+TARGET = tst_partitiontable
+QT = core testlib
+CONFIG += console testcase c++11
+CONFIG -= app_bundle
+
+# Parses synthetic MBR, EBR and GPT layouts held in memory
+!linux: error("The unit tests are built on Linux")
+
+INCLUDEPATH += ../../src
+
+SOURCES += \
+    tst_partitiontable.cpp \
+    ../../src/partitiontable.cpp \
+    ../../src/checksum.cpp
@@ -0,0 +1,266 @@
+#include <QtTest>
+#include <QtEndian>
+
+#include "partitiontable.h"
+#include "checksum.h"
+
+static const quint64 SECTOR_SIZE = 512;
+static const quint64 DEVICE_SECTORS = 8192;
+static const quint32 GPT_ENTRIES = 128;
+static const quint32 GPT_ENTRY_SIZE = 128;
+static const quint64 GPT_ENTRY_SECTORS = GPT_ENTRIES * GPT_ENTRY_SIZE / SECTOR_SIZE;
+
+// Device image held in memory, read through the same callback a job passes in
+class MemoryDisk
+{
+public:
+    MemoryDisk() : m_data(static_cast<int>(DEVICE_SECTORS * SECTOR_SIZE), '\0')
+    {
+    }
+
+    PartitionTable::SectorReader reader()
+    {
+        return [this](const quint64 startSector, const quint64 numSectors, QByteArray& data, QString& msg)
+        {
+            if (failReads)
+            {
+                msg = QString("Read Error;Simulated read error.");
+                return false;
+            }
+            data = m_data.mid(static_cast<int>(startSector * SECTOR_SIZE), static_cast<int>(numSectors * SECTOR_SIZE));
+            return true;
+        };
+    }
+
+    uchar* sector(const quint64 lba)
+    {
+        return reinterpret_cast<uchar*>(m_data.data()) + lba * SECTOR_SIZE;
+    }
+
+    void setSignature(const quint64 lba)
+    {
+        sector(lba)[0x1FE] = 0x55;
+        sector(lba)[0x1FF] = 0xAA;
+    }
+
+    void setMbrEntry(const quint64 lba, const int index, const quint8 type, const quint32 startSector, const quint32 numSectors)
+    {
+        uchar* entry = sector(lba) + 0x1BE + 16 * index;
+        entry[0] = 0x00;
+        entry[4] = type;
+        qToLittleEndian<quint32>(startSector, entry + 8);
+        qToLittleEndian<quint32>(numSectors, entry + 12);
+        setSignature(lba);
+    }
+
+    void writeGptHeader(const quint64 lba, const quint64 alternateLba, const quint64 entriesLba)
+    {
+        uchar* p = sector(lba);
+        memset(p, 0, SECTOR_SIZE);
+        memcpy(p, "EFI PART", 8);
+        qToLittleEndian<quint32>(0x00010000, p + 8);
+        qToLittleEndian<quint32>(92, p + 12);
+        qToLittleEndian<quint64>(lba, p + 24);
+        qToLittleEndian<quint64>(alternateLba, p + 32);
+        qToLittleEndian<quint64>(2 + GPT_ENTRY_SECTORS, p + 40);
+        qToLittleEndian<quint64>(DEVICE_SECTORS - 2 - GPT_ENTRY_SECTORS, p + 48);
+        qToLittleEndian<quint64>(entriesLba, p + 72);
+        qToLittleEndian<quint32>(GPT_ENTRIES, p + 80);
+        qToLittleEndian<quint32>(GPT_ENTRY_SIZE, p + 84);
+        qToLittleEndian<quint32>(Checksum::crc32(reinterpret_cast<const char*>(sector(entriesLba)), GPT_ENTRIES * GPT_ENTRY_SIZE), p + 88);
+        qToLittleEndian<quint32>(Checksum::crc32(reinterpret_cast<const char*>(p), 92), p + 16);
+    }
+
+    // Protective MBR, primary and backup header and entries with one partition per range
+    void writeGpt(const QVector<DiskExtent>& partitions)
+    {
+        setMbrEntry(0, 0, 0xEE, 1, static_cast<quint32>(DEVICE_SECTORS - 1));
+        const quint64 backupEntries = DEVICE_SECTORS - 1 - GPT_ENTRY_SECTORS;
+        for (int i = 0; i < partitions.size(); i++)
+        {
+            foreach (quint64 entriesLba, QVector<quint64>({2, backupEntries}))
+            {
+                uchar* entry = sector(entriesLba) + i * GPT_ENTRY_SIZE;
+                memset(entry, 0xAB, 16);
+                qToLittleEndian<quint64>(partitions.at(i).startSector, entry + 32);
+                qToLittleEndian<quint64>(partitions.at(i).startSector + partitions.at(i).numSectors - 1, entry + 40);
+            }
+        }
+        writeGptHeader(1, DEVICE_SECTORS - 1, 2);
+        writeGptHeader(DEVICE_SECTORS - 1, 1, backupEntries);
+    }
+
+    bool failReads = {false};
+
+private:
+    QByteArray m_data;
+};
+
+static void compareExtents(const QVector<DiskExtent>& actual, const QVector<DiskExtent>& expected)
+{
+    QCOMPARE(actual.size(), expected.size());
+    for (int i = 0; i < expected.size(); i++)
+    {
+        QCOMPARE(actual.at(i).startSector, expected.at(i).startSector);
+        QCOMPARE(actual.at(i).numSectors, expected.at(i).numSectors);
+    }
+}
+
+static DiskExtent extent(const quint64 startSector, const quint64 numSectors)
+{
+    DiskExtent result;
+    result.startSector = startSector;
+    result.numSectors = numSectors;
+    return result;
+}
+
+class PartitionTableTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void unpartitioned();
+    void bootSectorWithoutTable();
+    void mbrPrimaries();
+    void mbrExtended();
+    void mbrPastDevice();
+    void gpt();
+    void gptBackupHeader();
+    void gptCorrupt();
+    void readError();
+};
+
+void PartitionTableTest::unpartitioned()
+{
+    MemoryDisk disk;
+    PartitionTable table;
+    QString msg;
+    QVERIFY(table.read(disk.reader(), SECTOR_SIZE, DEVICE_SECTORS, msg));
+    QCOMPARE(table.scheme(), PartitionTable::SchemeNone);
+    QVERIFY(table.partitions().isEmpty());
+    compareExtents(table.usedExtents(), {extent(0, DEVICE_SECTORS)});
+    QCOMPARE(table.usedSectors(), DEVICE_SECTORS);
+
+    // An empty device has nothing to read
+    QVERIFY(table.read(disk.reader(), SECTOR_SIZE, 0, msg));
+    QVERIFY(table.usedExtents().isEmpty());
+}
+
+void PartitionTableTest::bootSectorWithoutTable()
+{
+    // A FAT boot sector has the signature, its code does not pass as status bytes
+    MemoryDisk disk;
+    disk.setSignature(0);
+    memset(disk.sector(0) + 0x1BE, 0x90, 64);
+    PartitionTable table;
+    QString msg;
+    QVERIFY(table.read(disk.reader(), SECTOR_SIZE, DEVICE_SECTORS, msg));
+    QCOMPARE(table.scheme(), PartitionTable::SchemeNone);
+    compareExtents(table.usedExtents(), {extent(0, DEVICE_SECTORS)});
+}
+
+void PartitionTableTest::mbrPrimaries()
+{
+    MemoryDisk disk;
+    disk.setMbrEntry(0, 0, 0x0C, 2048, 1024);
+    disk.setMbrEntry(0, 2, 0x83, 4096, 1024);
+    PartitionTable table;
+    QString msg;
+    QVERIFY(table.read(disk.reader(), SECTOR_SIZE, DEVICE_SECTORS, msg));
+    QCOMPARE(table.scheme(), PartitionTable::SchemeMbr);
+    compareExtents(table.partitions(), {extent(2048, 1024), extent(4096, 1024)});
+
+    // The boot area in front of the first partition merges with it
+    compareExtents(table.usedExtents(), {extent(0, 3072), extent(4096, 1024)});
+    QCOMPARE(table.usedSectors(), quint64(4096));
+    QCOMPARE(table.endSector(), quint64(5120));
+}
+
+void PartitionTableTest::mbrExtended()
+{
+    MemoryDisk disk;
+    disk.setMbrEntry(0, 0, 0x0C, 2048, 1024);
+    disk.setMbrEntry(0, 1, 0x0F, 4096, 4096);
+
+    // Logical partitions are relative to their EBR, links to the extended partition
+    disk.setMbrEntry(4096, 0, 0x83, 63, 500);
+    disk.setMbrEntry(4096, 1, 0x05, 1024, 1024);
+    disk.setMbrEntry(5120, 0, 0x83, 63, 200);
+
+    PartitionTable table;
+    QString msg;
+    QVERIFY(table.read(disk.reader(), SECTOR_SIZE, DEVICE_SECTORS, msg));
+    QCOMPARE(table.scheme(), PartitionTable::SchemeMbr);
+    compareExtents(table.partitions(), {extent(2048, 1024), extent(4159, 500), extent(5183, 200)});
+    compareExtents(table.usedExtents(), {extent(0, 3072), extent(4096, 1), extent(4159, 500), extent(5120, 1), extent(5183, 200)});
+}
+
+void PartitionTableTest::mbrPastDevice()
+{
+    // A table that does not fit the device belongs to another one, all of it is used
+    MemoryDisk disk;
+    disk.setMbrEntry(0, 0, 0x83, 2048, static_cast<quint32>(DEVICE_SECTORS));
+    PartitionTable table;
+    QString msg;
+    QVERIFY(table.read(disk.reader(), SECTOR_SIZE, DEVICE_SECTORS, msg));
+    QCOMPARE(table.scheme(), PartitionTable::SchemeNone);
+    compareExtents(table.usedExtents(), {extent(0, DEVICE_SECTORS)});
+}
+
+void PartitionTableTest::gpt()
+{
+    MemoryDisk disk;
+    disk.writeGpt({extent(2048, 2048), extent(6144, 1000)});
+    PartitionTable table;
+    QString msg;
+    QVERIFY(table.read(disk.reader(), SECTOR_SIZE, DEVICE_SECTORS, msg));
+    QCOMPARE(table.scheme(), PartitionTable::SchemeGpt);
+    compareExtents(table.partitions(), {extent(2048, 2048), extent(6144, 1000)});
+
+    // Protective MBR, headers and both entry arrays are kept along with the partitions
+    const quint64 firstUsable = 2 + GPT_ENTRY_SECTORS;
+    const quint64 backupStart = DEVICE_SECTORS - 1 - GPT_ENTRY_SECTORS;
+    compareExtents(table.usedExtents(), {extent(0, firstUsable), extent(2048, 2048), extent(6144, 1000), extent(backupStart, GPT_ENTRY_SECTORS + 1)});
+    QCOMPARE(table.endSector(), DEVICE_SECTORS);
+}
+
+void PartitionTableTest::gptBackupHeader()
+{
+    MemoryDisk disk;
+    disk.writeGpt({extent(2048, 2048)});
+    disk.sector(1)[16] ^= 0xFF;
+    PartitionTable table;
+    QString msg;
+    QVERIFY(table.read(disk.reader(), SECTOR_SIZE, DEVICE_SECTORS, msg));
+    QCOMPARE(table.scheme(), PartitionTable::SchemeGpt);
+    compareExtents(table.partitions(), {extent(2048, 2048)});
+}
+
+void PartitionTableTest::gptCorrupt()
+{
+    // Entries that no longer match their checksum in both copies, the device is used as a whole
+    MemoryDisk disk;
+    disk.writeGpt({extent(2048, 2048)});
+    disk.sector(2)[0] ^= 0xFF;
+    disk.sector(DEVICE_SECTORS - 1 - GPT_ENTRY_SECTORS)[0] ^= 0xFF;
+    PartitionTable table;
+    QString msg;
+    QVERIFY(table.read(disk.reader(), SECTOR_SIZE, DEVICE_SECTORS, msg));
+    QCOMPARE(table.scheme(), PartitionTable::SchemeNone);
+    QVERIFY(table.partitions().isEmpty());
+    compareExtents(table.usedExtents(), {extent(0, DEVICE_SECTORS)});
+}
+
+void PartitionTableTest::readError()
+{
+    MemoryDisk disk;
+    disk.failReads = true;
+    PartitionTable table;
+    QString msg;
+    QVERIFY(!table.read(disk.reader(), SECTOR_SIZE, DEVICE_SECTORS, msg));
+    QVERIFY(msg.startsWith("Read Error;"));
+}
+
+QTEST_APPLESS_MAIN(PartitionTableTest)
+
+#include "tst_partitiontable.moc"
@@ -0,0 +1,9 @@
+TEMPLATE = subdirs
+
+# Unit tests of the portable imaging code, Linux only like adinbd; run them with make check
+SUBDIRS += \
+    iobackend \
+    partitiontable \
+    filesystemprobe \
+    clonepipeline \
+    chunkrepository